@@ -0,0 +1,142 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "ostree-adaptive-limit.h"
+
+/* Minimum length of a sampling window, in microseconds */
+#define ADAPTIVE_LIMIT_WINDOW_USEC (G_USEC_PER_SEC / 2)
+/* Relative change in throughput between windows which we treat as noise */
+#define ADAPTIVE_LIMIT_RATE_TOLERANCE 0.05
+/* Once throughput has plateaued, back off if the queueing latency is
+ * this many times the best we've seen; more concurrency is then just
+ * adding to queues rather than using idle capacity.
+ */
+#define ADAPTIVE_LIMIT_LATENCY_FACTOR 2.0
+
+void
+_ostree_adaptive_limit_init (OstreeAdaptiveLimit *limit,
+                             guint                min_limit,
+                             guint                max_limit,
+                             guint                initial)
+{
+  g_return_if_fail (min_limit > 0);
+  g_return_if_fail (min_limit <= max_limit);
+
+  memset (limit, 0, sizeof (*limit));
+  limit->min_limit = min_limit;
+  limit->max_limit = max_limit;
+  limit->limit = CLAMP (initial, min_limit, max_limit);
+  limit->direction = 1;
+}
+
+/* Move the limit by a step proportional to its size in the current
+ * direction, so that we converge quickly on fat links without
+ * overshooting small limits.
+ */
+static void
+adaptive_limit_step (OstreeAdaptiveLimit *limit)
+{
+  const guint step = MAX (1, limit->limit / 4);
+
+  if (limit->direction > 0)
+    limit->limit = MIN (limit->limit + step, limit->max_limit);
+  else
+    limit->limit = (limit->limit > limit->min_limit + step) ?
+      limit->limit - step : limit->min_limit;
+}
+
+/* Record completion of one operation; @units is the work it did (such as
+ * bytes transferred), and @in_flight the number of operations outstanding
+ * including this one.  @now is a monotonic time in microseconds.
+ *
+ * Returns: %TRUE if the limit changed
+ */
+gboolean
+_ostree_adaptive_limit_record (OstreeAdaptiveLimit *limit,
+                               guint64              now,
+                               guint64              units,
+                               guint                in_flight)
+{
+  if (limit->min_limit == limit->max_limit)
+    return FALSE;
+
+  if (limit->window_start == 0)
+    {
+      limit->window_start = now;
+      return FALSE;
+    }
+
+  limit->window_units += units;
+  limit->window_in_flight_total += in_flight;
+  limit->window_completions++;
+
+  /* Let each window see at least one full round of operations */
+  const guint64 elapsed = now - limit->window_start;
+  if (elapsed < ADAPTIVE_LIMIT_WINDOW_USEC ||
+      limit->window_completions < limit->limit)
+    return FALSE;
+
+  const double secs = (double) elapsed / G_USEC_PER_SEC;
+  const double rate = limit->window_units / secs;
+  const double completion_rate = limit->window_completions / secs;
+  const double mean_in_flight =
+    (double) limit->window_in_flight_total / limit->window_completions;
+  /* Little's law: mean time an operation spends in the system */
+  const double latency = mean_in_flight / completion_rate;
+  const guint old_limit = limit->limit;
+
+  if (limit->min_latency == 0 || latency < limit->min_latency)
+    limit->min_latency = latency;
+
+  if (limit->last_rate == 0)
+    adaptive_limit_step (limit);
+  else if (rate > limit->last_rate * (1 + ADAPTIVE_LIMIT_RATE_TOLERANCE))
+    {
+      /* That helped; keep going the same way */
+      adaptive_limit_step (limit);
+    }
+  else if (rate < limit->last_rate * (1 - ADAPTIVE_LIMIT_RATE_TOLERANCE))
+    {
+      /* That hurt; turn around */
+      limit->direction = -limit->direction;
+      adaptive_limit_step (limit);
+    }
+  else if (latency > limit->min_latency * ADAPTIVE_LIMIT_LATENCY_FACTOR)
+    {
+      limit->direction = -1;
+      adaptive_limit_step (limit);
+    }
+
+  limit->last_rate = rate;
+  limit->window_start = now;
+  limit->window_units = 0;
+  limit->window_in_flight_total = 0;
+  limit->window_completions = 0;
+
+  if (limit->limit != old_limit)
+    g_debug ("adaptive limit: %u -> %u (%.0f units/s, latency %.3fs)",
+             old_limit, limit->limit, rate, latency);
+
+  return limit->limit != old_limit;
+}
@@ -0,0 +1,62 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A concurrency limit which adjusts itself between @min_limit and
+ * @max_limit by hill climbing on measured throughput.  Each completed
+ * operation is recorded along with the amount of work it did (e.g. bytes)
+ * and the number of operations in flight at the time; the queueing latency
+ * is derived from those via Little's law.
+ *
+ * Not thread safe; intended to be driven from a single main context.
+ */
+typedef struct {
+  guint min_limit;
+  guint max_limit;
+  guint limit;
+
+  /* The current sampling window */
+  guint64 window_start;
+  guint64 window_units;
+  guint64 window_in_flight_total;
+  guint window_completions;
+
+  /* Results from previous windows */
+  double last_rate;
+  double min_latency;
+  int direction;
+} OstreeAdaptiveLimit;
+
+void _ostree_adaptive_limit_init (OstreeAdaptiveLimit *limit,
+                                  guint                min_limit,
+                                  guint                max_limit,
+                                  guint                initial);
+
+gboolean _ostree_adaptive_limit_record (OstreeAdaptiveLimit *limit,
+                                        guint64              now,
+                                        guint64              units,
+                                        guint                in_flight);
+
+G_END_DECLS
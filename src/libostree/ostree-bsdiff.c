@@ -0,0 +1,524 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * The match search and patch emission in _ostree_bsdiff() follow bsdiff:
+ *
+ * Copyright 2003-2005 Colin Percival
+ * Copyright 2012 Matthew Endsley
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted providing that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <limits.h>
+#include <string.h>
+
+#include "ostree-bsdiff.h"
+
+/* bsdiff spends most of its time and memory building a suffix array of the
+ * old file; the vendored copy uses qsufsort, which needs two 64 bit arrays
+ * and is O(n log n).  This uses SA-IS (Nong, Zhang & Chan, "Two Efficient
+ * Algorithms for Linear Time Suffix Array Construction"), with 32 bit
+ * indices, so one 4n array plus a bit per byte suffices.  Suffix arrays
+ * are unique, so the generated patches are identical to bsdiff's.
+ */
+
+/* One level of the SA-IS recursion.  At the top level the string is the
+ * input bytes shifted up by one, followed by a virtual 0 sentinel; below
+ * that it is a reduced string of names, which already ends in a unique 0.
+ */
+typedef struct {
+  const guint8 *bytes;
+  const gint32 *ints;
+  gint32 n; /* Including the sentinel */
+} SaisString;
+
+static inline gint32
+sais_chr (const SaisString *s,
+          gint32            i)
+{
+  if (s->bytes)
+    return i == s->n - 1 ? 0 : (gint32)s->bytes[i] + 1;
+  return s->ints[i];
+}
+
+/* The type bit of each suffix is set for S-type, clear for L-type */
+static inline gboolean
+sais_is_s (const guint8 *t,
+           gint32        i)
+{
+  return (t[i >> 3] >> (i & 7)) & 1;
+}
+
+static inline gboolean
+sais_is_lms (const guint8 *t,
+             gint32        i)
+{
+  return i > 0 && sais_is_s (t, i) && !sais_is_s (t, i - 1);
+}
+
+/* Fill @bkt with the start (or if @end, one past the end) of the bucket
+ * for each of the @k symbols.
+ */
+static void
+sais_get_buckets (const SaisString *s,
+                  gint32           *bkt,
+                  gint32            k,
+                  gboolean          end)
+{
+  gint32 sum = 0;
+
+  memset (bkt, 0, sizeof (gint32) * k);
+  for (gint32 i = 0; i < s->n; i++)
+    bkt[sais_chr (s, i)]++;
+  for (gint32 i = 0; i < k; i++)
+    {
+      sum += bkt[i];
+      bkt[i] = end ? sum : sum - bkt[i];
+    }
+}
+
+static void
+sais_induce (const SaisString *s,
+             const guint8     *t,
+             gint32           *sa,
+             gint32           *bkt,
+             gint32            k)
+{
+  /* L-type suffixes, left to right from the bucket heads */
+  sais_get_buckets (s, bkt, k, FALSE);
+  for (gint32 i = 0; i < s->n; i++)
+    {
+      const gint32 j = sa[i] - 1;
+      if (j >= 0 && !sais_is_s (t, j))
+        sa[bkt[sais_chr (s, j)]++] = j;
+    }
+
+  /* Then S-type, right to left from the bucket tails */
+  sais_get_buckets (s, bkt, k, TRUE);
+  for (gint32 i = s->n - 1; i >= 0; i--)
+    {
+      const gint32 j = sa[i] - 1;
+      if (j >= 0 && sais_is_s (t, j))
+        sa[--bkt[sais_chr (s, j)]] = j;
+    }
+}
+
+static gboolean
+sais (const SaisString *s,
+      gint32           *sa,
+      gint32            k)
+{
+  const gint32 n = s->n;
+  gint32 i, j;
+  g_autofree guint8 *t = g_try_malloc0 (n / 8 + 1);
+  g_autofree gint32 *bkt = g_try_new (gint32, k);
+
+  if (!t || !bkt)
+    return FALSE;
+
+  /* Classify the suffixes.  The sentinel is S-type; the symbol before it
+   * is necessarily larger, so L-type, which t already says.
+   */
+  t[(n - 1) >> 3] |= 1 << ((n - 1) & 7);
+  for (i = n - 3; i >= 0; i--)
+    {
+      const gint32 c = sais_chr (s, i);
+      const gint32 c1 = sais_chr (s, i + 1);
+      if (c < c1 || (c == c1 && sais_is_s (t, i + 1)))
+        t[i >> 3] |= 1 << (i & 7);
+    }
+
+  /* Stage 1: sort the LMS substrings by induction */
+  sais_get_buckets (s, bkt, k, TRUE);
+  for (i = 0; i < n; i++)
+    sa[i] = -1;
+  for (i = 1; i < n; i++)
+    {
+      if (sais_is_lms (t, i))
+        sa[--bkt[sais_chr (s, i)]] = i;
+    }
+  sais_induce (s, t, sa, bkt, k);
+
+  /* Compact the sorted LMS substrings into the first n1 entries */
+  gint32 n1 = 0;
+  for (i = 0; i < n; i++)
+    {
+      if (sais_is_lms (t, sa[i]))
+        sa[n1++] = sa[i];
+    }
+
+  /* Name them; LMS positions are at least two apart, so pos / 2 is a
+   * unique slot in the upper part of the array.
+   */
+  for (i = n1; i < n; i++)
+    sa[i] = -1;
+  gint32 name = 0;
+  gint32 prev = -1;
+  for (i = 0; i < n1; i++)
+    {
+      const gint32 pos = sa[i];
+      gboolean diff = FALSE;
+
+      for (gint32 d = 0; d < n; d++)
+        {
+          if (prev == -1 ||
+              sais_chr (s, pos + d) != sais_chr (s, prev + d) ||
+              sais_is_s (t, pos + d) != sais_is_s (t, prev + d))
+            {
+              diff = TRUE;
+              break;
+            }
+          else if (d > 0 && (sais_is_lms (t, pos + d) || sais_is_lms (t, prev + d)))
+            break;
+        }
+
+      if (diff)
+        {
+          name++;
+          prev = pos;
+        }
+      sa[n1 + pos / 2] = name - 1;
+    }
+  for (i = n - 1, j = n - 1; i >= n1; i--)
+    {
+      if (sa[i] >= 0)
+        sa[j--] = sa[i];
+    }
+
+  /* Stage 2: sort the reduced string, recursing if the names aren't
+   * already unique.
+   */
+  gint32 *sa1 = sa;
+  gint32 *s1 = sa + n - n1;
+  g_clear_pointer (&bkt, g_free);
+  if (name < n1)
+    {
+      const SaisString reduced = { NULL, s1, n1 };
+      if (!sais (&reduced, sa1, name))
+        return FALSE;
+    }
+  else
+    {
+      for (i = 0; i < n1; i++)
+        sa1[s1[i]] = i;
+    }
+
+  /* Stage 3: induce the full suffix array from the sorted LMS suffixes */
+  bkt = g_try_new (gint32, k);
+  if (!bkt)
+    return FALSE;
+  sais_get_buckets (s, bkt, k, TRUE);
+  for (i = 1, j = 0; i < n; i++)
+    {
+      if (sais_is_lms (t, i))
+        s1[j++] = i;
+    }
+  for (i = 0; i < n1; i++)
+    sa1[i] = s1[sa1[i]];
+  for (i = n1; i < n; i++)
+    sa[i] = -1;
+  for (i = n1 - 1; i >= 0; i--)
+    {
+      j = sa[i];
+      sa[i] = -1;
+      sa[--bkt[sais_chr (s, j)]] = j;
+    }
+  sais_induce (s, t, sa, bkt, k);
+
+  return TRUE;
+}
+
+/* Sort the suffixes of @buf into @sa, which must have room for @len + 1
+ * entries.  As with bsdiff's qsufsort, the empty suffix is included, and
+ * sorts first.  Returns %FALSE if memory could not be allocated.
+ */
+gboolean
+_ostree_bsdiff_suffix_sort (const guint8 *buf,
+                            gint32        len,
+                            gint32       *sa)
+{
+  g_return_val_if_fail (len >= 0 && len < G_MAXINT32, FALSE);
+
+  if (len == 0)
+    {
+      sa[0] = 0;
+      return TRUE;
+    }
+
+  const SaisString s = { buf, NULL, len + 1 };
+  return sais (&s, sa, 257);
+}
+
+static gint64
+matchlen (const guint8 *old,
+          gint64        oldsize,
+          const guint8 *new,
+          gint64        newsize)
+{
+  gint64 i;
+
+  for (i = 0; i < oldsize && i < newsize; i++)
+    {
+      if (old[i] != new[i])
+        break;
+    }
+  return i;
+}
+
+/* Find the longest prefix of @new in @old by binary search over @sa */
+static gint64
+search (const gint32 *sa,
+        const guint8 *old,
+        gint64        oldsize,
+        const guint8 *new,
+        gint64        newsize,
+        gint64        st,
+        gint64        en,
+        gint64       *pos)
+{
+  while (en - st >= 2)
+    {
+      const gint64 x = st + (en - st) / 2;
+      if (memcmp (old + sa[x], new, MIN (oldsize - sa[x], newsize)) < 0)
+        st = x;
+      else
+        en = x;
+    }
+
+  const gint64 x = matchlen (old + sa[st], oldsize - sa[st], new, newsize);
+  const gint64 y = matchlen (old + sa[en], oldsize - sa[en], new, newsize);
+  if (x > y)
+    {
+      *pos = sa[st];
+      return x;
+    }
+  *pos = sa[en];
+  return y;
+}
+
+static void
+offtout (gint64  x,
+         guint8 *buf)
+{
+  guint64 y = x < 0 ? -x : x;
+
+  for (guint i = 0; i < 8; i++)
+    {
+      buf[i] = y & 0xff;
+      y >>= 8;
+    }
+  if (x < 0)
+    buf[7] |= 0x80;
+}
+
+static int
+writedata (struct bsdiff_stream *stream,
+           const void           *buffer,
+           gint64                length)
+{
+  while (length > 0)
+    {
+      const int smallsize = (int) MIN (length, INT_MAX);
+      if (stream->write (stream, buffer, smallsize) == -1)
+        return -1;
+      length -= smallsize;
+      buffer = (const guint8*)buffer + smallsize;
+    }
+  return 0;
+}
+
+static int
+bsdiff_with_sa (const gint32         *sa,
+                const guint8         *old,
+                gint64                oldsize,
+                const guint8         *new,
+                gint64                newsize,
+                guint8               *buffer,
+                struct bsdiff_stream *stream)
+{
+  gint64 scan = 0, pos = 0, len = 0;
+  gint64 lastscan = 0, lastpos = 0, lastoffset = 0;
+  guint8 buf[8 * 3];
+
+  while (scan < newsize)
+    {
+      gint64 oldscore = 0;
+      gint64 scsc;
+
+      for (scsc = scan += len; scan < newsize; scan++)
+        {
+          len = search (sa, old, oldsize, new + scan, newsize - scan,
+                        0, oldsize, &pos);
+
+          for (; scsc < scan + len; scsc++)
+            {
+              if (scsc + lastoffset < oldsize &&
+                  old[scsc + lastoffset] == new[scsc])
+                oldscore++;
+            }
+
+          if ((len == oldscore && len != 0) || len > oldscore + 8)
+            break;
+
+          if (scan + lastoffset < oldsize &&
+              old[scan + lastoffset] == new[scan])
+            oldscore--;
+        }
+
+      if (len != oldscore || scan == newsize)
+        {
+          gint64 s = 0, sf = 0, lenf = 0;
+          gint64 i;
+
+          for (i = 0; lastscan + i < scan && lastpos + i < oldsize; )
+            {
+              if (old[lastpos + i] == new[lastscan + i])
+                s++;
+              i++;
+              if (s * 2 - i > sf * 2 - lenf)
+                {
+                  sf = s;
+                  lenf = i;
+                }
+            }
+
+          gint64 lenb = 0;
+          if (scan < newsize)
+            {
+              gint64 sb = 0;
+              s = 0;
+              for (i = 1; scan >= lastscan + i && pos >= i; i++)
+                {
+                  if (old[pos - i] == new[scan - i])
+                    s++;
+                  if (s * 2 - i > sb * 2 - lenb)
+                    {
+                      sb = s;
+                      lenb = i;
+                    }
+                }
+            }
+
+          if (lastscan + lenf > scan - lenb)
+            {
+              const gint64 overlap = (lastscan + lenf) - (scan - lenb);
+              gint64 ss = 0, lens = 0;
+              s = 0;
+              for (i = 0; i < overlap; i++)
+                {
+                  if (new[lastscan + lenf - overlap + i] ==
+                      old[lastpos + lenf - overlap + i])
+                    s++;
+                  if (new[scan - lenb + i] == old[pos - lenb + i])
+                    s--;
+                  if (s > ss)
+                    {
+                      ss = s;
+                      lens = i + 1;
+                    }
+                }
+
+              lenf += lens - overlap;
+              lenb -= lens;
+            }
+
+          const gint64 extralen = (scan - lenb) - (lastscan + lenf);
+          offtout (lenf, buf);
+          offtout (extralen, buf + 8);
+          offtout ((pos - lenb) - (lastpos + lenf), buf + 16);
+
+          /* Control data */
+          if (writedata (stream, buf, sizeof (buf)) < 0)
+            return -1;
+
+          /* Diff data */
+          for (i = 0; i < lenf; i++)
+            buffer[i] = new[lastscan + i] - old[lastpos + i];
+          if (writedata (stream, buffer, lenf) < 0)
+            return -1;
+
+          /* Extra data */
+          for (i = 0; i < extralen; i++)
+            buffer[i] = new[lastscan + lenf + i];
+          if (writedata (stream, buffer, extralen) < 0)
+            return -1;
+
+          lastscan = scan - lenb;
+          lastpos = pos - lenb;
+          lastoffset = pos - scan;
+        }
+    }
+
+  return 0;
+}
+
+/* A drop-in replacement for bsdiff(), producing the same output using less
+ * time and memory.  Old files of 2GiB or more are passed to the vendored
+ * implementation, as they don't fit 32 bit indices.
+ */
+int
+_ostree_bsdiff (const guint8         *old,
+                gint64                oldsize,
+                const guint8         *new,
+                gint64                newsize,
+                struct bsdiff_stream *stream)
+{
+  if (oldsize >= G_MAXINT32)
+    return bsdiff (old, oldsize, new, newsize, stream);
+
+  gint32 *sa = stream->malloc ((oldsize + 1) * sizeof (gint32));
+  if (!sa)
+    return -1;
+  guint8 *buffer = stream->malloc (newsize + 1);
+  if (!buffer)
+    {
+      stream->free (sa);
+      return -1;
+    }
+
+  int result = -1;
+  if (_ostree_bsdiff_suffix_sort (old, oldsize, sa))
+    result = bsdiff_with_sa (sa, old, oldsize, new, newsize, buffer, stream);
+
+  stream->free (buffer);
+  stream->free (sa);
+  return result;
+}
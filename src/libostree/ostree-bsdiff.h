@@ -0,0 +1,38 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <glib.h>
+#include "bsdiff/bsdiff.h"
+
+G_BEGIN_DECLS
+
+gboolean _ostree_bsdiff_suffix_sort (const guint8 *buf,
+                                     gint32        len,
+                                     gint32       *sa);
+
+int _ostree_bsdiff (const guint8         *old,
+                    gint64                oldsize,
+                    const guint8         *new,
+                    gint64                newsize,
+                    struct bsdiff_stream *stream);
+
+G_END_DECLS
@@ -21,12 +21,15 @@
 #pragma once
 
 #include "ostree-core.h"
+#include "otutil.h"
 #include <sys/stat.h>
 
 G_BEGIN_DECLS
 
 /* It's what gzip does, 9 is too slow */
 #define OSTREE_ARCHIVE_DEFAULT_COMPRESSION_LEVEL (6)
+/* zstd's own default; decompression speed is mostly independent of level */
+#define OSTREE_ARCHIVE_ZSTD_DEFAULT_COMPRESSION_LEVEL (3)
 
 /* This file contains private implementation data format definitions
  * read by multiple implementation .c files.
@@ -78,7 +81,7 @@ gboolean _ostree_write_variant_with_size (GOutputStream      *output,
                                           GVariant           *variant,
                                           guint64             alignment_offset,
                                           gsize              *out_bytes_written,
-                                          GChecksum          *checksum,
+                                          OtChecksum         *checksum,
                                           GCancellable       *cancellable,
                                           GError            **error);
 
@@ -108,7 +111,7 @@ _ostree_checksum_inplace_from_bytes_v (GVariant *csum_v, char *buf)
 char *
 _ostree_get_relative_object_path (const char        *checksum,
                                   OstreeObjectType   type,
-                                  gboolean           compressed);
+                                  OstreeRepoMode     mode);
 
 
 char *
@@ -158,6 +161,91 @@ _ostree_repo_mode_is_bare (OstreeRepoMode mode)
     mode == OSTREE_REPO_MODE_BARE_USER_ONLY;
 }
 
+static inline gboolean
+_ostree_repo_mode_is_archive (OstreeRepoMode mode)
+{
+  return
+    mode == OSTREE_REPO_MODE_ARCHIVE_Z2 ||
+    mode == OSTREE_REPO_MODE_ARCHIVE_ZSTD;
+}
+
+/* Extra suffix appended to the object type for loose content objects;
+ * e.g. .filez for archive-z2.
+ */
+static inline const char *
+_ostree_loose_object_suffix (OstreeObjectType objtype,
+                             OstreeRepoMode   mode)
+{
+  if (OSTREE_OBJECT_TYPE_IS_META (objtype))
+    return "";
+  switch (mode)
+    {
+    case OSTREE_REPO_MODE_ARCHIVE_Z2:
+      return "z";
+    case OSTREE_REPO_MODE_ARCHIVE_ZSTD:
+      return "zst";
+    default:
+      return "";
+    }
+}
+
+gboolean
+_ostree_repo_mode_check_supported (OstreeRepoMode   mode,
+                                   GError         **error);
+
+GConverter *
+_ostree_archive_compressor_new (OstreeRepoMode mode,
+                                guint          level);
+
+GConverter *
+_ostree_archive_decompressor_new (OstreeRepoMode mode);
+
+gboolean
+_ostree_content_stream_parse (OstreeRepoMode          repo_mode,
+                              GInputStream           *input,
+                              guint64                 input_length,
+                              gboolean                trusted,
+                              GInputStream          **out_input,
+                              GFileInfo             **out_file_info,
+                              GVariant              **out_xattrs,
+                              GCancellable           *cancellable,
+                              GError                **error);
+
+gboolean
+_ostree_content_file_parse_at (OstreeRepoMode          repo_mode,
+                               int                     parent_dfd,
+                               const char             *path,
+                               gboolean                trusted,
+                               GInputStream          **out_input,
+                               GFileInfo             **out_file_info,
+                               GVariant              **out_xattrs,
+                               GCancellable           *cancellable,
+                               GError                **error);
+
+typedef struct _OstreeContentChecksum OstreeContentChecksum;
+
+OstreeContentChecksum *
+_ostree_content_checksum_new (OstreeRepoMode mode);
+
+void
+_ostree_content_checksum_reset (OstreeContentChecksum *self);
+
+void
+_ostree_content_checksum_free (OstreeContentChecksum *self);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(OstreeContentChecksum, _ostree_content_checksum_free)
+
+void
+_ostree_content_checksum_update (OstreeContentChecksum *self,
+                                 const guint8          *buf,
+                                 gsize                  len);
+
+gboolean
+_ostree_content_checksum_finish (OstreeContentChecksum *self,
+                                 char                  *out_checksum,
+                                 GFileInfo            **out_file_info,
+                                 GVariant             **out_xattrs,
+                                 GError               **error);
+
 GVariant *
 _ostree_detached_metadata_append_gpg_sig (GVariant   *existing_metadata,
                                           GBytes     *signature_bytes);
@@ -31,6 +31,10 @@
 #include "ostree.h"
 #include "ostree-core-private.h"
 #include "ostree-chain-input-stream.h"
+#ifdef HAVE_ZSTD
+#include "ostree-zstd-compressor.h"
+#include "ostree-zstd-decompressor.h"
+#endif
 #include "otutil.h"
 
 #define ALIGN_VALUE(this, boundary) \
@@ -352,7 +356,7 @@ write_padding (GOutputStream    *output,
                guint             alignment,
                gsize             offset,
                gsize            *out_bytes_written,
-               GChecksum        *checksum,
+               OtChecksum       *checksum,
                GCancellable     *cancellable,
                GError          **error)
 {
@@ -397,7 +401,7 @@ _ostree_write_variant_with_size (GOutputStream      *output,
                                  GVariant           *variant,
                                  guint64             alignment_offset,
                                  gsize              *out_bytes_written,
-                                 GChecksum          *checksum,
+                                 OtChecksum         *checksum,
                                  GCancellable       *cancellable,
                                  GError            **error)
 {
@@ -452,7 +456,7 @@ _ostree_write_variant_with_size (GOutputStream      *output,
 static gboolean
 write_file_header_update_checksum (GOutputStream         *out,
                                    GVariant              *header,
-                                   GChecksum             *checksum,
+                                   OtChecksum            *checksum,
                                    GCancellable          *cancellable,
                                    GError               **error)
 {
@@ -546,6 +550,55 @@ _ostree_raw_file_to_archive_stream (GInputStream       *input,
                                      error);
 }
 
+/* Returns %FALSE if this build can't read or write repositories in @mode */
+gboolean
+_ostree_repo_mode_check_supported (OstreeRepoMode   mode,
+                                   GError         **error)
+{
+#ifndef HAVE_ZSTD
+  if (mode == OSTREE_REPO_MODE_ARCHIVE_ZSTD)
+    return glnx_throw (error, "This version of OSTree was built without zstd support; "
+                       "archive-zstd repositories are not supported");
+#endif
+  return TRUE;
+}
+
+/* The compressor used for file content in an archive repository of
+ * mode @mode; @level is interpreted according to the algorithm.
+ */
+GConverter *
+_ostree_archive_compressor_new (OstreeRepoMode mode,
+                                guint          level)
+{
+  switch (mode)
+    {
+    case OSTREE_REPO_MODE_ARCHIVE_Z2:
+      return (GConverter*)g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW, level);
+#ifdef HAVE_ZSTD
+    case OSTREE_REPO_MODE_ARCHIVE_ZSTD:
+      return (GConverter*)_ostree_zstd_compressor_new (level);
+#endif
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+GConverter *
+_ostree_archive_decompressor_new (OstreeRepoMode mode)
+{
+  switch (mode)
+    {
+    case OSTREE_REPO_MODE_ARCHIVE_Z2:
+      return (GConverter*)g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW);
+#ifdef HAVE_ZSTD
+    case OSTREE_REPO_MODE_ARCHIVE_ZSTD:
+      return (GConverter*)_ostree_zstd_decompressor_new ();
+#endif
+    default:
+      g_assert_not_reached ();
+    }
+}
+
 /**
  * ostree_raw_file_to_archive_z2_stream:
  * @input: File raw content stream
@@ -676,6 +729,32 @@ ostree_content_stream_parse (gboolean                compressed,
                              GCancellable           *cancellable,
                              GError                **error)
 {
+  return _ostree_content_stream_parse (compressed ? OSTREE_REPO_MODE_ARCHIVE_Z2 : OSTREE_REPO_MODE_BARE,
+                                       input, input_length, trusted,
+                                       out_input, out_file_info, out_xattrs,
+                                       cancellable, error);
+}
+
+/*
+ * _ostree_content_stream_parse:
+ * @repo_mode: Mode of the repository the object is stored in, which
+ *   determines how the content is compressed
+ *
+ * Like ostree_content_stream_parse(), but also supports
+ * %OSTREE_REPO_MODE_ARCHIVE_ZSTD objects.
+ */
+gboolean
+_ostree_content_stream_parse (OstreeRepoMode          repo_mode,
+                              GInputStream           *input,
+                              guint64                 input_length,
+                              gboolean                trusted,
+                              GInputStream          **out_input,
+                              GFileInfo             **out_file_info,
+                              GVariant              **out_xattrs,
+                              GCancellable           *cancellable,
+                              GError                **error)
+{
+  const gboolean compressed = _ostree_repo_mode_is_archive (repo_mode);
   guint32 archive_header_size;
   guchar dummy[4];
   gsize bytes_read;
@@ -736,8 +815,8 @@ ostree_content_stream_parse (gboolean                compressed,
        **/
       if (compressed)
         {
-          g_autoptr(GConverter) zlib_decomp = (GConverter*)g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW);
-          ret_input = g_converter_input_stream_new (input, zlib_decomp);
+          g_autoptr(GConverter) decomp = _ostree_archive_decompressor_new (repo_mode);
+          ret_input = g_converter_input_stream_new (input, decomp);
         }
       else
         ret_input = g_object_ref (input);
@@ -774,6 +853,24 @@ ostree_content_file_parse_at (gboolean                compressed,
                               GVariant              **out_xattrs,
                               GCancellable           *cancellable,
                               GError                **error)
+{
+  return _ostree_content_file_parse_at (compressed ? OSTREE_REPO_MODE_ARCHIVE_Z2 : OSTREE_REPO_MODE_BARE,
+                                        parent_dfd, path, trusted,
+                                        out_input, out_file_info, out_xattrs,
+                                        cancellable, error);
+}
+
+/* See _ostree_content_stream_parse() */
+gboolean
+_ostree_content_file_parse_at (OstreeRepoMode          repo_mode,
+                               int                     parent_dfd,
+                               const char             *path,
+                               gboolean                trusted,
+                               GInputStream          **out_input,
+                               GFileInfo             **out_file_info,
+                               GVariant              **out_xattrs,
+                               GCancellable           *cancellable,
+                               GError                **error)
 {
   glnx_fd_close int fd = -1;
   if (!glnx_openat_rdonly (parent_dfd, path, TRUE, &fd, error))
@@ -788,10 +885,10 @@ ostree_content_file_parse_at (gboolean                compressed,
   g_autoptr(GFileInfo) ret_file_info = NULL;
   g_autoptr(GVariant) ret_xattrs = NULL;
   g_autoptr(GInputStream) ret_input = NULL;
-  if (!ostree_content_stream_parse (compressed, file_input, stbuf.st_size, trusted,
-                                    out_input ? &ret_input : NULL,
-                                    &ret_file_info, &ret_xattrs,
-                                    cancellable, error))
+  if (!_ostree_content_stream_parse (repo_mode, file_input, stbuf.st_size, trusted,
+                                     out_input ? &ret_input : NULL,
+                                     &ret_file_info, &ret_xattrs,
+                                     cancellable, error))
     return FALSE;
 
   ot_transfer_out_value (out_input, &ret_input);
@@ -800,6 +897,290 @@ ostree_content_file_parse_at (gboolean                compressed,
   return TRUE;
 }
 
+struct _OstreeContentChecksum {
+  OstreeRepoMode mode;
+  OtChecksum checksum;
+
+  /* The header size and padding */
+  guint8 header_prefix[8];
+  gsize header_prefix_len;
+  guint8 *header_buf;
+  gsize header_size;
+  gsize header_len;
+
+  /* Set once the header has been parsed */
+  GFileInfo *file_info;
+  GVariant *xattrs;
+  GConverter *decompressor;
+  gboolean content_complete;
+  guint64 content_len;
+
+  GError *error;
+};
+
+/*
+ * _ostree_content_checksum_new:
+ * @mode: Mode of the repository the object is serialized for
+ *
+ * Returns a context for computing the checksum of a content object from
+ * its serialized form as stored in a repository of mode @mode (i.e. the
+ * form parsed by _ostree_content_stream_parse()), as the data becomes
+ * available.  This is used to verify objects while they are being
+ * downloaded, rather than reading them back afterwards.
+ */
+OstreeContentChecksum *
+_ostree_content_checksum_new (OstreeRepoMode mode)
+{
+  OstreeContentChecksum *self = g_new0 (OstreeContentChecksum, 1);
+  self->mode = mode;
+  ot_checksum_init (&self->checksum);
+  return self;
+}
+
+static void
+content_checksum_clear (OstreeContentChecksum *self)
+{
+  ot_checksum_clear (&self->checksum);
+  g_clear_pointer (&self->header_buf, g_free);
+  g_clear_object (&self->file_info);
+  g_clear_pointer (&self->xattrs, g_variant_unref);
+  g_clear_object (&self->decompressor);
+  g_clear_error (&self->error);
+}
+
+/* Discard all data seen so far, e.g. when a download is restarted */
+void
+_ostree_content_checksum_reset (OstreeContentChecksum *self)
+{
+  const OstreeRepoMode mode = self->mode;
+
+  content_checksum_clear (self);
+  memset (self, 0, sizeof (*self));
+  self->mode = mode;
+  ot_checksum_init (&self->checksum);
+}
+
+void
+_ostree_content_checksum_free (OstreeContentChecksum *self)
+{
+  content_checksum_clear (self);
+  g_free (self);
+}
+
+static gboolean
+content_checksum_parse_header (OstreeContentChecksum *self,
+                               GError               **error)
+{
+  const gboolean compressed = _ostree_repo_mode_is_archive (self->mode);
+  g_autoptr(GVariant) file_header =
+    g_variant_new_from_data (compressed ? _OSTREE_ZLIB_FILE_HEADER_GVARIANT_FORMAT : _OSTREE_FILE_HEADER_GVARIANT_FORMAT,
+                             self->header_buf, self->header_size, FALSE,
+                             g_free, self->header_buf);
+  self->header_buf = NULL;
+
+  g_autoptr(GFileInfo) file_info = NULL;
+  g_autoptr(GVariant) xattrs = NULL;
+  if (compressed)
+    {
+      if (!zlib_file_header_parse (file_header, &file_info, &xattrs, error))
+        return FALSE;
+    }
+  else
+    {
+      if (!file_header_parse (file_header, &file_info, &xattrs, error))
+        return FALSE;
+    }
+
+  /* The object checksum covers the uncompressed header, as in
+   * ostree_checksum_file_from_input().
+   */
+  g_autoptr(GVariant) checksum_header = _ostree_file_header_new (file_info, xattrs);
+  if (!write_file_header_update_checksum (NULL, checksum_header, &self->checksum,
+                                          NULL, error))
+    return FALSE;
+
+  if (compressed && g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
+    self->decompressor = _ostree_archive_decompressor_new (self->mode);
+
+  self->file_info = g_steal_pointer (&file_info);
+  self->xattrs = g_steal_pointer (&xattrs);
+  return TRUE;
+}
+
+static gboolean
+content_checksum_decompress (OstreeContentChecksum *self,
+                             const guint8          *buf,
+                             gsize                  len,
+                             GConverterFlags        flags,
+                             GError               **error)
+{
+  const guint64 expected_len = g_file_info_get_size (self->file_info);
+  guint8 outbuf[8192];
+
+  while (!self->content_complete)
+    {
+      g_autoptr(GError) local_error = NULL;
+      gsize bytes_read = 0;
+      gsize bytes_written = 0;
+      GConverterResult res =
+        g_converter_convert (self->decompressor, buf, len, outbuf, sizeof (outbuf),
+                             flags, &bytes_read, &bytes_written, &local_error);
+      if (res == G_CONVERTER_ERROR)
+        {
+          /* Wait for the rest of the stream */
+          if (!(flags & G_CONVERTER_INPUT_AT_END) &&
+              g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT))
+            return TRUE;
+          g_propagate_error (error, g_steal_pointer (&local_error));
+          return FALSE;
+        }
+
+      ot_checksum_update (&self->checksum, outbuf, bytes_written);
+      self->content_len += bytes_written;
+      if (self->content_len > expected_len)
+        return glnx_throw (error, "Corrupted archive file; content exceeds size %" G_GUINT64_FORMAT,
+                           expected_len);
+      buf += bytes_read;
+      len -= bytes_read;
+
+      if (res == G_CONVERTER_FINISHED)
+        self->content_complete = TRUE;
+      else if (bytes_read == 0 && bytes_written == 0)
+        {
+          if (flags & G_CONVERTER_INPUT_AT_END)
+            return glnx_throw (error, "Corrupted archive file; truncated content");
+          return TRUE;
+        }
+    }
+
+  /* Like _ostree_content_stream_parse(), ignore anything after the end of
+   * the compressed stream.
+   */
+  return TRUE;
+}
+
+/*
+ * _ostree_content_checksum_update:
+ * @self: Checksum context
+ * @buf: (array length=len): Data
+ * @len: Length of @buf
+ *
+ * Feed the next @len bytes of the serialized object.  Any error is
+ * deferred until _ostree_content_checksum_finish().
+ */
+void
+_ostree_content_checksum_update (OstreeContentChecksum *self,
+                                 const guint8          *buf,
+                                 gsize                  len)
+{
+  if (self->error)
+    return;
+
+  while (len > 0 && self->file_info == NULL)
+    {
+      if (self->header_prefix_len < sizeof (self->header_prefix))
+        {
+          const gsize n = MIN (len, sizeof (self->header_prefix) - self->header_prefix_len);
+          memcpy (self->header_prefix + self->header_prefix_len, buf, n);
+          self->header_prefix_len += n;
+          buf += n;
+          len -= n;
+
+          if (self->header_prefix_len == sizeof (self->header_prefix))
+            {
+              guint32 header_size_be;
+              memcpy (&header_size_be, self->header_prefix, sizeof (header_size_be));
+              self->header_size = GUINT32_FROM_BE (header_size_be);
+              if (self->header_size == 0)
+                {
+                  (void) glnx_throw (&self->error, "File header size is zero");
+                  return;
+                }
+              else if (self->header_size > OSTREE_MAX_METADATA_SIZE)
+                {
+                  (void) glnx_throw (&self->error, "File header size %" G_GSIZE_FORMAT " exceeds maximum size %u",
+                                     self->header_size, OSTREE_MAX_METADATA_SIZE);
+                  return;
+                }
+              self->header_buf = g_malloc (self->header_size);
+            }
+        }
+      else
+        {
+          const gsize n = MIN (len, self->header_size - self->header_len);
+          memcpy (self->header_buf + self->header_len, buf, n);
+          self->header_len += n;
+          buf += n;
+          len -= n;
+
+          if (self->header_len == self->header_size &&
+              !content_checksum_parse_header (self, &self->error))
+            return;
+        }
+    }
+
+  if (len == 0 || self->content_complete ||
+      g_file_info_get_file_type (self->file_info) != G_FILE_TYPE_REGULAR)
+    return;
+
+  if (self->decompressor)
+    (void) content_checksum_decompress (self, buf, len, 0, &self->error);
+  else
+    {
+      ot_checksum_update (&self->checksum, buf, len);
+      self->content_len += len;
+    }
+}
+
+/*
+ * _ostree_content_checksum_finish:
+ * @self: Checksum context
+ * @out_checksum: (out caller-allocates): Return location for the hex checksum,
+ *   of length %OSTREE_SHA256_STRING_LEN + 1
+ * @out_file_info: (out) (optional): Metadata from the object header
+ * @out_xattrs: (out) (optional): Extended attributes from the object header
+ * @error: Error
+ *
+ * Complete the checksum once all of the serialized object has been passed
+ * to _ostree_content_checksum_update().  Fails if the data was not a
+ * well-formed content object.
+ */
+gboolean
+_ostree_content_checksum_finish (OstreeContentChecksum *self,
+                                 char                  *out_checksum,
+                                 GFileInfo            **out_file_info,
+                                 GVariant             **out_xattrs,
+                                 GError               **error)
+{
+  if (self->error)
+    {
+      g_propagate_error (error, g_error_copy (self->error));
+      return FALSE;
+    }
+
+  if (self->file_info == NULL)
+    return glnx_throw (error, "Corrupted archive file; truncated header");
+
+  if (self->decompressor)
+    {
+      if (!self->content_complete &&
+          !content_checksum_decompress (self, (const guint8*)"", 0, G_CONVERTER_INPUT_AT_END, error))
+        return FALSE;
+      if (self->content_len != g_file_info_get_size (self->file_info))
+        return glnx_throw (error, "Corrupted archive file; content size %" G_GUINT64_FORMAT " does not match header size %" G_GUINT64_FORMAT,
+                           self->content_len, (guint64) g_file_info_get_size (self->file_info));
+    }
+  else if (g_file_info_get_file_type (self->file_info) == G_FILE_TYPE_REGULAR)
+    g_file_info_set_size (self->file_info, self->content_len);
+
+  ot_checksum_get_hexdigest (&self->checksum, out_checksum, OSTREE_SHA256_STRING_LEN+1);
+  if (out_file_info)
+    *out_file_info = g_object_ref (self->file_info);
+  if (out_xattrs)
+    *out_xattrs = self->xattrs ? g_variant_ref (self->xattrs) : NULL;
+  return TRUE;
+}
+
 /**
  * ostree_content_file_parse:
  * @compressed: Whether or not the stream is zlib-compressed
@@ -853,18 +1234,19 @@ ostree_checksum_file_from_input (GFileInfo        *file_info,
                                  GError          **error)
 {
 
-  g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_auto(OtChecksum) checksum = { 0, };
+  ot_checksum_init (&checksum);
 
   if (OSTREE_OBJECT_TYPE_IS_META (objtype))
     {
-      if (!ot_gio_splice_update_checksum (NULL, in, checksum, cancellable, error))
+      if (!ot_gio_splice_update_checksum (NULL, in, &checksum, cancellable, error))
         return FALSE;
     }
   else if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
     {
       g_autoptr(GVariant) dirmeta = ostree_create_directory_metadata (file_info, xattrs);
-      g_checksum_update (checksum, g_variant_get_data (dirmeta),
-                         g_variant_get_size (dirmeta));
+      ot_checksum_update (&checksum, g_variant_get_data (dirmeta),
+                          g_variant_get_size (dirmeta));
     }
   else
     {
@@ -872,18 +1254,20 @@ ostree_checksum_file_from_input (GFileInfo        *file_info,
 
       file_header = _ostree_file_header_new (file_info, xattrs);
 
-      if (!write_file_header_update_checksum (NULL, file_header, checksum,
+      if (!write_file_header_update_checksum (NULL, file_header, &checksum,
                                               cancellable, error))
         return FALSE;
 
       if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
         {
-          if (!ot_gio_splice_update_checksum (NULL, in, checksum, cancellable, error))
+          if (!ot_gio_splice_update_checksum (NULL, in, &checksum, cancellable, error))
             return FALSE;
         }
     }
 
-  *out_csum = ot_csum_from_gchecksum (checksum);
+  guint8 digest[OSTREE_SHA256_DIGEST_LEN];
+  ot_checksum_get_digest (&checksum, digest, sizeof (digest));
+  *out_csum = g_memdup (digest, sizeof (digest));
   return TRUE;
 }
 
@@ -1525,7 +1909,7 @@ _ostree_loose_path (char              *buf,
   buf++;
   snprintf (buf, _OSTREE_LOOSE_PATH_MAX - 2, "/%s.%s%s",
             checksum + 2, ostree_object_type_to_string (objtype),
-            (!OSTREE_OBJECT_TYPE_IS_META (objtype) && mode == OSTREE_REPO_MODE_ARCHIVE_Z2) ? "z" : "");
+            _ostree_loose_object_suffix (objtype, mode));
 }
 
 /**
@@ -1589,7 +1973,7 @@ _ostree_mode_uidgid_to_gfileinfo (mode_t mode, uid_t uid, gid_t gid)
 char *
 _ostree_get_relative_object_path (const char         *checksum,
                                   OstreeObjectType    type,
-                                  gboolean            compressed)
+                                  OstreeRepoMode      mode)
 {
   GString *path;
 
@@ -1602,8 +1986,7 @@ _ostree_get_relative_object_path (const char         *checksum,
   g_string_append (path, checksum + 2);
   g_string_append_c (path, '.');
   g_string_append (path, ostree_object_type_to_string (type));
-  if (!OSTREE_OBJECT_TYPE_IS_META (type) && compressed)
-    g_string_append (path, "z");
+  g_string_append (path, _ostree_loose_object_suffix (type, mode));
 
   return g_string_free (path, FALSE);
 }
@@ -184,6 +184,7 @@ typedef enum {
  * @OSTREE_REPO_MODE_ARCHIVE_Z2: Files are compressed, should be owned by non-root.  Can be served via HTTP
  * @OSTREE_REPO_MODE_BARE_USER: Files are stored as themselves, except ownership; can be written by user. Hardlinks work only in user checkouts.
  * @OSTREE_REPO_MODE_BARE_USER_ONLY: Same as BARE_USER, but all metadata is not stored, so it can only be used for user checkouts. Does not need xattrs.
+ * @OSTREE_REPO_MODE_ARCHIVE_ZSTD: Like ARCHIVE_Z2, but files are compressed with zstd, which is much faster to decompress.  Only available if OSTree was built with zstd support. (Since: 2017.10)
  *
  * See the documentation of #OstreeRepo for more information about the
  * possible modes.
@@ -193,6 +194,7 @@ typedef enum {
   OSTREE_REPO_MODE_ARCHIVE_Z2,
   OSTREE_REPO_MODE_BARE_USER,
   OSTREE_REPO_MODE_BARE_USER_ONLY,
+  OSTREE_REPO_MODE_ARCHIVE_ZSTD,
 } OstreeRepoMode;
 
 /**
@@ -342,6 +344,64 @@ void ostree_object_from_string (const char *str,
                                 gchar     **out_checksum,
                                 OstreeObjectType *out_objtype);
 
+/**
+ * OstreeObjectSet:
+ *
+ * A compact set of object names; each entry is stored as a binary
+ * checksum plus object type.  This is a lower memory alternative to
+ * the #GHashTable returned by ostree_repo_traverse_new_reachable().
+ *
+ * Since: 2017.10
+ */
+typedef struct OstreeObjectSet OstreeObjectSet;
+
+/**
+ * OstreeObjectSetIter:
+ *
+ * A stack-allocated iterator over an #OstreeObjectSet.
+ *
+ * Since: 2017.10
+ */
+typedef struct {
+  /*< private >*/
+  OstreeObjectSet *set;
+  gsize pos;
+  gpointer padding[2];
+} OstreeObjectSetIter;
+
+_OSTREE_PUBLIC
+OstreeObjectSet *ostree_object_set_new (void);
+
+_OSTREE_PUBLIC
+void ostree_object_set_free (OstreeObjectSet *set);
+
+_OSTREE_PUBLIC
+guint ostree_object_set_size (OstreeObjectSet *set);
+
+_OSTREE_PUBLIC
+gboolean ostree_object_set_add (OstreeObjectSet   *set,
+                                const char        *checksum,
+                                OstreeObjectType   objtype);
+
+_OSTREE_PUBLIC
+gboolean ostree_object_set_remove (OstreeObjectSet   *set,
+                                   const char        *checksum,
+                                   OstreeObjectType   objtype);
+
+_OSTREE_PUBLIC
+gboolean ostree_object_set_contains (OstreeObjectSet   *set,
+                                     const char        *checksum,
+                                     OstreeObjectType   objtype);
+
+_OSTREE_PUBLIC
+void ostree_object_set_iter_init (OstreeObjectSetIter *iter,
+                                  OstreeObjectSet     *set);
+
+_OSTREE_PUBLIC
+gboolean ostree_object_set_iter_next (OstreeObjectSetIter  *iter,
+                                      const guint8        **out_csum,
+                                      OstreeObjectType     *out_objtype);
+
 _OSTREE_PUBLIC
 gboolean
 ostree_content_stream_parse (gboolean                compressed,
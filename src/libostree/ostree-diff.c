@@ -25,6 +25,7 @@
 #include "libglnx.h"
 #include "ostree.h"
 #include "ostree-repo-private.h"
+#include "ostree-core-private.h"
 #include "otutil.h"
 
 static gboolean
@@ -445,6 +446,376 @@ ostree_diff_dirs_with_options (OstreeDiffFlags        flags,
   return ret;
 }
 
+typedef struct {
+  OstreeRepo *repo;
+  OstreeDiffCommitsFunc func;
+  gpointer user_data;
+  GString *path;
+  GCancellable *cancellable;
+} DiffCommitsData;
+
+/* Report a change to @name in the current directory */
+static gboolean
+diff_commits_emit (DiffCommitsData      *data,
+                   OstreeDiffChangeType  change,
+                   const char           *name,
+                   OstreeObjectType      src_objtype,
+                   GVariant             *src_csum_v,
+                   OstreeObjectType      target_objtype,
+                   GVariant             *target_csum_v,
+                   GError              **error)
+{
+  char src_checksum[OSTREE_SHA256_STRING_LEN+1];
+  char target_checksum[OSTREE_SHA256_STRING_LEN+1];
+  const gsize dirlen = data->path->len;
+
+  if (src_csum_v)
+    _ostree_checksum_inplace_from_bytes_v (src_csum_v, src_checksum);
+  if (target_csum_v)
+    _ostree_checksum_inplace_from_bytes_v (target_csum_v, target_checksum);
+
+  g_string_append_c (data->path, '/');
+  g_string_append (data->path, name);
+  const gboolean ret = data->func (change, data->path->str,
+                                   src_objtype, src_csum_v ? src_checksum : NULL,
+                                   target_objtype, target_csum_v ? target_checksum : NULL,
+                                   data->user_data, error);
+  g_string_truncate (data->path, dirlen);
+  return ret;
+}
+
+static gboolean
+load_dirtree (OstreeRepo  *repo,
+              GVariant    *csum_v,
+              GVariant   **out_files,
+              GVariant   **out_dirs,
+              GError     **error)
+{
+  char checksum[OSTREE_SHA256_STRING_LEN+1];
+  g_autoptr(GVariant) dirtree = NULL;
+
+  _ostree_checksum_inplace_from_bytes_v (csum_v, checksum);
+  if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_DIR_TREE, checksum,
+                                 &dirtree, error))
+    return FALSE;
+
+  *out_files = g_variant_get_child_value (dirtree, 0);
+  *out_dirs = g_variant_get_child_value (dirtree, 1);
+  return TRUE;
+}
+
+/* Index of @name in @entries, a sorted array of dirtree entries, or -1 */
+static int
+dirtree_entries_find (GVariant   *entries,
+                      const char *name)
+{
+  gsize lo = 0;
+  gsize hi = g_variant_n_children (entries);
+
+  while (lo < hi)
+    {
+      const gsize mid = lo + (hi - lo) / 2;
+      g_autoptr(GVariant) entry = g_variant_get_child_value (entries, mid);
+      const char *entry_name;
+      g_variant_get_child (entry, 0, "&s", &entry_name);
+      const int c = strcmp (name, entry_name);
+      if (c == 0)
+        return mid;
+      else if (c < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  return -1;
+}
+
+/* Report everything under the dirtree @contents_csum_v as added, in the
+ * same order as diff_add_dir_recurse().
+ */
+static gboolean
+diff_commits_add_tree (DiffCommitsData *data,
+                       GVariant        *contents_csum_v,
+                       GError         **error)
+{
+  g_autoptr(GVariant) files = NULL;
+  g_autoptr(GVariant) dirs = NULL;
+
+  if (g_cancellable_set_error_if_cancelled (data->cancellable, error))
+    return FALSE;
+
+  if (!load_dirtree (data->repo, contents_csum_v, &files, &dirs, error))
+    return FALSE;
+
+  const guint n_files = g_variant_n_children (files);
+  for (guint i = 0; i < n_files; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) csum_v = NULL;
+      g_variant_get_child (files, i, "(&s@ay)", &name, &csum_v);
+      if (!diff_commits_emit (data, OSTREE_DIFF_CHANGE_ADDED, name,
+                              0, NULL, OSTREE_OBJECT_TYPE_FILE, csum_v, error))
+        return FALSE;
+    }
+
+  const guint n_dirs = g_variant_n_children (dirs);
+  for (guint i = 0; i < n_dirs; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) tree_csum_v = NULL;
+      g_autoptr(GVariant) meta_csum_v = NULL;
+      g_variant_get_child (dirs, i, "(&s@ay@ay)", &name, &tree_csum_v, &meta_csum_v);
+      if (!diff_commits_emit (data, OSTREE_DIFF_CHANGE_ADDED, name,
+                              0, NULL, OSTREE_OBJECT_TYPE_DIR_META, meta_csum_v, error))
+        return FALSE;
+
+      const gsize dirlen = data->path->len;
+      g_string_append_c (data->path, '/');
+      g_string_append (data->path, name);
+      const gboolean ret = diff_commits_add_tree (data, tree_csum_v, error);
+      g_string_truncate (data->path, dirlen);
+      if (!ret)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Compare the dirtrees @a_csum_v and @b_csum_v, which differ.  Entries
+ * are sorted by name, so files and subdirectories are each merged in one
+ * pass; subdirectories with the same dirtree checksum aren't descended
+ * into.  Changes are reported in the same order as
+ * ostree_diff_dirs_with_options() finds them.
+ */
+static gboolean
+diff_commits_trees (DiffCommitsData *data,
+                    GVariant        *a_csum_v,
+                    GVariant        *b_csum_v,
+                    GError         **error)
+{
+  g_autoptr(GVariant) a_files = NULL;
+  g_autoptr(GVariant) a_dirs = NULL;
+  g_autoptr(GVariant) b_files = NULL;
+  g_autoptr(GVariant) b_dirs = NULL;
+
+  if (g_cancellable_set_error_if_cancelled (data->cancellable, error))
+    return FALSE;
+
+  if (!load_dirtree (data->repo, a_csum_v, &a_files, &a_dirs, error))
+    return FALSE;
+  if (!load_dirtree (data->repo, b_csum_v, &b_files, &b_dirs, error))
+    return FALSE;
+
+  const guint n_a_files = g_variant_n_children (a_files);
+  const guint n_b_files = g_variant_n_children (b_files);
+  const guint n_a_dirs = g_variant_n_children (a_dirs);
+  const guint n_b_dirs = g_variant_n_children (b_dirs);
+
+  /* Files in a: modified, changed type, or removed */
+  guint j = 0;
+  int b_index;
+  for (guint i = 0; i < n_a_files; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) csum_v = NULL;
+      g_variant_get_child (a_files, i, "(&s@ay)", &name, &csum_v);
+
+      int c = 1;
+      g_autoptr(GVariant) b_csum_v = NULL;
+      for (; j < n_b_files; j++)
+        {
+          const char *b_name;
+          g_clear_pointer (&b_csum_v, g_variant_unref);
+          g_variant_get_child (b_files, j, "(&s@ay)", &b_name, &b_csum_v);
+          c = strcmp (name, b_name);
+          if (c <= 0)
+            break;
+        }
+
+      if (c == 0)
+        {
+          if (!g_variant_equal (csum_v, b_csum_v) &&
+              !diff_commits_emit (data, OSTREE_DIFF_CHANGE_MODIFIED, name,
+                                  OSTREE_OBJECT_TYPE_FILE, csum_v,
+                                  OSTREE_OBJECT_TYPE_FILE, b_csum_v, error))
+            return FALSE;
+        }
+      else if ((b_index = dirtree_entries_find (b_dirs, name)) >= 0)
+        {
+          g_autoptr(GVariant) b_meta_csum_v = NULL;
+          g_variant_get_child (b_dirs, b_index, "(&s@ay@ay)", NULL, NULL, &b_meta_csum_v);
+          if (!diff_commits_emit (data, OSTREE_DIFF_CHANGE_MODIFIED, name,
+                                  OSTREE_OBJECT_TYPE_FILE, csum_v,
+                                  OSTREE_OBJECT_TYPE_DIR_META, b_meta_csum_v, error))
+            return FALSE;
+        }
+      else
+        {
+          if (!diff_commits_emit (data, OSTREE_DIFF_CHANGE_REMOVED, name,
+                                  OSTREE_OBJECT_TYPE_FILE, csum_v,
+                                  0, NULL, error))
+            return FALSE;
+        }
+    }
+
+  /* Directories in a: the same, recursing where the contents differ */
+  j = 0;
+  for (guint i = 0; i < n_a_dirs; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) tree_csum_v = NULL;
+      g_autoptr(GVariant) meta_csum_v = NULL;
+      g_variant_get_child (a_dirs, i, "(&s@ay@ay)", &name, &tree_csum_v, &meta_csum_v);
+
+      int c = 1;
+      g_autoptr(GVariant) b_tree_csum_v = NULL;
+      g_autoptr(GVariant) b_meta_csum_v = NULL;
+      for (; j < n_b_dirs; j++)
+        {
+          const char *b_name;
+          g_clear_pointer (&b_tree_csum_v, g_variant_unref);
+          g_clear_pointer (&b_meta_csum_v, g_variant_unref);
+          g_variant_get_child (b_dirs, j, "(&s@ay@ay)", &b_name, &b_tree_csum_v, &b_meta_csum_v);
+          c = strcmp (name, b_name);
+          if (c <= 0)
+            break;
+        }
+
+      if (c == 0)
+        {
+          if (!g_variant_equal (meta_csum_v, b_meta_csum_v) &&
+              !diff_commits_emit (data, OSTREE_DIFF_CHANGE_MODIFIED, name,
+                                  OSTREE_OBJECT_TYPE_DIR_META, meta_csum_v,
+                                  OSTREE_OBJECT_TYPE_DIR_META, b_meta_csum_v, error))
+            return FALSE;
+
+          if (!g_variant_equal (tree_csum_v, b_tree_csum_v))
+            {
+              const gsize dirlen = data->path->len;
+              g_string_append_c (data->path, '/');
+              g_string_append (data->path, name);
+              const gboolean ret = diff_commits_trees (data, tree_csum_v, b_tree_csum_v, error);
+              g_string_truncate (data->path, dirlen);
+              if (!ret)
+                return FALSE;
+            }
+        }
+      else if ((b_index = dirtree_entries_find (b_files, name)) >= 0)
+        {
+          g_autoptr(GVariant) b_csum_v = NULL;
+          g_variant_get_child (b_files, b_index, "(&s@ay)", NULL, &b_csum_v);
+          if (!diff_commits_emit (data, OSTREE_DIFF_CHANGE_MODIFIED, name,
+                                  OSTREE_OBJECT_TYPE_DIR_META, meta_csum_v,
+                                  OSTREE_OBJECT_TYPE_FILE, b_csum_v, error))
+            return FALSE;
+        }
+      else
+        {
+          if (!diff_commits_emit (data, OSTREE_DIFF_CHANGE_REMOVED, name,
+                                  OSTREE_OBJECT_TYPE_DIR_META, meta_csum_v,
+                                  0, NULL, error))
+            return FALSE;
+        }
+    }
+
+  /* Then whatever only b has */
+  for (guint i = 0; i < n_b_files; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) csum_v = NULL;
+      g_variant_get_child (b_files, i, "(&s@ay)", &name, &csum_v);
+      if (dirtree_entries_find (a_files, name) >= 0 || dirtree_entries_find (a_dirs, name) >= 0)
+        continue;
+      if (!diff_commits_emit (data, OSTREE_DIFF_CHANGE_ADDED, name,
+                              0, NULL, OSTREE_OBJECT_TYPE_FILE, csum_v, error))
+        return FALSE;
+    }
+
+  for (guint i = 0; i < n_b_dirs; i++)
+    {
+      const char *name;
+      g_autoptr(GVariant) tree_csum_v = NULL;
+      g_autoptr(GVariant) meta_csum_v = NULL;
+      g_variant_get_child (b_dirs, i, "(&s@ay@ay)", &name, &tree_csum_v, &meta_csum_v);
+      if (dirtree_entries_find (a_dirs, name) >= 0 || dirtree_entries_find (a_files, name) >= 0)
+        continue;
+      if (!diff_commits_emit (data, OSTREE_DIFF_CHANGE_ADDED, name,
+                              0, NULL, OSTREE_OBJECT_TYPE_DIR_META, meta_csum_v, error))
+        return FALSE;
+
+      const gsize dirlen = data->path->len;
+      g_string_append_c (data->path, '/');
+      g_string_append (data->path, name);
+      const gboolean ret = diff_commits_add_tree (data, tree_csum_v, error);
+      g_string_truncate (data->path, dirlen);
+      if (!ret)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * ostree_diff_commits:
+ * @repo: Repo
+ * @src_commit: (nullable): Checksum of the source commit, or %NULL to diff from an empty tree
+ * @target_commit: Checksum of the target commit
+ * @func: (scope call): Called for each change
+ * @user_data: Data for @func
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Compute the difference between two commits, calling @func with each
+ * changed path.  This gives the same changes as
+ * ostree_diff_dirs_with_options() would for the two commit roots, in the
+ * same order: a directory whose metadata changed is reported as modified,
+ * and a path whose type changed is reported as modified without
+ * descending into it.
+ *
+ * Rather than going through #GFile, this works directly on the dirtree
+ * objects, and skips any subdirectory whose contents checksum is the same
+ * on both sides, so its cost depends on the size of the change rather
+ * than of the trees.
+ *
+ * Since: 2017.10
+ */
+gboolean
+ostree_diff_commits (OstreeRepo            *repo,
+                     const char            *src_commit,
+                     const char            *target_commit,
+                     OstreeDiffCommitsFunc  func,
+                     gpointer               user_data,
+                     GCancellable          *cancellable,
+                     GError               **error)
+{
+  g_autoptr(GVariant) src_commit_v = NULL;
+  g_autoptr(GVariant) target_commit_v = NULL;
+  g_autoptr(GVariant) src_tree_csum_v = NULL;
+  g_autoptr(GVariant) target_tree_csum_v = NULL;
+  g_autoptr(GString) path = g_string_new ("");
+  DiffCommitsData data = { repo, func, user_data, path, cancellable };
+
+  g_return_val_if_fail (target_commit != NULL, FALSE);
+  g_return_val_if_fail (func != NULL, FALSE);
+
+  if (!ostree_repo_load_commit (repo, target_commit, &target_commit_v, NULL, error))
+    return FALSE;
+  target_tree_csum_v = g_variant_get_child_value (target_commit_v, 6);
+
+  if (src_commit == NULL)
+    return diff_commits_add_tree (&data, target_tree_csum_v, error);
+
+  if (!ostree_repo_load_commit (repo, src_commit, &src_commit_v, NULL, error))
+    return FALSE;
+  src_tree_csum_v = g_variant_get_child_value (src_commit_v, 6);
+
+  /* Fast path for identical trees */
+  if (g_variant_equal (src_tree_csum_v, target_tree_csum_v))
+    return TRUE;
+
+  return diff_commits_trees (&data, src_tree_csum_v, target_tree_csum_v, error);
+}
+
 static void
 print_diff_item (char        prefix,
                  GFile      *base,
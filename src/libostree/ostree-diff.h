@@ -107,6 +107,57 @@ gboolean ostree_diff_dirs_with_options (OstreeDiffFlags       flags,
                                         GCancellable          *cancellable,
                                         GError                **error);
 
+/**
+ * OstreeDiffChangeType:
+ * @OSTREE_DIFF_CHANGE_MODIFIED: The path exists on both sides, with different content or metadata, or with a different type
+ * @OSTREE_DIFF_CHANGE_REMOVED: The path only exists on the source side
+ * @OSTREE_DIFF_CHANGE_ADDED: The path only exists on the target side
+ *
+ * Since: 2017.10
+ */
+typedef enum {
+  OSTREE_DIFF_CHANGE_MODIFIED,
+  OSTREE_DIFF_CHANGE_REMOVED,
+  OSTREE_DIFF_CHANGE_ADDED,
+} OstreeDiffChangeType;
+
+/**
+ * OstreeDiffCommitsFunc:
+ * @change: What changed
+ * @path: Absolute path within the commits, e.g. `/usr/bin/bash`
+ * @src_objtype: %OSTREE_OBJECT_TYPE_FILE or %OSTREE_OBJECT_TYPE_DIR_META, saying what @src_checksum is; unset if added
+ * @src_checksum: (nullable): Checksum in the source commit, or %NULL if added
+ * @target_objtype: %OSTREE_OBJECT_TYPE_FILE or %OSTREE_OBJECT_TYPE_DIR_META, saying what @target_checksum is; unset if removed
+ * @target_checksum: (nullable): Checksum in the target commit, or %NULL if removed
+ * @user_data: User data
+ * @error: Error
+ *
+ * Called by ostree_diff_commits() for each changed path.  A path which
+ * changed type is reported as modified, with different object types on
+ * each side.  The strings are only valid for the duration of the call.
+ *
+ * Returns: %TRUE to continue, %FALSE (with @error set) to stop
+ *
+ * Since: 2017.10
+ */
+typedef gboolean (*OstreeDiffCommitsFunc) (OstreeDiffChangeType  change,
+                                           const char           *path,
+                                           OstreeObjectType      src_objtype,
+                                           const char           *src_checksum,
+                                           OstreeObjectType      target_objtype,
+                                           const char           *target_checksum,
+                                           gpointer              user_data,
+                                           GError              **error);
+
+_OSTREE_PUBLIC
+gboolean ostree_diff_commits (OstreeRepo            *repo,
+                              const char            *src_commit,
+                              const char            *target_commit,
+                              OstreeDiffCommitsFunc  func,
+                              gpointer               user_data,
+                              GCancellable          *cancellable,
+                              GError               **error);
+
 _OSTREE_PUBLIC
 void ostree_diff_print (GFile          *a,
                         GFile          *b,
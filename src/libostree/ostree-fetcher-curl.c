@@ -83,6 +83,7 @@ struct OstreeFetcher
   int curl_running;
   GHashTable *outstanding_requests; /* Set<GTask> */
   GHashTable *sockets; /* Set<SockInfo> */
+  guint max_connections;
 
   guint64 bytes_transferred;
 };
@@ -101,6 +102,8 @@ struct FetcherRequest {
   GError *caught_write_error;
   GLnxTmpfile tmpf;
   GString *output_buf;
+  const OstreeFetcherSinkFuncs *sink_funcs;
+  gpointer sink; /* Nullable */
 
   CURL *easy;
   char error[CURL_ERROR_SIZE];
@@ -223,10 +226,8 @@ _ostree_fetcher_init (OstreeFetcher *self)
   curl_multi_setopt (self->multi, CURLMOPT_SOCKETDATA, self);
   curl_multi_setopt (self->multi, CURLMOPT_TIMERFUNCTION, update_timeout_cb);
   curl_multi_setopt (self->multi, CURLMOPT_TIMERDATA, self);
-#if CURL_AT_LEAST_VERSION(7, 30, 0)
-  /* Let's do something reasonable here. */
-  curl_multi_setopt (self->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, 8);
-#endif
+  /* Let's do something reasonable here; the puller may raise this. */
+  _ostree_fetcher_set_max_connections (self, _OSTREE_MAX_OUTSTANDING_FETCHER_REQUESTS);
   /* This version mirrors the version at which we're enabling HTTP2 support.
    * See also https://github.com/curl/curl/blob/curl-7_53_0/docs/examples/http2-download.c
    */
@@ -406,6 +407,13 @@ check_multi_info (OstreeFetcher *fetcher)
       curl_multi_remove_handle (fetcher->multi, easy);
       if (continued_request)
         {
+          /* Drop anything we received from the previous mirror, such as
+           * an error page.
+           */
+          glnx_tmpfile_clear (&req->tmpf);
+          req->current_size = 0;
+          if (req->sink)
+            req->sink_funcs->reset (req->sink);
           req->idx++;
           initiate_next_curl_request (req, task);
         }
@@ -583,6 +591,8 @@ write_cb (void *ptr, size_t size, size_t nmemb, void *data)
           glnx_set_error_from_errno (&req->caught_write_error);
           return -1;
         }
+      if (req->sink)
+        req->sink_funcs->update (req->sink, ptr, realsize);
     }
 
   req->current_size += realsize;
@@ -616,6 +626,8 @@ request_unref (FetcherRequest *req)
   glnx_tmpfile_clear (&req->tmpf);
   if (req->output_buf)
     g_string_free (req->output_buf, TRUE);
+  if (req->sink)
+    req->sink_funcs->free (req->sink);
   curl_easy_cleanup (req->easy);
 
   g_free (req);
@@ -682,6 +694,19 @@ _ostree_fetcher_set_extra_headers (OstreeFetcher *self,
     }
 }
 
+/* The puller adjusts the number of requests it makes at once; make sure
+ * we can open a connection for each.
+ */
+void
+_ostree_fetcher_set_max_connections (OstreeFetcher *self,
+                                     guint          max_connections)
+{
+  self->max_connections = max_connections;
+#if CURL_AT_LEAST_VERSION(7, 30, 0)
+  curl_multi_setopt (self->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) max_connections);
+#endif
+}
+
 /* Re-bind all of the outstanding curl items to our new main context */
 static void
 adopt_steal_mainctx (OstreeFetcher *self,
@@ -796,6 +821,8 @@ _ostree_fetcher_request_async (OstreeFetcher         *self,
                                const char            *filename,
                                OstreeFetcherRequestFlags flags,
                                gboolean               is_membuf,
+                               const OstreeFetcherSinkFuncs *sink_funcs,
+                               gpointer               sink,
                                guint64                max_size,
                                int                    priority,
                                GCancellable          *cancellable,
@@ -829,6 +856,8 @@ _ostree_fetcher_request_async (OstreeFetcher         *self,
   req->max_size = max_size;
   req->flags = flags;
   req->is_membuf = is_membuf;
+  req->sink_funcs = sink_funcs;
+  req->sink = sink;
   /* We'll allocate the tmpfile on demand, so we handle
    * file I/O errors just in the write func.
    */
@@ -849,7 +878,7 @@ _ostree_fetcher_request_async (OstreeFetcher         *self,
    * but we do want to abort if we're asked to do obviously too many requests.
    */
   g_assert_cmpint (g_hash_table_size (self->outstanding_requests), <,
-                   _OSTREE_MAX_OUTSTANDING_FETCHER_REQUESTS * 2);
+                   self->max_connections * 2);
 }
 
 void
@@ -863,7 +892,7 @@ _ostree_fetcher_request_to_tmpfile (OstreeFetcher         *self,
                                     GAsyncReadyCallback    callback,
                                     gpointer               user_data)
 {
-  _ostree_fetcher_request_async (self, mirrorlist, filename, flags, FALSE,
+  _ostree_fetcher_request_async (self, mirrorlist, filename, flags, FALSE, NULL, NULL,
                                  max_size, priority, cancellable,
                                  callback, user_data);
 }
@@ -895,6 +924,43 @@ _ostree_fetcher_request_to_tmpfile_finish (OstreeFetcher *self,
   return TRUE;
 }
 
+void
+_ostree_fetcher_request_to_tmpfile_with_sink (OstreeFetcher         *self,
+                                              GPtrArray             *mirrorlist,
+                                              const char            *filename,
+                                              OstreeFetcherRequestFlags flags,
+                                              guint64                max_size,
+                                              int                    priority,
+                                              const OstreeFetcherSinkFuncs *sink_funcs,
+                                              gpointer               sink,
+                                              GCancellable          *cancellable,
+                                              GAsyncReadyCallback    callback,
+                                              gpointer               user_data)
+{
+  _ostree_fetcher_request_async (self, mirrorlist, filename, flags, FALSE,
+                                 sink_funcs, sink,
+                                 max_size, priority, cancellable,
+                                 callback, user_data);
+}
+
+gboolean
+_ostree_fetcher_request_to_tmpfile_with_sink_finish (OstreeFetcher *self,
+                                                     GAsyncResult  *result,
+                                                     char         **out_filename,
+                                                     gpointer      *out_sink,
+                                                     GError       **error)
+{
+  if (!_ostree_fetcher_request_to_tmpfile_finish (self, result, out_filename, error))
+    return FALSE;
+
+  FetcherRequest *req = g_task_get_task_data ((GTask*)result);
+  /* We always write the complete response to a new tmpfile */
+  if (out_sink)
+    *out_sink = g_steal_pointer (&req->sink);
+
+  return TRUE;
+}
+
 void
 _ostree_fetcher_request_to_membuf (OstreeFetcher         *self,
                                    GPtrArray             *mirrorlist,
@@ -906,7 +972,7 @@ _ostree_fetcher_request_to_membuf (OstreeFetcher         *self,
                                    GAsyncReadyCallback    callback,
                                    gpointer               user_data)
 {
-  _ostree_fetcher_request_async (self, mirrorlist, filename, flags, TRUE,
+  _ostree_fetcher_request_async (self, mirrorlist, filename, flags, TRUE, NULL, NULL,
                                  max_size, priority, cancellable,
                                  callback, user_data);
 }
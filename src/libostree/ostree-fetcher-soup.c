@@ -96,6 +96,11 @@ typedef struct {
   GInputStream *request_body;
   char *out_tmpfile;
   GOutputStream *out_stream;
+  /* Fed the whole response, including any part we resumed from; see
+   * _ostree_fetcher_request_to_tmpfile_with_sink().
+   */
+  const OstreeFetcherSinkFuncs *sink_funcs;
+  gpointer sink;
 
   guint64 max_size;
   guint64 current_size;
@@ -198,6 +203,44 @@ pending_uri_ref (OstreeFetcherPendingURI *pending)
   return pending;
 }
 
+static void
+pending_uri_clear_sink (OstreeFetcherPendingURI *pending)
+{
+  if (pending->sink)
+    pending->sink_funcs->free (g_steal_pointer (&pending->sink));
+}
+
+/* When resuming a download, the sink hasn't seen the data we already have;
+ * feed it what's in the tmpfile so it still covers the whole response.
+ */
+static gboolean
+pending_uri_feed_sink_from_tmpfile (OstreeFetcherPendingURI *pending,
+                                    GError                 **error)
+{
+  glnx_fd_close int fd = -1;
+  guint8 buf[8192];
+
+  if (!pending->sink)
+    return TRUE;
+
+  if (!glnx_openat_rdonly (pending->thread_closure->tmpdir_dfd,
+                           pending->out_tmpfile, FALSE, &fd, error))
+    return FALSE;
+
+  pending->sink_funcs->reset (pending->sink);
+  while (TRUE)
+    {
+      ssize_t n = TEMP_FAILURE_RETRY (read (fd, buf, sizeof (buf)));
+      if (n < 0)
+        return glnx_throw_errno_prefix (error, "read");
+      else if (n == 0)
+        break;
+      pending->sink_funcs->update (pending->sink, buf, n);
+    }
+
+  return TRUE;
+}
+
 static void
 pending_uri_unref (OstreeFetcherPendingURI *pending)
 {
@@ -212,6 +255,7 @@ pending_uri_unref (OstreeFetcherPendingURI *pending)
   g_clear_object (&pending->request_body);
   g_free (pending->out_tmpfile);
   g_clear_object (&pending->out_stream);
+  pending_uri_clear_sink (pending);
   g_free (pending);
 }
 
@@ -342,6 +386,27 @@ session_thread_set_headers_cb (ThreadClosure *thread_closure,
   thread_closure->extra_headers = g_variant_ref (headers);
 }
 
+static void
+session_thread_set_max_conns_cb (ThreadClosure *thread_closure,
+                                 gpointer data)
+{
+  gint max_conns = GPOINTER_TO_INT (data);
+  gint cur_max_conns_per_host;
+  gint cur_max_conns;
+
+  g_object_get (thread_closure->session,
+                "max-conns-per-host", &cur_max_conns_per_host,
+                "max-conns", &cur_max_conns,
+                NULL);
+  if (max_conns > cur_max_conns_per_host)
+    {
+      g_object_set (thread_closure->session, "max-conns-per-host", max_conns, NULL);
+      thread_closure->max_outstanding = 3 * max_conns;
+    }
+  if (max_conns > cur_max_conns)
+    g_object_set (thread_closure->session, "max-conns", max_conns, NULL);
+}
+
 #ifdef HAVE_LIBSOUP_CLIENT_CERTS
 static void
 session_thread_set_tls_interaction_cb (ThreadClosure *thread_closure,
@@ -840,6 +905,19 @@ _ostree_fetcher_set_extra_headers (OstreeFetcher *self,
                            (GDestroyNotify) g_variant_unref);
 }
 
+/* The puller adjusts the number of requests it makes at once; make sure
+ * we can open a connection for each.
+ */
+void
+_ostree_fetcher_set_max_connections (OstreeFetcher *self,
+                                     guint          max_connections)
+{
+  session_thread_idle_add (self->thread_closure,
+                           session_thread_set_max_conns_cb,
+                           GINT_TO_POINTER ((gint) max_connections),
+                           NULL);
+}
+
 static gboolean
 finish_stream (OstreeFetcherPendingURI *pending,
                GCancellable            *cancellable,
@@ -1014,6 +1092,10 @@ on_stream_read (GObject        *object,
       
       pending->current_size += bytes_read;
 
+      if (pending->sink)
+        pending->sink_funcs->update (pending->sink,
+                                     g_bytes_get_data (bytes, NULL), bytes_read);
+
       /* We do this instead of _write_bytes_async() as that's not
        * guaranteed to do a complete write.
        */
@@ -1069,6 +1151,8 @@ on_request_sent (GObject        *object,
           // We already have the whole file, so just use it.
           pending->state = OSTREE_FETCHER_STATE_COMPLETE;
           (void) g_input_stream_close (pending->request_body, NULL, NULL);
+          if (!pending_uri_feed_sink_from_tmpfile (pending, &local_error))
+            goto out;
           g_task_return_pointer (task,
                                  g_strdup (pending->out_tmpfile),
                                  (GDestroyNotify) g_free);
@@ -1152,7 +1236,12 @@ on_request_sent (GObject        *object,
        * ignored our range request, we need to truncate.
        */
       if (msg && msg->status_code == SOUP_STATUS_PARTIAL_CONTENT)
-        oflags |= O_APPEND;
+        {
+          oflags |= O_APPEND;
+          /* We won't see the start of the data over the wire */
+          if (!pending_uri_feed_sink_from_tmpfile (pending, &local_error))
+            goto out;
+        }
       else
         oflags |= O_TRUNC;
 
@@ -1200,6 +1289,8 @@ _ostree_fetcher_request_async (OstreeFetcher         *self,
                                const char            *filename,
                                OstreeFetcherRequestFlags flags,
                                gboolean               is_membuf,
+                               const OstreeFetcherSinkFuncs *sink_funcs,
+                               gpointer               sink,
                                guint64                max_size,
                                int                    priority,
                                GCancellable          *cancellable,
@@ -1222,6 +1313,8 @@ _ostree_fetcher_request_async (OstreeFetcher         *self,
   pending->flags = flags;
   pending->max_size = max_size;
   pending->is_membuf = is_membuf;
+  pending->sink_funcs = sink_funcs;
+  pending->sink = sink;
 
   task = g_task_new (self, cancellable, callback, user_data);
   g_task_set_source_tag (task, _ostree_fetcher_request_async);
@@ -1247,7 +1340,7 @@ _ostree_fetcher_request_to_tmpfile (OstreeFetcher         *self,
                                     GAsyncReadyCallback    callback,
                                     gpointer               user_data)
 {
-  _ostree_fetcher_request_async (self, mirrorlist, filename, flags, FALSE,
+  _ostree_fetcher_request_async (self, mirrorlist, filename, flags, FALSE, NULL, NULL,
                                  max_size, priority, cancellable,
                                  callback, user_data);
 }
@@ -1279,6 +1372,42 @@ _ostree_fetcher_request_to_tmpfile_finish (OstreeFetcher *self,
   return TRUE;
 }
 
+void
+_ostree_fetcher_request_to_tmpfile_with_sink (OstreeFetcher         *self,
+                                              GPtrArray             *mirrorlist,
+                                              const char            *filename,
+                                              OstreeFetcherRequestFlags flags,
+                                              guint64                max_size,
+                                              int                    priority,
+                                              const OstreeFetcherSinkFuncs *sink_funcs,
+                                              gpointer               sink,
+                                              GCancellable          *cancellable,
+                                              GAsyncReadyCallback    callback,
+                                              gpointer               user_data)
+{
+  _ostree_fetcher_request_async (self, mirrorlist, filename, flags, FALSE,
+                                 sink_funcs, sink,
+                                 max_size, priority, cancellable,
+                                 callback, user_data);
+}
+
+gboolean
+_ostree_fetcher_request_to_tmpfile_with_sink_finish (OstreeFetcher *self,
+                                                     GAsyncResult  *result,
+                                                     char         **out_filename,
+                                                     gpointer      *out_sink,
+                                                     GError       **error)
+{
+  if (!_ostree_fetcher_request_to_tmpfile_finish (self, result, out_filename, error))
+    return FALSE;
+
+  OstreeFetcherPendingURI *pending = g_task_get_task_data ((GTask*)result);
+  if (out_sink)
+    *out_sink = g_steal_pointer (&pending->sink);
+
+  return TRUE;
+}
+
 void
 _ostree_fetcher_request_to_membuf (OstreeFetcher         *self,
                                    GPtrArray             *mirrorlist,
@@ -1290,7 +1419,7 @@ _ostree_fetcher_request_to_membuf (OstreeFetcher         *self,
                                    GAsyncReadyCallback    callback,
                                    gpointer               user_data)
 {
-  _ostree_fetcher_request_async (self, mirrorlist, filename, flags, TRUE,
+  _ostree_fetcher_request_async (self, mirrorlist, filename, flags, TRUE, NULL, NULL,
                                  max_size, priority, cancellable,
                                  callback, user_data);
 }
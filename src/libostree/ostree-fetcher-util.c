@@ -124,6 +124,43 @@ _ostree_fetcher_request_uri_to_membuf (OstreeFetcher  *fetcher,
                                                      cancellable, error);
 }
 
+static const OstreeFetcherSinkFuncs content_checksum_sink_funcs = {
+  (void (*)(gpointer, const guint8 *, gsize)) _ostree_content_checksum_update,
+  (void (*)(gpointer)) _ostree_content_checksum_reset,
+  (GDestroyNotify) _ostree_content_checksum_free,
+};
+
+void
+_ostree_fetcher_request_content_to_tmpfile (OstreeFetcher         *self,
+                                            GPtrArray             *mirrorlist,
+                                            const char            *filename,
+                                            OstreeRepoMode         content_mode,
+                                            OstreeFetcherRequestFlags flags,
+                                            guint64                max_size,
+                                            int                    priority,
+                                            GCancellable          *cancellable,
+                                            GAsyncReadyCallback    callback,
+                                            gpointer               user_data)
+{
+  _ostree_fetcher_request_to_tmpfile_with_sink (self, mirrorlist, filename, flags,
+                                                max_size, priority,
+                                                &content_checksum_sink_funcs,
+                                                _ostree_content_checksum_new (content_mode),
+                                                cancellable, callback, user_data);
+}
+
+gboolean
+_ostree_fetcher_request_content_to_tmpfile_finish (OstreeFetcher          *self,
+                                                   GAsyncResult           *result,
+                                                   char                  **out_filename,
+                                                   OstreeContentChecksum **out_checksum,
+                                                   GError                **error)
+{
+  return _ostree_fetcher_request_to_tmpfile_with_sink_finish (self, result, out_filename,
+                                                              (gpointer*)out_checksum,
+                                                              error);
+}
+
 #define OSTREE_HTTP_FAILURE_ID SD_ID128_MAKE(f0,2b,ce,89,a5,4e,4e,fa,b3,a9,4a,79,7d,26,20,4a)
 
 void
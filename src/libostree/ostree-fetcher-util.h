@@ -23,6 +23,7 @@
 #ifndef __GI_SCANNER__
 
 #include "ostree-fetcher.h"
+#include "ostree-core-private.h"
 
 G_BEGIN_DECLS
 
@@ -43,6 +44,27 @@ gboolean _ostree_fetcher_request_uri_to_membuf (OstreeFetcher *fetcher,
                                                 GCancellable   *cancellable,
                                                 GError         **error);
 
+/* Like _ostree_fetcher_request_to_tmpfile(), but also checksums the data as
+ * it arrives as a content object serialized for a repository of mode
+ * @content_mode.  The checksum context is returned by the finish function.
+ */
+void _ostree_fetcher_request_content_to_tmpfile (OstreeFetcher         *self,
+                                                 GPtrArray             *mirrorlist,
+                                                 const char            *filename,
+                                                 OstreeRepoMode         content_mode,
+                                                 OstreeFetcherRequestFlags flags,
+                                                 guint64                max_size,
+                                                 int                    priority,
+                                                 GCancellable          *cancellable,
+                                                 GAsyncReadyCallback    callback,
+                                                 gpointer               user_data);
+
+gboolean _ostree_fetcher_request_content_to_tmpfile_finish (OstreeFetcher          *self,
+                                                            GAsyncResult           *result,
+                                                            char                  **out_filename,
+                                                            OstreeContentChecksum **out_checksum,
+                                                            GError                **error);
+
 void _ostree_fetcher_journal_failure (const char *remote_name,
                                       const char *url,
                                       const char *msg);
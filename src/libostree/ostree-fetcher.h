@@ -111,6 +111,9 @@ void _ostree_fetcher_set_tls_database (OstreeFetcher *self,
 void _ostree_fetcher_set_extra_headers (OstreeFetcher *self,
                                         GVariant      *extra_headers);
 
+void _ostree_fetcher_set_max_connections (OstreeFetcher *self,
+                                          guint          max_connections);
+
 guint64 _ostree_fetcher_bytes_transferred (OstreeFetcher       *self);
 
 void _ostree_fetcher_request_to_tmpfile (OstreeFetcher         *self,
@@ -128,6 +131,40 @@ gboolean _ostree_fetcher_request_to_tmpfile_finish (OstreeFetcher *self,
                                                     char         **out_filename,
                                                     GError       **error);
 
+/* Something which consumes the body of a response as it is written to the
+ * tmpfile, such as an incremental checksum.  @reset is called when the
+ * fetcher starts over, e.g. with the next mirror.  @update may be called on
+ * the main loop of the caller, so it shouldn't do anything expensive.
+ */
+typedef struct {
+  void (*update) (gpointer sink, const guint8 *buf, gsize len);
+  void (*reset) (gpointer sink);
+  GDestroyNotify free;
+} OstreeFetcherSinkFuncs;
+
+/* Like _ostree_fetcher_request_to_tmpfile(), but also feeds the data to
+ * @sink, which the request takes ownership of.  The sink is returned by the
+ * finish function.  If a previous partial download is resumed, the data
+ * already in the tmpfile is fed to the sink first.
+ */
+void _ostree_fetcher_request_to_tmpfile_with_sink (OstreeFetcher         *self,
+                                                   GPtrArray             *mirrorlist,
+                                                   const char            *filename,
+                                                   OstreeFetcherRequestFlags flags,
+                                                   guint64                max_size,
+                                                   int                    priority,
+                                                   const OstreeFetcherSinkFuncs *sink_funcs,
+                                                   gpointer               sink,
+                                                   GCancellable          *cancellable,
+                                                   GAsyncReadyCallback    callback,
+                                                   gpointer               user_data);
+
+gboolean _ostree_fetcher_request_to_tmpfile_with_sink_finish (OstreeFetcher *self,
+                                                              GAsyncResult  *result,
+                                                              char         **out_filename,
+                                                              gpointer      *out_sink,
+                                                              GError       **error);
+
 void _ostree_fetcher_request_to_membuf (OstreeFetcher         *self,
                                         GPtrArray             *mirrorlist,
                                         const char            *filename,
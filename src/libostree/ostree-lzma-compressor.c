@@ -36,6 +36,12 @@ enum {
  *
  * An implementation of #GConverter that compresses data using
  * LZMA.
+ *
+ * The params dictionary may contain "preset" (u), the xz preset level
+ * (default 8), and "threads" (u), the number of encoder threads.  If
+ * "threads" is given, the input is split into independently compressed
+ * blocks of "block-size" (t) bytes; the output then depends on the block
+ * size but not on the number of threads.
  */
 
 static void _ostree_lzma_compressor_iface_init          (GConverterIface *iface);
@@ -81,7 +87,7 @@ _ostree_lzma_compressor_set_property (GObject      *object,
   switch (prop_id)
     {
     case PROP_PARAMS:
-      self->params = g_value_get_variant (value);
+      self->params = g_value_dup_variant (value);
       break;
 
     default:
@@ -158,6 +164,77 @@ _ostree_lzma_compressor_reset (GConverter *converter)
     }
 }
 
+/* Smaller blocks give more parallelism, at the cost of compression ratio */
+#define OSTREE_LZMA_MT_DEFAULT_BLOCK_SIZE (8 * 1024 * 1024)
+
+static guint32
+lzma_compressor_get_preset (GVariant *params)
+{
+  guint32 preset = 8;
+
+  if (params)
+    (void) g_variant_lookup (params, "preset", "u", &preset);
+  return preset;
+}
+
+#if LZMA_VERSION >= 50020002
+/* Fill in @mt and return %TRUE if @params asks for the multithreaded encoder */
+static gboolean
+lzma_compressor_get_mt_options (GVariant *params,
+                                lzma_mt  *mt)
+{
+  guint32 threads = 0;
+  guint64 block_size = OSTREE_LZMA_MT_DEFAULT_BLOCK_SIZE;
+
+  if (params)
+    {
+      (void) g_variant_lookup (params, "threads", "u", &threads);
+      (void) g_variant_lookup (params, "block-size", "t", &block_size);
+    }
+  if (threads == 0)
+    return FALSE;
+
+  memset (mt, 0, sizeof (*mt));
+  mt->threads = threads;
+  mt->block_size = block_size;
+  mt->preset = lzma_compressor_get_preset (params);
+  mt->check = LZMA_CHECK_CRC64;
+  return TRUE;
+}
+#endif
+
+static lzma_ret
+_ostree_lzma_compressor_init_encoder (OstreeLzmaCompressor *self)
+{
+#if LZMA_VERSION >= 50020002
+  lzma_mt mt;
+  if (lzma_compressor_get_mt_options (self->params, &mt))
+    return lzma_stream_encoder_mt (&self->lstream, &mt);
+#endif
+
+  return lzma_easy_encoder (&self->lstream, lzma_compressor_get_preset (self->params),
+                            LZMA_CHECK_CRC64);
+}
+
+/* Returns an estimate of the memory an encoder with @params will use, or 0
+ * if it isn't known.
+ */
+guint64
+_ostree_lzma_compressor_memusage (GVariant *params)
+{
+  guint64 usage;
+
+#if LZMA_VERSION >= 50020002
+  lzma_mt mt;
+  if (lzma_compressor_get_mt_options (params, &mt))
+    usage = lzma_stream_encoder_mt_memusage (&mt);
+  else
+#endif
+    usage = lzma_easy_encoder_memusage (lzma_compressor_get_preset (params));
+
+  return usage == UINT64_MAX ? 0 : usage;
+}
+
 static GConverterResult
 _ostree_lzma_compressor_convert (GConverter *converter,
 				 const void *inbuf,
@@ -182,7 +259,7 @@ _ostree_lzma_compressor_convert (GConverter *converter,
 
   if (!self->initialized)
     {
-      res = lzma_easy_encoder (&self->lstream, 8, LZMA_CHECK_CRC64);
+      res = _ostree_lzma_compressor_init_encoder (self);
       if (res != LZMA_OK)
         goto out;
       self->initialized = TRUE;
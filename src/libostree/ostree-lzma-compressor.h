@@ -41,4 +41,6 @@ GType            _ostree_lzma_compressor_get_type (void) G_GNUC_CONST;
 
 OstreeLzmaCompressor *_ostree_lzma_compressor_new (GVariant *params);
 
+guint64 _ostree_lzma_compressor_memusage (GVariant *params);
+
 G_END_DECLS
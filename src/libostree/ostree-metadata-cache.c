@@ -0,0 +1,237 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+
+#include "ostree-metadata-cache.h"
+
+typedef struct {
+  guint8 csum[OSTREE_SHA256_DIGEST_LEN];
+  OstreeObjectType objtype;
+  GVariant *variant;
+  gsize size;
+  GList link;  /* Position in the LRU list; data points back to the entry */
+} OstreeMetadataCacheEntry;
+
+struct OstreeMetadataCache {
+  GMutex lock;
+  /* (element-type OstreeMetadataCacheEntry) Used as a set; the entries
+   * are their own keys.
+   */
+  GHashTable *entries;
+  GQueue lru;  /* Most recently used at the head */
+  gsize max_size;
+  gsize size;
+
+  guint64 hits;
+  guint64 misses;
+  guint64 evictions;
+};
+
+static guint
+entry_hash (gconstpointer p)
+{
+  const OstreeMetadataCacheEntry *entry = p;
+  guint v;
+  /* Checksums are uniformly distributed already */
+  memcpy (&v, entry->csum, sizeof (v));
+  return v ^ entry->objtype;
+}
+
+static gboolean
+entry_equal (gconstpointer a,
+             gconstpointer b)
+{
+  const OstreeMetadataCacheEntry *entry_a = a;
+  const OstreeMetadataCacheEntry *entry_b = b;
+  return entry_a->objtype == entry_b->objtype &&
+    memcmp (entry_a->csum, entry_b->csum, OSTREE_SHA256_DIGEST_LEN) == 0;
+}
+
+static void
+entry_free (OstreeMetadataCacheEntry *entry)
+{
+  g_variant_unref (entry->variant);
+  g_free (entry);
+}
+
+static void
+init_key (OstreeMetadataCacheEntry *key,
+          OstreeObjectType          objtype,
+          const char               *checksum)
+{
+  ostree_checksum_inplace_to_bytes (checksum, key->csum);
+  key->objtype = objtype;
+}
+
+OstreeMetadataCache *
+_ostree_metadata_cache_new (gsize max_size)
+{
+  OstreeMetadataCache *cache = g_new0 (OstreeMetadataCache, 1);
+  g_mutex_init (&cache->lock);
+  cache->entries = g_hash_table_new_full (entry_hash, entry_equal,
+                                          NULL, (GDestroyNotify)entry_free);
+  g_queue_init (&cache->lru);
+  cache->max_size = max_size;
+  return cache;
+}
+
+void
+_ostree_metadata_cache_free (OstreeMetadataCache *cache)
+{
+  if (!cache)
+    return;
+  g_hash_table_unref (cache->entries);
+  g_mutex_clear (&cache->lock);
+  g_free (cache);
+}
+
+/* Called with the lock held */
+static void
+remove_entry (OstreeMetadataCache      *cache,
+              OstreeMetadataCacheEntry *entry)
+{
+  g_queue_unlink (&cache->lru, &entry->link);
+  cache->size -= entry->size;
+  g_hash_table_remove (cache->entries, entry);
+}
+
+/* Called with the lock held */
+static void
+evict_to (OstreeMetadataCache *cache,
+          gsize                max_size)
+{
+  while (cache->size > max_size)
+    {
+      GList *tail = g_queue_peek_tail_link (&cache->lru);
+      g_assert (tail);
+      remove_entry (cache, tail->data);
+      cache->evictions++;
+    }
+}
+
+void
+_ostree_metadata_cache_set_max_size (OstreeMetadataCache *cache,
+                                     gsize                max_size)
+{
+  g_mutex_lock (&cache->lock);
+  cache->max_size = max_size;
+  evict_to (cache, max_size);
+  g_mutex_unlock (&cache->lock);
+}
+
+/* Returns: (transfer full) (nullable): The cached variant */
+GVariant *
+_ostree_metadata_cache_lookup (OstreeMetadataCache *cache,
+                               OstreeObjectType     objtype,
+                               const char          *checksum)
+{
+  OstreeMetadataCacheEntry key;
+  GVariant *ret = NULL;
+
+  init_key (&key, objtype, checksum);
+
+  g_mutex_lock (&cache->lock);
+  if (cache->max_size > 0)
+    {
+      OstreeMetadataCacheEntry *entry = g_hash_table_lookup (cache->entries, &key);
+      if (entry)
+        {
+          g_queue_unlink (&cache->lru, &entry->link);
+          g_queue_push_head_link (&cache->lru, &entry->link);
+          ret = g_variant_ref (entry->variant);
+          cache->hits++;
+        }
+      else
+        cache->misses++;
+    }
+  g_mutex_unlock (&cache->lock);
+
+  return ret;
+}
+
+void
+_ostree_metadata_cache_insert (OstreeMetadataCache *cache,
+                               OstreeObjectType     objtype,
+                               const char          *checksum,
+                               GVariant            *variant)
+{
+  OstreeMetadataCacheEntry *entry = g_new0 (OstreeMetadataCacheEntry, 1);
+  init_key (entry, objtype, checksum);
+  entry->size = g_variant_get_size (variant);
+
+  g_mutex_lock (&cache->lock);
+  /* Objects larger than the whole cache would just flush it */
+  if (entry->size <= cache->max_size)
+    {
+      OstreeMetadataCacheEntry *old = g_hash_table_lookup (cache->entries, entry);
+      if (old)
+        remove_entry (cache, old);
+
+      evict_to (cache, cache->max_size - entry->size);
+
+      entry->variant = g_variant_ref (variant);
+      entry->link.data = entry;
+      g_queue_push_head_link (&cache->lru, &entry->link);
+      cache->size += entry->size;
+      g_hash_table_add (cache->entries, g_steal_pointer (&entry));
+    }
+  g_mutex_unlock (&cache->lock);
+
+  g_free (entry);
+}
+
+void
+_ostree_metadata_cache_remove (OstreeMetadataCache *cache,
+                               OstreeObjectType     objtype,
+                               const char          *checksum)
+{
+  OstreeMetadataCacheEntry key;
+
+  init_key (&key, objtype, checksum);
+
+  g_mutex_lock (&cache->lock);
+  OstreeMetadataCacheEntry *entry = g_hash_table_lookup (cache->entries, &key);
+  if (entry)
+    remove_entry (cache, entry);
+  g_mutex_unlock (&cache->lock);
+}
+
+void
+_ostree_metadata_cache_get_stats (OstreeMetadataCache *cache,
+                                  guint64             *out_hits,
+                                  guint64             *out_misses,
+                                  guint64             *out_evictions,
+                                  guint64             *out_size)
+{
+  g_mutex_lock (&cache->lock);
+  if (out_hits)
+    *out_hits = cache->hits;
+  if (out_misses)
+    *out_misses = cache->misses;
+  if (out_evictions)
+    *out_evictions = cache->evictions;
+  if (out_size)
+    *out_size = cache->size;
+  g_mutex_unlock (&cache->lock);
+}
@@ -0,0 +1,63 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#pragma once
+
+#include <gio/gio.h>
+#include "ostree-core.h"
+
+G_BEGIN_DECLS
+
+/* A thread-safe cache of parsed metadata objects, bounded by the total
+ * serialized size of the cached variants, evicting the least recently
+ * used entry first.  A cache with a maximum size of 0 is disabled; lookups
+ * always miss without being counted.
+ */
+typedef struct OstreeMetadataCache OstreeMetadataCache;
+
+OstreeMetadataCache *_ostree_metadata_cache_new (gsize max_size);
+
+void _ostree_metadata_cache_free (OstreeMetadataCache *cache);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(OstreeMetadataCache, _ostree_metadata_cache_free)
+
+void _ostree_metadata_cache_set_max_size (OstreeMetadataCache *cache,
+                                          gsize                max_size);
+
+GVariant *_ostree_metadata_cache_lookup (OstreeMetadataCache *cache,
+                                         OstreeObjectType     objtype,
+                                         const char          *checksum);
+
+void _ostree_metadata_cache_insert (OstreeMetadataCache *cache,
+                                    OstreeObjectType     objtype,
+                                    const char          *checksum,
+                                    GVariant            *variant);
+
+void _ostree_metadata_cache_remove (OstreeMetadataCache *cache,
+                                    OstreeObjectType     objtype,
+                                    const char          *checksum);
+
+void _ostree_metadata_cache_get_stats (OstreeMetadataCache *cache,
+                                       guint64             *out_hits,
+                                       guint64             *out_misses,
+                                       guint64             *out_evictions,
+                                       guint64             *out_size);
+
+G_END_DECLS
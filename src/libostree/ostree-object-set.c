@@ -0,0 +1,323 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "ostree-object-set.h"
+
+#define OBJECT_SET_MIN_SLOTS 64
+
+typedef struct {
+  guint8 csum[OSTREE_SHA256_DIGEST_LEN];
+  /* OstreeObjectType; 0 is not a valid type, and marks an empty slot */
+  guint8 objtype;
+} OstreeObjectSetEntry;
+
+struct OstreeObjectSet {
+  OstreeObjectSetEntry *entries;
+  gsize n_slots;   /* Always a power of two */
+  guint n_entries;
+};
+
+/* Checksums are uniformly distributed already, so just use a prefix */
+static inline gsize
+entry_hash (const guint8     *csum,
+            OstreeObjectType  objtype)
+{
+  guint64 v;
+  memcpy (&v, csum, sizeof (v));
+  return (gsize) (v ^ objtype);
+}
+
+static inline gboolean
+entry_equal (const OstreeObjectSetEntry *entry,
+             const guint8               *csum,
+             OstreeObjectType            objtype)
+{
+  return entry->objtype == objtype &&
+    memcmp (entry->csum, csum, OSTREE_SHA256_DIGEST_LEN) == 0;
+}
+
+/**
+ * ostree_object_set_new:
+ *
+ * Returns: (transfer full): A new empty object set
+ *
+ * Since: 2017.10
+ */
+OstreeObjectSet *
+ostree_object_set_new (void)
+{
+  OstreeObjectSet *set = g_new0 (OstreeObjectSet, 1);
+  set->n_slots = OBJECT_SET_MIN_SLOTS;
+  set->entries = g_new0 (OstreeObjectSetEntry, set->n_slots);
+  return set;
+}
+
+/**
+ * ostree_object_set_free:
+ * @set: (transfer full) (nullable): An object set
+ *
+ * Free @set.
+ *
+ * Since: 2017.10
+ */
+void
+ostree_object_set_free (OstreeObjectSet *set)
+{
+  if (!set)
+    return;
+  g_free (set->entries);
+  g_free (set);
+}
+
+/**
+ * ostree_object_set_size:
+ * @set: An object set
+ *
+ * Returns: The number of objects in @set
+ *
+ * Since: 2017.10
+ */
+guint
+ostree_object_set_size (OstreeObjectSet *set)
+{
+  return set->n_entries;
+}
+
+/* Returns the slot holding @csum/@objtype, or the empty slot where it
+ * would be inserted.
+ */
+static gsize
+lookup_slot (OstreeObjectSet  *set,
+             const guint8     *csum,
+             OstreeObjectType  objtype)
+{
+  const gsize mask = set->n_slots - 1;
+  gsize i = entry_hash (csum, objtype) & mask;
+
+  while (set->entries[i].objtype != 0 &&
+         !entry_equal (&set->entries[i], csum, objtype))
+    i = (i + 1) & mask;
+
+  return i;
+}
+
+static void
+grow (OstreeObjectSet *set)
+{
+  OstreeObjectSetEntry *old_entries = set->entries;
+  gsize old_n_slots = set->n_slots;
+
+  set->n_slots *= 2;
+  set->entries = g_new0 (OstreeObjectSetEntry, set->n_slots);
+
+  for (gsize i = 0; i < old_n_slots; i++)
+    {
+      OstreeObjectSetEntry *entry = &old_entries[i];
+      if (entry->objtype == 0)
+        continue;
+      set->entries[lookup_slot (set, entry->csum, entry->objtype)] = *entry;
+    }
+
+  g_free (old_entries);
+}
+
+/* Returns %TRUE if the object was newly added */
+gboolean
+_ostree_object_set_add (OstreeObjectSet   *set,
+                        const guint8      *csum,
+                        OstreeObjectType   objtype)
+{
+  g_return_val_if_fail (objtype != 0, FALSE);
+
+  /* Keep the load factor under 3/4 */
+  if ((set->n_entries + 1) * 4 > set->n_slots * 3)
+    grow (set);
+
+  gsize i = lookup_slot (set, csum, objtype);
+  if (set->entries[i].objtype != 0)
+    return FALSE;
+
+  memcpy (set->entries[i].csum, csum, OSTREE_SHA256_DIGEST_LEN);
+  set->entries[i].objtype = objtype;
+  set->n_entries++;
+  return TRUE;
+}
+
+/**
+ * ostree_object_set_add:
+ * @set: An object set
+ * @checksum: ASCII SHA256 checksum
+ * @objtype: Object type
+ *
+ * Returns: %TRUE if the object was newly added, %FALSE if it was already present
+ *
+ * Since: 2017.10
+ */
+gboolean
+ostree_object_set_add (OstreeObjectSet   *set,
+                       const char        *checksum,
+                       OstreeObjectType   objtype)
+{
+  guint8 csum[OSTREE_SHA256_DIGEST_LEN];
+  ostree_checksum_inplace_to_bytes (checksum, csum);
+  return _ostree_object_set_add (set, csum, objtype);
+}
+
+/* Returns %TRUE if the object was present */
+gboolean
+_ostree_object_set_remove (OstreeObjectSet   *set,
+                           const guint8      *csum,
+                           OstreeObjectType   objtype)
+{
+  const gsize mask = set->n_slots - 1;
+  gsize i = lookup_slot (set, csum, objtype);
+
+  if (set->entries[i].objtype == 0)
+    return FALSE;
+
+  /* Backward shift deletion; move any following entries in the probe
+   * sequence which would no longer be reachable into the hole.
+   */
+  gsize j = i;
+  while (TRUE)
+    {
+      j = (j + 1) & mask;
+      OstreeObjectSetEntry *entry = &set->entries[j];
+      if (entry->objtype == 0)
+        break;
+
+      gsize home = entry_hash (entry->csum, entry->objtype) & mask;
+      /* Can the entry at j stay where it is, given a hole at i? */
+      if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+        continue;
+
+      set->entries[i] = *entry;
+      i = j;
+    }
+
+  memset (&set->entries[i], 0, sizeof (OstreeObjectSetEntry));
+  set->n_entries--;
+  return TRUE;
+}
+
+/**
+ * ostree_object_set_remove:
+ * @set: An object set
+ * @checksum: ASCII SHA256 checksum
+ * @objtype: Object type
+ *
+ * Returns: %TRUE if the object was present
+ *
+ * Since: 2017.10
+ */
+gboolean
+ostree_object_set_remove (OstreeObjectSet   *set,
+                          const char        *checksum,
+                          OstreeObjectType   objtype)
+{
+  guint8 csum[OSTREE_SHA256_DIGEST_LEN];
+  ostree_checksum_inplace_to_bytes (checksum, csum);
+  return _ostree_object_set_remove (set, csum, objtype);
+}
+
+gboolean
+_ostree_object_set_contains (OstreeObjectSet   *set,
+                             const guint8      *csum,
+                             OstreeObjectType   objtype)
+{
+  return set->entries[lookup_slot (set, csum, objtype)].objtype != 0;
+}
+
+/**
+ * ostree_object_set_contains:
+ * @set: An object set
+ * @checksum: ASCII SHA256 checksum
+ * @objtype: Object type
+ *
+ * Returns: %TRUE if @set contains the object
+ *
+ * Since: 2017.10
+ */
+gboolean
+ostree_object_set_contains (OstreeObjectSet   *set,
+                            const char        *checksum,
+                            OstreeObjectType   objtype)
+{
+  guint8 csum[OSTREE_SHA256_DIGEST_LEN];
+  ostree_checksum_inplace_to_bytes (checksum, csum);
+  return _ostree_object_set_contains (set, csum, objtype);
+}
+
+/**
+ * ostree_object_set_iter_init:
+ * @iter: An iterator
+ * @set: An object set
+ *
+ * Initialize @iter to walk over @set, in no particular order.  The set
+ * must not be modified during iteration.
+ *
+ * Since: 2017.10
+ */
+void
+ostree_object_set_iter_init (OstreeObjectSetIter *iter,
+                             OstreeObjectSet     *set)
+{
+  iter->set = set;
+  iter->pos = 0;
+}
+
+/**
+ * ostree_object_set_iter_next:
+ * @iter: An iterator
+ * @out_csum: (out) (optional) (transfer none) (array fixed-size=32): Binary checksum
+ * @out_objtype: (out) (optional): Object type
+ *
+ * Advance @iter; use ostree_checksum_from_bytes() or
+ * ostree_checksum_inplace_from_bytes() to convert @out_csum to a string.
+ *
+ * Returns: %FALSE when there are no more objects
+ *
+ * Since: 2017.10
+ */
+gboolean
+ostree_object_set_iter_next (OstreeObjectSetIter  *iter,
+                             const guint8        **out_csum,
+                             OstreeObjectType     *out_objtype)
+{
+  OstreeObjectSet *set = iter->set;
+
+  while (iter->pos < set->n_slots)
+    {
+      OstreeObjectSetEntry *entry = &set->entries[iter->pos++];
+      if (entry->objtype == 0)
+        continue;
+      if (out_csum)
+        *out_csum = entry->csum;
+      if (out_objtype)
+        *out_objtype = entry->objtype;
+      return TRUE;
+    }
+
+  return FALSE;
+}
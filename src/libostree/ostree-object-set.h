@@ -0,0 +1,47 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include "ostree-core.h"
+
+G_BEGIN_DECLS
+
+/* Private API for #OstreeObjectSet operating on binary checksums; see
+ * ostree-core.h for the public half.  The set is an open-addressing hash
+ * table of 32 byte checksums plus one byte for the type.
+ *
+ * Not thread safe; callers must provide their own locking.
+ */
+
+gboolean _ostree_object_set_add (OstreeObjectSet   *set,
+                                 const guint8      *csum,
+                                 OstreeObjectType   objtype);
+
+gboolean _ostree_object_set_remove (OstreeObjectSet   *set,
+                                    const guint8      *csum,
+                                    OstreeObjectType   objtype);
+
+gboolean _ostree_object_set_contains (OstreeObjectSet   *set,
+                                      const guint8      *csum,
+                                      OstreeObjectType   objtype);
+
+G_END_DECLS
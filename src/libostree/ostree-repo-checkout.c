@@ -29,15 +29,32 @@
 #include "otutil.h"
 
 #include "ostree-repo-file.h"
+#include "ostree-diff.h"
 #include "ostree-sepolicy-private.h"
 #include "ostree-core-private.h"
 #include "ostree-repo-private.h"
 
 #define WHITEOUT_PREFIX ".wh."
 
+/* A repo in the parent chain that a checkout may hardlink objects from */
+typedef struct {
+  OstreeRepo *repo;
+  gboolean is_usermode;
+  /* The checkout mode matches the repo mode */
+  gboolean is_hardlinkable;
+  /* Regular files can be linked from its uncompressed object cache */
+  gboolean is_archive_with_cache;
+} CheckoutLinkSource;
+
 /* Per-checkout call state/caching */
 typedef struct {
   GString *selabel_path_buf;
+  /* Set for parallel checkouts, guards options->devino_to_csum_cache */
+  GMutex *devino_cache_lock;
+  /* (element-type CheckoutLinkSource) The repo and its parents, unless
+   * doing a copying checkout
+   */
+  GArray *link_sources;
 } CheckoutState;
 
 static void
@@ -45,6 +62,8 @@ checkout_state_clear (CheckoutState *state)
 {
   if (state->selabel_path_buf)
     g_string_free (state->selabel_path_buf, TRUE);
+  if (state->link_sources)
+    g_array_unref (state->link_sources);
 }
 G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(CheckoutState, checkout_state_clear)
 
@@ -120,9 +139,12 @@ write_regular_file_content (OstreeRepo            *self,
   if (G_IS_FILE_DESCRIPTOR_BASED (input))
     {
       int infd = g_file_descriptor_based_get_fd ((GFileDescriptorBased*) input);
-      guint64 len = g_file_info_get_size (file_info);
 
-      if (glnx_regfile_copy_bytes (infd, outfd, (off_t)len, TRUE) < 0)
+      /* This is the whole object file; copying all of it lets
+       * glnx_regfile_copy_bytes() try a FICLONE reflink before
+       * copy_file_range().
+       */
+      if (glnx_regfile_copy_bytes (infd, outfd, (off_t) -1, TRUE) < 0)
         return glnx_throw_errno_prefix (error, "regfile copy");
     }
   else
@@ -359,6 +381,140 @@ checkout_file_hardlink (OstreeRepo                          *self,
   return TRUE;
 }
 
+/* Work out once per checkout whether we can hardlink from @repo and each
+ * of its parents, rather than for every file.
+ */
+static void
+checkout_state_init_link_sources (CheckoutState               *state,
+                                  OstreeRepo                  *repo,
+                                  OstreeRepoCheckoutAtOptions *options)
+{
+  if (options->force_copy)
+    return;
+
+  state->link_sources = g_array_new (FALSE, TRUE, sizeof (CheckoutLinkSource));
+  for (OstreeRepo *current_repo = repo; current_repo; current_repo = current_repo->parent_repo)
+    {
+      CheckoutLinkSource source = { current_repo, };
+      source.is_usermode =
+        current_repo->mode == OSTREE_REPO_MODE_BARE_USER ||
+        current_repo->mode == OSTREE_REPO_MODE_BARE_USER_ONLY;
+      source.is_hardlinkable =
+        (current_repo->mode == OSTREE_REPO_MODE_BARE
+         && options->mode == OSTREE_REPO_CHECKOUT_MODE_NONE) ||
+        (source.is_usermode && options->mode == OSTREE_REPO_CHECKOUT_MODE_USER);
+      source.is_archive_with_cache =
+        _ostree_repo_mode_is_archive (current_repo->mode)
+        && options->mode == OSTREE_REPO_CHECKOUT_MODE_USER
+        && options->enable_uncompressed_cache
+        && current_repo->enable_uncompressed_cache;
+      g_array_append_val (state->link_sources, source);
+    }
+}
+
+/* Hardlink @checksum from @source's objects (or uncompressed cache) */
+static gboolean
+checkout_link_from_source (CheckoutLinkSource          *source,
+                           OstreeRepoCheckoutAtOptions *options,
+                           CheckoutState               *state,
+                           const char                  *checksum,
+                           int                          destination_dfd,
+                           const char                  *destination_name,
+                           HardlinkResult              *out_result,
+                           GCancellable                *cancellable,
+                           GError                     **error)
+{
+  char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+
+  /* Override repo mode; for archive we're looking in
+     the cache, which is in "bare" form */
+  _ostree_loose_path (loose_path_buf, checksum, OSTREE_OBJECT_TYPE_FILE, OSTREE_REPO_MODE_BARE);
+  if (!checkout_file_hardlink (source->repo,
+                               options,
+                               loose_path_buf,
+                               destination_dfd, destination_name,
+                               TRUE, out_result,
+                               cancellable, error))
+    return FALSE;
+
+  if (*out_result == HARDLINK_RESULT_LINKED && options->devino_to_csum_cache)
+    {
+      struct stat stbuf;
+      OstreeDevIno *key;
+
+      if (TEMP_FAILURE_RETRY (fstatat (destination_dfd, destination_name, &stbuf, AT_SYMLINK_NOFOLLOW)) != 0)
+        return glnx_throw_errno (error);
+
+      key = g_new (OstreeDevIno, 1);
+      key->dev = stbuf.st_dev;
+      key->ino = stbuf.st_ino;
+      memcpy (key->checksum, checksum, OSTREE_SHA256_STRING_LEN+1);
+
+      if (state->devino_cache_lock)
+        g_mutex_lock (state->devino_cache_lock);
+      g_hash_table_add ((GHashTable*)options->devino_to_csum_cache, key);
+      if (state->devino_cache_lock)
+        g_mutex_unlock (state->devino_cache_lock);
+    }
+
+  return TRUE;
+}
+
+/* Try to hardlink @checksum without looking at the object's metadata.
+ * That's possible as long as the object is stored as what we'd check
+ * out, which is the case for bare and bare-user-only repos (symlinks
+ * there are real symlinks) and for the uncompressed cache (which only
+ * holds regular files).  We stop at the first repo where that isn't true,
+ * returning its index in @out_next_source so that checkout_one_file_at()
+ * can resume from there.
+ */
+static gboolean
+checkout_link_without_metadata (OstreeRepoCheckoutAtOptions *options,
+                                CheckoutState               *state,
+                                const char                  *checksum,
+                                int                          destination_dfd,
+                                const char                  *destination_name,
+                                guint                       *out_next_source,
+                                gboolean                    *out_done,
+                                GCancellable                *cancellable,
+                                GError                     **error)
+{
+  guint i;
+
+  for (i = 0; i < state->link_sources->len; i++)
+    {
+      CheckoutLinkSource *source = &g_array_index (state->link_sources, CheckoutLinkSource, i);
+      const gboolean is_bare_user =
+        source->repo->mode == OSTREE_REPO_MODE_BARE_USER;
+
+      /* bare-user symlinks are regular files, and whether we may fail
+       * with no_copy_fallback depends on the file type; both need the
+       * object metadata.
+       */
+      if ((source->is_hardlinkable && is_bare_user) ||
+          (options->no_copy_fallback && !source->is_hardlinkable))
+        break;
+
+      if (!(source->is_hardlinkable || source->is_archive_with_cache))
+        continue;
+
+      HardlinkResult hardlink_res = HARDLINK_RESULT_NOT_SUPPORTED;
+      if (!checkout_link_from_source (source, options, state, checksum,
+                                      destination_dfd, destination_name,
+                                      &hardlink_res, cancellable, error))
+        return FALSE;
+      if (hardlink_res != HARDLINK_RESULT_NOT_SUPPORTED)
+        {
+          *out_done = TRUE;
+          return TRUE;
+        }
+    }
+
+  *out_next_source = i;
+  *out_done = FALSE;
+  return TRUE;
+}
+
 static gboolean
 checkout_one_file_at (OstreeRepo                        *repo,
                       OstreeRepoCheckoutAtOptions         *options,
@@ -372,8 +528,24 @@ checkout_one_file_at (OstreeRepo                        *repo,
   gboolean need_copy = TRUE;
   gboolean is_bare_user_symlink = FALSE;
   char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+  guint next_source = 0;
+
+  /* Whiteouts need to know whether this is a symlink, but otherwise try
+   * hardlinking first, which usually avoids loading the object entirely.
+   */
+  if (!options->force_copy &&
+      !(options->process_whiteouts && g_str_has_prefix (destination_name, WHITEOUT_PREFIX)))
+    {
+      gboolean done;
+      if (!checkout_link_without_metadata (options, state, checksum,
+                                           destination_dfd, destination_name,
+                                           &next_source, &done,
+                                           cancellable, error))
+        return FALSE;
+      if (done)
+        return TRUE;
+    }
 
-  /* FIXME - avoid the GFileInfo here */
   g_autoptr(GFileInfo) source_info = NULL;
   if (!ostree_repo_load_file (repo, checksum, NULL, &source_info, NULL,
                               cancellable, error))
@@ -404,79 +576,40 @@ checkout_one_file_at (OstreeRepo                        *repo,
     {
       HardlinkResult hardlink_res = HARDLINK_RESULT_NOT_SUPPORTED;
       /* Try to do a hardlink first, if it's a regular file.  This also
-       * traverses all parent repos.
+       * traverses all parent repos, starting from wherever
+       * checkout_link_without_metadata() left off.
        */
-      OstreeRepo *current_repo = repo;
-
-      while (current_repo)
+      for (guint i = next_source; i < state->link_sources->len; i++)
         {
-          /* TODO - Hoist this up to the toplevel at least for checking out from
-           * !parent; don't need to compute it for each file.
-           */
-          gboolean repo_is_usermode =
-            current_repo->mode == OSTREE_REPO_MODE_BARE_USER ||
-            current_repo->mode == OSTREE_REPO_MODE_BARE_USER_ONLY;
-          /* We're hardlinkable if the checkout mode matches the repo mode */
-          gboolean is_hardlinkable =
-            (current_repo->mode == OSTREE_REPO_MODE_BARE
-             && options->mode == OSTREE_REPO_CHECKOUT_MODE_NONE) ||
-            (repo_is_usermode && options->mode == OSTREE_REPO_CHECKOUT_MODE_USER);
-          gboolean current_can_cache = (options->enable_uncompressed_cache
-                                        && current_repo->enable_uncompressed_cache);
-          gboolean is_archive_z2_with_cache = (current_repo->mode == OSTREE_REPO_MODE_ARCHIVE_Z2
-                                               && options->mode == OSTREE_REPO_CHECKOUT_MODE_USER
-                                               && current_can_cache);
+          CheckoutLinkSource *source = &g_array_index (state->link_sources, CheckoutLinkSource, i);
 
           /* NOTE: bare-user symlinks are not stored as symlinks; see
            * https://github.com/ostreedev/ostree/commit/47c612e5a0688c3452a125655a245e8f4f01b2b0
            * as well as write_object().
            */
-          is_bare_user_symlink = (repo_is_usermode && is_symlink);
-          const gboolean is_bare = is_hardlinkable && !is_bare_user_symlink;
+          is_bare_user_symlink = (source->is_usermode && is_symlink);
+          const gboolean is_bare = source->is_hardlinkable && !is_bare_user_symlink;
 
           /* Verify if no_copy_fallback is set that we can hardlink, with a
            * special exception for bare-user symlinks.
            */
-          if (options->no_copy_fallback && !is_hardlinkable && !is_bare_user_symlink)
+          if (options->no_copy_fallback && !source->is_hardlinkable && !is_bare_user_symlink)
             return glnx_throw (error,
-                               repo_is_usermode ?
+                               source->is_usermode ?
                                "User repository mode requires user checkout mode to hardlink" :
                                "Bare repository mode cannot hardlink in user checkout mode");
 
           /* But only under these conditions */
-          if (is_bare || is_archive_z2_with_cache)
+          if (is_bare || source->is_archive_with_cache)
             {
-              /* Override repo mode; for archive we're looking in
-                 the cache, which is in "bare" form */
-              _ostree_loose_path (loose_path_buf, checksum, OSTREE_OBJECT_TYPE_FILE, OSTREE_REPO_MODE_BARE);
-              if (!checkout_file_hardlink (current_repo,
-                                           options,
-                                           loose_path_buf,
-                                           destination_dfd, destination_name,
-                                           TRUE, &hardlink_res,
-                                           cancellable, error))
+              if (!checkout_link_from_source (source, options, state, checksum,
+                                              destination_dfd, destination_name,
+                                              &hardlink_res, cancellable, error))
                 return FALSE;
 
-              if (hardlink_res == HARDLINK_RESULT_LINKED && options->devino_to_csum_cache)
-                {
-                  struct stat stbuf;
-                  OstreeDevIno *key;
-
-                  if (TEMP_FAILURE_RETRY (fstatat (destination_dfd, destination_name, &stbuf, AT_SYMLINK_NOFOLLOW)) != 0)
-                    return glnx_throw_errno (error);
-
-                  key = g_new (OstreeDevIno, 1);
-                  key->dev = stbuf.st_dev;
-                  key->ino = stbuf.st_ino;
-                  memcpy (key->checksum, checksum, OSTREE_SHA256_STRING_LEN+1);
-
-                  g_hash_table_add ((GHashTable*)options->devino_to_csum_cache, key);
-                }
-
               if (hardlink_res != HARDLINK_RESULT_NOT_SUPPORTED)
                 break;
             }
-          current_repo = current_repo->parent_repo;
         }
 
       need_copy = (hardlink_res == HARDLINK_RESULT_NOT_SUPPORTED);
@@ -495,7 +628,7 @@ checkout_one_file_at (OstreeRepo                        *repo,
       && !is_whiteout
       && !is_symlink
       && need_copy
-      && repo->mode == OSTREE_REPO_MODE_ARCHIVE_Z2
+      && _ostree_repo_mode_is_archive (repo->mode)
       && options->mode == OSTREE_REPO_CHECKOUT_MODE_USER)
     {
       HardlinkResult hardlink_res = HARDLINK_RESULT_NOT_SUPPORTED;
@@ -577,32 +710,53 @@ checkout_one_file_at (OstreeRepo                        *repo,
   return TRUE;
 }
 
+/* A directory being checked out.  Its final mode, ownership and mtime are
+ * only applied by checkout_dir_finish() once all of its children have been
+ * written.
+ */
+typedef struct CheckoutDir CheckoutDir;
+struct CheckoutDir {
+  int dfd;
+  gboolean did_exist;
+  guint32 uid;
+  guint32 gid;
+  guint32 mode;
+
+  /* Only used for parallel checkouts; see CheckoutPool */
+  CheckoutDir *parent;
+  volatile gint pending;
+};
+
 /*
- * checkout_tree_at:
+ * checkout_dir_begin:
  * @self: Repo
- * @mode: Options controlling all files
+ * @options: Options controlling all files
  * @state: Any state we're carrying through
- * @overwrite_mode: Whether or not to overwrite files
  * @destination_parent_fd: Place tree here
  * @destination_name: Use this name for tree
- * @source: Source tree
- * @source_info: Source info
+ * @dirtree_checksum: Source tree
+ * @dirmeta_checksum: Source tree metadata
+ * @dir: (out caller-allocates): Directory state
+ * @out_dirtree: (out): The loaded dirtree
  * @cancellable: Cancellable
  * @error: Error
  *
- * Like ostree_repo_checkout_tree(), but check out @source into the
- * relative @destination_name, located by @destination_parent_fd.
+ * Create (or for union/add, reuse) the directory @destination_name, and
+ * open it; the contents are then checked out into @dir->dfd, and the
+ * directory finalized with checkout_dir_finish().
  */
 static gboolean
-checkout_tree_at_recurse (OstreeRepo                        *self,
-                          OstreeRepoCheckoutAtOptions       *options,
-                          CheckoutState                     *state,
-                          int                                destination_parent_fd,
-                          const char                        *destination_name,
-                          const char                        *dirtree_checksum,
-                          const char                        *dirmeta_checksum,
-                          GCancellable                      *cancellable,
-                          GError                           **error)
+checkout_dir_begin (OstreeRepo                        *self,
+                    OstreeRepoCheckoutAtOptions       *options,
+                    CheckoutState                     *state,
+                    int                                destination_parent_fd,
+                    const char                        *destination_name,
+                    const char                        *dirtree_checksum,
+                    const char                        *dirmeta_checksum,
+                    CheckoutDir                       *dir,
+                    GVariant                         **out_dirtree,
+                    GCancellable                      *cancellable,
+                    GError                           **error)
 {
   gboolean did_exist = FALSE;
   const gboolean sepolicy_enabled = options->sepolicy && !self->disable_xattrs;
@@ -684,6 +838,105 @@ checkout_tree_at_recurse (OstreeRepo                        *self,
         return FALSE;
     }
 
+  dir->dfd = glnx_steal_fd (&destination_dfd);
+  dir->did_exist = did_exist;
+  dir->uid = uid;
+  dir->gid = gid;
+  dir->mode = mode;
+  *out_dirtree = g_steal_pointer (&dirtree);
+  return TRUE;
+}
+
+/* Apply the metadata of @dir, now that all of its children exist */
+static gboolean
+checkout_dir_finish (OstreeRepo                        *self,
+                     OstreeRepoCheckoutAtOptions       *options,
+                     CheckoutDir                       *dir,
+                     GError                           **error)
+{
+  /* We do fchmod/fchown last so that no one else could access the
+   * partially created directory and change content we're laying out.
+   */
+  if (!dir->did_exist)
+    {
+      guint32 canonical_mode;
+      /* Silently ignore world-writable directories (plus sticky, suid bits,
+       * etc.) when doing a checkout for bare-user-only repos, or if requested explicitly.
+       * This is related to the logic in ostree-repo-commit.c for files.
+       * See also: https://github.com/ostreedev/ostree/pull/909 i.e. 0c4b3a2b6da950fd78e63f9afec602f6188f1ab0
+       */
+      if (self->mode == OSTREE_REPO_MODE_BARE_USER_ONLY || options->bareuseronly_dirs)
+        canonical_mode = (dir->mode & 0775) | S_IFDIR;
+      else
+        canonical_mode = dir->mode;
+      if (TEMP_FAILURE_RETRY (fchmod (dir->dfd, canonical_mode)) < 0)
+        return glnx_throw_errno_prefix (error, "fchmod");
+    }
+
+  if (!dir->did_exist && options->mode != OSTREE_REPO_CHECKOUT_MODE_USER)
+    {
+      if (TEMP_FAILURE_RETRY (fchown (dir->dfd, dir->uid, dir->gid)) < 0)
+        return glnx_throw_errno (error);
+    }
+
+  /* Set directory mtime to OSTREE_TIMESTAMP, so that it is constant for all checkouts.
+   * Must be done after setting permissions and creating all children.  Note we skip doing
+   * this for directories that already exist (under the theory we possibly don't own them),
+   * and we also skip it if doing copying checkouts, which is mostly for /etc.
+   */
+  if (!dir->did_exist && !options->force_copy)
+    {
+      const struct timespec times[2] = { { OSTREE_TIMESTAMP, UTIME_OMIT }, { OSTREE_TIMESTAMP, 0} };
+      if (TEMP_FAILURE_RETRY (futimens (dir->dfd, times)) < 0)
+        return glnx_throw_errno (error);
+    }
+
+  if (fsync_is_enabled (self, options))
+    {
+      if (fsync (dir->dfd) == -1)
+        return glnx_throw_errno (error);
+    }
+
+  return TRUE;
+}
+
+/*
+ * checkout_tree_at:
+ * @self: Repo
+ * @mode: Options controlling all files
+ * @state: Any state we're carrying through
+ * @overwrite_mode: Whether or not to overwrite files
+ * @destination_parent_fd: Place tree here
+ * @destination_name: Use this name for tree
+ * @source: Source tree
+ * @source_info: Source info
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Like ostree_repo_checkout_tree(), but check out @source into the
+ * relative @destination_name, located by @destination_parent_fd.
+ */
+static gboolean
+checkout_tree_at_recurse (OstreeRepo                        *self,
+                          OstreeRepoCheckoutAtOptions       *options,
+                          CheckoutState                     *state,
+                          int                                destination_parent_fd,
+                          const char                        *destination_name,
+                          const char                        *dirtree_checksum,
+                          const char                        *dirmeta_checksum,
+                          GCancellable                      *cancellable,
+                          GError                           **error)
+{
+  CheckoutDir dir = { -1, };
+  g_autoptr(GVariant) dirtree = NULL;
+
+  if (!checkout_dir_begin (self, options, state,
+                           destination_parent_fd, destination_name,
+                           dirtree_checksum, dirmeta_checksum,
+                           &dir, &dirtree, cancellable, error))
+    return FALSE;
+  glnx_fd_close int destination_dfd = dir.dfd;
+
   GString *selabel_path_buf = state->selabel_path_buf;
   /* Process files in this subdir */
   { g_autoptr(GVariant) dir_file_contents = g_variant_get_child_value (dirtree, 0);
@@ -744,50 +997,280 @@ checkout_tree_at_recurse (OstreeRepo                        *self,
       }
   }
 
-  /* We do fchmod/fchown last so that no one else could access the
-   * partially created directory and change content we're laying out.
-   */
-  if (!did_exist)
+  return checkout_dir_finish (self, options, &dir, error);
+}
+
+/* Parallel checkouts use a pool of worker threads.  Each directory and each
+ * file is a task; a directory task creates the directory and then queues
+ * tasks for all of its children.  Every CheckoutDir counts its unfinished
+ * children (plus one while it is still being populated), and whichever
+ * thread completes the last one finalizes the directory with
+ * checkout_dir_finish() and in turn completes it in its parent.  The
+ * calling thread just waits for the root to be finalized.
+ *
+ * Pending tasks are kept on a stack rather than in the GThreadPool queue
+ * itself (which only holds one token per task), so that we always work on
+ * the most recently expanded directory.  That keeps the traversal close to
+ * depth first, which bounds the number of directories held open at once.
+ */
+typedef struct {
+  CheckoutDir *parent;  /* NULL for the root */
+  char *name;
+  gboolean is_dir;
+  char checksum[OSTREE_SHA256_STRING_LEN+1];  /* Content, or dirtree */
+  char meta_checksum[OSTREE_SHA256_STRING_LEN+1];  /* Only for dirs */
+} CheckoutTask;
+
+typedef struct {
+  OstreeRepo *repo;
+  OstreeRepoCheckoutAtOptions *options;
+  CheckoutState *state;
+  int root_parent_dfd;
+  GCancellable *cancellable;
+  GThreadPool *pool;
+
+  GMutex lock;
+  GCond cond;
+  GPtrArray *tasks;  /* (element-type CheckoutTask) Stack of pending tasks */
+  gboolean done;     /* The root has been completed */
+  GError *error;     /* First error seen; further tasks are skipped */
+} CheckoutPool;
+
+static void
+checkout_task_free (CheckoutTask *task)
+{
+  g_free (task->name);
+  g_free (task);
+}
+
+static void
+checkout_pool_push (CheckoutPool *pool,
+                    CheckoutDir  *parent,
+                    const char   *name,
+                    gboolean      is_dir,
+                    GVariant     *csum_v,
+                    GVariant     *meta_csum_v)
+{
+  CheckoutTask *task = g_new0 (CheckoutTask, 1);
+  task->parent = parent;
+  task->name = g_strdup (name);
+  task->is_dir = is_dir;
+  _ostree_checksum_inplace_from_bytes_v (csum_v, task->checksum);
+  if (meta_csum_v)
+    _ostree_checksum_inplace_from_bytes_v (meta_csum_v, task->meta_checksum);
+
+  if (parent)
+    g_atomic_int_inc (&parent->pending);
+
+  g_mutex_lock (&pool->lock);
+  g_ptr_array_add (pool->tasks, task);
+  g_mutex_unlock (&pool->lock);
+  /* The pool is exclusive, so this can't fail */
+  g_thread_pool_push (pool->pool, pool, NULL);
+}
+
+static gboolean
+checkout_pool_has_error (CheckoutPool *pool)
+{
+  g_mutex_lock (&pool->lock);
+  gboolean ret = pool->error != NULL;
+  g_mutex_unlock (&pool->lock);
+  return ret;
+}
+
+/* A child of @dir is finished (or was skipped); finalize @dir if it was
+ * the last one, and so on up the tree.
+ */
+static void
+checkout_pool_complete (CheckoutPool *pool,
+                        CheckoutDir  *dir)
+{
+  while (dir != NULL)
     {
-      guint32 canonical_mode;
-      /* Silently ignore world-writable directories (plus sticky, suid bits,
-       * etc.) when doing a checkout for bare-user-only repos, or if requested explicitly.
-       * This is related to the logic in ostree-repo-commit.c for files.
-       * See also: https://github.com/ostreedev/ostree/pull/909 i.e. 0c4b3a2b6da950fd78e63f9afec602f6188f1ab0
-       */
-      if (self->mode == OSTREE_REPO_MODE_BARE_USER_ONLY || options->bareuseronly_dirs)
-        canonical_mode = (mode & 0775) | S_IFDIR;
-      else
-        canonical_mode = mode;
-      if (TEMP_FAILURE_RETRY (fchmod (destination_dfd, canonical_mode)) < 0)
-        return glnx_throw_errno_prefix (error, "fchmod");
+      if (!g_atomic_int_dec_and_test (&dir->pending))
+        return;
+
+      g_autoptr(GError) local_error = NULL;
+      if (!checkout_pool_has_error (pool))
+        (void) checkout_dir_finish (pool->repo, pool->options, dir, &local_error);
+      if (local_error)
+        {
+          g_mutex_lock (&pool->lock);
+          if (pool->error == NULL)
+            pool->error = g_steal_pointer (&local_error);
+          g_mutex_unlock (&pool->lock);
+        }
+
+      CheckoutDir *parent = dir->parent;
+      (void) close (dir->dfd);
+      g_free (dir);
+      dir = parent;
     }
 
-  if (!did_exist && options->mode != OSTREE_REPO_CHECKOUT_MODE_USER)
+  g_mutex_lock (&pool->lock);
+  pool->done = TRUE;
+  g_cond_signal (&pool->cond);
+  g_mutex_unlock (&pool->lock);
+}
+
+static gboolean
+checkout_pool_run_dir (CheckoutPool  *pool,
+                       CheckoutTask  *task,
+                       GError       **error)
+{
+  int parent_dfd = task->parent ? task->parent->dfd : pool->root_parent_dfd;
+  g_autoptr(GVariant) dirtree = NULL;
+  CheckoutDir *dir = g_new0 (CheckoutDir, 1);
+
+  if (!checkout_dir_begin (pool->repo, pool->options, pool->state,
+                           parent_dfd, task->name,
+                           task->checksum, task->meta_checksum,
+                           dir, &dirtree, pool->cancellable, error))
     {
-      if (TEMP_FAILURE_RETRY (fchown (destination_dfd, uid, gid)) < 0)
-        return glnx_throw_errno (error);
+      g_free (dir);
+      return FALSE;
     }
 
-  /* Set directory mtime to OSTREE_TIMESTAMP, so that it is constant for all checkouts.
-   * Must be done after setting permissions and creating all children.  Note we skip doing
-   * this for directories that already exist (under the theory we possibly don't own them),
-   * and we also skip it if doing copying checkouts, which is mostly for /etc.
+  /* The directory now stands in for this task in its parent, and holds
+   * an extra reference on itself until all children are queued.
    */
-  if (!did_exist && !options->force_copy)
+  dir->parent = task->parent;
+  dir->pending = 1;
+
+  /* Queue subdirectories first, so that files are popped first */
+  { g_autoptr(GVariant) dir_subdirs = g_variant_get_child_value (dirtree, 1);
+    const char *dname;
+    g_autoptr(GVariant) subdirtree_csum_v = NULL;
+    g_autoptr(GVariant) subdirmeta_csum_v = NULL;
+    GVariantIter viter;
+    g_variant_iter_init (&viter, dir_subdirs);
+    while (g_variant_iter_loop (&viter, "(&s@ay@ay)", &dname,
+                                &subdirtree_csum_v, &subdirmeta_csum_v))
+      checkout_pool_push (pool, dir, dname, TRUE, subdirtree_csum_v, subdirmeta_csum_v);
+  }
+
+  { g_autoptr(GVariant) dir_file_contents = g_variant_get_child_value (dirtree, 0);
+    GVariantIter viter;
+    g_variant_iter_init (&viter, dir_file_contents);
+    const char *fname;
+    g_autoptr(GVariant) contents_csum_v = NULL;
+    while (g_variant_iter_loop (&viter, "(&s@ay)", &fname, &contents_csum_v))
+      checkout_pool_push (pool, dir, fname, FALSE, contents_csum_v, NULL);
+    contents_csum_v = NULL; /* iter_loop freed it */
+  }
+
+  checkout_pool_complete (pool, dir);
+  return TRUE;
+}
+
+static void
+checkout_pool_worker (gpointer data,
+                      gpointer user_data)
+{
+  CheckoutPool *pool = user_data;
+  g_autoptr(GError) local_error = NULL;
+
+  g_mutex_lock (&pool->lock);
+  g_assert_cmpuint (pool->tasks->len, >, 0);
+  CheckoutTask *task = pool->tasks->pdata[pool->tasks->len - 1];
+  g_ptr_array_remove_index (pool->tasks, pool->tasks->len - 1);
+  const gboolean skip = pool->error != NULL;
+  g_mutex_unlock (&pool->lock);
+
+  if (skip || g_cancellable_set_error_if_cancelled (pool->cancellable, &local_error))
     {
-      const struct timespec times[2] = { { OSTREE_TIMESTAMP, UTIME_OMIT }, { OSTREE_TIMESTAMP, 0} };
-      if (TEMP_FAILURE_RETRY (futimens (destination_dfd, times)) < 0)
-        return glnx_throw_errno (error);
+      checkout_pool_complete (pool, task->parent);
+    }
+  else if (task->is_dir)
+    {
+      /* On success, the new directory completes itself in the parent */
+      if (!checkout_pool_run_dir (pool, task, &local_error))
+        checkout_pool_complete (pool, task->parent);
+    }
+  else
+    {
+      (void) checkout_one_file_at (pool->repo, pool->options, pool->state,
+                                   task->checksum,
+                                   task->parent->dfd, task->name,
+                                   pool->cancellable, &local_error);
+      checkout_pool_complete (pool, task->parent);
     }
 
-  if (fsync_is_enabled (self, options))
+  if (local_error)
     {
-      if (fsync (destination_dfd) == -1)
-        return glnx_throw_errno (error);
+      g_mutex_lock (&pool->lock);
+      if (pool->error == NULL)
+        pool->error = g_steal_pointer (&local_error);
+      g_mutex_unlock (&pool->lock);
     }
 
-  return TRUE;
+  checkout_task_free (task);
+}
+
+/* Like checkout_tree_at_recurse(), but using @n_threads worker threads */
+static gboolean
+checkout_tree_at_parallel (OstreeRepo                        *self,
+                           OstreeRepoCheckoutAtOptions       *options,
+                           CheckoutState                     *state,
+                           int                                destination_parent_fd,
+                           const char                        *destination_name,
+                           const char                        *dirtree_checksum,
+                           const char                        *dirmeta_checksum,
+                           guint                              n_threads,
+                           GCancellable                      *cancellable,
+                           GError                           **error)
+{
+  CheckoutPool pool = { 0, };
+  GMutex devino_cache_lock;
+
+  pool.repo = self;
+  pool.options = options;
+  pool.state = state;
+  pool.root_parent_dfd = destination_parent_fd;
+  pool.cancellable = cancellable;
+  pool.tasks = g_ptr_array_new ();
+  g_mutex_init (&pool.lock);
+  g_cond_init (&pool.cond);
+  g_mutex_init (&devino_cache_lock);
+  state->devino_cache_lock = &devino_cache_lock;
+
+  /* Exclusive, so all threads are started (or fail) up front */
+  pool.pool = g_thread_pool_new (checkout_pool_worker, &pool, n_threads, TRUE, error);
+  gboolean ret = pool.pool != NULL;
+  if (ret)
+    {
+      CheckoutTask *root = g_new0 (CheckoutTask, 1);
+      root->name = g_strdup (destination_name);
+      root->is_dir = TRUE;
+      memcpy (root->checksum, dirtree_checksum, OSTREE_SHA256_STRING_LEN+1);
+      memcpy (root->meta_checksum, dirmeta_checksum, OSTREE_SHA256_STRING_LEN+1);
+      g_mutex_lock (&pool.lock);
+      g_ptr_array_add (pool.tasks, root);
+      g_mutex_unlock (&pool.lock);
+      g_thread_pool_push (pool.pool, &pool, NULL);
+
+      g_mutex_lock (&pool.lock);
+      while (!pool.done)
+        g_cond_wait (&pool.cond, &pool.lock);
+      g_mutex_unlock (&pool.lock);
+
+      /* Wait for the workers to return before tearing down */
+      g_thread_pool_free (pool.pool, FALSE, TRUE);
+      g_assert_cmpuint (pool.tasks->len, ==, 0);
+
+      if (pool.error)
+        {
+          g_propagate_error (error, g_steal_pointer (&pool.error));
+          ret = FALSE;
+        }
+    }
+
+  state->devino_cache_lock = NULL;
+  g_mutex_clear (&devino_cache_lock);
+  g_cond_clear (&pool.cond);
+  g_mutex_clear (&pool.lock);
+  g_ptr_array_unref (pool.tasks);
+  return ret;
 }
 
 /* Begin a checkout process */
@@ -802,6 +1285,7 @@ checkout_tree_at (OstreeRepo                        *self,
                   GError                           **error)
 {
   g_auto(CheckoutState) state = { 0, };
+  checkout_state_init_link_sources (&state, self, options);
   // If SELinux labeling is enabled, we need to keep track of the full path string
   if (options->sepolicy)
     {
@@ -853,12 +1337,369 @@ checkout_tree_at (OstreeRepo                        *self,
   g_assert_cmpint (g_file_info_get_file_type (source_info), ==, G_FILE_TYPE_DIRECTORY);
   const char *dirtree_checksum = ostree_repo_file_tree_get_contents_checksum (source);
   const char *dirmeta_checksum = ostree_repo_file_tree_get_metadata_checksum (source);
+
+  /* SELinux labeling tracks the current path in the shared state, and
+   * whiteouts depend on processing entries in order, so those are always
+   * done serially.
+   */
+  if (options->n_threads > 1 && !options->sepolicy && !options->process_whiteouts)
+    return checkout_tree_at_parallel (self, options, &state, destination_parent_fd,
+                                      destination_name,
+                                      dirtree_checksum, dirmeta_checksum,
+                                      options->n_threads,
+                                      cancellable, error);
+
   return checkout_tree_at_recurse (self, options, &state, destination_parent_fd,
                                    destination_name,
                                    dirtree_checksum, dirmeta_checksum,
                                    cancellable, error);
 }
 
+/* State for updating an existing checkout in place; see
+ * checkout_tree_update_at().
+ */
+typedef struct {
+  OstreeRepo *repo;
+  OstreeRepoCheckoutAtOptions *options;
+  CheckoutState *state;
+  int destination_dfd;
+  GFile *target_root;
+  const char *prefix;      /* Path of the checked out subtree in the commit */
+  char *skip_prefix;       /* A new directory we already checked out in full */
+  GHashTable *dirty_dirs;  /* Directories whose entries we changed */
+  GHashTable *dir_metas;   /* Directory path → dirmeta to apply at the end */
+  GCancellable *cancellable;
+} CheckoutUpdate;
+
+/* Record that @relpath (opened as @dfd) needs the metadata in
+ * @dirmeta_checksum applied once all of its children are updated, and
+ * make sure we can change those children in the meantime.
+ */
+static gboolean
+checkout_update_queue_dir_meta (CheckoutUpdate  *update,
+                                int              dfd,
+                                const char      *relpath,
+                                const char      *dirmeta_checksum,
+                                GError         **error)
+{
+  struct stat stbuf;
+
+  if (!glnx_fstat (dfd, &stbuf, error))
+    return FALSE;
+  if ((stbuf.st_mode & S_IWUSR) == 0)
+    {
+      if (TEMP_FAILURE_RETRY (fchmod (dfd, (stbuf.st_mode | S_IWUSR) & 07777)) < 0)
+        return glnx_throw_errno_prefix (error, "fchmod");
+    }
+
+  g_hash_table_replace (update->dir_metas, g_strdup (relpath), g_strdup (dirmeta_checksum));
+  return TRUE;
+}
+
+/* Like checkout_update_queue_dir_meta(), for a directory whose metadata
+ * didn't change, but which we're about to change the entries of.  It only
+ * needs to be revisited if it isn't writable as it is.
+ */
+static gboolean
+checkout_update_prepare_parent (CheckoutUpdate  *update,
+                                int              dfd,
+                                const char      *relpath,
+                                GError         **error)
+{
+  struct stat stbuf;
+
+  if (g_hash_table_contains (update->dir_metas, relpath))
+    return TRUE;
+  if (!glnx_fstat (dfd, &stbuf, error))
+    return FALSE;
+  if ((stbuf.st_mode & S_IWUSR) != 0)
+    return TRUE;
+
+  g_autofree char *path = NULL;
+  if (*relpath == '\0')
+    path = g_strdup (update->prefix);
+  else if (strcmp (update->prefix, "/") == 0)
+    path = g_strconcat ("/", relpath, NULL);
+  else
+    path = g_strconcat (update->prefix, "/", relpath, NULL);
+
+  g_autoptr(GFile) dir = NULL;
+  if (strcmp (path, "/") == 0)
+    dir = g_object_ref (update->target_root);
+  else
+    dir = g_file_resolve_relative_path (update->target_root, path + 1);
+  if (!ostree_repo_file_ensure_resolved ((OstreeRepoFile*)dir, error))
+    return FALSE;
+
+  return checkout_update_queue_dir_meta (update, dfd, relpath,
+                                         ostree_repo_file_tree_get_metadata_checksum ((OstreeRepoFile*)dir),
+                                         error);
+}
+
+/* Apply the metadata in @dirmeta_checksum to the existing directory @dfd,
+ * as a fresh checkout would have.
+ */
+static gboolean
+checkout_update_dir_meta (CheckoutUpdate  *update,
+                          int              dfd,
+                          const char      *dirmeta_checksum,
+                          GError         **error)
+{
+  OstreeRepoCheckoutAtOptions *options = update->options;
+  g_autoptr(GVariant) dirmeta = NULL;
+  g_autoptr(GVariant) xattrs = NULL;
+
+  if (!ostree_repo_load_variant (update->repo, OSTREE_OBJECT_TYPE_DIR_META,
+                                 dirmeta_checksum, &dirmeta, error))
+    return FALSE;
+
+  guint32 uid, gid, mode;
+  g_variant_get (dirmeta, "(uuu@a(ayay))",
+                 &uid, &gid, &mode,
+                 options->mode != OSTREE_REPO_CHECKOUT_MODE_USER ? &xattrs : NULL);
+
+  if (xattrs)
+    {
+      if (!glnx_fd_set_all_xattrs (dfd, xattrs, update->cancellable, error))
+        return FALSE;
+    }
+
+  CheckoutDir dir = { dfd, FALSE, GUINT32_FROM_BE (uid), GUINT32_FROM_BE (gid),
+                      GUINT32_FROM_BE (mode), };
+  return checkout_dir_finish (update->repo, options, &dir, error);
+}
+
+/* Check out the directory @path of the target commit as @name in @parent_dfd */
+static gboolean
+checkout_update_add_tree (CheckoutUpdate  *update,
+                          const char      *path,
+                          int              parent_dfd,
+                          const char      *name,
+                          GError         **error)
+{
+  g_autoptr(GFile) dir = g_file_resolve_relative_path (update->target_root, path + 1);
+
+  if (!ostree_repo_file_ensure_resolved ((OstreeRepoFile*)dir, error))
+    return FALSE;
+
+  return checkout_tree_at_recurse (update->repo, update->options, update->state,
+                                   parent_dfd, name,
+                                   ostree_repo_file_tree_get_contents_checksum ((OstreeRepoFile*)dir),
+                                   ostree_repo_file_tree_get_metadata_checksum ((OstreeRepoFile*)dir),
+                                   update->cancellable, error);
+}
+
+static gboolean
+checkout_update_apply_change (OstreeDiffChangeType  change,
+                              const char           *path,
+                              OstreeObjectType      src_objtype,
+                              const char           *src_checksum,
+                              OstreeObjectType      target_objtype,
+                              const char           *target_checksum,
+                              gpointer              user_data,
+                              GError              **error)
+{
+  CheckoutUpdate *update = user_data;
+  const char *relpath;
+
+  /* Only look at changes inside the subpath we checked out */
+  if (strcmp (update->prefix, "/") == 0)
+    relpath = path + 1;
+  else if (strcmp (path, update->prefix) == 0)
+    relpath = "";
+  else if (g_str_has_prefix (path, update->prefix) && path[strlen (update->prefix)] == '/')
+    relpath = path + strlen (update->prefix) + 1;
+  else
+    return TRUE;
+
+  /* Changes below a new directory come after it, and it's already done */
+  if (update->skip_prefix)
+    {
+      const gsize skip_len = strlen (update->skip_prefix);
+      if (strncmp (relpath, update->skip_prefix, skip_len) == 0 && relpath[skip_len] == '/')
+        return TRUE;
+      g_clear_pointer (&update->skip_prefix, g_free);
+    }
+
+  const gboolean type_changed = change == OSTREE_DIFF_CHANGE_MODIFIED && src_objtype != target_objtype;
+
+  if (*relpath == '\0')
+    {
+      if (change != OSTREE_DIFF_CHANGE_MODIFIED || type_changed ||
+          target_objtype != OSTREE_OBJECT_TYPE_DIR_META)
+        return glnx_throw (error, "Cannot update checkout of %s in place; it changed type", path);
+      return checkout_update_queue_dir_meta (update, update->destination_dfd, "",
+                                             target_checksum, error);
+    }
+
+  g_autofree char *parent = g_path_get_dirname (relpath);
+  const char *name = glnx_basename (relpath);
+  glnx_fd_close int parent_dfd = -1;
+  if (strcmp (parent, ".") == 0)
+    parent[0] = '\0';
+  if (!glnx_opendirat (update->destination_dfd, *parent ? parent : ".", TRUE, &parent_dfd, error))
+    return FALSE;
+  if (!checkout_update_prepare_parent (update, parent_dfd, parent, error))
+    return FALSE;
+
+  /* Adding or removing an entry changes the directory's mtime */
+  if (change != OSTREE_DIFF_CHANGE_MODIFIED || type_changed ||
+      target_objtype == OSTREE_OBJECT_TYPE_FILE)
+    g_hash_table_add (update->dirty_dirs, g_steal_pointer (&parent));
+
+  /* First, get rid of the old entry */
+  if (change == OSTREE_DIFF_CHANGE_REMOVED || type_changed)
+    {
+      if (!glnx_shutil_rm_rf_at (parent_dfd, name, update->cancellable, error))
+        return FALSE;
+    }
+  else if (change == OSTREE_DIFF_CHANGE_MODIFIED && target_objtype == OSTREE_OBJECT_TYPE_FILE)
+    {
+      /* Never write into the old file; in a hardlink checkout, it's the object */
+      if (unlinkat (parent_dfd, name, 0) < 0 && errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "unlinkat(%s)", relpath);
+    }
+
+  if (change == OSTREE_DIFF_CHANGE_REMOVED)
+    return TRUE;
+
+  if (target_objtype == OSTREE_OBJECT_TYPE_FILE)
+    {
+      if (!checkout_one_file_at (update->repo, update->options, update->state,
+                                 target_checksum, parent_dfd, name,
+                                 update->cancellable, error))
+        return FALSE;
+    }
+  else if (change == OSTREE_DIFF_CHANGE_ADDED || type_changed)
+    {
+      if (!checkout_update_add_tree (update, path, parent_dfd, name, error))
+        return FALSE;
+      update->skip_prefix = g_strdup (relpath);
+    }
+  else
+    {
+      glnx_fd_close int dfd = -1;
+      if (!glnx_opendirat (parent_dfd, name, TRUE, &dfd, error))
+        return FALSE;
+      if (!checkout_update_queue_dir_meta (update, dfd, relpath, target_checksum, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static guint
+path_depth (const char *path)
+{
+  guint depth = (*path != '\0');
+  for (const char *p = path; *p; p++)
+    depth += (*p == '/');
+  return depth;
+}
+
+static gint
+compare_paths_deepest_first (gconstpointer a,
+                             gconstpointer b)
+{
+  const guint depth_a = path_depth (*(const char**)a);
+  const guint depth_b = path_depth (*(const char**)b);
+
+  if (depth_a > depth_b)
+    return -1;
+  else if (depth_a < depth_b)
+    return 1;
+  return 0;
+}
+
+/*
+ * checkout_tree_update_at:
+ *
+ * Move the existing checkout @destination_name of @update_from (with the
+ * same options) to @target, where @target is the directory @prefix of
+ * @commit.  Only the paths which differ between the two commits are
+ * touched, using ostree_diff_commits(); unchanged subtrees are never
+ * visited, so the cost scales with the size of the change.
+ */
+static gboolean
+checkout_tree_update_at (OstreeRepo                        *self,
+                         OstreeRepoCheckoutAtOptions       *options,
+                         int                                destination_parent_fd,
+                         const char                        *destination_name,
+                         const char                        *update_from,
+                         const char                        *commit,
+                         GFile                             *commit_root,
+                         const char                        *prefix,
+                         GCancellable                      *cancellable,
+                         GError                           **error)
+{
+  g_auto(CheckoutState) state = { 0, };
+  checkout_state_init_link_sources (&state, self, options);
+
+  if (options->process_whiteouts || options->sepolicy)
+    return glnx_throw (error, "Updating a checkout in place is not supported with whiteouts or SELinux labeling");
+
+  glnx_fd_close int destination_dfd = -1;
+  if (!glnx_opendirat (destination_parent_fd, destination_name, TRUE,
+                       &destination_dfd, error))
+    return FALSE;
+
+  g_auto(OstreeRepoMemoryCacheRef) memcache_ref;
+  _ostree_repo_memory_cache_ref_init (&memcache_ref, self);
+
+  g_autoptr(GHashTable) dirty_dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_autoptr(GHashTable) dir_metas = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  CheckoutUpdate update = { self, options, &state, destination_dfd, commit_root,
+                            prefix, NULL, dirty_dirs, dir_metas, cancellable };
+  const gboolean ret = ostree_diff_commits (self, update_from, commit,
+                                            checkout_update_apply_change, &update,
+                                            cancellable, error);
+  g_free (update.skip_prefix);
+  if (!ret)
+    return glnx_prefix_error (error, "Updating checkout from %s", update_from);
+
+  /* Now that all the entries are in place, apply directory metadata, children
+   * before parents, so that e.g. a read-only mode doesn't get in our way.
+   */
+  g_autoptr(GPtrArray) meta_paths = g_ptr_array_new ();
+  GLNX_HASH_TABLE_FOREACH (dir_metas, const char*, dirpath)
+    g_ptr_array_add (meta_paths, (char*)dirpath);
+  g_ptr_array_sort (meta_paths, compare_paths_deepest_first);
+  for (guint i = 0; i < meta_paths->len; i++)
+    {
+      const char *dirpath = meta_paths->pdata[i];
+      glnx_fd_close int dfd = -1;
+      if (!glnx_opendirat (destination_dfd, *dirpath ? dirpath : ".", TRUE, &dfd, error))
+        return FALSE;
+      if (!checkout_update_dir_meta (&update, dfd, g_hash_table_lookup (dir_metas, dirpath), error))
+        return FALSE;
+    }
+
+  /* Finally, give directories we added to or removed from the same mtime
+   * (and durability) as in a fresh checkout.
+   */
+  GLNX_HASH_TABLE_FOREACH (dirty_dirs, const char*, dirpath)
+    {
+      glnx_fd_close int dfd = -1;
+      if (!glnx_opendirat (destination_dfd, *dirpath ? dirpath : ".", TRUE, &dfd, error))
+        return FALSE;
+
+      if (!options->force_copy)
+        {
+          const struct timespec times[2] = { { OSTREE_TIMESTAMP, UTIME_OMIT }, { OSTREE_TIMESTAMP, 0} };
+          if (TEMP_FAILURE_RETRY (futimens (dfd, times)) < 0)
+            return glnx_throw_errno_prefix (error, "futimens");
+        }
+
+      if (fsync_is_enabled (self, options))
+        {
+          if (fsync (dfd) == -1)
+            return glnx_throw_errno_prefix (error, "fsync");
+        }
+    }
+
+  return TRUE;
+}
+
 static void
 canonicalize_options (OstreeRepo                  *self,
                       OstreeRepoCheckoutAtOptions *options)
@@ -1022,6 +1863,23 @@ ostree_repo_checkout_at (OstreeRepo                        *self,
   if (!target_info)
     return FALSE;
 
+  if (options->update_from)
+    {
+      if (g_file_info_get_file_type (target_info) != G_FILE_TYPE_DIRECTORY)
+        return glnx_throw (error, "Can only update checkouts of directories in place");
+
+      /* Paths from ostree_diff_commits() look like /usr/bin */
+      const char *subpath = options->subpath;
+      while (*subpath == '/')
+        subpath++;
+      g_autofree char *prefix = g_strconcat ("/", subpath, NULL);
+      while (strlen (prefix) > 1 && g_str_has_suffix (prefix, "/"))
+        prefix[strlen (prefix) - 1] = '\0';
+      return checkout_tree_update_at (self, options, destination_dfd, destination_path,
+                                      options->update_from, commit, commit_root,
+                                      prefix, cancellable, error);
+    }
+
   if (!checkout_tree_at (self, options,
                          destination_dfd,
                          destination_path,
@@ -152,6 +152,7 @@ _ostree_repo_commit_tmpf_final (OstreeRepo        *self,
     return FALSE;
   /* We're done with the fd */
   glnx_tmpfile_clear (tmpf);
+  _ostree_repo_object_index_add (self, checksum, objtype);
   return TRUE;
 }
 
@@ -193,6 +194,7 @@ _ostree_repo_commit_path_final (OstreeRepo        *self,
       ot_cleanup_unlinkat_clear (tmp_path);
     }
 
+  _ostree_repo_object_index_add (self, checksum, objtype);
   return TRUE;
 }
 
@@ -215,7 +217,7 @@ commit_loose_regfile_object (OstreeRepo        *self,
   /* We may be writing as root to a non-root-owned repository; if so,
    * automatically inherit the non-root ownership.
    */
-  if (self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2
+  if (_ostree_repo_mode_is_archive (self->mode)
       && self->target_owner_uid != -1)
     {
       if (fchown (tmpf->fd, self->target_owner_uid, self->target_owner_gid) < 0)
@@ -397,6 +399,35 @@ add_size_index_to_metadata (OstreeRepo        *self,
   return g_variant_ref_sink (g_variant_builder_end (builder));
 }
 
+/* Account for writing @size bytes in the current transaction, failing if
+ * that would exceed the min-free-space-percent limit.
+ */
+static gboolean
+txn_reserve_space (OstreeRepo  *self,
+                   guint64      size,
+                   GError     **error)
+{
+  /* Free space check; only applies during transactions */
+  if (self->min_free_space_percent > 0 && self->in_transaction)
+    {
+      g_mutex_lock (&self->txn_stats_lock);
+      g_assert_cmpint (self->txn_blocksize, >, 0);
+      const fsblkcnt_t object_blocks = (size / self->txn_blocksize) + 1;
+      if (object_blocks > self->max_txn_blocks)
+        {
+          g_mutex_unlock (&self->txn_stats_lock);
+          g_autofree char *formatted_required = g_format_size ((guint64)object_blocks * self->txn_blocksize);
+          return glnx_throw (error, "min-free-space-percent '%u%%' would be exceeded, %s more required",
+                             self->min_free_space_percent, formatted_required);
+        }
+      /* This is the main bit that needs mutex protection */
+      self->max_txn_blocks -= object_blocks;
+      g_mutex_unlock (&self->txn_stats_lock);
+    }
+
+  return TRUE;
+}
+
 /* Combines a check for whether or not we already have the object with
  * allocating a tempfile if we don't.  Used by the static delta code.
  */
@@ -448,6 +479,57 @@ _ostree_repo_commit_trusted_content_bare (OstreeRepo          *self,
                                       cancellable, error);
 }
 
+/* Like _ostree_repo_commit_trusted_content_bare(), but for a content object
+ * which is already serialized in the format of this archive repository,
+ * such as one fetched from a remote of the same mode; this avoids
+ * decompressing and recompressing it.  @file_info is the metadata from
+ * its header.
+ */
+gboolean
+_ostree_repo_commit_trusted_content_archive (OstreeRepo          *self,
+                                             const char          *checksum,
+                                             GFileInfo           *file_info,
+                                             OtCleanupUnlinkat   *tmp_path,
+                                             GCancellable        *cancellable,
+                                             GError             **error)
+{
+  g_assert (_ostree_repo_mode_is_archive (self->mode));
+
+  glnx_fd_close int fd = -1;
+  if (!glnx_openat_rdonly (tmp_path->dfd, tmp_path->path, FALSE, &fd, error))
+    return FALSE;
+  struct stat stbuf;
+  if (!glnx_fstat (fd, &stbuf, error))
+    return FALSE;
+
+  if (!txn_reserve_space (self, stbuf.st_size, error))
+    return FALSE;
+
+  /* See commit_loose_regfile_object() */
+  if (self->target_owner_uid != -1)
+    {
+      if (fchown (fd, self->target_owner_uid, self->target_owner_gid) < 0)
+        return glnx_throw_errno_prefix (error, "fchown");
+    }
+  if (!self->in_transaction && !self->disable_fsync)
+    {
+      if (fsync (fd) == -1)
+        return glnx_throw_errno_prefix (error, "fsync");
+    }
+
+  const guint64 unpacked_size = g_file_info_get_size (file_info);
+  g_mutex_lock (&self->txn_stats_lock);
+  if (self->generate_sizes && g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
+    repo_store_size_entry (self, checksum, unpacked_size, stbuf.st_size);
+  self->txn_stats.content_objects_written++;
+  self->txn_stats.content_bytes_written += unpacked_size;
+  self->txn_stats.content_objects_total++;
+  g_mutex_unlock (&self->txn_stats_lock);
+
+  return _ostree_repo_commit_path_final (self, checksum, OSTREE_OBJECT_TYPE_FILE,
+                                         tmp_path, cancellable, error);
+}
+
 static gboolean
 create_regular_tmpfile_linkable_with_content (OstreeRepo *self,
                                               guint64 length,
@@ -563,23 +645,8 @@ write_content_object (OstreeRepo         *self,
   else
     size = 0;
 
-  /* Free space check; only applies during transactions */
-  if (self->min_free_space_percent > 0 && self->in_transaction)
-    {
-      g_mutex_lock (&self->txn_stats_lock);
-      g_assert_cmpint (self->txn_blocksize, >, 0);
-      const fsblkcnt_t object_blocks = (size / self->txn_blocksize) + 1;
-      if (object_blocks > self->max_txn_blocks)
-        {
-          g_mutex_unlock (&self->txn_stats_lock);
-          g_autofree char *formatted_required = g_format_size ((guint64)object_blocks * self->txn_blocksize);
-          return glnx_throw (error, "min-free-space-percent '%u%%' would be exceeded, %s more required",
-                             self->min_free_space_percent, formatted_required);
-        }
-      /* This is the main bit that needs mutex protection */
-      self->max_txn_blocks -= object_blocks;
-      g_mutex_unlock (&self->txn_stats_lock);
-    }
+  if (!txn_reserve_space (self, size, error))
+    return FALSE;
 
   /* For regular files, we create them with default mode, and only
    * later apply any xattrs and setuid bits.  The rationale here
@@ -605,7 +672,7 @@ write_content_object (OstreeRepo         *self,
                                               cancellable, error))
         return FALSE;
     }
-  else if (repo_mode != OSTREE_REPO_MODE_ARCHIVE_Z2)
+  else if (!_ostree_repo_mode_is_archive (repo_mode))
     {
       if (!create_regular_tmpfile_linkable_with_content (self, size, file_input,
                                                          &tmpf, cancellable, error))
@@ -614,12 +681,10 @@ write_content_object (OstreeRepo         *self,
   else
     {
       g_autoptr(GVariant) file_meta = NULL;
-      g_autoptr(GConverter) zlib_compressor = NULL;
+      g_autoptr(GConverter) compressor = NULL;
       g_autoptr(GOutputStream) compressed_out_stream = NULL;
       g_autoptr(GOutputStream) temp_out = NULL;
 
-      g_assert (repo_mode == OSTREE_REPO_MODE_ARCHIVE_Z2);
-
       if (self->generate_sizes)
         indexable = TRUE;
 
@@ -636,8 +701,10 @@ write_content_object (OstreeRepo         *self,
 
       if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
         {
-          zlib_compressor = (GConverter*)g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW, self->zlib_compression_level);
-          compressed_out_stream = g_converter_output_stream_new (temp_out, zlib_compressor);
+          const guint level = repo_mode == OSTREE_REPO_MODE_ARCHIVE_ZSTD ?
+            self->zstd_compression_level : self->zlib_compression_level;
+          compressor = _ostree_archive_compressor_new (repo_mode, level);
+          compressed_out_stream = g_converter_output_stream_new (temp_out, compressor);
           /* Don't close the base; we'll do that later */
           g_filter_output_stream_set_close_base_stream ((GFilterOutputStream*)compressed_out_stream, FALSE);
 
@@ -740,7 +807,12 @@ write_content_object (OstreeRepo         *self,
           if (!glnx_fstat (tmpf.fd, &stbuf, error))
             return FALSE;
 
+          /* Content may be written from multiple threads; see
+           * ostree_repo_commit_modifier_set_threads().
+           */
+          g_mutex_lock (&self->txn_stats_lock);
           repo_store_size_entry (self, actual_checksum, unpacked_size, stbuf.st_size);
+          g_mutex_unlock (&self->txn_stats_lock);
         }
 
       /* This path is for regular files */
@@ -935,6 +1007,7 @@ scan_one_loose_devino (OstreeRepo                     *self,
           switch (self->mode)
             {
             case OSTREE_REPO_MODE_ARCHIVE_Z2:
+            case OSTREE_REPO_MODE_ARCHIVE_ZSTD:
             case OSTREE_REPO_MODE_BARE:
             case OSTREE_REPO_MODE_BARE_USER:
             case OSTREE_REPO_MODE_BARE_USER_ONLY:
@@ -983,7 +1056,7 @@ scan_loose_devino (OstreeRepo                     *self,
         return FALSE;
     }
 
-  if (self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2)
+  if (_ostree_repo_mode_is_archive (self->mode))
     {
       if (!scan_one_loose_devino (self, self->uncompressed_objects_dir_fd, devino_cache,
                                   cancellable, error))
@@ -1127,90 +1200,143 @@ ostree_repo_prepare_transaction (OstreeRepo     *self,
   return TRUE;
 }
 
+static int
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+  return strcmp (*(const char *const*)a, *(const char *const*)b);
+}
+
+/* Gather the names in @dfd/@path, sorted */
 static gboolean
-rename_pending_loose_objects (OstreeRepo        *self,
-                              GCancellable      *cancellable,
-                              GError           **error)
+list_sorted_names_at (int            dfd,
+                      const char    *path,
+                      gboolean       dirs_only,
+                      GPtrArray    **out_names,
+                      GCancellable  *cancellable,
+                      GError       **error)
 {
   g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+  g_autoptr(GPtrArray) names = g_ptr_array_new_with_free_func (g_free);
 
-  if (!glnx_dirfd_iterator_init_at (self->commit_stagedir_fd, ".", FALSE, &dfd_iter, error))
+  if (!glnx_dirfd_iterator_init_at (dfd, path, FALSE, &dfd_iter, error))
     return FALSE;
 
-  /* Iterate over the outer checksum dir */
   while (TRUE)
     {
       struct dirent *dent;
-      gboolean renamed_some_object = FALSE;
-      g_auto(GLnxDirFdIterator) child_dfd_iter = { 0, };
-      char loose_objpath[_OSTREE_LOOSE_PATH_MAX];
 
       if (!glnx_dirfd_iterator_next_dent_ensure_dtype (&dfd_iter, &dent, cancellable, error))
         return FALSE;
       if (dent == NULL)
         break;
 
-      if (dent->d_type != DT_DIR)
+      if (dirs_only && dent->d_type != DT_DIR)
         continue;
 
+      g_ptr_array_add (names, g_strdup (dent->d_name));
+    }
+
+  g_ptr_array_sort (names, compare_strings);
+  *out_names = g_steal_pointer (&names);
+  return TRUE;
+}
+
+/* Move all objects from the staging directory into objects/.  The renames
+ * are grouped by target directory, so each objects/XX directory is
+ * created, opened and (depending on core.finalize-sync) fsync()ed once.
+ */
+static gboolean
+rename_pending_loose_objects (OstreeRepo        *self,
+                              GCancellable      *cancellable,
+                              GError           **error)
+{
+  /* See the comment in ostree_repo_commit_transaction() */
+  const gboolean per_dir_sync = (self->finalize_sync == OSTREE_REPO_FINALIZE_SYNC_DIRECTORIES ||
+                                 g_getenv ("OSTREE_SUPPRESS_SYNCFS") != NULL);
+  guint64 rename_usec = 0;
+  guint64 sync_usec = 0;
+  guint64 start;
+
+  g_autoptr(GPtrArray) prefixes = NULL;
+  if (!list_sorted_names_at (self->commit_stagedir_fd, ".", TRUE, &prefixes,
+                             cancellable, error))
+    return FALSE;
+
+  /* Iterate over the outer checksum dir */
+  for (guint i = 0; i < prefixes->len; i++)
+    {
+      const char *prefix = prefixes->pdata[i];
+
       /* All object directories only have two character entries */
-      if (strlen (dent->d_name) != 2)
+      if (strlen (prefix) != 2)
         continue;
 
-      if (!glnx_dirfd_iterator_init_at (dfd_iter.fd, dent->d_name, FALSE,
-                                        &child_dfd_iter, error))
+      g_autoptr(GPtrArray) names = NULL;
+      if (!list_sorted_names_at (self->commit_stagedir_fd, prefix, FALSE, &names,
+                                 cancellable, error))
         return FALSE;
+      if (names->len == 0)
+        continue;
 
-      loose_objpath[0] = dent->d_name[0];
-      loose_objpath[1] = dent->d_name[1];
-      loose_objpath[2] = '/';
-
-      /* Iterate over inner checksum dir */
-      while (TRUE)
-        {
-          struct dirent *child_dent;
+      start = g_get_monotonic_time ();
 
-          if (!glnx_dirfd_iterator_next_dent (&child_dfd_iter, &child_dent, cancellable, error))
-            return FALSE;
-          if (child_dent == NULL)
-            break;
+      glnx_fd_close int source_dir_fd = -1;
+      if (!glnx_opendirat (self->commit_stagedir_fd, prefix, FALSE,
+                           &source_dir_fd, error))
+        return FALSE;
 
-          g_strlcpy (loose_objpath + 3, child_dent->d_name, sizeof (loose_objpath)-3);
+      if (!_ostree_repo_ensure_loose_objdir_at (self->objects_dir_fd, prefix,
+                                                cancellable, error))
+        return FALSE;
 
-          if (!_ostree_repo_ensure_loose_objdir_at (self->objects_dir_fd, loose_objpath,
-                                                    cancellable, error))
-            return FALSE;
+      glnx_fd_close int target_dir_fd = -1;
+      if (!glnx_opendirat (self->objects_dir_fd, prefix, FALSE,
+                           &target_dir_fd, error))
+        return FALSE;
 
-          if (!glnx_renameat (child_dfd_iter.fd, loose_objpath + 3,
-                              self->objects_dir_fd, loose_objpath, error))
+      for (guint j = 0; j < names->len; j++)
+        {
+          const char *name = names->pdata[j];
+          if (!glnx_renameat (source_dir_fd, name, target_dir_fd, name, error))
             return FALSE;
-
-          renamed_some_object = TRUE;
         }
 
-      if (renamed_some_object)
+      rename_usec += g_get_monotonic_time () - start;
+
+      if (per_dir_sync)
         {
           /* Ensure that in the case of a power cut all the directory metadata that
              we want has reached the disk. In particular, we want this before we
              update the refs to point to these objects. */
-          glnx_fd_close int target_dir_fd = -1;
-
-          loose_objpath[2] = 0;
-
-          if (!glnx_opendirat (self->objects_dir_fd,
-                               loose_objpath, FALSE,
-                               &target_dir_fd,
-                               error))
-            return FALSE;
-
+          start = g_get_monotonic_time ();
           if (fsync (target_dir_fd) == -1)
             return glnx_throw_errno_prefix (error, "fsync");
+          sync_usec += g_get_monotonic_time () - start;
         }
     }
 
-  /* In case we created any loose object subdirs, make sure they are on disk */
-  if (fsync (self->objects_dir_fd) == -1)
-    return glnx_throw_errno_prefix (error, "fsync");
+  start = g_get_monotonic_time ();
+  if (per_dir_sync)
+    {
+      /* In case we created any loose object subdirs, make sure they are on disk */
+      if (fsync (self->objects_dir_fd) == -1)
+        return glnx_throw_errno_prefix (error, "fsync");
+    }
+  else
+    {
+      /* One syncfs() covers every directory we touched, as well as any
+       * new object subdirs.
+       */
+      if (syncfs (self->objects_dir_fd) == -1)
+        return glnx_throw_errno_prefix (error, "syncfs");
+    }
+  sync_usec += g_get_monotonic_time () - start;
+
+  g_mutex_lock (&self->txn_stats_lock);
+  self->txn_stats.rename_usec = rename_usec;
+  self->txn_stats.dir_sync_usec = sync_usec;
+  g_mutex_unlock (&self->txn_stats_lock);
 
   if (!glnx_shutil_rm_rf_at (self->tmp_dir_fd, self->commit_stagedir_name,
                              cancellable, error))
@@ -1534,8 +1660,13 @@ ostree_repo_commit_transaction (OstreeRepo                  *self,
    */
   if (g_getenv ("OSTREE_SUPPRESS_SYNCFS") == NULL)
     {
+      guint64 start = g_get_monotonic_time ();
       if (syncfs (self->tmp_dir_fd) < 0)
         return glnx_throw_errno (error);
+      const guint64 elapsed = g_get_monotonic_time () - start;
+      g_mutex_lock (&self->txn_stats_lock);
+      self->txn_stats.data_sync_usec = elapsed;
+      g_mutex_unlock (&self->txn_stats_lock);
     }
 
   if (!rename_pending_loose_objects (self, cancellable, error))
@@ -1546,6 +1677,7 @@ ostree_repo_commit_transaction (OstreeRepo                  *self,
 
   if (self->loose_object_devino_hash)
     g_hash_table_remove_all (self->loose_object_devino_hash);
+  _ostree_repo_object_index_clear (self);
 
   if (self->txn_refs)
     if (!_ostree_repo_update_refs (self, self->txn_refs, cancellable, error))
@@ -1592,6 +1724,7 @@ ostree_repo_abort_transaction (OstreeRepo     *self,
 
   if (self->loose_object_devino_hash)
     g_hash_table_remove_all (self->loose_object_devino_hash);
+  _ostree_repo_object_index_clear (self);
 
   g_clear_pointer (&self->txn_refs, g_hash_table_destroy);
   g_clear_pointer (&self->txn_collection_refs, g_hash_table_destroy);
@@ -2519,11 +2652,252 @@ get_modified_xattrs (OstreeRepo                       *self,
   return TRUE;
 }
 
+/* Write the content object for a file being committed from @file_input (%NULL
+ * for symlinks), returning its binary checksum.
+ *
+ * For archive repos, compression dominates the cost of writing an object, and
+ * it's entirely wasted if we already have it, which is the common case when
+ * re-committing a mostly unchanged tree.  So if the content is backed by a file
+ * descriptor, first do a cheap uncompressed checksum pass over it, and only
+ * rewind and compress if the object is new.  The object is still checksummed
+ * again as it's written, so a file changing underneath us is detected.
+ */
+static gboolean
+write_content_for_commit (OstreeRepo    *self,
+                          GInputStream  *file_input,
+                          GFileInfo     *file_info,
+                          GVariant      *xattrs,
+                          guchar       **out_csum,
+                          GCancellable  *cancellable,
+                          GError       **error)
+{
+  g_autofree char *expected_checksum = NULL;
+
+  if (_ostree_repo_mode_is_archive (self->mode)
+      && g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR
+      && G_IS_FILE_DESCRIPTOR_BASED (file_input))
+    {
+      const int fd = g_file_descriptor_based_get_fd ((GFileDescriptorBased*) file_input);
+      g_autoptr(GInputStream) hash_input = g_unix_input_stream_new (fd, FALSE);
+      g_autofree guchar *csum = NULL;
+      if (!ostree_checksum_file_from_input (file_info, xattrs, hash_input,
+                                            OSTREE_OBJECT_TYPE_FILE, &csum,
+                                            cancellable, error))
+        return FALSE;
+      if (lseek (fd, 0, SEEK_SET) < 0)
+        return glnx_throw_errno_prefix (error, "lseek");
+      expected_checksum = ostree_checksum_from_bytes (csum);
+
+      gboolean have_obj;
+      if (!_ostree_repo_has_loose_object (self, expected_checksum, OSTREE_OBJECT_TYPE_FILE,
+                                          &have_obj, cancellable, error))
+        return FALSE;
+      if (have_obj)
+        {
+          g_mutex_lock (&self->txn_stats_lock);
+          self->txn_stats.content_objects_total++;
+          g_mutex_unlock (&self->txn_stats_lock);
+          *out_csum = g_steal_pointer (&csum);
+          /* Note early return */
+          return TRUE;
+        }
+    }
+
+  g_autoptr(GInputStream) file_object_input = NULL;
+  guint64 file_obj_length;
+  if (!ostree_raw_file_to_content_stream (file_input,
+                                          file_info, xattrs,
+                                          &file_object_input, &file_obj_length,
+                                          cancellable, error))
+    return FALSE;
+
+  return write_content_object (self, expected_checksum,
+                               file_object_input, file_obj_length, out_csum,
+                               cancellable, error);
+}
+
+/* When a commit modifier asks for more than one thread, content objects are
+ * written (checksummed, compressed, staged) by a pool of worker threads while
+ * the directory walk itself stays on the calling thread.  The resulting
+ * checksums are only ever added to the OstreeMutableTree from the calling
+ * thread, as jobs complete; since dirtree serialization sorts by name, the
+ * order in which they arrive doesn't affect the result.
+ */
+typedef struct {
+  OstreeMutableTree *mtree;
+  char *name;
+  GInputStream *input; /* Raw file content, NULL for symlinks */
+  GFileInfo *file_info;
+  GVariant *xattrs;
+  guchar *csum;
+  GError *error;
+} CommitContentJob;
+
+typedef struct {
+  OstreeRepo *repo;
+  GThreadPool *pool;
+  GAsyncQueue *completed; /* (element-type CommitContentJob) */
+  guint n_outstanding;
+  /* Bounds the number of open input fds */
+  guint max_outstanding;
+  GCancellable *cancellable;
+  GError *error; /* First error seen; further results are discarded */
+} CommitContentPool;
+
+static void
+commit_content_job_free (CommitContentJob *job)
+{
+  g_clear_object (&job->mtree);
+  g_free (job->name);
+  g_clear_object (&job->input);
+  g_clear_object (&job->file_info);
+  g_clear_pointer (&job->xattrs, g_variant_unref);
+  g_free (job->csum);
+  g_clear_error (&job->error);
+  g_free (job);
+}
+
+static void
+commit_content_pool_worker (gpointer data,
+                            gpointer user_data)
+{
+  CommitContentJob *job = data;
+  CommitContentPool *pool = user_data;
+
+  (void) write_content_for_commit (pool->repo, job->input, job->file_info, job->xattrs,
+                                   &job->csum, pool->cancellable, &job->error);
+  /* Close the input now rather than when the walk gets around to it */
+  g_clear_object (&job->input);
+  g_async_queue_push (pool->completed, job);
+}
+
+static CommitContentPool *
+commit_content_pool_new (OstreeRepo   *repo,
+                         guint         n_threads,
+                         GCancellable *cancellable,
+                         GError      **error)
+{
+  CommitContentPool *pool = g_new0 (CommitContentPool, 1);
+
+  pool->repo = g_object_ref (repo);
+  pool->completed = g_async_queue_new ();
+  pool->max_outstanding = n_threads * 4;
+  pool->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  pool->pool = g_thread_pool_new (commit_content_pool_worker, pool,
+                                  n_threads, FALSE, error);
+  if (!pool->pool)
+    {
+      g_async_queue_unref (pool->completed);
+      g_clear_object (&pool->cancellable);
+      g_object_unref (pool->repo);
+      g_free (pool);
+      return NULL;
+    }
+
+  return pool;
+}
+
+static void
+commit_content_pool_free (CommitContentPool *pool)
+{
+  CommitContentJob *job;
+
+  /* Waits for any jobs still queued, e.g. if the walk failed */
+  g_thread_pool_free (pool->pool, FALSE, TRUE);
+  while ((job = g_async_queue_try_pop (pool->completed)) != NULL)
+    commit_content_job_free (job);
+  g_async_queue_unref (pool->completed);
+  g_clear_object (&pool->cancellable);
+  g_clear_error (&pool->error);
+  g_object_unref (pool->repo);
+  g_free (pool);
+}
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(CommitContentPool, commit_content_pool_free)
+
+/* Called from the walking thread for each finished job */
+static void
+commit_content_pool_complete_one (CommitContentPool *pool,
+                                  CommitContentJob  *job)
+{
+  g_assert_cmpuint (pool->n_outstanding, >, 0);
+  pool->n_outstanding--;
+
+  if (job->error)
+    {
+      if (pool->error == NULL)
+        pool->error = g_steal_pointer (&job->error);
+    }
+  else if (pool->error == NULL)
+    {
+      char checksum[OSTREE_SHA256_STRING_LEN+1];
+      ostree_checksum_inplace_from_bytes (job->csum, checksum);
+      (void) ostree_mutable_tree_replace_file (job->mtree, job->name, checksum,
+                                               &pool->error);
+    }
+
+  commit_content_job_free (job);
+}
+
+/* Wait for all outstanding jobs, and propagate the first error if any */
+static gboolean
+commit_content_pool_drain (CommitContentPool *pool,
+                           GError           **error)
+{
+  while (pool->n_outstanding > 0)
+    commit_content_pool_complete_one (pool, g_async_queue_pop (pool->completed));
+
+  if (pool->error)
+    {
+      g_propagate_error (error, g_steal_pointer (&pool->error));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+commit_content_pool_push (CommitContentPool *pool,
+                          OstreeMutableTree *mtree,
+                          const char        *name,
+                          GInputStream      *input,
+                          GFileInfo         *file_info,
+                          GVariant          *xattrs,
+                          GError           **error)
+{
+  CommitContentJob *job;
+
+  /* Apply whatever has finished, then block until there's room */
+  while ((job = g_async_queue_try_pop (pool->completed)) != NULL)
+    commit_content_pool_complete_one (pool, job);
+  while (pool->error == NULL && pool->n_outstanding >= pool->max_outstanding)
+    commit_content_pool_complete_one (pool, g_async_queue_pop (pool->completed));
+  if (pool->error)
+    return commit_content_pool_drain (pool, error);
+
+  job = g_new0 (CommitContentJob, 1);
+  job->mtree = g_object_ref (mtree);
+  job->name = g_strdup (name);
+  job->input = input ? g_object_ref (input) : NULL;
+  job->file_info = g_object_ref (file_info);
+  job->xattrs = xattrs ? g_variant_ref (xattrs) : NULL;
+
+  pool->n_outstanding++;
+  if (!g_thread_pool_push (pool->pool, job, error))
+    {
+      pool->n_outstanding--;
+      commit_content_job_free (job);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 static gboolean
 write_directory_to_mtree_internal (OstreeRepo                  *self,
                                    GFile                       *dir,
                                    OstreeMutableTree           *mtree,
                                    OstreeRepoCommitModifier    *modifier,
+                                   CommitContentPool           *content_pool,
                                    GPtrArray                   *path,
                                    GCancellable                *cancellable,
                                    GError                     **error);
@@ -2532,6 +2906,7 @@ write_dfd_iter_to_mtree_internal (OstreeRepo                  *self,
                                   GLnxDirFdIterator           *src_dfd_iter,
                                   OstreeMutableTree           *mtree,
                                   OstreeRepoCommitModifier    *modifier,
+                                  CommitContentPool           *content_pool,
                                   GPtrArray                   *path,
                                   GCancellable                *cancellable,
                                   GError                     **error);
@@ -2544,6 +2919,7 @@ write_directory_content_to_mtree_internal (OstreeRepo                  *self,
                                            GFileInfo                   *child_info,
                                            OstreeMutableTree           *mtree,
                                            OstreeRepoCommitModifier    *modifier,
+                                           CommitContentPool           *content_pool,
                                            GPtrArray                   *path,
                                            GCancellable                *cancellable,
                                            GError                     **error)
@@ -2596,7 +2972,7 @@ write_directory_content_to_mtree_internal (OstreeRepo                  *self,
       if (dir_enum != NULL)
         {
           if (!write_directory_to_mtree_internal (self, child, child_mtree,
-                                                  modifier, path,
+                                                  modifier, content_pool, path,
                                                   cancellable, error))
             return FALSE;
         }
@@ -2608,7 +2984,7 @@ write_directory_content_to_mtree_internal (OstreeRepo                  *self,
             return FALSE;
 
           if (!write_dfd_iter_to_mtree_internal (self, &child_dfd_iter, child_mtree,
-                                                 modifier, path,
+                                                 modifier, content_pool, path,
                                                  cancellable, error))
             return FALSE;
         }
@@ -2624,11 +3000,9 @@ write_directory_content_to_mtree_internal (OstreeRepo                  *self,
     }
   else
     {
-      guint64 file_obj_length;
       const char *loose_checksum;
       g_autoptr(GInputStream) file_input = NULL;
       g_autoptr(GVariant) xattrs = NULL;
-      g_autoptr(GInputStream) file_object_input = NULL;
       g_autofree guchar *child_file_csum = NULL;
       g_autofree char *tmp_checksum = NULL;
 
@@ -2666,20 +3040,26 @@ write_directory_content_to_mtree_internal (OstreeRepo                  *self,
                                     cancellable, error))
             return FALSE;
 
-          if (!ostree_raw_file_to_content_stream (file_input,
-                                                  modified_info, xattrs,
-                                                  &file_object_input, &file_obj_length,
-                                                  cancellable, error))
-            return FALSE;
-          if (!ostree_repo_write_content (self, NULL, file_object_input, file_obj_length,
-                                          &child_file_csum, cancellable, error))
-            return FALSE;
+          if (content_pool)
+            {
+              /* The pool adds the file to @mtree once it's written */
+              if (!commit_content_pool_push (content_pool, mtree, name,
+                                             file_input, modified_info, xattrs,
+                                             error))
+                return FALSE;
+            }
+          else
+            {
+              if (!write_content_for_commit (self, file_input, modified_info, xattrs,
+                                             &child_file_csum, cancellable, error))
+                return FALSE;
 
-          g_free (tmp_checksum);
-          tmp_checksum = ostree_checksum_from_bytes (child_file_csum);
-          if (!ostree_mutable_tree_replace_file (mtree, name, tmp_checksum,
-                                                 error))
-            return FALSE;
+              g_free (tmp_checksum);
+              tmp_checksum = ostree_checksum_from_bytes (child_file_csum);
+              if (!ostree_mutable_tree_replace_file (mtree, name, tmp_checksum,
+                                                     error))
+                return FALSE;
+            }
         }
     }
 
@@ -2693,6 +3073,7 @@ write_directory_to_mtree_internal (OstreeRepo                  *self,
                                    GFile                       *dir,
                                    OstreeMutableTree           *mtree,
                                    OstreeRepoCommitModifier    *modifier,
+                                   CommitContentPool           *content_pool,
                                    GPtrArray                   *path,
                                    GCancellable                *cancellable,
                                    GError                     **error)
@@ -2776,7 +3157,7 @@ write_directory_to_mtree_internal (OstreeRepo                  *self,
 
           if (!write_directory_content_to_mtree_internal (self, repo_dir, dir_enum, NULL,
                                                           child_info,
-                                                          mtree, modifier, path,
+                                                          mtree, modifier, content_pool, path,
                                                           cancellable, error))
             return FALSE;
         }
@@ -2790,6 +3171,7 @@ write_dfd_iter_to_mtree_internal (OstreeRepo                  *self,
                                   GLnxDirFdIterator           *src_dfd_iter,
                                   OstreeMutableTree           *mtree,
                                   OstreeRepoCommitModifier    *modifier,
+                                  CommitContentPool           *content_pool,
                                   GPtrArray                   *path,
                                   GCancellable                *cancellable,
                                   GError                     **error)
@@ -2886,7 +3268,7 @@ write_dfd_iter_to_mtree_internal (OstreeRepo                  *self,
 
       if (!write_directory_content_to_mtree_internal (self, NULL, NULL, src_dfd_iter,
                                                       child_info,
-                                                      mtree, modifier, path,
+                                                      mtree, modifier, content_pool, path,
                                                       cancellable, error))
         return FALSE;
     }
@@ -2927,9 +3309,21 @@ ostree_repo_write_directory_to_mtree (OstreeRepo                *self,
       if (modifier && modifier->flags & OSTREE_REPO_COMMIT_MODIFIER_FLAGS_GENERATE_SIZES)
         self->generate_sizes = TRUE;
 
+      g_autoptr(CommitContentPool) content_pool = NULL;
+      if (modifier && modifier->n_threads > 1)
+        {
+          content_pool = commit_content_pool_new (self, modifier->n_threads,
+                                                  cancellable, error);
+          if (!content_pool)
+            return FALSE;
+        }
+
       g_autoptr(GPtrArray) path = g_ptr_array_new ();
-      if (!write_directory_to_mtree_internal (self, dir, mtree, modifier, path,
-                                              cancellable, error))
+      if (!write_directory_to_mtree_internal (self, dir, mtree, modifier, content_pool,
+                                              path, cancellable, error))
+        return FALSE;
+
+      if (content_pool && !commit_content_pool_drain (content_pool, error))
         return FALSE;
     }
 
@@ -2966,9 +3360,22 @@ ostree_repo_write_dfd_to_mtree (OstreeRepo                *self,
   if (!glnx_dirfd_iterator_init_at (dfd, path, FALSE, &dfd_iter, error))
     return FALSE;
 
+  g_autoptr(CommitContentPool) content_pool = NULL;
+  if (modifier && modifier->n_threads > 1)
+    {
+      content_pool = commit_content_pool_new (self, modifier->n_threads,
+                                              cancellable, error);
+      if (!content_pool)
+        return FALSE;
+    }
+
   g_autoptr(GPtrArray) pathbuilder = g_ptr_array_new ();
-  if (!write_dfd_iter_to_mtree_internal (self, &dfd_iter, mtree, modifier, pathbuilder,
-                                         cancellable, error))
+  if (!write_dfd_iter_to_mtree_internal (self, &dfd_iter, mtree, modifier, content_pool,
+                                         pathbuilder, cancellable, error))
+    return FALSE;
+
+  /* All content must be in @mtree before we return */
+  if (content_pool && !commit_content_pool_drain (content_pool, error))
     return FALSE;
 
   return TRUE;
@@ -3152,6 +3559,33 @@ ostree_repo_commit_modifier_set_sepolicy (OstreeRepoCommitModifier
   modifier->sepolicy = sepolicy ? g_object_ref (sepolicy) : NULL;
 }
 
+/**
+ * ostree_repo_commit_modifier_set_threads:
+ * @modifier: An #OstreeRepoCommitModifier
+ * @n_threads: Number of threads to use for writing content objects
+ *
+ * By default, ostree_repo_write_dfd_to_mtree() and
+ * ostree_repo_write_directory_to_mtree() checksum, compress and stage each
+ * content object in turn on the calling thread.  If @n_threads is greater
+ * than 1, the directory walk still happens on the calling thread (and any
+ * filter or xattr callbacks are invoked from it), but content objects are
+ * written from a pool of up to @n_threads worker threads.  If @n_threads is
+ * 0, the number of available processors is used.
+ *
+ * The resulting #OstreeMutableTree is identical to the one produced by the
+ * serial path.
+ *
+ * Since: 2017.10
+ */
+void
+ostree_repo_commit_modifier_set_threads (OstreeRepoCommitModifier  *modifier,
+                                         guint                      n_threads)
+{
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+  modifier->n_threads = n_threads;
+}
+
 /**
  * ostree_repo_commit_modifier_set_devino_cache:
  * @modifier: Modifier
@@ -0,0 +1,314 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2011 Colin Walters <walters@verbum.org>
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "ostree-autocleanups.h"
+#include "ostree-core-private.h"
+#include "ostree-repo-private.h"
+#include "otutil.h"
+
+/**
+ * ostree_repo_fsck_object:
+ * @self: Repo
+ * @objtype: Object type
+ * @sha256: Checksum
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Load the object @sha256 of type @objtype, validate its structure, and
+ * verify that its content matches its checksum.  A missing object results
+ * in a %G_IO_ERROR_NOT_FOUND error, and an object whose content does not
+ * match its checksum in %G_IO_ERROR_INVALID_DATA.
+ *
+ * This function may be called from multiple threads at once.
+ *
+ * Since: 2017.10
+ */
+gboolean
+ostree_repo_fsck_object (OstreeRepo           *self,
+                         OstreeObjectType      objtype,
+                         const char           *sha256,
+                         GCancellable         *cancellable,
+                         GError              **error)
+{
+  g_autoptr(GVariant) metadata = NULL;
+  g_autoptr(GInputStream) input = NULL;
+  g_autoptr(GFileInfo) file_info = NULL;
+  g_autoptr(GVariant) xattrs = NULL;
+
+  if (OSTREE_OBJECT_TYPE_IS_META (objtype))
+    {
+      if (!ostree_repo_load_variant (self, objtype, sha256, &metadata, error))
+        return glnx_prefix_error (error, "Loading metadata object %s", sha256);
+
+      if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
+        {
+          if (!ostree_validate_structureof_commit (metadata, error))
+            return glnx_prefix_error (error, "While validating commit metadata '%s'", sha256);
+        }
+      else if (objtype == OSTREE_OBJECT_TYPE_DIR_TREE)
+        {
+          if (!ostree_validate_structureof_dirtree (metadata, error))
+            return glnx_prefix_error (error, "While validating directory tree '%s'", sha256);
+        }
+      else if (objtype == OSTREE_OBJECT_TYPE_DIR_META)
+        {
+          if (!ostree_validate_structureof_dirmeta (metadata, error))
+            return glnx_prefix_error (error, "While validating directory metadata '%s'", sha256);
+        }
+
+      input = g_memory_input_stream_new_from_data (g_variant_get_data (metadata),
+                                                   g_variant_get_size (metadata),
+                                                   NULL);
+    }
+  else
+    {
+      g_assert (objtype == OSTREE_OBJECT_TYPE_FILE);
+
+      if (!ostree_repo_load_file (self, sha256, &input, &file_info, &xattrs,
+                                  cancellable, error))
+        return glnx_prefix_error (error, "Loading file object %s", sha256);
+
+      guint32 mode = g_file_info_get_attribute_uint32 (file_info, "unix::mode");
+      if (!ostree_validate_structureof_file_mode (mode, error))
+        return glnx_prefix_error (error, "While validating file '%s'", sha256);
+    }
+
+  g_autofree guchar *computed_csum = NULL;
+  if (!ostree_checksum_file_from_input (file_info, xattrs, input, objtype,
+                                        &computed_csum, cancellable, error))
+    return FALSE;
+
+  char actual_checksum[OSTREE_SHA256_STRING_LEN+1];
+  ostree_checksum_inplace_from_bytes (computed_csum, actual_checksum);
+  if (strcmp (sha256, actual_checksum) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "corrupted object %s.%s; actual checksum: %s",
+                   sha256, ostree_object_type_to_string (objtype),
+                   actual_checksum);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Verification of each object happens in a worker thread; the results
+ * are passed back to the calling thread, so that the callback (which
+ * may print, or delete objects) never runs concurrently with itself.
+ */
+typedef struct {
+  char checksum[OSTREE_SHA256_STRING_LEN+1];
+  OstreeObjectType objtype;
+  GError *error;
+} FsckJob;
+
+typedef struct {
+  OstreeRepo *repo;
+  GThreadPool *pool;
+  GAsyncQueue *completed; /* (element-type FsckJob) */
+  guint n_outstanding;
+  /* Bounds the number of jobs in flight, and hence memory */
+  guint max_outstanding;
+  OstreeRepoFsckObjectFunc func;
+  gpointer user_data;
+  GCancellable *cancellable;
+  GError *error; /* First error seen; further results are discarded */
+} FsckPool;
+
+static void
+fsck_job_free (FsckJob *job)
+{
+  g_clear_error (&job->error);
+  g_free (job);
+}
+
+static void
+fsck_pool_worker (gpointer data,
+                  gpointer user_data)
+{
+  FsckJob *job = data;
+  FsckPool *pool = user_data;
+
+  (void) ostree_repo_fsck_object (pool->repo, job->objtype, job->checksum,
+                                  pool->cancellable, &job->error);
+  g_async_queue_push (pool->completed, job);
+}
+
+/* Hand the result for one object to the callback; with no callback, any
+ * problem with an object is an error.
+ */
+static gboolean
+fsck_dispatch_result (OstreeRepo               *repo,
+                      const char               *checksum,
+                      OstreeObjectType          objtype,
+                      GError                  **object_error,
+                      OstreeRepoFsckObjectFunc  func,
+                      gpointer                  user_data,
+                      GError                  **error)
+{
+  if (func)
+    return func (repo, checksum, objtype, *object_error, user_data, error);
+
+  if (*object_error)
+    {
+      g_propagate_error (error, g_steal_pointer (object_error));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Called from the iterating thread for each finished job */
+static void
+fsck_pool_complete_one (FsckPool *pool,
+                        FsckJob  *job)
+{
+  g_assert_cmpuint (pool->n_outstanding, >, 0);
+  pool->n_outstanding--;
+
+  if (pool->error == NULL)
+    (void) fsck_dispatch_result (pool->repo, job->checksum, job->objtype,
+                                 &job->error, pool->func, pool->user_data,
+                                 &pool->error);
+
+  fsck_job_free (job);
+}
+
+static gboolean
+fsck_objects_threaded (OstreeRepo               *self,
+                       OstreeObjectSet          *objects,
+                       guint                     n_threads,
+                       OstreeRepoFsckObjectFunc  func,
+                       gpointer                  user_data,
+                       GCancellable             *cancellable,
+                       GError                  **error)
+{
+  FsckPool pool = { 0, };
+
+  pool.repo = self;
+  pool.func = func;
+  pool.user_data = user_data;
+  pool.cancellable = cancellable;
+  pool.max_outstanding = n_threads * 4;
+  pool.pool = g_thread_pool_new (fsck_pool_worker, &pool, n_threads, TRUE, error);
+  if (!pool.pool)
+    return FALSE;
+  pool.completed = g_async_queue_new ();
+
+  OstreeObjectSetIter iter;
+  const guint8 *csum;
+  OstreeObjectType objtype;
+  ostree_object_set_iter_init (&iter, objects);
+  while (pool.error == NULL &&
+         ostree_object_set_iter_next (&iter, &csum, &objtype))
+    {
+      if (g_cancellable_set_error_if_cancelled (cancellable, &pool.error))
+        break;
+
+      while (pool.n_outstanding >= pool.max_outstanding)
+        fsck_pool_complete_one (&pool, g_async_queue_pop (pool.completed));
+
+      FsckJob *job = g_new0 (FsckJob, 1);
+      ostree_checksum_inplace_from_bytes (csum, job->checksum);
+      job->objtype = objtype;
+      pool.n_outstanding++;
+      if (!g_thread_pool_push (pool.pool, job, &pool.error))
+        {
+          pool.n_outstanding--;
+          fsck_job_free (job);
+        }
+    }
+
+  while (pool.n_outstanding > 0)
+    fsck_pool_complete_one (&pool, g_async_queue_pop (pool.completed));
+
+  g_thread_pool_free (pool.pool, FALSE, TRUE);
+  g_async_queue_unref (pool.completed);
+
+  if (pool.error)
+    {
+      g_propagate_error (error, pool.error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/**
+ * ostree_repo_fsck_objects:
+ * @self: Repo
+ * @objects: Set of objects to verify
+ * @n_threads: Number of threads to use; 0 for one per CPU
+ * @func: (scope call) (nullable): Called with the result for each object
+ * @user_data: Data for @func
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Verify each object in @objects as ostree_repo_fsck_object() does,
+ * spreading the work across a pool of @n_threads threads.
+ *
+ * @func is invoked in the calling thread, once per object, in no
+ * particular order, with the error (if any) from verifying that object.
+ * If it returns %FALSE, no further objects are verified and that error is
+ * returned.  If @func is %NULL, the first object which fails verification
+ * causes this function to fail.
+ *
+ * Since: 2017.10
+ */
+gboolean
+ostree_repo_fsck_objects (OstreeRepo               *self,
+                          OstreeObjectSet          *objects,
+                          guint                     n_threads,
+                          OstreeRepoFsckObjectFunc  func,
+                          gpointer                  user_data,
+                          GCancellable             *cancellable,
+                          GError                  **error)
+{
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+
+  if (n_threads > 1)
+    return fsck_objects_threaded (self, objects, n_threads, func, user_data,
+                                  cancellable, error);
+
+  OstreeObjectSetIter iter;
+  const guint8 *csum;
+  OstreeObjectType objtype;
+  ostree_object_set_iter_init (&iter, objects);
+  while (ostree_object_set_iter_next (&iter, &csum, &objtype))
+    {
+      char checksum[OSTREE_SHA256_STRING_LEN+1];
+      g_autoptr(GError) object_error = NULL;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+
+      ostree_checksum_inplace_from_bytes (csum, checksum);
+      (void) ostree_repo_fsck_object (self, objtype, checksum, cancellable, &object_error);
+      if (!fsck_dispatch_result (self, checksum, objtype, &object_error,
+                                 func, user_data, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
@@ -25,6 +25,8 @@
 #include "ostree-ref.h"
 #include "ostree-repo.h"
 #include "ostree-remote-private.h"
+#include "ostree-object-set.h"
+#include "ostree-metadata-cache.h"
 
 G_BEGIN_DECLS
 
@@ -35,8 +37,14 @@ G_BEGIN_DECLS
 #define _OSTREE_SUMMARY_CACHE_DIR "summaries"
 #define _OSTREE_CACHE_DIR "cache"
 
+/* The limits on outstanding fetches and writes during a pull adapt to the
+ * measured throughput; these are the starting points, and the default
+ * bounds, which remotes can override.
+ */
 #define _OSTREE_MAX_OUTSTANDING_FETCHER_REQUESTS 8
-#define _OSTREE_MAX_OUTSTANDING_DELTAPART_REQUESTS 2
+#define _OSTREE_MIN_OUTSTANDING_FETCHER_REQUESTS_LIMIT 2
+#define _OSTREE_MAX_OUTSTANDING_FETCHER_REQUESTS_LIMIT 64
+#define _OSTREE_MAX_OUTSTANDING_DELTAPART_REQUESTS 4
 
 /* In most cases, writing to disk should be much faster than
  * fetching from the network, so we shouldn't actually hit
@@ -45,6 +53,8 @@ G_BEGIN_DECLS
  * situation towards EMFILE.
  * */
 #define _OSTREE_MAX_OUTSTANDING_WRITE_REQUESTS 16
+#define _OSTREE_MIN_OUTSTANDING_WRITE_REQUESTS_LIMIT 4
+#define _OSTREE_MAX_OUTSTANDING_WRITE_REQUESTS_LIMIT 64
 
 /* Well-known keys for the additional metadata field in a summary file. */
 #define OSTREE_SUMMARY_LAST_MODIFIED "ostree.summary.last-modified"
@@ -57,7 +67,8 @@ G_BEGIN_DECLS
 #define OSTREE_COMMIT_TIMESTAMP "ostree.commit.timestamp"
 
 typedef enum {
-  OSTREE_REPO_TEST_ERROR_PRE_COMMIT = (1 << 0)
+  OSTREE_REPO_TEST_ERROR_PRE_COMMIT = (1 << 0),
+  OSTREE_REPO_TEST_ERROR_IMPORT_NO_HARDLINK = (1 << 1)
 } OstreeRepoTestErrorFlags;
 
 struct OstreeRepoCommitModifier {
@@ -74,6 +85,7 @@ struct OstreeRepoCommitModifier {
 
   OstreeSePolicy *sepolicy;
   GHashTable *devino_cache;
+  guint n_threads;
 };
 
 typedef enum {
@@ -83,6 +95,14 @@ typedef enum {
   OSTREE_REPO_SYSROOT_KIND_IS_SYSROOT_OSTREE, /* We match /ostree/repo */
 } OstreeRepoSysrootKind;
 
+/* How rename_pending_loose_objects() makes renamed objects durable; see
+ * core.finalize-sync.
+ */
+typedef enum {
+  OSTREE_REPO_FINALIZE_SYNC_DIRECTORIES, /* fsync() each objects/XX directory */
+  OSTREE_REPO_FINALIZE_SYNC_SYNCFS,      /* A single syncfs() */
+} OstreeRepoFinalizeSync;
+
 /**
  * OstreeRepo:
  *
@@ -119,6 +139,16 @@ struct OstreeRepo {
   guint dirmeta_cache_refcount;
   /* char * checksum → GVariant * for dirmeta objects, used in the checkout path */
   GHashTable *dirmeta_cache;
+  /* Repo-wide LRU cache of dirtree, dirmeta and commit objects; sized by
+   * core.metadata-cache-size, and disabled by default.
+   */
+  OstreeMetadataCache *metadata_cache;
+
+  /* Loose objects known to exist, built lazily during a transaction
+   * if core.object-index is enabled; see _ostree_repo_has_loose_object().
+   */
+  GMutex object_index_lock;
+  OstreeObjectSet *object_index;
 
   gboolean inited;
   gboolean writable;
@@ -128,6 +158,7 @@ struct OstreeRepo {
   gboolean disable_fsync;
   gboolean disable_xattrs;
   guint zlib_compression_level;
+  guint zstd_compression_level;
   GHashTable *loose_object_devino_hash;
   GHashTable *updated_uncompressed_dirs;
   GHashTable *object_sizes;
@@ -145,6 +176,8 @@ struct OstreeRepo {
   OstreeRepoMode mode;
   gboolean enable_uncompressed_cache;
   gboolean generate_sizes;
+  gboolean enable_object_index;
+  OstreeRepoFinalizeSync finalize_sync;
   guint64 tmp_expiry_seconds;
   gchar *collection_id;
 
@@ -224,6 +257,19 @@ _ostree_repo_has_loose_object (OstreeRepo           *self,
                                GCancellable         *cancellable,
                                GError             **error);
 
+void
+_ostree_repo_object_index_add (OstreeRepo        *self,
+                               const char        *checksum,
+                               OstreeObjectType   objtype);
+
+void
+_ostree_repo_object_index_remove (OstreeRepo        *self,
+                                  const char        *checksum,
+                                  OstreeObjectType   objtype);
+
+void
+_ostree_repo_object_index_clear (OstreeRepo *self);
+
 gboolean
 _ostree_write_bareuser_metadata (int fd,
                                  guint32       uid,
@@ -353,6 +399,14 @@ _ostree_repo_commit_trusted_content_bare (OstreeRepo          *self,
                                           GCancellable        *cancellable,
                                           GError             **error);
 
+gboolean
+_ostree_repo_commit_trusted_content_archive (OstreeRepo          *self,
+                                             const char          *checksum,
+                                             GFileInfo           *file_info,
+                                             OtCleanupUnlinkat   *tmp_path,
+                                             GCancellable        *cancellable,
+                                             GError             **error);
+
 gboolean
 _ostree_repo_load_file_bare (OstreeRepo         *self,
                              const char         *checksum,
@@ -22,6 +22,7 @@
 
 #include "config.h"
 
+#include "ostree-autocleanups.h"
 #include "ostree-core-private.h"
 #include "ostree-repo-private.h"
 #include "otutil.h"
@@ -29,6 +30,7 @@
 typedef struct {
   OstreeRepo *repo;
   GHashTable *reachable;
+  OstreeObjectSet *reachable_set;
   guint n_reachable_meta;
   guint n_reachable_content;
   guint n_unreachable_meta;
@@ -60,11 +62,17 @@ maybe_prune_loose_object (OtPruneData        *data,
                           GCancellable       *cancellable,
                           GError            **error)
 {
-  g_autoptr(GVariant) key = NULL;
+  gboolean is_reachable;
 
-  key = ostree_object_name_serialize (checksum, objtype);
+  if (data->reachable_set)
+    is_reachable = ostree_object_set_contains (data->reachable_set, checksum, objtype);
+  else
+    {
+      g_autoptr(GVariant) key = ostree_object_name_serialize (checksum, objtype);
+      is_reachable = g_hash_table_lookup_extended (data->reachable, key, NULL, NULL);
+    }
 
-  if (!g_hash_table_lookup_extended (data->reachable, key, NULL, NULL))
+  if (!is_reachable)
     {
       g_debug ("Pruning unneeded object %s.%s", checksum,
                ostree_object_type_to_string (objtype));
@@ -234,9 +242,14 @@ repo_prune_internal (OstreeRepo        *self,
 {
   OtPruneData data = { 0, };
 
+  if ((options->reachable == NULL) == (options->reachable_set == NULL))
+    return glnx_throw (error, "Exactly one of reachable or reachable_set must be specified");
+
   data.repo = self;
+  data.reachable_set = options->reachable_set;
   /* We unref this when we're done */
-  g_autoptr(GHashTable) reachable_owned = g_hash_table_ref (options->reachable);
+  g_autoptr(GHashTable) reachable_owned =
+    options->reachable ? g_hash_table_ref (options->reachable) : NULL;
   data.reachable = reachable_owned;
 
   GLNX_HASH_TABLE_FOREACH_KV (objects, GVariant*, serialized_key, GVariant*, objdata)
@@ -307,7 +320,7 @@ ostree_repo_prune (OstreeRepo        *self,
   g_autoptr(GHashTable) objects = NULL;
   gboolean refs_only = flags & OSTREE_REPO_PRUNE_FLAGS_REFS_ONLY;
 
-  g_autoptr(GHashTable) reachable = ostree_repo_traverse_new_reachable ();
+  g_autoptr(OstreeObjectSet) reachable = ostree_object_set_new ();
 
   /* This original prune API has fixed logic for traversing refs or all commits
    * combined with actually deleting content. The newer backend API just does
@@ -326,8 +339,8 @@ ostree_repo_prune (OstreeRepo        *self,
       GLNX_HASH_TABLE_FOREACH_V (all_refs, const char*, checksum)
         {
           g_debug ("Finding objects to keep for commit %s", checksum);
-          if (!ostree_repo_traverse_commit_union (self, checksum, depth, reachable,
-                                                  cancellable, error))
+          if (!ostree_repo_traverse_commit_union_set (self, checksum, depth, reachable,
+                                                      cancellable, error))
             return FALSE;
         }
 
@@ -341,8 +354,8 @@ ostree_repo_prune (OstreeRepo        *self,
       GLNX_HASH_TABLE_FOREACH_V (all_collection_refs, const char*, checksum)
         {
           g_debug ("Finding objects to keep for commit %s", checksum);
-          if (!ostree_repo_traverse_commit_union (self, checksum, depth, reachable,
-                                                  cancellable, error))
+          if (!ostree_repo_traverse_commit_union_set (self, checksum, depth, reachable,
+                                                      cancellable, error))
             return FALSE;
         }
     }
@@ -364,13 +377,14 @@ ostree_repo_prune (OstreeRepo        *self,
             continue;
 
           g_debug ("Finding objects to keep for commit %s", checksum);
-          if (!ostree_repo_traverse_commit_union (self, checksum, depth, reachable,
-                                                  cancellable, error))
+          if (!ostree_repo_traverse_commit_union_set (self, checksum, depth, reachable,
+                                                      cancellable, error))
             return FALSE;
         }
     }
 
-  { OstreeRepoPruneOptions opts = { flags, reachable };
+  { OstreeRepoPruneOptions opts = { flags, };
+    opts.reachable_set = reachable;
     return repo_prune_internal (self, objects, &opts,
                                 out_objects_total, out_objects_pruned,
                                 out_pruned_object_size_total, cancellable, error);
@@ -396,6 +410,10 @@ ostree_repo_prune (OstreeRepo        *self,
  * retain all commits from a production branch, but just GC some history from
  * your dev branch.
  *
+ * Exactly one of the @reachable or (since 2017.10) @reachable_set members of
+ * @options must be set; the latter is built by
+ * ostree_repo_traverse_commit_union_set() and uses much less memory.
+ *
  * The %OSTREE_REPO_PRUNE_FLAGS_NO_PRUNE flag may be specified to just determine
  * statistics on objects that would be deleted, without actually deleting them.
  */
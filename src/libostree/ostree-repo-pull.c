@@ -36,6 +36,7 @@
 #include "ostree-repo-static-delta-private.h"
 #include "ostree-metalink.h"
 #include "ostree-fetcher-util.h"
+#include "ostree-adaptive-limit.h"
 #include "ostree-remote-private.h"
 #include "ot-fs-utils.h"
 
@@ -59,6 +60,14 @@
 #define OSTREE_REPO_PULL_CONTENT_PRIORITY  (OSTREE_FETCHER_DEFAULT_PRIORITY)
 #define OSTREE_REPO_PULL_METADATA_PRIORITY (OSTREE_REPO_PULL_CONTENT_PRIORITY - 100)
 
+/* Maximum number of content objects to look up locally in one batch; see
+ * queue_resolve_content().
+ */
+#define OSTREE_REPO_PULL_CONTENT_RESOLVE_BATCH_SIZE 512
+
+/* Default for the delta-decode-window remote option */
+#define OSTREE_REPO_PULL_DEFAULT_DELTAPART_DECODE_WINDOW (1024 * 1024)
+
 typedef enum {
   OSTREE_FETCHER_SECURITY_STATE_CA_PINNED,
   OSTREE_FETCHER_SECURITY_STATE_TLS,
@@ -120,7 +129,14 @@ typedef struct {
   guint             n_outstanding_content_fetches;
   guint             n_outstanding_content_write_requests;
   guint             n_outstanding_deltapart_fetches;
-  guint             n_outstanding_deltapart_write_requests;
+  guint             n_outstanding_deltapart_write_requests; /* Includes queued */
+  GQueue            pending_deltapart_executions; /* Queue<FetchStaticDeltaData> */
+  guint             n_executing_deltaparts;
+  guint64           executing_deltapart_usize;
+  OstreeAdaptiveLimit fetch_limit; /* Outstanding fetches */
+  OstreeAdaptiveLimit write_limit; /* Outstanding writes */
+  guint64 deltapart_decode_window; /* See _ostree_delta_part_decoder_new() */
+  guint64           limit_bytes_transferred; /* For fetch_limit */
   guint             n_total_deltaparts;
   guint             n_total_delta_fallbacks;
   guint64           fetched_deltapart_size; /* How much of the delta we have now */
@@ -156,6 +172,9 @@ typedef struct {
 
   GQueue scan_object_queue;
   GSource *idle_src;
+
+  struct ContentResolveBatch *content_resolve_batch; /* Being filled */
+  guint         n_outstanding_content_resolves;
 } OtPullData;
 
 typedef struct {
@@ -180,6 +199,12 @@ typedef struct {
   char *to_revision;
   guint i;
   guint64 size;
+  guint64 usize;
+  /* Set once we have the part, for execution */
+  OstreeDeltaPartDecoder *decoder; /* Fed the part as it was fetched */
+  GInputStream *part_in;
+  GBytes *inline_part_bytes;
+  OstreeStaticDeltaOpenFlags open_flags;
 } FetchStaticDeltaData;
 
 typedef struct {
@@ -190,7 +215,31 @@ typedef struct {
   OstreeCollectionRef *requested_ref;  /* (nullable) */
 } ScanObjectQueueData;
 
+/* Content objects referenced by scanned dirtrees, to be looked up in the
+ * local repo and any localcache repos off the main thread; see
+ * queue_resolve_content().
+ */
+typedef enum {
+  CONTENT_RESOLVE_FETCH,
+  CONTENT_RESOLVE_STORED,
+  CONTENT_RESOLVE_IMPORT, /* From remote_repo_local or localcache_repos */
+} ContentResolveAction;
+
+typedef struct {
+  char checksum[OSTREE_SHA256_STRING_LEN+1];
+  const char *path; /* Owned by the batch */
+  ContentResolveAction action;
+  OstreeRepo *import_repo;
+} ContentResolveEntry;
+
+typedef struct ContentResolveBatch {
+  OtPullData *pull_data;
+  GArray *entries; /* (element-type ContentResolveEntry) */
+  GPtrArray *paths;
+} ContentResolveBatch;
+
 static void start_fetch (OtPullData *pull_data, FetchObjectData *fetch);
+static void flush_content_resolve_batch (OtPullData *pull_data);
 static void start_fetch_deltapart (OtPullData *pull_data,
                                    FetchStaticDeltaData *fetch);
 static gboolean fetcher_queue_is_full (OtPullData *pull_data);
@@ -217,6 +266,57 @@ static gboolean scan_one_metadata_object_c (OtPullData                 *pull_dat
                                             GCancellable               *cancellable,
                                             GError                    **error);
 
+static guint
+pull_n_outstanding_fetches (OtPullData *pull_data)
+{
+  return pull_data->n_outstanding_content_fetches +
+    pull_data->n_outstanding_metadata_fetches +
+    pull_data->n_outstanding_deltapart_fetches;
+}
+
+static guint
+pull_n_outstanding_writes (OtPullData *pull_data)
+{
+  return pull_data->n_outstanding_content_write_requests +
+    pull_data->n_outstanding_metadata_write_requests +
+    pull_data->n_outstanding_deltapart_write_requests;
+}
+
+/* Feed the adaptive fetch limit; call as each fetch completes, before
+ * decrementing its outstanding counter.  Fetch throughput is measured
+ * in bytes, since object sizes vary wildly.
+ */
+static void
+pull_record_fetch_complete (OtPullData *pull_data)
+{
+  guint64 bytes = _ostree_fetcher_bytes_transferred (pull_data->fetcher);
+  guint64 delta = bytes > pull_data->limit_bytes_transferred ?
+    bytes - pull_data->limit_bytes_transferred : 0;
+
+  pull_data->limit_bytes_transferred = bytes;
+  (void) _ostree_adaptive_limit_record (&pull_data->fetch_limit, g_get_monotonic_time (),
+                                        delta, pull_n_outstanding_fetches (pull_data));
+}
+
+/* Likewise for writes, which are measured in completed requests */
+static void
+pull_record_write_complete (OtPullData *pull_data)
+{
+  (void) _ostree_adaptive_limit_record (&pull_data->write_limit, g_get_monotonic_time (),
+                                        1, pull_n_outstanding_writes (pull_data));
+}
+
+/* Whether we still have metadata to scan, or content found by scanning
+ * which we have yet to look up.
+ */
+static gboolean
+pull_is_scanning (OtPullData *pull_data)
+{
+  return !g_queue_is_empty (&pull_data->scan_object_queue) ||
+    pull_data->content_resolve_batch != NULL ||
+    pull_data->n_outstanding_content_resolves > 0;
+}
+
 static gboolean
 update_progress (gpointer user_data)
 {
@@ -238,12 +338,8 @@ update_progress (gpointer user_data)
   if (pull_data->dry_run && pull_data->n_outstanding_metadata_fetches > 0)
     return TRUE;
 
-  outstanding_writes = pull_data->n_outstanding_content_write_requests +
-    pull_data->n_outstanding_metadata_write_requests +
-    pull_data->n_outstanding_deltapart_write_requests;
-  outstanding_fetches = pull_data->n_outstanding_content_fetches +
-    pull_data->n_outstanding_metadata_fetches +
-    pull_data->n_outstanding_deltapart_fetches;
+  outstanding_writes = pull_n_outstanding_writes (pull_data);
+  outstanding_fetches = pull_n_outstanding_fetches (pull_data);
   bytes_transferred = _ostree_fetcher_bytes_transferred (pull_data->fetcher);
   fetched = pull_data->n_fetched_metadata + pull_data->n_fetched_content;
   requested = pull_data->n_requested_metadata + pull_data->n_requested_content;
@@ -253,9 +349,11 @@ update_progress (gpointer user_data)
   ostree_async_progress_set (pull_data->progress,
                              "outstanding-fetches", "u", outstanding_fetches,
                              "outstanding-writes", "u", outstanding_writes,
+                             "fetch-concurrency", "u", pull_data->fetch_limit.limit,
+                             "write-concurrency", "u", pull_data->write_limit.limit,
                              "fetched", "u", fetched,
                              "requested", "u", requested,
-                             "scanning", "u", g_queue_is_empty (&pull_data->scan_object_queue) ? 0 : 1,
+                             "scanning", "u", pull_is_scanning (pull_data) ? 1 : 0,
                              "scanned-metadata", "u", n_scanned_metadata,
                              "bytes-transferred", "t", bytes_transferred,
                              "start-time", "t", start_time,
@@ -301,7 +399,7 @@ pull_termination_condition (OtPullData          *pull_data)
   gboolean current_write_idle = (pull_data->n_outstanding_metadata_write_requests == 0 &&
                                  pull_data->n_outstanding_content_write_requests == 0 &&
                                  pull_data->n_outstanding_deltapart_write_requests == 0 );
-  gboolean current_scan_idle = g_queue_is_empty (&pull_data->scan_object_queue);
+  gboolean current_scan_idle = !pull_is_scanning (pull_data);
   gboolean current_idle = current_fetch_idle && current_write_idle && current_scan_idle;
 
   /* we only enter the main loop when we're fetching objects */
@@ -398,27 +496,26 @@ check_outstanding_requests_handle_error (OtPullData          *pull_data,
     }
 }
 
-/* We have a total-request limit, as well has a hardcoded max of 2 for delta
- * parts. The logic for the delta one is that processing them is expensive, and
- * doing multiple simultaneously could risk space/memory on smaller devices. We
- * also throttle on outstanding writes in case fetches are faster.
+/* We have a total-request limit, as well has a hardcoded max for delta
+ * parts. Executing parts is bounded separately by their uncompressed size
+ * (see start_pending_deltapart_executions()); fetched parts waiting for that
+ * count as outstanding writes, and we also throttle on outstanding writes
+ * in case fetches are faster.
+ *
+ * The request and write limits adapt to the measured throughput, within the
+ * bounds from the remote config; see pull_record_fetch_complete().  Since
+ * they can shrink, we may be over a limit here.
  */
 static gboolean
 fetcher_queue_is_full (OtPullData *pull_data)
 {
   const gboolean fetch_full =
-      ((pull_data->n_outstanding_metadata_fetches +
-        pull_data->n_outstanding_content_fetches +
-        pull_data->n_outstanding_deltapart_fetches) ==
-         _OSTREE_MAX_OUTSTANDING_FETCHER_REQUESTS);
+      (pull_n_outstanding_fetches (pull_data) >= pull_data->fetch_limit.limit);
   const gboolean deltas_full =
       (pull_data->n_outstanding_deltapart_fetches ==
         _OSTREE_MAX_OUTSTANDING_DELTAPART_REQUESTS);
   const gboolean writes_full =
-      ((pull_data->n_outstanding_metadata_write_requests +
-        pull_data->n_outstanding_content_write_requests +
-        pull_data->n_outstanding_deltapart_write_requests) >=
-         _OSTREE_MAX_OUTSTANDING_WRITE_REQUESTS);
+      (pull_n_outstanding_writes (pull_data) >= pull_data->write_limit.limit);
   return fetch_full || deltas_full || writes_full;
 }
 
@@ -432,6 +529,8 @@ idle_worker (gpointer user_data)
   scan_data = g_queue_pop_head (&pull_data->scan_object_queue);
   if (!scan_data)
     {
+      /* Look up whatever content the last dirtrees referenced */
+      flush_content_resolve_batch (pull_data);
       g_clear_pointer (&pull_data->idle_src, (GDestroyNotify) g_source_destroy);
       return G_SOURCE_REMOVE;
     }
@@ -627,6 +726,16 @@ validate_bareuseronly_mode (OtPullData *pull_data,
   return TRUE;
 }
 
+/* Whether content objects as fetched from the remote are in the format we
+ * store them in, i.e. we're an archive repo of the same mode.
+ */
+static gboolean
+pull_can_store_fetched_content (OtPullData *pull_data)
+{
+  return _ostree_repo_mode_is_archive (pull_data->repo->mode)
+    && pull_data->repo->mode == pull_data->remote_mode;
+}
+
 /* Synchronously import a single content object; this is used async for content,
  * or synchronously for metadata. @src_repo is either
  * pull_data->remote_repo_local or one of pull_data->localcache_repos.
@@ -761,10 +870,181 @@ on_local_object_imported (GObject        *object,
 
  out:
   g_assert_cmpint (pull_data->n_outstanding_content_write_requests, >, 0);
+  pull_record_write_complete (pull_data);
   pull_data->n_outstanding_content_write_requests--;
   check_outstanding_requests_handle_error (pull_data, &local_error);
 }
 
+static void
+content_resolve_batch_free (ContentResolveBatch *batch)
+{
+  g_array_unref (batch->entries);
+  g_ptr_array_unref (batch->paths);
+  g_free (batch);
+}
+
+/* Runs in a worker thread; decides what to do with each object.  We sort
+ * the batch first so that lookups walk the objects/ directories in order.
+ */
+static void
+resolve_content_in_thread (GTask        *task,
+                           gpointer      source,
+                           gpointer      task_data,
+                           GCancellable *cancellable)
+{
+  ContentResolveBatch *batch = task_data;
+  OtPullData *pull_data = batch->pull_data;
+  g_autoptr(GError) local_error = NULL;
+
+  g_array_sort (batch->entries, (GCompareFunc) strcmp);
+
+  for (guint i = 0; i < batch->entries->len; i++)
+    {
+      ContentResolveEntry *entry = &g_array_index (batch->entries, ContentResolveEntry, i);
+      gboolean is_stored;
+
+      if (!ostree_repo_has_object (pull_data->repo, OSTREE_OBJECT_TYPE_FILE, entry->checksum,
+                                   &is_stored, cancellable, &local_error))
+        break;
+      if (is_stored)
+        {
+          entry->action = CONTENT_RESOLVE_STORED;
+          continue;
+        }
+
+      /* Is this a local repo? */
+      if (pull_data->remote_repo_local)
+        {
+          entry->action = CONTENT_RESOLVE_IMPORT;
+          entry->import_repo = pull_data->remote_repo_local;
+          continue;
+        }
+
+      /* We're doing HTTP, but see if we have the object in a local cache first */
+      entry->action = CONTENT_RESOLVE_FETCH;
+      for (guint j = 0; pull_data->localcache_repos && j < pull_data->localcache_repos->len; j++)
+        {
+          OstreeRepo *localcache_repo = pull_data->localcache_repos->pdata[j];
+          gboolean localcache_repo_has_obj;
+
+          if (!ostree_repo_has_object (localcache_repo, OSTREE_OBJECT_TYPE_FILE, entry->checksum,
+                                       &localcache_repo_has_obj, cancellable, &local_error))
+            break;
+          if (localcache_repo_has_obj)
+            {
+              entry->action = CONTENT_RESOLVE_IMPORT;
+              entry->import_repo = localcache_repo;
+              break;
+            }
+        }
+      if (local_error)
+        break;
+    }
+
+  if (local_error)
+    g_task_return_error (task, g_steal_pointer (&local_error));
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+static void
+on_content_resolved (GObject        *object,
+                     GAsyncResult   *result,
+                     gpointer        user_data)
+{
+  OtPullData *pull_data = user_data;
+  ContentResolveBatch *batch = g_task_get_task_data ((GTask*)result);
+  g_autoptr(GError) local_error = NULL;
+
+  if (!g_task_propagate_boolean ((GTask*)result, &local_error))
+    goto out;
+
+  for (guint i = 0; i < batch->entries->len; i++)
+    {
+      const ContentResolveEntry *entry = &g_array_index (batch->entries, ContentResolveEntry, i);
+
+      switch (entry->action)
+        {
+        case CONTENT_RESOLVE_STORED:
+          break;
+        case CONTENT_RESOLVE_IMPORT:
+          async_import_one_local_content_object (pull_data, entry->import_repo,
+                                                 entry->checksum, pull_data->cancellable,
+                                                 on_local_object_imported, pull_data);
+          if (entry->import_repo != pull_data->remote_repo_local)
+            pull_data->n_fetched_localcache_content++;
+          break;
+        case CONTENT_RESOLVE_FETCH:
+          /* Not available locally, queue a HTTP request */
+          enqueue_one_object_request (pull_data, entry->checksum, OSTREE_OBJECT_TYPE_FILE,
+                                      entry->path, FALSE, FALSE, NULL);
+          break;
+        }
+    }
+
+ out:
+  g_assert_cmpuint (pull_data->n_outstanding_content_resolves, >, 0);
+  pull_data->n_outstanding_content_resolves--;
+  check_outstanding_requests_handle_error (pull_data, &local_error);
+}
+
+/* Start looking up the objects in the current batch, if any */
+static void
+flush_content_resolve_batch (OtPullData *pull_data)
+{
+  ContentResolveBatch *batch = g_steal_pointer (&pull_data->content_resolve_batch);
+  if (batch == NULL)
+    return;
+
+  g_autoptr(GTask) task = g_task_new (pull_data->repo, pull_data->cancellable,
+                                      on_content_resolved, pull_data);
+  g_task_set_source_tag (task, flush_content_resolve_batch);
+  g_task_set_task_data (task, batch, (GDestroyNotify) content_resolve_batch_free);
+  pull_data->n_outstanding_content_resolves++;
+  g_task_run_in_thread (task, resolve_content_in_thread);
+}
+
+/* Queue content object @checksum, referenced from the dirtree at @path, to
+ * be looked up in the local repo and the localcache repos.  Rather than
+ * doing a synchronous lookup per object on the main loop (which also
+ * drives the fetcher), they're checked in batches in a worker thread, and
+ * fetches or imports are queued once the results come back.
+ *
+ * @inout_batch_path caches the copy of @path in the current batch.
+ */
+static void
+queue_resolve_content (OtPullData  *pull_data,
+                       const char  *checksum,
+                       const char  *path,
+                       const char **inout_batch_path)
+{
+  ContentResolveBatch *batch = pull_data->content_resolve_batch;
+
+  if (batch == NULL)
+    {
+      batch = pull_data->content_resolve_batch = g_new0 (ContentResolveBatch, 1);
+      batch->pull_data = pull_data;
+      batch->entries = g_array_new (FALSE, TRUE, sizeof (ContentResolveEntry));
+      batch->paths = g_ptr_array_new_with_free_func (g_free);
+      *inout_batch_path = NULL;
+    }
+
+  if (*inout_batch_path == NULL)
+    {
+      char *path_copy = g_strdup (path);
+      g_ptr_array_add (batch->paths, path_copy);
+      *inout_batch_path = path_copy;
+    }
+
+  ContentResolveEntry entry = { { 0, }, };
+  memcpy (entry.checksum, checksum, OSTREE_SHA256_STRING_LEN);
+  entry.path = *inout_batch_path;
+  g_array_append_val (batch->entries, entry);
+
+  if (batch->entries->len >= OSTREE_REPO_PULL_CONTENT_RESOLVE_BATCH_SIZE)
+    flush_content_resolve_batch (pull_data);
+}
+
 static gboolean
 scan_dirtree_object (OtPullData   *pull_data,
                      const char   *checksum,
@@ -781,10 +1061,10 @@ scan_dirtree_object (OtPullData   *pull_data,
   /* PARSE OSTREE_SERIALIZED_TREE_VARIANT */
   g_autoptr(GVariant) files_variant = g_variant_get_child_value (tree, 0);
   const guint n = g_variant_n_children (files_variant);
+  const char *batch_path = NULL;
   for (guint i = 0; i < n; i++)
     {
       const char *filename;
-      gboolean file_is_stored;
       g_autoptr(GVariant) csum = NULL;
       g_autofree char *file_checksum = NULL;
 
@@ -800,59 +1080,13 @@ scan_dirtree_object (OtPullData   *pull_data,
 
       file_checksum = ostree_checksum_from_bytes_v (csum);
 
-      if (!ostree_repo_has_object (pull_data->repo, OSTREE_OBJECT_TYPE_FILE, file_checksum,
-                                   &file_is_stored, cancellable, error))
-        return FALSE;
-
-      /* If we already have this object, move on to the next */
-      if (file_is_stored)
-        continue;
-
       /* Already have a request pending?  If so, move on to the next */
       if (g_hash_table_lookup (pull_data->requested_content, file_checksum))
         continue;
 
-      /* Is this a local repo? */
-      if (pull_data->remote_repo_local)
-        {
-          async_import_one_local_content_object (pull_data, pull_data->remote_repo_local,
-                                                 file_checksum, cancellable,
-                                                 on_local_object_imported,
-                                                 pull_data);
-          g_hash_table_add (pull_data->requested_content, g_steal_pointer (&file_checksum));
-          /* Note early loop continue */
-          continue;
-        }
-
-      /* We're doing HTTP, but see if we have the object in a local cache first */
-      gboolean did_import_from_cache_repo = FALSE;
-      if (pull_data->localcache_repos)
-        {
-          for (guint j = 0; j < pull_data->localcache_repos->len; j++)
-            {
-              OstreeRepo *localcache_repo = pull_data->localcache_repos->pdata[j];
-              gboolean localcache_repo_has_obj;
-
-              if (!ostree_repo_has_object (localcache_repo, OSTREE_OBJECT_TYPE_FILE, file_checksum,
-                                           &localcache_repo_has_obj, cancellable, error))
-                return FALSE;
-              if (!localcache_repo_has_obj)
-                continue;
-              async_import_one_local_content_object (pull_data, localcache_repo, file_checksum, cancellable,
-                                                     on_local_object_imported, pull_data);
-              g_hash_table_add (pull_data->requested_content, g_steal_pointer (&file_checksum));
-              did_import_from_cache_repo = TRUE;
-              pull_data->n_fetched_localcache_content++;
-              break;
-            }
-        }
-      if (did_import_from_cache_repo)
-        continue; /* Note early continue */
-
-      /* Not available locally, queue a HTTP request */
-      g_hash_table_add (pull_data->requested_content, file_checksum);
-      enqueue_one_object_request (pull_data, file_checksum, OSTREE_OBJECT_TYPE_FILE, path, FALSE, FALSE, NULL);
-      file_checksum = NULL;  /* Transfer ownership */
+      /* Otherwise, we'll look for it locally along with its neighbours */
+      queue_resolve_content (pull_data, file_checksum, path, &batch_path);
+      g_hash_table_add (pull_data->requested_content, g_steal_pointer (&file_checksum));
     }
 
   g_autoptr(GVariant) dirs_variant = g_variant_get_child_value (tree, 1);
@@ -1031,6 +1265,7 @@ content_fetch_on_write_complete (GObject        *object,
   if (g_hash_table_remove (pull_data->requested_fallback_content, expected_checksum))
     pull_data->n_fetched_deltapart_fallbacks++;
  out:
+  pull_record_write_complete (pull_data);
   pull_data->n_outstanding_content_write_requests--;
   check_outstanding_requests_handle_error (pull_data, &local_error);
   fetch_object_data_free (fetch_data);
@@ -1053,12 +1288,14 @@ content_fetch_on_complete (GObject        *object,
   g_autoptr(GInputStream) file_in = NULL;
   g_autoptr(GInputStream) object_input = NULL;
   g_auto(OtCleanupUnlinkat) tmp_unlinker = { _ostree_fetcher_get_dfd (fetcher), NULL };
+  g_autoptr(OstreeContentChecksum) content_checksum = NULL;
   const char *checksum;
   g_autofree char *checksum_obj = NULL;
   OstreeObjectType objtype;
   gboolean free_fetch_data = TRUE;
 
-  if (!_ostree_fetcher_request_to_tmpfile_finish (fetcher, result, &tmp_unlinker.path, error))
+  if (!_ostree_fetcher_request_content_to_tmpfile_finish (fetcher, result, &tmp_unlinker.path,
+                                                          &content_checksum, error))
     goto out;
 
   ostree_object_name_deserialize (fetch_data->object, &checksum, &objtype);
@@ -1067,13 +1304,38 @@ content_fetch_on_complete (GObject        *object,
   checksum_obj = ostree_object_to_string (checksum, objtype);
   g_debug ("fetch of %s complete", checksum_obj);
 
-  /* If we're mirroring and writing into an archive repo, we can directly copy
-   * the content rather than paying the cost of exploding it, checksumming, and
-   * re-gzip.
+  /* If the fetcher checksummed the object as it arrived, we already know
+   * whether it's valid without reading it back.
    */
-  if (pull_data->is_mirror && pull_data->repo->mode == OSTREE_REPO_MODE_ARCHIVE_Z2
-      && !pull_data->is_bareuseronly_files)
+  if (content_checksum)
     {
+      char actual_checksum[OSTREE_SHA256_STRING_LEN+1];
+      g_autoptr(GFileInfo) verified_file_info = NULL;
+
+      if (!_ostree_content_checksum_finish (content_checksum, actual_checksum,
+                                            &verified_file_info, NULL, error))
+        {
+          g_prefix_error (error, "Corrupted content object %s: ", checksum);
+          goto out;
+        }
+
+      if (strcmp (checksum, actual_checksum) != 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Corrupted content object; checksum expected='%s' actual='%s'",
+                       checksum, actual_checksum);
+          goto out;
+        }
+
+      /* Since it's in the same format as our repo, it can be stored as is */
+      g_assert (pull_can_store_fetched_content (pull_data));
+
+      if (!validate_bareuseronly_mode (pull_data,
+                                       checksum,
+                                       g_file_info_get_attribute_uint32 (verified_file_info, "unix::mode"),
+                                       error))
+        goto out;
+
       gboolean have_object;
       if (!ostree_repo_has_object (pull_data->repo, OSTREE_OBJECT_TYPE_FILE, checksum,
                                    &have_object,
@@ -1082,22 +1344,26 @@ content_fetch_on_complete (GObject        *object,
 
       if (!have_object)
         {
-          if (!_ostree_repo_commit_path_final (pull_data->repo, checksum, objtype,
-                                               &tmp_unlinker,
-                                               cancellable, error))
+          if (!_ostree_repo_commit_trusted_content_archive (pull_data->repo, checksum,
+                                                            verified_file_info,
+                                                            &tmp_unlinker,
+                                                            cancellable, error))
             goto out;
         }
       pull_data->n_fetched_content++;
+      /* Was this a delta fallback? */
+      if (g_hash_table_remove (pull_data->requested_fallback_content, checksum))
+        pull_data->n_fetched_deltapart_fallbacks++;
     }
   else
     {
       /* Non-mirroring path */
 
       /* If it appears corrupted, we'll delete it below */
-      if (!ostree_content_file_parse_at (TRUE, _ostree_fetcher_get_dfd (fetcher),
-                                         tmp_unlinker.path, FALSE,
-                                         &file_in, &file_info, &xattrs,
-                                         cancellable, error))
+      if (!_ostree_content_file_parse_at (pull_data->remote_mode, _ostree_fetcher_get_dfd (fetcher),
+                                          tmp_unlinker.path, FALSE,
+                                          &file_in, &file_info, &xattrs,
+                                          cancellable, error))
         goto out;
 
       /* Also, delete it now that we've opened it, we'll hold
@@ -1126,6 +1392,7 @@ content_fetch_on_complete (GObject        *object,
     }
 
  out:
+  pull_record_fetch_complete (pull_data);
   pull_data->n_outstanding_content_fetches--;
   check_outstanding_requests_handle_error (pull_data, &local_error);
   if (free_fetch_data)
@@ -1170,6 +1437,7 @@ on_metadata_written (GObject           *object,
   queue_scan_one_metadata_object_c (pull_data, csum, objtype, fetch_data->path, 0, fetch_data->requested_ref);
 
  out:
+  pull_record_write_complete (pull_data);
   pull_data->n_outstanding_metadata_write_requests--;
   fetch_object_data_free (fetch_data);
 
@@ -1289,6 +1557,7 @@ meta_fetch_on_complete (GObject           *object,
 
  out:
   g_assert (pull_data->n_outstanding_metadata_fetches > 0);
+  pull_record_fetch_complete (pull_data);
   pull_data->n_outstanding_metadata_fetches--;
   pull_data->n_fetched_metadata++;
   check_outstanding_requests_handle_error (pull_data, &local_error);
@@ -1304,9 +1573,60 @@ fetch_static_delta_data_free (gpointer  data)
   g_variant_unref (fetch_data->objects);
   g_free (fetch_data->from_revision);
   g_free (fetch_data->to_revision);
+  g_clear_pointer (&fetch_data->decoder, _ostree_delta_part_decoder_free);
+  g_clear_object (&fetch_data->part_in);
+  g_clear_pointer (&fetch_data->inline_part_bytes, g_bytes_unref);
   g_free (fetch_data);
 }
 
+static void on_static_delta_written (GObject      *object,
+                                     GAsyncResult *result,
+                                     gpointer      user_data);
+
+/* Start executing as many queued delta parts as fit in our budget; see
+ * _ostree_static_delta_part_execution_fits().  They're started in order, so
+ * a large part isn't starved by smaller ones behind it.
+ */
+static void
+start_pending_deltapart_executions (OtPullData *pull_data)
+{
+  FetchStaticDeltaData *fetch_data;
+
+  while ((fetch_data = g_queue_peek_head (&pull_data->pending_deltapart_executions)) != NULL)
+    {
+      if (!_ostree_static_delta_part_execution_fits (pull_data->n_executing_deltaparts,
+                                                     pull_data->executing_deltapart_usize,
+                                                     fetch_data->usize))
+        break;
+
+      (void) g_queue_pop_head (&pull_data->pending_deltapart_executions);
+      pull_data->n_executing_deltaparts++;
+      pull_data->executing_deltapart_usize += fetch_data->usize;
+      _ostree_static_delta_part_execute_async (pull_data->repo,
+                                               fetch_data->objects,
+                                               g_steal_pointer (&fetch_data->decoder),
+                                               fetch_data->part_in,
+                                               fetch_data->inline_part_bytes,
+                                               fetch_data->open_flags,
+                                               fetch_data->expected_checksum,
+                                               pull_data->cancellable,
+                                               on_static_delta_written,
+                                               fetch_data);
+    }
+}
+
+/* Queue a delta part whose data we have for decompression and execution in
+ * a worker thread; takes ownership of @fetch_data.
+ */
+static void
+queue_execute_deltapart (OtPullData           *pull_data,
+                         FetchStaticDeltaData *fetch_data)
+{
+  g_queue_push_tail (&pull_data->pending_deltapart_executions, fetch_data);
+  pull_data->n_outstanding_deltapart_write_requests++;
+  start_pending_deltapart_executions (pull_data);
+}
+
 static void
 on_static_delta_written (GObject           *object,
                          GAsyncResult      *result,
@@ -1324,7 +1644,13 @@ on_static_delta_written (GObject           *object,
 
  out:
   g_assert (pull_data->n_outstanding_deltapart_write_requests > 0);
+  g_assert (pull_data->n_executing_deltaparts > 0);
+  pull_record_write_complete (pull_data);
   pull_data->n_outstanding_deltapart_write_requests--;
+  pull_data->n_executing_deltaparts--;
+  pull_data->executing_deltapart_usize -= fetch_data->usize;
+  if (local_error == NULL)
+    start_pending_deltapart_executions (pull_data);
   check_outstanding_requests_handle_error (pull_data, &local_error);
   /* Always free state */
   fetch_static_delta_data_free (fetch_data);
@@ -1339,8 +1665,6 @@ static_deltapart_fetch_on_complete (GObject           *object,
   FetchStaticDeltaData *fetch_data = user_data;
   OtPullData *pull_data = fetch_data->pull_data;
   g_autofree char *temp_path = NULL;
-  g_autoptr(GInputStream) in = NULL;
-  g_autoptr(GVariant) part = NULL;
   g_autoptr(GError) local_error = NULL;
   GError **error = &local_error;
   glnx_fd_close int fd = -1;
@@ -1348,7 +1672,8 @@ static_deltapart_fetch_on_complete (GObject           *object,
 
   g_debug ("fetch static delta part %s complete", fetch_data->expected_checksum);
 
-  if (!_ostree_fetcher_request_to_tmpfile_finish (fetcher, result, &temp_path, error))
+  if (!_ostree_fetcher_request_to_tmpfile_with_sink_finish (fetcher, result, &temp_path,
+                                                            (gpointer*)&fetch_data->decoder, error))
     goto out;
 
   if (!glnx_openat_rdonly (_ostree_fetcher_get_dfd (fetcher), temp_path, TRUE, &fd, error))
@@ -1361,24 +1686,18 @@ static_deltapart_fetch_on_complete (GObject           *object,
       goto out;
     }
 
-  in = g_unix_input_stream_new (fd, FALSE);
-
-  /* TODO - make async */
-  if (!_ostree_static_delta_part_open (in, NULL, 0, fetch_data->expected_checksum,
-                                       &part, pull_data->cancellable, error))
-    goto out;
-
-  _ostree_static_delta_part_execute_async (pull_data->repo,
-                                           fetch_data->objects,
-                                           part,
-                                           pull_data->cancellable,
-                                           on_static_delta_written,
-                                           fetch_data);
-  pull_data->n_outstanding_deltapart_write_requests++;
+  /* The decoder may still be catching up; we wait for it when executing
+   * the part, off the main loop.  If it fell behind, decompression and
+   * checksum verification happen from the fetched file instead.
+   */
+  fetch_data->open_flags = OSTREE_STATIC_DELTA_OPEN_FLAGS_NONE;
+  fetch_data->part_in = g_unix_input_stream_new (glnx_steal_fd (&fd), TRUE);
+  queue_execute_deltapart (pull_data, fetch_data);
   free_fetch_data = FALSE;
 
  out:
   g_assert (pull_data->n_outstanding_deltapart_fetches > 0);
+  pull_record_fetch_complete (pull_data);
   pull_data->n_outstanding_deltapart_fetches--;
   pull_data->n_fetched_deltaparts++;
   check_outstanding_requests_handle_error (pull_data, &local_error);
@@ -1960,7 +2279,7 @@ start_fetch (OtPullData *pull_data,
     }
   else
     {
-      obj_subpath = _ostree_get_relative_object_path (expected_checksum, objtype, TRUE);
+      obj_subpath = _ostree_get_relative_object_path (expected_checksum, objtype, pull_data->remote_mode);
       mirrorlist = pull_data->content_mirrorlist;
     }
 
@@ -1975,12 +2294,26 @@ start_fetch (OtPullData *pull_data,
   else
     expected_max_size = 0;
 
-  _ostree_fetcher_request_to_tmpfile (pull_data->fetcher, mirrorlist,
-                                      obj_subpath, flags, expected_max_size,
-                                      is_meta ? OSTREE_REPO_PULL_METADATA_PRIORITY
-                                      : OSTREE_REPO_PULL_CONTENT_PRIORITY,
-                                      pull_data->cancellable,
-                                      is_meta ? meta_fetch_on_complete : content_fetch_on_complete, fetch);
+  if (is_meta)
+    _ostree_fetcher_request_to_tmpfile (pull_data->fetcher, mirrorlist,
+                                        obj_subpath, flags, expected_max_size,
+                                        OSTREE_REPO_PULL_METADATA_PRIORITY,
+                                        pull_data->cancellable,
+                                        meta_fetch_on_complete, fetch);
+  else if (pull_can_store_fetched_content (pull_data))
+    /* Verify the object as it's downloaded, so it can be stored as is */
+    _ostree_fetcher_request_content_to_tmpfile (pull_data->fetcher, mirrorlist,
+                                                obj_subpath, pull_data->remote_mode,
+                                                flags, expected_max_size,
+                                                OSTREE_REPO_PULL_CONTENT_PRIORITY,
+                                                pull_data->cancellable,
+                                                content_fetch_on_complete, fetch);
+  else
+    _ostree_fetcher_request_to_tmpfile (pull_data->fetcher, mirrorlist,
+                                        obj_subpath, flags, expected_max_size,
+                                        OSTREE_REPO_PULL_CONTENT_PRIORITY,
+                                        pull_data->cancellable,
+                                        content_fetch_on_complete, fetch);
 }
 
 static gboolean
@@ -2072,6 +2405,12 @@ process_one_static_delta_fallback (OtPullData   *pull_data,
   return TRUE;
 }
 
+static const OstreeFetcherSinkFuncs deltapart_decoder_sink_funcs = {
+  (void (*)(gpointer, const guint8 *, gsize)) _ostree_delta_part_decoder_update,
+  (void (*)(gpointer)) _ostree_delta_part_decoder_reset,
+  (GDestroyNotify) _ostree_delta_part_decoder_free,
+};
+
 static void
 start_fetch_deltapart (OtPullData *pull_data,
                        FetchStaticDeltaData *fetch)
@@ -2079,13 +2418,17 @@ start_fetch_deltapart (OtPullData *pull_data,
   g_autofree char *deltapart_path = _ostree_get_relative_static_delta_part_path (fetch->from_revision, fetch->to_revision, fetch->i);
   pull_data->n_outstanding_deltapart_fetches++;
   g_assert_cmpint (pull_data->n_outstanding_deltapart_fetches, <=, _OSTREE_MAX_OUTSTANDING_DELTAPART_REQUESTS);
-  _ostree_fetcher_request_to_tmpfile (pull_data->fetcher,
-                                      pull_data->content_mirrorlist,
-                                      deltapart_path, 0, fetch->size,
-                                      OSTREE_FETCHER_DEFAULT_PRIORITY,
-                                      pull_data->cancellable,
-                                      static_deltapart_fetch_on_complete,
-                                      fetch);
+  /* Verify and decompress the part in the background while it's being
+   * downloaded */
+  _ostree_fetcher_request_to_tmpfile_with_sink (pull_data->fetcher,
+                                                pull_data->content_mirrorlist,
+                                                deltapart_path, 0, fetch->size,
+                                                OSTREE_FETCHER_DEFAULT_PRIORITY,
+                                                &deltapart_decoder_sink_funcs,
+                                                _ostree_delta_part_decoder_new (pull_data->deltapart_decode_window),
+                                                pull_data->cancellable,
+                                                static_deltapart_fetch_on_complete,
+                                                fetch);
 }
 
 static gboolean
@@ -2252,27 +2595,16 @@ process_one_static_delta (OtPullData                 *pull_data,
       fetch_data->objects = g_variant_ref (objects);
       fetch_data->expected_checksum = ostree_checksum_from_bytes_v (csum_v);
       fetch_data->size = size;
+      fetch_data->usize = usize;
       fetch_data->i = i;
 
       if (inline_part_bytes != NULL)
         {
-          g_autoptr(GInputStream) memin = g_memory_input_stream_new_from_bytes (inline_part_bytes);
-          g_autoptr(GVariant) inline_delta_part = NULL;
-
+          fetch_data->part_in = g_memory_input_stream_new_from_bytes (inline_part_bytes);
+          fetch_data->inline_part_bytes = g_steal_pointer (&inline_part_bytes);
           /* For inline parts we are relying on per-commit GPG, so don't bother checksumming. */
-          if (!_ostree_static_delta_part_open (memin, inline_part_bytes,
-                                               OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM,
-                                               NULL, &inline_delta_part,
-                                               cancellable, error))
-            goto out;
-
-          _ostree_static_delta_part_execute_async (pull_data->repo,
-                                                   fetch_data->objects,
-                                                   inline_delta_part,
-                                                   pull_data->cancellable,
-                                                   on_static_delta_written,
-                                                   fetch_data);
-          pull_data->n_outstanding_deltapart_write_requests++;
+          fetch_data->open_flags = OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM;
+          queue_execute_deltapart (pull_data, fetch_data);
         }
       else
         {
@@ -2490,6 +2822,7 @@ on_superblock_fetched (GObject   *src,
     ostree_collection_ref_free (fdata->requested_ref);
   g_free (fdata);
   g_assert (pull_data->n_outstanding_metadata_fetches > 0);
+  pull_record_fetch_complete (pull_data);
   pull_data->n_outstanding_metadata_fetches--;
   pull_data->n_fetched_metadata++;
   check_outstanding_requests_handle_error (pull_data, &local_error);
@@ -3021,6 +3354,48 @@ repo_remote_fetch_summary (OstreeRepo    *self,
   return ret;
 }
 
+/* Read the @prefix-min and @prefix-max bounds for an adaptive limit from
+ * the remote config, and initialize @limit with them.
+ */
+static gboolean
+init_remote_adaptive_limit (OstreeRepo          *self,
+                            const char          *remote_name,
+                            const char          *prefix,
+                            guint                default_min,
+                            guint                default_max,
+                            guint                initial,
+                            OstreeAdaptiveLimit *limit,
+                            GError             **error)
+{
+  g_autofree char *min_key = g_strconcat (prefix, "-min", NULL);
+  g_autofree char *max_key = g_strconcat (prefix, "-max", NULL);
+  g_autofree char *min_str = NULL;
+  g_autofree char *max_str = NULL;
+
+  if (!ostree_repo_get_remote_option (self, remote_name, min_key, NULL,
+                                      &min_str, error))
+    return FALSE;
+  if (!ostree_repo_get_remote_option (self, remote_name, max_key, NULL,
+                                      &max_str, error))
+    return FALSE;
+
+  guint64 min_limit = min_str ? g_ascii_strtoull (min_str, NULL, 10) : default_min;
+  guint64 max_limit = max_str ? g_ascii_strtoull (max_str, NULL, 10) : default_max;
+
+  /* Let a remote which only sets one bound move the other out of the way */
+  if (min_str && !max_str)
+    max_limit = MAX (max_limit, min_limit);
+  else if (max_str && !min_str)
+    min_limit = MIN (min_limit, max_limit);
+
+  if (min_limit == 0 || min_limit > max_limit || max_limit > G_MAXUINT)
+    return glnx_throw (error, "Invalid %s/%s for remote \"%s\"",
+                       min_key, max_key, remote_name);
+
+  _ostree_adaptive_limit_init (limit, min_limit, max_limit, initial);
+  return TRUE;
+}
+
 /* Create the fetcher by unioning options from the remote config, plus
  * any options specific to this pull (such as extra headers).
  */
@@ -3038,6 +3413,31 @@ reinitialize_fetcher (OtPullData *pull_data, const char *remote_name,
   if (pull_data->extra_headers)
     _ostree_fetcher_set_extra_headers (pull_data->fetcher, pull_data->extra_headers);
 
+  if (!init_remote_adaptive_limit (pull_data->repo, remote_name, "fetch-concurrency",
+                                   _OSTREE_MIN_OUTSTANDING_FETCHER_REQUESTS_LIMIT,
+                                   _OSTREE_MAX_OUTSTANDING_FETCHER_REQUESTS_LIMIT,
+                                   _OSTREE_MAX_OUTSTANDING_FETCHER_REQUESTS,
+                                   &pull_data->fetch_limit, error))
+    return FALSE;
+  if (!init_remote_adaptive_limit (pull_data->repo, remote_name, "write-concurrency",
+                                   _OSTREE_MIN_OUTSTANDING_WRITE_REQUESTS_LIMIT,
+                                   _OSTREE_MAX_OUTSTANDING_WRITE_REQUESTS_LIMIT,
+                                   _OSTREE_MAX_OUTSTANDING_WRITE_REQUESTS,
+                                   &pull_data->write_limit, error))
+    return FALSE;
+  pull_data->limit_bytes_transferred = 0;
+
+  g_autofree char *decode_window_str = NULL;
+  if (!ostree_repo_get_remote_option (pull_data->repo, remote_name, "delta-decode-window", NULL,
+                                      &decode_window_str, error))
+    return FALSE;
+  pull_data->deltapart_decode_window = decode_window_str ?
+    g_ascii_strtoull (decode_window_str, NULL, 10) : OSTREE_REPO_PULL_DEFAULT_DELTAPART_DECODE_WINDOW;
+
+  /* Allow enough connections for the largest number of requests we'll make */
+  _ostree_fetcher_set_max_connections (pull_data->fetcher,
+                                       pull_data->fetch_limit.max_limit);
+
   return TRUE;
 }
 
@@ -3361,6 +3761,7 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
     }
 
   g_queue_init (&pull_data->scan_object_queue);
+  g_queue_init (&pull_data->pending_deltapart_executions);
 
   pull_data->start_time = g_get_monotonic_time ();
 
@@ -3569,13 +3970,15 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
                                                 &pull_data->has_tombstone_commits, error))
         goto out;
 
-      if (pull_data->remote_mode != OSTREE_REPO_MODE_ARCHIVE_Z2)
+      if (!_ostree_repo_mode_is_archive (pull_data->remote_mode))
         {
           g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                        "Can't pull from archives with mode \"%s\"",
                        remote_mode_str);
           goto out;
         }
+      if (!_ostree_repo_mode_check_supported (pull_data->remote_mode, error))
+        goto out;
     }
   }
 
@@ -3589,8 +3992,8 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
 
     }
 
-  /* We can't use static deltas if pulling into an archive-z2 repo. */
-  if (self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2)
+  /* We can't use static deltas if pulling into an archive repo. */
+  if (_ostree_repo_mode_is_archive (self->mode))
     {
       if (pull_data->require_static_deltas)
         {
@@ -4222,7 +4625,10 @@ ostree_repo_pull_with_options (OstreeRepo             *self,
   g_clear_pointer (&pull_data->pending_fetch_content, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->pending_fetch_metadata, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&pull_data->pending_fetch_deltaparts, (GDestroyNotify) g_hash_table_unref);
+  g_queue_foreach (&pull_data->pending_deltapart_executions, (GFunc) fetch_static_delta_data_free, NULL);
+  g_queue_clear (&pull_data->pending_deltapart_executions);
   g_clear_pointer (&pull_data->idle_src, (GDestroyNotify) g_source_destroy);
+  g_clear_pointer (&pull_data->content_resolve_batch, (GDestroyNotify) content_resolve_batch_free);
   g_clear_pointer (&pull_data->dirs, (GDestroyNotify) g_ptr_array_unref);
   g_clear_pointer (&remote_config, (GDestroyNotify) g_key_file_unref);
   return ret;
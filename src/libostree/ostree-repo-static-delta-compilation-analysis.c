@@ -187,6 +187,25 @@ build_content_sizenames_filtered (OstreeRepo              *repo,
   return ret;
 }
 
+typedef struct {
+  OstreeRepo *repo;
+  GVariant *commit;
+  GPtrArray *sizenames;
+  GCancellable *cancellable;
+  GError *error;
+} BuildContentSizenamesData;
+
+static gpointer
+build_content_sizenames_thread (gpointer data)
+{
+  BuildContentSizenamesData *bdata = data;
+
+  (void) build_content_sizenames_filtered (bdata->repo, bdata->commit, NULL,
+                                           &bdata->sizenames,
+                                           bdata->cancellable, &bdata->error);
+  return NULL;
+}
+
 static gboolean
 string_array_nonempty_intersection (GPtrArray    *a,
                                     GPtrArray    *b,
@@ -225,6 +244,9 @@ string_array_nonempty_intersection (GPtrArray    *a,
  * @new_reachable_regfile_content is a Set<checksum> of new regular
  * file objects.
  *
+ * If @n_threads is greater than one, the two commits are traversed
+ * concurrently.
+ *
  * Currently, @out_modified_regfile_content will be a Map<to checksum,from checksum>;
  * however in the future it would be easy to have this function return
  * multiple candidate matches.  The hard part would be changing
@@ -237,6 +259,7 @@ _ostree_delta_compute_similar_objects (OstreeRepo                 *repo,
                                        GVariant                   *to_commit,
                                        GHashTable                 *new_reachable_regfile_content,
                                        guint                       similarity_percent_threshold,
+                                       guint                       n_threads,
                                        GHashTable                **out_modified_regfile_content,
                                        GCancellable               *cancellable,
                                        GError                    **error)
@@ -250,15 +273,43 @@ _ostree_delta_compute_similar_objects (OstreeRepo                 *repo,
   guint lower;
   guint upper;
 
-  if (!build_content_sizenames_filtered (repo, from_commit, NULL,
-                                         &from_sizes,
-                                         cancellable, error))
-    goto out;
+  if (n_threads > 1)
+    {
+      BuildContentSizenamesData from_data = { repo, from_commit, NULL, cancellable, NULL };
+      GThread *from_thread = g_thread_try_new ("ostree-delta-analysis",
+                                               build_content_sizenames_thread, &from_data,
+                                               error);
+      if (!from_thread)
+        goto out;
 
-  if (!build_content_sizenames_filtered (repo, to_commit, new_reachable_regfile_content,
-                                         &to_sizes,
-                                         cancellable, error))
-    goto out;
+      gboolean to_ok = build_content_sizenames_filtered (repo, to_commit, new_reachable_regfile_content,
+                                                         &to_sizes,
+                                                         cancellable, error);
+      g_thread_join (from_thread);
+      from_sizes = g_steal_pointer (&from_data.sizenames);
+      if (!to_ok)
+        {
+          g_clear_error (&from_data.error);
+          goto out;
+        }
+      if (from_data.error)
+        {
+          g_propagate_error (error, from_data.error);
+          goto out;
+        }
+    }
+  else
+    {
+      if (!build_content_sizenames_filtered (repo, from_commit, NULL,
+                                             &from_sizes,
+                                             cancellable, error))
+        goto out;
+
+      if (!build_content_sizenames_filtered (repo, to_commit, new_reachable_regfile_content,
+                                             &to_sizes,
+                                             cancellable, error))
+        goto out;
+    }
   
   /* Iterate over all newly added objects, find objects which have
    * similar basename and sizes.
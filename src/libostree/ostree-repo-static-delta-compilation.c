@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <gio/gunixoutputstream.h>
 #include <gio/gmemoryoutputstream.h>
+#include <gio/gfiledescriptorbased.h>
 
 #include "ostree-core-private.h"
 #include "ostree-repo-private.h"
@@ -34,7 +35,7 @@
 #include "otutil.h"
 #include "libglnx.h"
 #include "ostree-varint.h"
-#include "bsdiff/bsdiff.h"
+#include "ostree-bsdiff.h"
 
 #define CONTENT_SIZE_SIMILARITY_THRESHOLD_PERCENT (30)
 
@@ -49,9 +50,23 @@ typedef struct {
   GPtrArray *xattrs;
 } OstreeStaticDeltaPartBuilder;
 
+/* Bounds the estimated memory used by concurrent work; a max of 0 means
+ * unbounded.
+ */
+typedef struct {
+  GMutex lock;
+  GCond cond;
+  guint64 used;
+  guint64 max;
+} DeltaMemoryBudget;
+
+typedef struct _DeltaPartWriter DeltaPartWriter;
+
 typedef struct {
   GPtrArray *parts;
   GPtrArray *fallback_objects;
+  DeltaMemoryBudget *budget;
+  DeltaPartWriter *writer; /* If set, parts are written as soon as they're complete */
   guint64 loose_compressed_size;
   guint64 min_fallback_size_bytes;
   guint64 max_bsdiff_size_bytes;
@@ -163,9 +178,66 @@ xattr_chunk_equals (const void *one, const void *two)
   return memcmp (g_variant_get_data (v1), g_variant_get_data (v2), l1) == 0;
 }
 
+static void
+delta_memory_budget_init (DeltaMemoryBudget *budget,
+                          guint64            max)
+{
+  g_mutex_init (&budget->lock);
+  g_cond_init (&budget->cond);
+  budget->used = 0;
+  budget->max = max;
+}
+
+static void
+delta_memory_budget_clear (DeltaMemoryBudget *budget)
+{
+  g_mutex_clear (&budget->lock);
+  g_cond_clear (&budget->cond);
+}
+
+/* Wait until @cost bytes are available, and take them.  Anything larger
+ * than the whole budget runs on its own.  Returns the amount taken, to be
+ * passed to delta_memory_budget_release().
+ */
+static guint64
+delta_memory_budget_acquire (DeltaMemoryBudget *budget,
+                             guint64            cost)
+{
+  if (budget->max == 0)
+    return 0;
+
+  cost = MIN (cost, budget->max);
+  g_mutex_lock (&budget->lock);
+  while (budget->used > 0 && budget->used + cost > budget->max)
+    g_cond_wait (&budget->cond, &budget->lock);
+  budget->used += cost;
+  g_mutex_unlock (&budget->lock);
+  return cost;
+}
+
+static void
+delta_memory_budget_release (DeltaMemoryBudget *budget,
+                             guint64            cost)
+{
+  if (cost == 0)
+    return;
+
+  g_mutex_lock (&budget->lock);
+  budget->used -= cost;
+  g_cond_broadcast (&budget->cond);
+  g_mutex_unlock (&budget->lock);
+}
+
+static void delta_part_writer_push (DeltaPartWriter              *writer,
+                                    OstreeStaticDeltaPartBuilder *part);
+
 static OstreeStaticDeltaPartBuilder *
 allocate_part (OstreeStaticDeltaBuilder *builder)
 {
+  /* The previous part is complete; when streaming, send it on its way */
+  if (builder->writer && builder->parts->len > 0)
+    delta_part_writer_push (builder->writer, builder->parts->pdata[builder->parts->len - 1]);
+
   OstreeStaticDeltaPartBuilder *part = g_new0 (OstreeStaticDeltaPartBuilder, 1);
   part->objects = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
   part->payload = g_string_new (NULL);
@@ -405,6 +477,8 @@ process_one_object (OstreeRepo                       *repo,
 
 typedef struct {
   char *from_checksum;
+  GBytes *payload; /* Only set between computing and packing the diff */
+  guint64 cost;    /* Memory budget held while payload is set */
 } ContentBsdiff;
 
 typedef struct {
@@ -424,11 +498,104 @@ static void
 content_bsdiffs_free (ContentBsdiff  *bsdiff)
 {
   g_free (bsdiff->from_checksum);
+  g_clear_pointer (&bsdiff->payload, g_bytes_unref);
   g_free (bsdiff);
 }
 
+typedef gboolean (*DeltaParallelFunc) (gpointer      user_data,
+                                       guint         i,
+                                       GCancellable *cancellable,
+                                       GError      **error);
+
+typedef struct {
+  DeltaParallelFunc func;
+  gpointer user_data;
+  GCancellable *cancellable;
+  GMutex lock;
+  GError *error; /* First error; once set, remaining items are skipped */
+} DeltaParallelData;
+
+static void
+delta_parallel_worker (gpointer data,
+                       gpointer user_data)
+{
+  DeltaParallelData *pdata = user_data;
+  /* Offset by one, since NULL can't be pushed */
+  const guint i = GPOINTER_TO_UINT (data) - 1;
+  g_autoptr(GError) local_error = NULL;
+
+  g_mutex_lock (&pdata->lock);
+  const gboolean failed = pdata->error != NULL;
+  g_mutex_unlock (&pdata->lock);
+  if (failed)
+    return;
+
+  if (!pdata->func (pdata->user_data, i, pdata->cancellable, &local_error))
+    {
+      g_mutex_lock (&pdata->lock);
+      if (pdata->error == NULL)
+        pdata->error = g_steal_pointer (&local_error);
+      g_mutex_unlock (&pdata->lock);
+    }
+}
+
+/* Call @func for each index in [0, @n_items) using up to @n_threads
+ * threads.  Callers store results in per-index slots and consume them in
+ * index order afterwards, so the output doesn't depend on scheduling.
+ */
+static gboolean
+delta_foreach_parallel (guint              n_items,
+                        guint              n_threads,
+                        DeltaParallelFunc  func,
+                        gpointer           user_data,
+                        GCancellable      *cancellable,
+                        GError           **error)
+{
+  const guint n_workers = MAX (1, MIN (n_threads, n_items));
+
+  if (n_workers == 1)
+    {
+      for (guint i = 0; i < n_items; i++)
+        {
+          if (!func (user_data, i, cancellable, error))
+            return FALSE;
+        }
+      return TRUE;
+    }
+
+  DeltaParallelData pdata = { func, user_data, cancellable, };
+  g_mutex_init (&pdata.lock);
+  GThreadPool *pool = g_thread_pool_new (delta_parallel_worker, &pdata, n_workers, TRUE, error);
+  if (!pool)
+    {
+      g_mutex_clear (&pdata.lock);
+      return FALSE;
+    }
+
+  g_autoptr(GError) push_error = NULL;
+  for (guint i = 0; i < n_items && push_error == NULL; i++)
+    (void) g_thread_pool_push (pool, GUINT_TO_POINTER (i + 1), &push_error);
+  /* Waits for everything queued */
+  g_thread_pool_free (pool, FALSE, TRUE);
+  g_mutex_clear (&pdata.lock);
+
+  if (pdata.error)
+    {
+      g_propagate_error (error, pdata.error);
+      return FALSE;
+    }
+  if (push_error)
+    {
+      g_propagate_error (error, g_steal_pointer (&push_error));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 /* Load a content object, uncompressing it to an unlinked tmpfile
-   that's mmap()'d and suitable for seeking.
+   that's mmap()'d and suitable for seeking.  Objects stored uncompressed
+   (in bare repositories) are mapped directly instead.
  */
 static gboolean
 get_unpacked_unlinked_content (OstreeRepo       *repo,
@@ -443,12 +610,43 @@ get_unpacked_unlinked_content (OstreeRepo       *repo,
                               cancellable, error))
     return FALSE;
 
+  if (G_IS_FILE_DESCRIPTOR_BASED (istream))
+    {
+      int fd = g_file_descriptor_based_get_fd ((GFileDescriptorBased*)istream);
+      g_autoptr(GMappedFile) mfile = g_mapped_file_new_from_fd (fd, FALSE, error);
+      if (!mfile)
+        return FALSE;
+      *out_content = g_mapped_file_get_bytes (mfile);
+      return TRUE;
+    }
+
   *out_content = ot_map_anonymous_tmpfile_from_content (istream, cancellable, error);
   if (!*out_content)
     return FALSE;
   return TRUE;
 }
 
+struct bzdiff_opaque_s
+{
+  GOutputStream *out;
+  GCancellable *cancellable;
+  GError **error;
+};
+
+static int
+bzdiff_write (struct bsdiff_stream* stream, const void* buffer, int size)
+{
+  struct bzdiff_opaque_s *op = stream->opaque;
+  if (!g_output_stream_write (op->out,
+                              buffer,
+                              size,
+                              op->cancellable,
+                              op->error))
+    return -1;
+
+  return 0;
+}
+
 static gboolean
 try_content_bsdiff (OstreeRepo                       *repo,
                     const char                       *from,
@@ -458,7 +656,7 @@ try_content_bsdiff (OstreeRepo                       *repo,
                     GCancellable                     *cancellable,
                     GError                           **error)
 {
-
+  *out_bsdiff = NULL;
 
   g_autoptr(GFileInfo) from_finfo = NULL;
   if (!ostree_repo_load_file (repo, from, NULL, &from_finfo, NULL,
@@ -469,12 +667,13 @@ try_content_bsdiff (OstreeRepo                       *repo,
                               cancellable, error))
     return FALSE;
 
-  *out_bsdiff = NULL;
-
   /* Ignore this if it's too large */
   if (g_file_info_get_size (to_finfo) + g_file_info_get_size (from_finfo) > max_bsdiff_size_bytes)
     return TRUE;
 
+  /* The diff itself is computed right before it's packed; see
+   * compute_content_bsdiff().
+   */
   ContentBsdiff *ret_bsdiff = g_new0 (ContentBsdiff, 1);
   ret_bsdiff->from_checksum = g_strdup (from);
 
@@ -482,6 +681,44 @@ try_content_bsdiff (OstreeRepo                       *repo,
   return TRUE;
 }
 
+static gboolean
+compute_content_bsdiff (OstreeRepo                       *repo,
+                        const char                       *to,
+                        ContentBsdiff                    *bsdiff,
+                        GCancellable                     *cancellable,
+                        GError                           **error)
+{
+  g_autoptr(GBytes) tmp_from = NULL;
+  if (!get_unpacked_unlinked_content (repo, bsdiff->from_checksum, &tmp_from, cancellable, error))
+    return FALSE;
+  g_autoptr(GBytes) tmp_to = NULL;
+  if (!get_unpacked_unlinked_content (repo, to, &tmp_to, cancellable, error))
+    return FALSE;
+
+  gsize tmp_to_len;
+  const guint8 *tmp_to_buf = g_bytes_get_data (tmp_to, &tmp_to_len);
+  gsize tmp_from_len;
+  const guint8 *tmp_from_buf = g_bytes_get_data (tmp_from, &tmp_from_len);
+
+  struct bsdiff_stream stream;
+  struct bzdiff_opaque_s op;
+  g_autoptr(GOutputStream) out = g_memory_output_stream_new_resizable ();
+  stream.malloc = malloc;
+  stream.free = free;
+  stream.write = bzdiff_write;
+  op.out = out;
+  op.cancellable = cancellable;
+  op.error = error;
+  stream.opaque = &op;
+  if (_ostree_bsdiff (tmp_from_buf, tmp_from_len, tmp_to_buf, tmp_to_len, &stream) < 0)
+    return glnx_throw (error, "bsdiff generation failed");
+  if (!g_output_stream_close (out, cancellable, error))
+    return FALSE;
+
+  bsdiff->payload = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (out));
+  return TRUE;
+}
+
 static gboolean
 try_content_rollsum (OstreeRepo                       *repo,
                      DeltaOpts                        opts,
@@ -528,27 +765,6 @@ try_content_rollsum (OstreeRepo                       *repo,
   return TRUE;
 }
 
-struct bzdiff_opaque_s
-{
-  GOutputStream *out;
-  GCancellable *cancellable;
-  GError **error;
-};
-
-static int
-bzdiff_write (struct bsdiff_stream* stream, const void* buffer, int size)
-{
-  struct bzdiff_opaque_s *op = stream->opaque;
-  if (!g_output_stream_write (op->out,
-                              buffer,
-                              size,
-                              op->cancellable,
-                              op->error))
-    return -1;
-
-  return 0;
-}
-
 static void
 append_payload_chunk_and_write (OstreeStaticDeltaPartBuilder    *current_part,
                                 const guint8                    *buf,
@@ -678,6 +894,18 @@ process_one_rollsum (OstreeRepo                       *repo,
   return TRUE;
 }
 
+/* Start a new part if the current one has gone over the maximum size */
+static void
+maybe_allocate_bsdiff_part (OstreeStaticDeltaBuilder         *builder,
+                            OstreeStaticDeltaPartBuilder    **current_part_val)
+{
+  OstreeStaticDeltaPartBuilder *current_part = *current_part_val;
+
+  if (current_part->objects->len > 0 &&
+      current_part->payload->len > builder->max_chunk_size_bytes)
+    *current_part_val = allocate_part (builder);
+}
+
 static gboolean
 process_one_bsdiff (OstreeRepo                       *repo,
                     OstreeStaticDeltaBuilder         *builder,
@@ -687,29 +915,9 @@ process_one_bsdiff (OstreeRepo                       *repo,
                     GCancellable                     *cancellable,
                     GError                          **error)
 {
+  maybe_allocate_bsdiff_part (builder, current_part_val);
   OstreeStaticDeltaPartBuilder *current_part = *current_part_val;
 
-  /* Check to see if this delta has gone over maximum size */
-  if (current_part->objects->len > 0 &&
-      current_part->payload->len > builder->max_chunk_size_bytes)
-    {
-      *current_part_val = current_part = allocate_part (builder);
-    }
-
-  g_autoptr(GBytes) tmp_from = NULL;
-  if (!get_unpacked_unlinked_content (repo, bsdiff_content->from_checksum, &tmp_from,
-                                      cancellable, error))
-    return FALSE;
-  g_autoptr(GBytes) tmp_to = NULL;
-  if (!get_unpacked_unlinked_content (repo, to_checksum, &tmp_to,
-                                      cancellable, error))
-    return FALSE;
-
-  gsize tmp_to_len;
-  const guint8 *tmp_to_buf = g_bytes_get_data (tmp_to, &tmp_to_len);
-  gsize tmp_from_len;
-  const guint8 *tmp_from_buf = g_bytes_get_data (tmp_from, &tmp_from_len);
-
   g_autoptr(GFileInfo) content_finfo = NULL;
   g_autoptr(GVariant) content_xattrs = NULL;
   if (!ostree_repo_load_file (repo, to_checksum, NULL,
@@ -717,7 +925,6 @@ process_one_bsdiff (OstreeRepo                       *repo,
                               cancellable, error))
     return FALSE;
   const guint64 content_size = g_file_info_get_size (content_finfo);
-  g_assert_cmpint (tmp_to_len, ==, content_size);
 
   current_part->uncompressed_size += content_size;
 
@@ -742,35 +949,25 @@ process_one_bsdiff (OstreeRepo                       *repo,
     _ostree_write_varuint64 (current_part->operations, content_size);
 
     {
-      struct bsdiff_stream stream;
-      struct bzdiff_opaque_s op;
-      const gchar *payload;
-      gssize payload_size;
-      g_autoptr(GOutputStream) out = g_memory_output_stream_new_resizable ();
-      stream.malloc = malloc;
-      stream.free = free;
-      stream.write = bzdiff_write;
-      op.out = out;
-      op.cancellable = cancellable;
-      op.error = error;
-      stream.opaque = &op;
-      if (bsdiff (tmp_from_buf, tmp_from_len, tmp_to_buf, tmp_to_len, &stream) < 0)
-        return glnx_throw (error, "bsdiff generation failed");
-
-      payload = g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (out));
-      payload_size = g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (out));
+      gsize payload_size;
+      const guint8 *payload = g_bytes_get_data (bsdiff_content->payload, &payload_size);
 
       g_string_append_c (current_part->operations, (gchar)OSTREE_STATIC_DELTA_OP_BSPATCH);
       _ostree_write_varuint64 (current_part->operations, current_part->payload->len);
       _ostree_write_varuint64 (current_part->operations, payload_size);
 
-      g_string_append_len (current_part->payload, payload, payload_size);
+      g_string_append_len (current_part->payload, (char*)payload, payload_size);
     }
     g_string_append_c (current_part->operations, (gchar)OSTREE_STATIC_DELTA_OP_CLOSE);
   }
 
   g_string_append_c (current_part->operations, (gchar)OSTREE_STATIC_DELTA_OP_UNSET_READ_SOURCE);
 
+  /* It's in the part now */
+  g_clear_pointer (&bsdiff_content->payload, g_bytes_unref);
+  delta_memory_budget_release (builder->budget, bsdiff_content->cost);
+  bsdiff_content->cost = 0;
+
   return TRUE;
 }
 
@@ -793,11 +990,192 @@ check_object_world_readable (OstreeRepo   *repo,
   return TRUE;
 }
 
+typedef struct {
+  const char *to_checksum;
+  const char *from_checksum;
+  ContentRollsum *rollsum;
+  ContentBsdiff *bsdiff;
+} ModifiedContent;
+
+typedef struct {
+  OstreeRepo *repo;
+  DeltaOpts opts;
+  guint64 max_bsdiff_size_bytes;
+  DeltaMemoryBudget *budget;
+  ModifiedContent *items;
+} AnalyzeModifiedContentData;
+
+static gboolean
+get_content_size (OstreeRepo   *repo,
+                  const char   *checksum,
+                  guint64      *out_size,
+                  GCancellable *cancellable,
+                  GError      **error)
+{
+  g_autoptr(GFileInfo) finfo = NULL;
+
+  if (!ostree_repo_load_file (repo, checksum, NULL, &finfo, NULL,
+                              cancellable, error))
+    return FALSE;
+
+  *out_size = g_file_info_get_size (finfo);
+  return TRUE;
+}
+
+/* A rough upper bound on the memory used to match a modified object against
+ * its old version, or with @with_bsdiff, to diff it.
+ */
+static guint64
+estimate_analysis_memory (OstreeRepo *repo,
+                          guint64     from_size,
+                          guint64     to_size,
+                          gboolean    with_bsdiff)
+{
+  guint64 mem = 0;
+
+  /* Unless we can map the objects directly, they're unpacked into
+   * anonymous tmpfiles, which may well be on tmpfs.
+   */
+  if (!_ostree_repo_mode_is_bare (repo->mode))
+    mem += from_size + to_size;
+  /* The suffix array, the output buffer and the patch */
+  if (with_bsdiff)
+    mem += 4 * (from_size + 1) + 2 * (to_size + 1);
+
+  return mem;
+}
+
+static gboolean
+compute_modified_content_matches (AnalyzeModifiedContentData *adata,
+                                  ModifiedContent            *item,
+                                  gboolean                    use_bsdiff,
+                                  GCancellable               *cancellable,
+                                  GError                    **error)
+{
+  if (!try_content_rollsum (adata->repo, adata->opts, item->from_checksum, item->to_checksum,
+                            &item->rollsum, cancellable, error))
+    return FALSE;
+  if (item->rollsum)
+    return TRUE;
+
+  if (use_bsdiff)
+    {
+      if (!try_content_bsdiff (adata->repo, item->from_checksum, item->to_checksum,
+                               &item->bsdiff, adata->max_bsdiff_size_bytes,
+                               cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Work out how to ship a modified object: via rollsum matches against its
+ * old version if enough of it is unchanged, otherwise via bsdiff.  This
+ * runs on a worker thread when generating with multiple threads.
+ */
+static gboolean
+analyze_modified_content (gpointer      user_data,
+                          guint         i,
+                          GCancellable *cancellable,
+                          GError      **error)
+{
+  AnalyzeModifiedContentData *adata = user_data;
+  ModifiedContent *item = &adata->items[i];
+  gboolean from_world_readable = FALSE;
+  gboolean use_bsdiff = !(adata->opts & DELTAOPT_FLAG_DISABLE_BSDIFF);
+  guint64 cost = 0;
+
+  /* We only want to include in the delta objects that we are sure will
+   * be readable by the client when applying the delta, regardless its
+   * access privileges, so that we don't run into permissions problems
+   * when the client is trying to update a bare-user repository with a
+   * bare repository defined as its parent.
+   */
+  if (!check_object_world_readable (adata->repo, item->from_checksum, &from_world_readable,
+                                    cancellable, error))
+    return FALSE;
+  if (!from_world_readable)
+    return TRUE;
+
+  if (adata->budget->max > 0)
+    {
+      guint64 from_size, to_size;
+
+      if (!get_content_size (adata->repo, item->from_checksum, &from_size, cancellable, error))
+        return FALSE;
+      if (!get_content_size (adata->repo, item->to_checksum, &to_size, cancellable, error))
+        return FALSE;
+
+      use_bsdiff = use_bsdiff && from_size + to_size <= adata->max_bsdiff_size_bytes;
+      /* Objects which would need more than the whole budget to bsdiff are
+       * shipped some other way.  This depends only on the sizes, so the
+       * output is still deterministic.
+       */
+      if (use_bsdiff &&
+          estimate_analysis_memory (adata->repo, from_size, to_size, TRUE) > adata->budget->max)
+        use_bsdiff = FALSE;
+      /* Only rollsums are computed here; see compute_bsdiff_item() */
+      cost = estimate_analysis_memory (adata->repo, from_size, to_size, FALSE);
+    }
+
+  cost = delta_memory_budget_acquire (adata->budget, cost);
+  const gboolean ret = compute_modified_content_matches (adata, item, use_bsdiff,
+                                                         cancellable, error);
+  delta_memory_budget_release (adata->budget, cost);
+  return ret;
+}
+
+typedef struct {
+  OstreeRepo *repo;
+  DeltaMemoryBudget *budget;
+  const char **to_checksums;
+  ContentBsdiff **bsdiffs;
+} ComputeBsdiffData;
+
+/* Compute the diff for one bsdiff'ed object, charging the memory for it to
+ * the budget until it's packed.  This runs on a worker thread when
+ * generating with multiple threads.
+ */
+static gboolean
+compute_bsdiff_item (gpointer      user_data,
+                     guint         i,
+                     GCancellable *cancellable,
+                     GError      **error)
+{
+  ComputeBsdiffData *cdata = user_data;
+  const char *to_checksum = cdata->to_checksums[i];
+  ContentBsdiff *bsdiff = cdata->bsdiffs[i];
+  guint64 cost = 0;
+
+  if (cdata->budget->max > 0)
+    {
+      guint64 from_size, to_size;
+
+      if (!get_content_size (cdata->repo, bsdiff->from_checksum, &from_size, cancellable, error))
+        return FALSE;
+      if (!get_content_size (cdata->repo, to_checksum, &to_size, cancellable, error))
+        return FALSE;
+      cost = estimate_analysis_memory (cdata->repo, from_size, to_size, TRUE);
+    }
+
+  /* Released by process_one_bsdiff() */
+  bsdiff->cost = delta_memory_budget_acquire (cdata->budget, cost);
+  if (!compute_content_bsdiff (cdata->repo, to_checksum, bsdiff, cancellable, error))
+    {
+      delta_memory_budget_release (cdata->budget, bsdiff->cost);
+      bsdiff->cost = 0;
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 static gboolean
 generate_delta_lowlatency (OstreeRepo                       *repo,
                            const char                       *from,
                            const char                       *to,
                            DeltaOpts                         opts,
+                           guint                             n_threads,
                            OstreeStaticDeltaBuilder         *builder,
                            GCancellable                     *cancellable,
                            GError                          **error)
@@ -886,6 +1264,7 @@ generate_delta_lowlatency (OstreeRepo                       *repo,
       if (!_ostree_delta_compute_similar_objects (repo, from_commit, to_commit,
                                                   new_reachable_regfile_content,
                                                   CONTENT_SIZE_SIMILARITY_THRESHOLD_PERCENT,
+                                                  n_threads,
                                                   &modified_regfile_content,
                                                   cancellable, error))
         return FALSE;
@@ -915,48 +1294,44 @@ generate_delta_lowlatency (OstreeRepo                       *repo,
                                                             g_free,
                                                             (GDestroyNotify) content_bsdiffs_free);
 
-  g_hash_table_iter_init (&hashiter, modified_regfile_content);
-  while (g_hash_table_iter_next (&hashiter, &key, &value))
-    {
-      const char *to_checksum = key;
-      const char *from_checksum = value;
-      ContentRollsum *rollsum;
-      ContentBsdiff *bsdiff;
-      gboolean from_world_readable = FALSE;
-
-      /* We only want to include in the delta objects that we are sure will
-       * be readable by the client when applying the delta, regardless its
-       * access privileges, so that we don't run into permissions problems
-       * when the client is trying to update a bare-user repository with a
-       * bare repository defined as its parent.
-       */
-      if (!check_object_world_readable (repo, from_checksum, &from_world_readable, cancellable, error))
-        return FALSE;
-      if (!from_world_readable)
-        continue;
+  const guint n_modified = g_hash_table_size (modified_regfile_content);
+  g_autofree ModifiedContent *modified = g_new0 (ModifiedContent, n_modified);
+  { guint i = 0;
+    g_hash_table_iter_init (&hashiter, modified_regfile_content);
+    while (g_hash_table_iter_next (&hashiter, &key, &value))
+      {
+        modified[i].to_checksum = key;
+        modified[i].from_checksum = value;
+        i++;
+      }
+  }
 
-      if (!try_content_rollsum (repo, opts, from_checksum, to_checksum,
-                                &rollsum, cancellable, error))
-        return FALSE;
+  AnalyzeModifiedContentData adata = { repo, opts, builder->max_bsdiff_size_bytes,
+                                       builder->budget, modified };
+  const gboolean analyzed =
+    delta_foreach_parallel (n_modified, n_threads, analyze_modified_content, &adata,
+                            cancellable, error);
 
-      if (rollsum)
-        {
-          g_hash_table_insert (rollsum_optimized_content_objects, g_strdup (to_checksum), rollsum);
-          builder->rollsum_size += rollsum->matches->match_size;
-          continue;
-        }
+  /* Collect the results in the original order even on error, so that they
+   * are freed; the tables (and hence the parts) come out the same however
+   * the work was scheduled.
+   */
+  for (guint i = 0; i < n_modified; i++)
+    {
+      ModifiedContent *item = &modified[i];
 
-      if (!(opts & DELTAOPT_FLAG_DISABLE_BSDIFF))
+      if (item->rollsum)
         {
-          if (!try_content_bsdiff (repo, from_checksum, to_checksum,
-                                   &bsdiff, builder->max_bsdiff_size_bytes,
-                                   cancellable, error))
-            return FALSE;
-
-          if (bsdiff)
-            g_hash_table_insert (bsdiff_optimized_content_objects, g_strdup (to_checksum), bsdiff);
+          builder->rollsum_size += item->rollsum->matches->match_size;
+          g_hash_table_insert (rollsum_optimized_content_objects,
+                               g_strdup (item->to_checksum), item->rollsum);
         }
+      else if (item->bsdiff)
+        g_hash_table_insert (bsdiff_optimized_content_objects,
+                             g_strdup (item->to_checksum), item->bsdiff);
     }
+  if (!analyzed)
+    return FALSE;
 
   if (opts & DELTAOPT_FLAG_VERBOSE)
     {
@@ -999,21 +1374,51 @@ generate_delta_lowlatency (OstreeRepo                       *repo,
       builder->n_rollsum++;
     }
 
-  /* Now do bsdiff'ed objects */
+  /* Now do bsdiff'ed objects.  The diffs are computed a batch at a time,
+   * right before they're packed, so only a batch of them is held in memory
+   * at once.  With a memory bound, they're done one at a time.
+   */
+  { const guint n_bsdiff = g_hash_table_size (bsdiff_optimized_content_objects);
+    g_autofree const char **to_checksums = g_new0 (const char *, n_bsdiff);
+    g_autofree ContentBsdiff **bsdiffs = g_new0 (ContentBsdiff *, n_bsdiff);
+    const guint batch_size = builder->budget->max > 0 ? 1 : n_threads;
+    guint i = 0;
+
+    g_hash_table_iter_init (&hashiter, bsdiff_optimized_content_objects);
+    while (g_hash_table_iter_next (&hashiter, &key, &value))
+      {
+        to_checksums[i] = key;
+        bsdiffs[i] = value;
+        i++;
+      }
 
-  g_hash_table_iter_init (&hashiter, bsdiff_optimized_content_objects);
-  while (g_hash_table_iter_next (&hashiter, &key, &value))
-    {
-      const char *checksum = key;
-      ContentBsdiff *bsdiff = value;
+    for (guint start = 0; start < n_bsdiff; start += batch_size)
+      {
+        const guint n = MIN (batch_size, n_bsdiff - start);
+        ComputeBsdiffData cdata = { repo, builder->budget,
+                                    to_checksums + start, bsdiffs + start };
 
-      if (!process_one_bsdiff (repo, builder, &current_part,
-                               checksum, bsdiff,
-                               cancellable, error))
-        return FALSE;
+        /* Start the next part before charging the diffs to the budget.
+         * Pushing the finished part takes budget for compressing it, which
+         * would otherwise wait for this thread to release the diffs.
+         */
+        maybe_allocate_bsdiff_part (builder, &current_part);
 
-      builder->n_bsdiff++;
-    }
+        if (!delta_foreach_parallel (n, n_threads, compute_bsdiff_item, &cdata,
+                                     cancellable, error))
+          return FALSE;
+
+        for (guint j = start; j < start + n; j++)
+          {
+            if (!process_one_bsdiff (repo, builder, &current_part,
+                                     to_checksums[j], bsdiffs[j],
+                                     cancellable, error))
+              return FALSE;
+
+            builder->n_bsdiff++;
+          }
+      }
+  }
 
   /* Scan for large objects, so we can fall back to plain HTTP-based
    * fetch.
@@ -1142,6 +1547,298 @@ get_fallback_headers (OstreeRepo               *self,
   return TRUE;
 }
 
+/* Serialize and compress one part; @part_builder's payload and operations
+ * are consumed.
+ */
+static GVariant *
+compress_delta_part (OstreeStaticDeltaPartBuilder *part_builder,
+                     GVariant                     *compressor_params,
+                     GCancellable                 *cancellable,
+                     GError                      **error)
+{
+  g_autoptr(GBytes) payload_b = NULL;
+  g_autoptr(GBytes) operations_b = NULL;
+  g_autoptr(GInputStream) part_payload_in = NULL;
+  g_autoptr(GMemoryOutputStream) part_payload_out = NULL;
+  g_autoptr(GConverterOutputStream) part_payload_compressor = NULL;
+  g_autoptr(GConverter) compressor = NULL;
+  g_autoptr(GVariant) delta_part_content = NULL;
+  g_auto(GVariantBuilder) mode_builder = OT_VARIANT_BUILDER_INITIALIZER;
+  g_auto(GVariantBuilder) xattr_builder = OT_VARIANT_BUILDER_INITIALIZER;
+  guint8 compression_type_char;
+
+  g_variant_builder_init (&mode_builder, G_VARIANT_TYPE ("a(uuu)"));
+  g_variant_builder_init (&xattr_builder, G_VARIANT_TYPE ("aa(ayay)"));
+  { guint j;
+    for (j = 0; j < part_builder->modes->len; j++)
+      g_variant_builder_add_value (&mode_builder, part_builder->modes->pdata[j]);
+
+    for (j = 0; j < part_builder->xattrs->len; j++)
+      g_variant_builder_add_value (&xattr_builder, part_builder->xattrs->pdata[j]);
+  }
+
+  payload_b = g_string_free_to_bytes (part_builder->payload);
+  part_builder->payload = NULL;
+
+  operations_b = g_string_free_to_bytes (part_builder->operations);
+  part_builder->operations = NULL;
+  /* FIXME - avoid duplicating memory here */
+  delta_part_content = g_variant_new ("(a(uuu)aa(ayay)@ay@ay)",
+                                      &mode_builder, &xattr_builder,
+                                      ot_gvariant_new_ay_bytes (payload_b),
+                                      ot_gvariant_new_ay_bytes (operations_b));
+  g_variant_ref_sink (delta_part_content);
+
+  /* Hardcode xz for now */
+  compressor = (GConverter*)_ostree_lzma_compressor_new (compressor_params);
+  compression_type_char = 'x';
+  part_payload_in = ot_variant_read (delta_part_content);
+  part_payload_out = (GMemoryOutputStream*)g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  part_payload_compressor = (GConverterOutputStream*)g_converter_output_stream_new ((GOutputStream*)part_payload_out, compressor);
+
+  {
+    gssize n_bytes_written = g_output_stream_splice ((GOutputStream*)part_payload_compressor, part_payload_in,
+                                                     G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET | G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE,
+                                                     cancellable, error);
+    if (n_bytes_written < 0)
+      return NULL;
+  }
+
+  /* FIXME - avoid duplicating memory here */
+  g_autoptr(GBytes) payload = g_memory_output_stream_steal_as_bytes (part_payload_out);
+  return g_variant_ref_sink (g_variant_new ("(y@ay)",
+                                            compression_type_char,
+                                            ot_gvariant_new_ay_bytes (payload)));
+}
+
+static GVariant *
+new_compressor_params (guint    compression_level,
+                       gboolean blocked,
+                       guint    n_lzma_threads)
+{
+  g_auto(GVariantDict) compressor_params_dict = OT_VARIANT_BUILDER_INITIALIZER;
+
+  g_variant_dict_init (&compressor_params_dict, NULL);
+  g_variant_dict_insert (&compressor_params_dict, "preset", "u", compression_level);
+  /* The blocked xz format doesn't depend on the number of threads, so
+   * it's chosen by the caller rather than by how many CPUs we have.
+   */
+  if (blocked)
+    g_variant_dict_insert (&compressor_params_dict, "threads", "u", n_lzma_threads);
+  return g_variant_ref_sink (g_variant_dict_end (&compressor_params_dict));
+}
+
+/* A compressed part, either kept in memory to be inlined into the
+ * superblock, or in a tmpfile to be linked into place.
+ */
+typedef struct {
+  GVariant *inline_part;
+  GLnxTmpfile tmpf;
+  guchar checksum[OSTREE_SHA256_DIGEST_LEN];
+  guint64 size;
+} DeltaPartOutput;
+
+static void
+delta_part_output_free (DeltaPartOutput *output)
+{
+  g_clear_pointer (&output->inline_part, g_variant_unref);
+  glnx_tmpfile_clear (&output->tmpf);
+  g_free (output);
+}
+
+/* Compresses parts and writes them out on up to n_workers threads.  Parts
+ * are pushed either all at once after generation, or when memory is
+ * bounded, each as soon as it is complete; then only the parts in flight
+ * are held uncompressed.
+ */
+struct _DeltaPartWriter {
+  GVariant *compressor_params;
+  guint64 compressor_memusage;
+  gboolean inline_parts;
+  int tmp_dfd;
+  DeltaMemoryBudget *budget;
+  GCancellable *cancellable;
+  GThreadPool *pool; /* NULL to write parts on the calling thread */
+  GPtrArray *outputs; /* (element-type DeltaPartOutput), in part order */
+  GMutex lock;
+  gboolean aborted;
+  GError *error; /* First error; once set, remaining parts are skipped */
+};
+
+typedef struct {
+  OstreeStaticDeltaPartBuilder *part;
+  DeltaPartOutput *output;
+  guint64 cost;
+} DeltaPartWriteJob;
+
+static gboolean
+write_delta_part (DeltaPartWriter               *writer,
+                  OstreeStaticDeltaPartBuilder  *part,
+                  DeltaPartOutput               *output,
+                  GError                       **error)
+{
+  g_autoptr(GVariant) delta_part = compress_delta_part (part, writer->compressor_params,
+                                                        writer->cancellable, error);
+  if (!delta_part)
+    return FALSE;
+
+  g_autoptr(GOutputStream) part_temp_outstream = NULL;
+  if (writer->inline_parts)
+    output->inline_part = g_variant_ref (delta_part);
+  else
+    {
+      if (!glnx_open_tmpfile_linkable_at (writer->tmp_dfd, ".", O_WRONLY | O_CLOEXEC,
+                                          &output->tmpf, error))
+        return FALSE;
+      part_temp_outstream = g_unix_output_stream_new (output->tmpf.fd, FALSE);
+    }
+
+  g_autoptr(GInputStream) part_in = ot_variant_read (delta_part);
+  g_autofree guchar *part_checksum = NULL;
+  if (!ot_gio_splice_get_checksum (part_temp_outstream, part_in,
+                                   &part_checksum,
+                                   writer->cancellable, error))
+    return FALSE;
+
+  memcpy (output->checksum, part_checksum, OSTREE_SHA256_DIGEST_LEN);
+  output->size = g_variant_get_size (delta_part);
+  return TRUE;
+}
+
+static void
+delta_part_write_job_run (DeltaPartWriter   *writer,
+                          DeltaPartWriteJob *job)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  g_mutex_lock (&writer->lock);
+  const gboolean skip = writer->aborted || writer->error != NULL;
+  g_mutex_unlock (&writer->lock);
+
+  if (!skip && !write_delta_part (writer, job->part, job->output, &local_error))
+    {
+      g_mutex_lock (&writer->lock);
+      if (writer->error == NULL)
+        writer->error = g_steal_pointer (&local_error);
+      g_mutex_unlock (&writer->lock);
+    }
+
+  delta_memory_budget_release (writer->budget, job->cost);
+  g_free (job);
+}
+
+static void
+delta_part_writer_worker (gpointer data,
+                          gpointer user_data)
+{
+  delta_part_write_job_run (user_data, data);
+}
+
+static void
+delta_part_writer_free (DeltaPartWriter *writer)
+{
+  if (writer->pool)
+    {
+      /* Let queued jobs drain without doing any work */
+      g_mutex_lock (&writer->lock);
+      writer->aborted = TRUE;
+      g_mutex_unlock (&writer->lock);
+      g_thread_pool_free (writer->pool, FALSE, TRUE);
+    }
+  g_clear_pointer (&writer->compressor_params, g_variant_unref);
+  g_clear_pointer (&writer->outputs, g_ptr_array_unref);
+  g_clear_error (&writer->error);
+  g_mutex_clear (&writer->lock);
+  g_free (writer);
+}
+
+static DeltaPartWriter *
+delta_part_writer_new (GVariant           *compressor_params,
+                       gboolean            inline_parts,
+                       int                 tmp_dfd,
+                       guint               n_workers,
+                       DeltaMemoryBudget  *budget,
+                       GCancellable       *cancellable,
+                       GError            **error)
+{
+  DeltaPartWriter *writer = g_new0 (DeltaPartWriter, 1);
+
+  writer->compressor_params = g_variant_ref (compressor_params);
+  writer->compressor_memusage = _ostree_lzma_compressor_memusage (compressor_params);
+  writer->inline_parts = inline_parts;
+  writer->tmp_dfd = tmp_dfd;
+  writer->budget = budget;
+  writer->cancellable = cancellable;
+  writer->outputs = g_ptr_array_new_with_free_func ((GDestroyNotify)delta_part_output_free);
+  g_mutex_init (&writer->lock);
+
+  if (n_workers > 1)
+    {
+      writer->pool = g_thread_pool_new (delta_part_writer_worker, writer, n_workers, TRUE, error);
+      if (!writer->pool)
+        {
+          delta_part_writer_free (writer);
+          return NULL;
+        }
+    }
+
+  return writer;
+}
+
+/* Queue @part to be compressed and written out, waiting while the memory
+ * budget is used up.  Errors are reported by delta_part_writer_finish().
+ */
+static void
+delta_part_writer_push (DeltaPartWriter              *writer,
+                        OstreeStaticDeltaPartBuilder *part)
+{
+  DeltaPartWriteJob *job = g_new0 (DeltaPartWriteJob, 1);
+  job->part = part;
+  job->output = g_new0 (DeltaPartOutput, 1);
+  g_ptr_array_add (writer->outputs, job->output);
+
+  /* The part itself, its serialized copy, and the compressed output */
+  const guint64 part_size = part->payload->len + part->operations->len;
+  job->cost = delta_memory_budget_acquire (writer->budget,
+                                           3 * part_size + writer->compressor_memusage);
+
+  if (writer->pool)
+    {
+      g_autoptr(GError) local_error = NULL;
+      if (!g_thread_pool_push (writer->pool, job, &local_error))
+        {
+          g_mutex_lock (&writer->lock);
+          if (writer->error == NULL)
+            writer->error = g_steal_pointer (&local_error);
+          g_mutex_unlock (&writer->lock);
+          delta_memory_budget_release (writer->budget, job->cost);
+          g_free (job);
+        }
+    }
+  else
+    delta_part_write_job_run (writer, job);
+}
+
+/* Wait for all pushed parts to be written */
+static gboolean
+delta_part_writer_finish (DeltaPartWriter  *writer,
+                          GError          **error)
+{
+  if (writer->pool)
+    {
+      g_thread_pool_free (writer->pool, FALSE, TRUE);
+      writer->pool = NULL;
+    }
+
+  if (writer->error)
+    {
+      g_propagate_error (error, g_steal_pointer (&writer->error));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 /**
  * ostree_repo_static_delta_generate:
  * @self: Repo
@@ -1163,13 +1860,20 @@ get_fallback_headers (OstreeRepo               *self,
  *   - min-fallback-size: u: Minimum uncompressed size in megabytes to use fallback, 0 to disable fallbacks
  *   - max-chunk-size: u: Maximum size in megabytes of a delta part
  *   - max-bsdiff-size: u: Maximum size in megabytes to consider bsdiff compression
- *   for input files
+ *   for input files.  Default 512.
  *   - compression: y: Compression type: 0=none, x=lzma, g=gzip
  *   - bsdiff-enabled: b: Enable bsdiff compression.  Default TRUE.
  *   - inline-parts: b: Put part data in header, to get a single file delta.  Default FALSE.
  *   - verbose: b: Print diagnostic messages.  Default FALSE.
  *   - endianness: b: Deltas use host byte order by default; this option allows choosing (G_BIG_ENDIAN or G_LITTLE_ENDIAN)
  *   - filename: ay: Save delta superblock to this filename, and parts in the same directory.  Default saves to repository.
+ *   - threads: u: Number of threads used to compute bsdiff/rollsum matches and to compress parts; 0 means one per CPU.  Default 1.  If given, parts are compressed as independent xz blocks, so the output is the same for any value; otherwise they're a single xz stream.
+ *   - compression-level: u: xz preset level, 0-9.  Default 8.
+ *   - max-rss: u: Approximate bound in megabytes on the memory used for
+ *   rollsum matching, computing bsdiff diffs (then done one at a time) and
+ *   compression; parts are then written out as soon as they are complete.
+ *   The part being assembled isn't counted, so this must be more than twice
+ *   max-chunk-size.  Default 0 (unbounded).
  */
 gboolean
 ostree_repo_static_delta_generate (OstreeRepo                   *self,
@@ -1192,7 +1896,6 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
   guint64 total_compressed_size = 0;
   guint64 total_uncompressed_size = 0;
   g_autoptr(GVariantBuilder) part_headers = NULL;
-  g_autoptr(GPtrArray) part_temp_paths = NULL;
   g_autoptr(GVariant) delta_descriptor = NULL;
   g_autoptr(GVariant) to_commit = NULL;
   const char *opt_filename;
@@ -1203,6 +1906,13 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
   gboolean inline_parts;
   guint endianness = G_BYTE_ORDER;
   glnx_fd_close int tmp_dfd = -1;
+  guint n_threads;
+  gboolean blocked_compression;
+  guint compression_level;
+  guint max_rss;
+  DeltaMemoryBudget budget;
+  DeltaPartWriter *writer = NULL;
+  g_autoptr(GVariant) compressor_params = NULL;
   builder.parts = g_ptr_array_new_with_free_func ((GDestroyNotify)ostree_static_delta_part_builder_unref);
   builder.fallback_objects = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
 
@@ -1211,7 +1921,7 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
   builder.min_fallback_size_bytes = ((guint64)min_fallback_size) * 1000 * 1000;
 
   if (!g_variant_lookup (params, "max-bsdiff-size", "u", &max_bsdiff_size))
-    max_bsdiff_size = 128;
+    max_bsdiff_size = 512;
   builder.max_bsdiff_size_bytes = ((guint64)max_bsdiff_size) * 1000 * 1000;
   if (!g_variant_lookup (params, "max-chunk-size", "u", &max_chunk_size))
     max_chunk_size = 32;
@@ -1239,6 +1949,34 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
   if (!g_variant_lookup (params, "inline-parts", "b", &inline_parts))
     inline_parts = FALSE;
 
+  /* The format parts are compressed in depends on whether threads were
+   * asked for at all, not on how many we get */
+  blocked_compression = g_variant_lookup (params, "threads", "u", &n_threads);
+  if (!blocked_compression)
+    n_threads = 1;
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+  if (!g_variant_lookup (params, "compression-level", "u", &compression_level))
+    compression_level = 8;
+  if (compression_level > 9)
+    {
+      glnx_throw (error, "Invalid compression level %u", compression_level);
+      goto out;
+    }
+
+  if (!g_variant_lookup (params, "max-rss", "u", &max_rss))
+    max_rss = 0;
+  /* Leave room for the part being built, and the one last pushed */
+  if (max_rss > 0 && max_rss <= 2 * max_chunk_size)
+    {
+      glnx_throw (error, "max-rss %u must be more than twice max-chunk-size %u",
+                  max_rss, max_chunk_size);
+      goto out;
+    }
+  delta_memory_budget_init (&budget, max_rss > 0 ?
+                            ((guint64)max_rss) * 1000 * 1000 - 2 * builder.max_chunk_size_bytes : 0);
+  builder.budget = &budget;
+
   if (!g_variant_lookup (params, "filename", "^&ay", &opt_filename))
     opt_filename = NULL;
 
@@ -1246,11 +1984,57 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
                                  &to_commit, error))
     goto out;
 
+  if (opt_filename)
+    {
+      g_autofree char *dnbuf = g_strdup (opt_filename);
+      const char *dn = dirname (dnbuf);
+      if (!glnx_opendirat (AT_FDCWD, dn, TRUE, &tmp_dfd, error))
+        goto out;
+    }
+  else
+    {
+      tmp_dfd = fcntl (self->tmp_dir_fd, F_DUPFD_CLOEXEC, 3);
+      if (tmp_dfd < 0)
+        {
+          glnx_set_error_from_errno (error);
+          goto out;
+        }
+    }
+
+  /* With bounded memory, compress each part as soon as it's complete,
+   * one part per thread; otherwise, compress them all at the end.
+   */
+  if (max_rss > 0)
+    {
+      compressor_params = new_compressor_params (compression_level, blocked_compression, 1);
+      writer = delta_part_writer_new (compressor_params, inline_parts, tmp_dfd,
+                                      n_threads, &budget, cancellable, error);
+      if (!writer)
+        goto out;
+      builder.writer = writer;
+    }
+
   /* Ignore optimization flags */
-  if (!generate_delta_lowlatency (self, from, to, delta_opts, &builder,
+  if (!generate_delta_lowlatency (self, from, to, delta_opts, n_threads, &builder,
                                   cancellable, error))
     goto out;
 
+  if (!writer)
+    {
+      /* Spread the threads over the parts first, then within each */
+      const guint n_workers = MAX (1, MIN (n_threads, builder.parts->len));
+      compressor_params = new_compressor_params (compression_level, blocked_compression,
+                                                 n_threads / n_workers);
+      writer = delta_part_writer_new (compressor_params, inline_parts, tmp_dfd,
+                                      n_workers, &budget, cancellable, error);
+      if (!writer)
+        goto out;
+    }
+  for (i = writer->outputs->len; i < builder.parts->len; i++)
+    delta_part_writer_push (writer, builder.parts->pdata[i]);
+  if (!delta_part_writer_finish (writer, error))
+    goto out;
+
   /* NOTE: Add user-supplied metadata first.  This is used by at least
    * xdg-app as a way to provide MIME content sniffing, since the
    * metadata appears first in the file.
@@ -1285,133 +2069,41 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
     g_variant_builder_add (&metadata_builder, "{sv}", "ostree.endianness", g_variant_new_byte (endianness_char));
   }
 
-  if (opt_filename)
-    {
-      g_autofree char *dnbuf = g_strdup (opt_filename);
-      const char *dn = dirname (dnbuf);
-      if (!glnx_opendirat (AT_FDCWD, dn, TRUE, &tmp_dfd, error))
-        goto out;
-    }
-  else
-    {
-      tmp_dfd = fcntl (self->tmp_dir_fd, F_DUPFD_CLOEXEC, 3);
-      if (tmp_dfd < 0)
-        {
-          glnx_set_error_from_errno (error);
-          goto out;
-        }
-    }
-
   part_headers = g_variant_builder_new (G_VARIANT_TYPE ("a" OSTREE_STATIC_DELTA_META_ENTRY_FORMAT));
-  part_temp_paths = g_ptr_array_new_with_free_func ((GDestroyNotify)glnx_tmpfile_clear);
+
   for (i = 0; i < builder.parts->len; i++)
     {
       OstreeStaticDeltaPartBuilder *part_builder = builder.parts->pdata[i];
-      g_autoptr(GBytes) payload_b;
-      g_autoptr(GBytes) operations_b;
-      g_autofree guchar *part_checksum = NULL;
+      DeltaPartOutput *output = writer->outputs->pdata[i];
       g_autoptr(GBytes) objtype_checksum_array = NULL;
       g_autoptr(GBytes) checksum_bytes = NULL;
-      g_autoptr(GOutputStream) part_temp_outstream = NULL;
-      g_autoptr(GInputStream) part_in = NULL;
-      g_autoptr(GInputStream) part_payload_in = NULL;
-      g_autoptr(GMemoryOutputStream) part_payload_out = NULL;
-      g_autoptr(GConverterOutputStream) part_payload_compressor = NULL;
-      g_autoptr(GConverter) compressor = NULL;
-      g_autoptr(GVariant) delta_part_content = NULL;
-      g_autoptr(GVariant) delta_part = NULL;
       g_autoptr(GVariant) delta_part_header = NULL;
-      g_auto(GVariantBuilder) mode_builder = OT_VARIANT_BUILDER_INITIALIZER;
-      g_auto(GVariantBuilder) xattr_builder = OT_VARIANT_BUILDER_INITIALIZER;
-      guint8 compression_type_char;
-
-      g_variant_builder_init (&mode_builder, G_VARIANT_TYPE ("a(uuu)"));
-      g_variant_builder_init (&xattr_builder, G_VARIANT_TYPE ("aa(ayay)"));
-      { guint j;
-        for (j = 0; j < part_builder->modes->len; j++)
-          g_variant_builder_add_value (&mode_builder, part_builder->modes->pdata[j]);
-
-        for (j = 0; j < part_builder->xattrs->len; j++)
-          g_variant_builder_add_value (&xattr_builder, part_builder->xattrs->pdata[j]);
-      }
-
-      payload_b = g_string_free_to_bytes (part_builder->payload);
-      part_builder->payload = NULL;
-
-      operations_b = g_string_free_to_bytes (part_builder->operations);
-      part_builder->operations = NULL;
-      /* FIXME - avoid duplicating memory here */
-      delta_part_content = g_variant_new ("(a(uuu)aa(ayay)@ay@ay)",
-                                          &mode_builder, &xattr_builder,
-                                          ot_gvariant_new_ay_bytes (payload_b),
-                                          ot_gvariant_new_ay_bytes (operations_b));
-      g_variant_ref_sink (delta_part_content);
-
-      /* Hardcode xz for now */
-      compressor = (GConverter*)_ostree_lzma_compressor_new (NULL);
-      compression_type_char = 'x';
-      part_payload_in = ot_variant_read (delta_part_content);
-      part_payload_out = (GMemoryOutputStream*)g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
-      part_payload_compressor = (GConverterOutputStream*)g_converter_output_stream_new ((GOutputStream*)part_payload_out, compressor);
-
-      {
-        gssize n_bytes_written = g_output_stream_splice ((GOutputStream*)part_payload_compressor, part_payload_in,
-                                                         G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET | G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE,
-                                                         cancellable, error);
-        if (n_bytes_written < 0)
-          goto out;
-      }
-
-      /* FIXME - avoid duplicating memory here */
-      { g_autoptr(GBytes) payload = g_memory_output_stream_steal_as_bytes (part_payload_out);
-        delta_part = g_variant_ref_sink (g_variant_new ("(y@ay)",
-                                                        compression_type_char,
-                                                        ot_gvariant_new_ay_bytes (payload)));
-      }
 
       if (inline_parts)
         {
           g_autofree char *part_relpath = _ostree_get_relative_static_delta_part_path (from, to, i);
-          g_variant_builder_add (&metadata_builder, "{sv}", part_relpath, delta_part);
+          g_variant_builder_add (&metadata_builder, "{sv}", part_relpath, output->inline_part);
         }
-      else
-        {
-          GLnxTmpfile *part_tmpf = g_new0 (GLnxTmpfile, 1);
-
-          if (!glnx_open_tmpfile_linkable_at (tmp_dfd, ".", O_WRONLY | O_CLOEXEC,
-                                              part_tmpf, error))
-            goto out;
-
-          /* Transfer tempfile ownership */
-          part_temp_outstream = g_unix_output_stream_new (part_tmpf->fd, FALSE);
-          g_ptr_array_add (part_temp_paths, g_steal_pointer (&part_tmpf));
-        }
-
-      part_in = ot_variant_read (delta_part);
-      if (!ot_gio_splice_get_checksum (part_temp_outstream, part_in,
-                                       &part_checksum,
-                                       cancellable, error))
-        goto out;
 
-      checksum_bytes = g_bytes_new (part_checksum, OSTREE_SHA256_DIGEST_LEN);
+      checksum_bytes = g_bytes_new (output->checksum, OSTREE_SHA256_DIGEST_LEN);
       objtype_checksum_array = objtype_checksum_array_new (part_builder->objects);
       delta_part_header = g_variant_new ("(u@aytt@ay)",
                                          maybe_swap_endian_u32 (builder.swap_endian, OSTREE_DELTAPART_VERSION),
                                          ot_gvariant_new_ay_bytes (checksum_bytes),
-                                         maybe_swap_endian_u64 (builder.swap_endian, (guint64) g_variant_get_size (delta_part)),
+                                         maybe_swap_endian_u64 (builder.swap_endian, output->size),
                                          maybe_swap_endian_u64 (builder.swap_endian, part_builder->uncompressed_size),
                                          ot_gvariant_new_ay_bytes (objtype_checksum_array));
 
       g_variant_builder_add_value (part_headers, g_variant_ref (delta_part_header));
 
-      total_compressed_size += g_variant_get_size (delta_part);
+      total_compressed_size += output->size;
       total_uncompressed_size += part_builder->uncompressed_size;
 
       if (delta_opts & DELTAOPT_FLAG_VERBOSE)
         {
           g_printerr ("part %u n:%u compressed:%" G_GUINT64_FORMAT " uncompressed:%" G_GUINT64_FORMAT "\n",
                       i, part_builder->objects->len,
-                      (guint64)g_variant_get_size (delta_part),
+                      output->size,
                       part_builder->uncompressed_size);
         }
     }
@@ -1439,20 +2131,18 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
       descriptor_name = g_strdup (basename (descriptor_relpath));
     }
 
-  for (i = 0; i < part_temp_paths->len; i++)
+  for (i = 0; i < writer->outputs->len && !inline_parts; i++)
     {
+      DeltaPartOutput *output = writer->outputs->pdata[i];
       g_autofree char *partstr = g_strdup_printf ("%u", i);
-      /* Take ownership of the path/fd here */
-      g_auto(GLnxTmpfile) tmpf = *((GLnxTmpfile*)part_temp_paths->pdata[i]);
-      g_clear_pointer (&(part_temp_paths->pdata[i]), g_free);
 
-      if (fchmod (tmpf.fd, 0644) < 0)
+      if (fchmod (output->tmpf.fd, 0644) < 0)
         {
           glnx_set_error_from_errno (error);
           goto out;
         }
 
-      if (!glnx_link_tmpfile_at (&tmpf, GLNX_LINK_TMPFILE_REPLACE,
+      if (!glnx_link_tmpfile_at (&output->tmpf, GLNX_LINK_TMPFILE_REPLACE,
                                  descriptor_dfd, partstr, error))
         goto out;
     }
@@ -1512,6 +2202,10 @@ ostree_repo_static_delta_generate (OstreeRepo                   *self,
 
   ret = TRUE;
  out:
+  /* Stop any parts still being written before freeing them */
+  g_clear_pointer (&writer, delta_part_writer_free);
+  if (builder.budget)
+    delta_memory_budget_clear (&budget);
   g_clear_pointer (&builder.parts, g_ptr_array_unref);
   g_clear_pointer (&builder.fallback_objects, g_ptr_array_unref);
   return ret;
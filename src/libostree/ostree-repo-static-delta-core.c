@@ -200,6 +200,140 @@ _ostree_repo_static_delta_part_have_all_objects (OstreeRepo             *repo,
   return TRUE;
 }
 
+/* One delta part to apply in ostree_repo_static_delta_execute_offline().
+ * Parts don't depend on each other, so they can be executed in parallel,
+ * bounded by their uncompressed size.
+ */
+typedef struct {
+  guint i;
+  GVariant *objects;
+  guint64 usize;
+  char checksum[OSTREE_SHA256_STRING_LEN+1];
+  GBytes *inline_part_bytes;
+  OstreeStaticDeltaOpenFlags open_flags;
+  GInputStream *part_in;
+  GError *error;
+} DeltaPartJob;
+
+static void
+delta_part_job_free (DeltaPartJob *job)
+{
+  g_variant_unref (job->objects);
+  g_clear_pointer (&job->inline_part_bytes, g_bytes_unref);
+  g_clear_object (&job->part_in);
+  g_clear_error (&job->error);
+  g_free (job);
+}
+
+/* Opened just before execution, so we don't hold a fd per part */
+static gboolean
+delta_part_job_open_input (DeltaPartJob *job,
+                           int           dfd,
+                           GError      **error)
+{
+  if (job->inline_part_bytes)
+    {
+      job->part_in = g_memory_input_stream_new_from_bytes (job->inline_part_bytes);
+      return TRUE;
+    }
+
+  g_autofree char *relpath = g_strdup_printf ("%u", job->i);
+  glnx_fd_close int part_fd = openat (dfd, relpath, O_RDONLY | O_CLOEXEC);
+  if (part_fd < 0)
+    return glnx_throw_errno_prefix (error, "Opening deltapart '%s'", relpath);
+
+  job->part_in = g_unix_input_stream_new (glnx_steal_fd (&part_fd), TRUE);
+  return TRUE;
+}
+
+typedef struct {
+  OstreeRepo *repo;
+  gboolean skip_validation;
+  GCancellable *cancellable;
+  GAsyncQueue *completed; /* (element-type DeltaPartJob) */
+} DeltaPartPool;
+
+static void
+delta_part_pool_worker (gpointer data,
+                        gpointer user_data)
+{
+  DeltaPartJob *job = data;
+  DeltaPartPool *pool = user_data;
+
+  (void) _ostree_static_delta_part_open_and_execute (pool->repo, job->objects, job->part_in,
+                                                     job->inline_part_bytes, job->open_flags,
+                                                     job->checksum, pool->skip_validation,
+                                                     pool->cancellable, &job->error);
+  g_clear_object (&job->part_in);
+  g_async_queue_push (pool->completed, job);
+}
+
+static gboolean
+execute_offline_parts_threaded (OstreeRepo    *self,
+                                int            dfd,
+                                GPtrArray     *jobs,
+                                guint          n_threads,
+                                gboolean       skip_validation,
+                                GCancellable  *cancellable,
+                                GError       **error)
+{
+  DeltaPartPool pool = { self, skip_validation, cancellable, NULL };
+  GThreadPool *threads = g_thread_pool_new (delta_part_pool_worker, &pool, n_threads, TRUE, error);
+  if (!threads)
+    return FALSE;
+  pool.completed = g_async_queue_new ();
+
+  GError *first_error = NULL;
+  guint n_executing = 0;
+  guint64 executing_usize = 0;
+  guint next_job = 0;
+  while (TRUE)
+    {
+      /* Start as many parts as our budget allows; after an error, we just
+       * wait for the ones already running.
+       */
+      if (first_error == NULL && next_job < jobs->len)
+        {
+          DeltaPartJob *job = jobs->pdata[next_job];
+          if (_ostree_static_delta_part_execution_fits (n_executing, executing_usize, job->usize))
+            {
+              next_job++;
+              if (!g_cancellable_set_error_if_cancelled (cancellable, &first_error) &&
+                  delta_part_job_open_input (job, dfd, &first_error) &&
+                  g_thread_pool_push (threads, job, &first_error))
+                {
+                  n_executing++;
+                  executing_usize += job->usize;
+                }
+              continue;
+            }
+        }
+
+      if (n_executing == 0)
+        break;
+
+      DeltaPartJob *done = g_async_queue_pop (pool.completed);
+      n_executing--;
+      executing_usize -= done->usize;
+      if (done->error && first_error == NULL)
+        {
+          first_error = g_steal_pointer (&done->error);
+          g_prefix_error (&first_error, "Executing delta part %i: ", done->i);
+        }
+    }
+
+  g_thread_pool_free (threads, FALSE, TRUE);
+  g_async_queue_unref (pool.completed);
+
+  if (first_error)
+    {
+      g_propagate_error (error, first_error);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 /**
  * ostree_repo_static_delta_execute_offline:
  * @self: Repo
@@ -316,20 +450,17 @@ ostree_repo_static_delta_execute_offline (OstreeRepo                    *self,
 
   g_autoptr(GVariant) headers = g_variant_get_child_value (meta, 6);
   const guint n = g_variant_n_children (headers);
+  g_autoptr(GPtrArray) jobs = g_ptr_array_new_with_free_func ((GDestroyNotify)delta_part_job_free);
   for (guint i = 0; i < n; i++)
     {
       guint32 version;
       guint64 size;
       guint64 usize;
       const guchar *csum;
-      char checksum[OSTREE_SHA256_STRING_LEN+1];
       gboolean have_all;
       g_autoptr(GVariant) csum_v = NULL;
       g_autoptr(GVariant) objects = NULL;
-      g_autoptr(GVariant) part = NULL;
       g_autofree char *deltapart_path = NULL;
-      OstreeStaticDeltaOpenFlags delta_open_flags =
-        skip_validation ? OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM : 0;
       g_autoptr(GVariant) header = g_variant_get_child_value (headers, i);
       g_variant_get (header, "(u@aytt@ay)", &version, &csum_v, &size, &usize, &objects);
 
@@ -349,52 +480,49 @@ ostree_repo_static_delta_execute_offline (OstreeRepo                    *self,
       csum = ostree_checksum_bytes_peek_validate (csum_v, error);
       if (!csum)
         return FALSE;
-      ostree_checksum_inplace_from_bytes (csum, checksum);
+
+      DeltaPartJob *job = g_new0 (DeltaPartJob, 1);
+      g_ptr_array_add (jobs, job);
+      job->i = i;
+      job->objects = g_steal_pointer (&objects);
+      job->usize = usize;
+      ostree_checksum_inplace_from_bytes (csum, job->checksum);
+      job->open_flags = skip_validation ? OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM : 0;
 
       deltapart_path =
         _ostree_get_relative_static_delta_part_path (from_checksum, to_checksum, i);
 
-      g_autoptr(GInputStream) part_in = NULL;
       g_autoptr(GVariant) inline_part_data = g_variant_lookup_value (metadata, deltapart_path, G_VARIANT_TYPE("(yay)"));
       if (inline_part_data)
         {
-          g_autoptr(GBytes) inline_part_bytes = g_variant_get_data_as_bytes (inline_part_data);
-          part_in = g_memory_input_stream_new_from_bytes (inline_part_bytes);
+          job->inline_part_bytes = g_variant_get_data_as_bytes (inline_part_data);
 
           /* For inline parts, we don't checksum, because it's
            * included with the metadata, so we're not trying to
            * protect against MITM or such.  Non-security related
            * checksums should be done at the underlying storage layer.
            */
-          delta_open_flags |= OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM;
-
-          if (!_ostree_static_delta_part_open (part_in, inline_part_bytes, 
-                                               delta_open_flags,
-                                               NULL,
-                                               &part,
-                                               cancellable, error))
-            return FALSE;
-        }
-      else
-        {
-          g_autofree char *relpath = g_strdup_printf ("%u", i); /* TODO avoid malloc here */
-          glnx_fd_close int part_fd = openat (dfd, relpath, O_RDONLY | O_CLOEXEC);
-          if (part_fd < 0)
-            return glnx_throw_errno_prefix (error, "Opening deltapart '%s'", relpath);
-
-          part_in = g_unix_input_stream_new (part_fd, FALSE);
-
-          if (!_ostree_static_delta_part_open (part_in, NULL,
-                                               delta_open_flags,
-                                               checksum,
-                                               &part,
-                                               cancellable, error))
-            return FALSE;
+          job->open_flags |= OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM;
         }
+    }
+
+  const guint n_threads = MIN (_ostree_static_delta_max_concurrent_parts (), jobs->len);
+  if (n_threads > 1)
+    return execute_offline_parts_threaded (self, dfd, jobs, n_threads, skip_validation,
+                                           cancellable, error);
 
-      if (!_ostree_static_delta_part_execute (self, objects, part, skip_validation,
-                                              NULL, cancellable, error))
-        return glnx_prefix_error (error, "Executing delta part %i", i);
+  for (guint i = 0; i < jobs->len; i++)
+    {
+      DeltaPartJob *job = jobs->pdata[i];
+
+      if (!delta_part_job_open_input (job, dfd, error))
+        return FALSE;
+      if (!_ostree_static_delta_part_open_and_execute (self, job->objects, job->part_in,
+                                                       job->inline_part_bytes, job->open_flags,
+                                                       job->checksum, skip_validation,
+                                                       cancellable, error))
+        return glnx_prefix_error (error, "Executing delta part %i", job->i);
+      g_clear_object (&job->part_in);
     }
 
   return TRUE;
@@ -496,6 +624,382 @@ _ostree_static_delta_part_open (GInputStream   *part_in,
   return TRUE;
 }
 
+/*
+ * Decoding fetched delta parts in the background
+ *
+ * The opcodes of a part refer to its payload by offset, and the part is a
+ * single GVariant whose framing is at the end, so we can't start executing
+ * it before we have all of it.  What we can do is verify and decompress it
+ * while it is being downloaded, rather than afterwards.
+ *
+ * The fetcher hands us the data on whichever thread it runs its I/O on,
+ * possibly the pull main loop, so feeding it only queues the data; the
+ * checksumming and decompression happen on a thread of our own.  At most @window_size
+ * bytes are queued.  If the decoder falls further behind than that, it
+ * gives up rather than slowing the download down, and the part is decoded
+ * from the fetched file when it's executed, as if there were no decoder.
+ * Decompressed data goes into an anonymous tmpfile, so heap usage is
+ * bounded by the window rather than by the part size.
+ */
+
+#define DELTA_PART_DECODER_BUFSIZE (64 * 1024)
+
+struct _OstreeDeltaPartDecoder {
+  gsize window_size;
+
+  /* Shared with the decoding thread */
+  GMutex lock;
+  GCond cond;
+  GThread *thread;
+  GQueue queue;        /* Queue<GBytes> of fetched data */
+  gsize queued_bytes;
+  gboolean reset;      /* Start again before decoding the queue */
+  gboolean overflowed; /* Gave up; see above */
+  gboolean done;       /* No more data is coming */
+
+  /* Only used by the decoding thread until it's joined */
+  guint8 *buf;
+  OtChecksum checksum; /* Of the data as fetched */
+  gboolean have_comptype;
+  guint8 comptype;
+  GConverter *decompressor;
+  gboolean decompressor_finished;
+  GLnxTmpfile tmpf;
+  GError *error; /* Sticky; reported by _ostree_delta_part_decoder_finish() */
+};
+
+/*
+ * _ostree_delta_part_decoder_new:
+ * @window_size: Maximum number of bytes queued for decoding; 0 disables
+ * decoding while fetching
+ *
+ * Returns: A decoder, to be used as an #OstreeFetcherSinkFuncs sink.
+ */
+OstreeDeltaPartDecoder *
+_ostree_delta_part_decoder_new (gsize window_size)
+{
+  OstreeDeltaPartDecoder *self = g_new0 (OstreeDeltaPartDecoder, 1);
+  self->window_size = window_size;
+  self->overflowed = (window_size == 0);
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  g_queue_init (&self->queue);
+  self->buf = g_malloc (DELTA_PART_DECODER_BUFSIZE);
+  ot_checksum_init (&self->checksum);
+  return self;
+}
+
+/* Called with the lock held */
+static void
+delta_part_decoder_clear_queue (OstreeDeltaPartDecoder *self)
+{
+  g_queue_foreach (&self->queue, (GFunc) g_bytes_unref, NULL);
+  g_queue_clear (&self->queue);
+  self->queued_bytes = 0;
+}
+
+/* Called on the decoding thread, or once it's joined */
+static void
+delta_part_decoder_reset_state (OstreeDeltaPartDecoder *self)
+{
+  ot_checksum_clear (&self->checksum);
+  ot_checksum_init (&self->checksum);
+  self->have_comptype = FALSE;
+  g_clear_object (&self->decompressor);
+  self->decompressor_finished = FALSE;
+  glnx_tmpfile_clear (&self->tmpf);
+  g_clear_error (&self->error);
+}
+
+/*
+ * _ostree_delta_part_decoder_reset:
+ * @self: Decoder
+ *
+ * Start again from the beginning of the part; used when a fetch is
+ * restarted, e.g. from another mirror.
+ */
+void
+_ostree_delta_part_decoder_reset (OstreeDeltaPartDecoder *self)
+{
+  g_mutex_lock (&self->lock);
+  delta_part_decoder_clear_queue (self);
+  self->reset = TRUE;
+  self->overflowed = (self->window_size == 0);
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+/* Stop the decoding thread once it has seen everything queued */
+static void
+delta_part_decoder_join (OstreeDeltaPartDecoder *self)
+{
+  g_mutex_lock (&self->lock);
+  self->done = TRUE;
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->lock);
+
+  if (self->thread)
+    g_thread_join (g_steal_pointer (&self->thread));
+}
+
+void
+_ostree_delta_part_decoder_free (OstreeDeltaPartDecoder *self)
+{
+  /* Don't bother decoding what's left */
+  g_mutex_lock (&self->lock);
+  delta_part_decoder_clear_queue (self);
+  self->overflowed = TRUE;
+  g_mutex_unlock (&self->lock);
+  delta_part_decoder_join (self);
+
+  delta_part_decoder_reset_state (self);
+  ot_checksum_clear (&self->checksum);
+  g_free (self->buf);
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+  g_free (self);
+}
+
+static gboolean
+delta_part_decoder_decompress (OstreeDeltaPartDecoder *self,
+                               const guint8           *buf,
+                               gsize                   len,
+                               GConverterFlags         flags,
+                               GError                **error)
+{
+  while (!self->decompressor_finished)
+    {
+      g_autoptr(GError) local_error = NULL;
+      gsize bytes_read = 0;
+      gsize bytes_written = 0;
+      GConverterResult res =
+        g_converter_convert (self->decompressor, buf, len, self->buf, DELTA_PART_DECODER_BUFSIZE,
+                             flags, &bytes_read, &bytes_written, &local_error);
+      if (res == G_CONVERTER_ERROR)
+        {
+          /* Wait for the rest of the stream */
+          if (!(flags & G_CONVERTER_INPUT_AT_END) &&
+              g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT))
+            return TRUE;
+          g_propagate_error (error, g_steal_pointer (&local_error));
+          return glnx_prefix_error (error, "Decompressing static delta part");
+        }
+
+      if (glnx_loop_write (self->tmpf.fd, self->buf, bytes_written) < 0)
+        return glnx_throw_errno_prefix (error, "write");
+      buf += bytes_read;
+      len -= bytes_read;
+
+      if (res == G_CONVERTER_FINISHED)
+        self->decompressor_finished = TRUE;
+      else if (bytes_read == 0 && bytes_written == 0)
+        {
+          if (flags & G_CONVERTER_INPUT_AT_END)
+            return glnx_throw (error, "Truncated static delta part");
+          return TRUE;
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+delta_part_decoder_update (OstreeDeltaPartDecoder *self,
+                           const guint8           *buf,
+                           gsize                   len,
+                           GError                **error)
+{
+  ot_checksum_update (&self->checksum, buf, len);
+
+  if (!self->have_comptype)
+    {
+      if (len == 0)
+        return TRUE;
+      self->comptype = buf[0];
+      self->have_comptype = TRUE;
+      buf++;
+      len--;
+
+      switch (self->comptype)
+        {
+        case 0:
+          break;
+        case 'x':
+          self->decompressor = (GConverter*) _ostree_lzma_decompressor_new ();
+          if (!glnx_open_anonymous_tmpfile (O_RDWR | O_CLOEXEC, &self->tmpf, error))
+            return FALSE;
+          break;
+        default:
+          return glnx_throw (error, "Invalid compression type '%u'", self->comptype);
+        }
+    }
+
+  /* Uncompressed parts are used directly from the fetched file */
+  if (self->decompressor == NULL)
+    return TRUE;
+
+  return delta_part_decoder_decompress (self, buf, len, 0, error);
+}
+
+static gpointer
+delta_part_decoder_thread (gpointer data)
+{
+  OstreeDeltaPartDecoder *self = data;
+
+  g_mutex_lock (&self->lock);
+  while (TRUE)
+    {
+      if (self->reset)
+        {
+          self->reset = FALSE;
+          g_mutex_unlock (&self->lock);
+          delta_part_decoder_reset_state (self);
+          g_mutex_lock (&self->lock);
+          continue;
+        }
+
+      GBytes *bytes = g_queue_pop_head (&self->queue);
+      if (bytes == NULL)
+        {
+          if (self->done)
+            break;
+          g_cond_wait (&self->cond, &self->lock);
+          continue;
+        }
+      self->queued_bytes -= g_bytes_get_size (bytes);
+      g_mutex_unlock (&self->lock);
+
+      if (self->error == NULL)
+        {
+          gsize len;
+          const guint8 *buf = g_bytes_get_data (bytes, &len);
+          (void) delta_part_decoder_update (self, buf, len, &self->error);
+        }
+      g_bytes_unref (bytes);
+
+      g_mutex_lock (&self->lock);
+    }
+  g_mutex_unlock (&self->lock);
+
+  return NULL;
+}
+
+/*
+ * _ostree_delta_part_decoder_update:
+ * @self: Decoder
+ * @buf: (array length=len): Data
+ * @len: Length of @buf
+ *
+ * Queue the next @len bytes of the part as fetched for decoding.  This
+ * doesn't block; any error is deferred until
+ * _ostree_delta_part_decoder_finish().
+ */
+void
+_ostree_delta_part_decoder_update (OstreeDeltaPartDecoder *self,
+                                   const guint8           *buf,
+                                   gsize                   len)
+{
+  g_mutex_lock (&self->lock);
+
+  if (!self->overflowed && self->queued_bytes + len > self->window_size)
+    {
+      g_debug ("Falling behind decoding static delta part; deferring it");
+      self->overflowed = TRUE;
+      delta_part_decoder_clear_queue (self);
+    }
+
+  if (!self->overflowed && self->thread == NULL)
+    {
+      g_autoptr(GError) local_error = NULL;
+      self->thread = g_thread_try_new ("deltapart-decoder", delta_part_decoder_thread,
+                                       self, &local_error);
+      if (self->thread == NULL)
+        {
+          g_debug ("Failed to start static delta part decoder: %s", local_error->message);
+          self->overflowed = TRUE;
+        }
+    }
+
+  if (!self->overflowed)
+    {
+      g_queue_push_tail (&self->queue, g_bytes_new (buf, len));
+      self->queued_bytes += len;
+      g_cond_signal (&self->cond);
+    }
+
+  g_mutex_unlock (&self->lock);
+}
+
+/*
+ * _ostree_delta_part_decoder_finish:
+ * @self: Decoder
+ * @expected_checksum: Checksum of the part from the superblock
+ * @out_verified: (out): Whether the part was decoded and verified
+ * @out_part: (out) (nullable): The decompressed part
+ * @error: Error
+ *
+ * Wait for the decoder to catch up, which may block, so this should be
+ * called from a worker thread.  Then verify the checksum of everything fed
+ * to @self, and return the part.
+ *
+ * If the decoder gave up, @out_verified is %FALSE, and the fetched file
+ * should be opened with _ostree_static_delta_part_open() as usual.  For an
+ * uncompressed part, @out_verified is %TRUE but @out_part is %NULL; the
+ * fetched file should be opened with
+ * %OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM.
+ */
+gboolean
+_ostree_delta_part_decoder_finish (OstreeDeltaPartDecoder *self,
+                                   const char             *expected_checksum,
+                                   gboolean               *out_verified,
+                                   GVariant              **out_part,
+                                   GError                **error)
+{
+  *out_verified = FALSE;
+  *out_part = NULL;
+
+  delta_part_decoder_join (self);
+
+  if (self->overflowed)
+    return TRUE;
+  /* Reset after the thread last looked */
+  if (self->reset)
+    {
+      self->reset = FALSE;
+      delta_part_decoder_reset_state (self);
+    }
+
+  if (self->error)
+    {
+      g_propagate_error (error, g_steal_pointer (&self->error));
+      return FALSE;
+    }
+  if (!self->have_comptype)
+    return glnx_throw (error, "Reading initial compression flag byte: Unexpected EOF");
+
+  char actual_checksum[OSTREE_SHA256_STRING_LEN+1];
+  ot_checksum_get_hexdigest (&self->checksum, actual_checksum, sizeof (actual_checksum));
+  if (strcmp (actual_checksum, expected_checksum) != 0)
+    return glnx_throw (error, "Checksum mismatch in static delta part; expected=%s actual=%s",
+                       expected_checksum, actual_checksum);
+
+  if (self->decompressor != NULL)
+    {
+      if (!delta_part_decoder_decompress (self, NULL, 0, G_CONVERTER_INPUT_AT_END, error))
+        return FALSE;
+
+      g_autoptr(GMappedFile) mfile = g_mapped_file_new_from_fd (self->tmpf.fd, FALSE, error);
+      if (!mfile)
+        return FALSE;
+      g_autoptr(GBytes) bytes = g_mapped_file_get_bytes (mfile);
+      *out_part = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (OSTREE_STATIC_DELTA_PART_PAYLOAD_FORMAT_V0),
+                                                                bytes, FALSE));
+    }
+
+  *out_verified = TRUE;
+  return TRUE;
+}
+
 /*
  * Displaying static delta parts
  */
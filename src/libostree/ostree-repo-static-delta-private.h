@@ -129,6 +129,23 @@ _ostree_static_delta_part_open (GInputStream   *part_in,
                                 GCancellable *cancellable,
                                 GError      **error);
 
+typedef struct _OstreeDeltaPartDecoder OstreeDeltaPartDecoder;
+
+OstreeDeltaPartDecoder *_ostree_delta_part_decoder_new (gsize window_size);
+void _ostree_delta_part_decoder_reset (OstreeDeltaPartDecoder *self);
+void _ostree_delta_part_decoder_free (OstreeDeltaPartDecoder *self);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(OstreeDeltaPartDecoder, _ostree_delta_part_decoder_free)
+
+void _ostree_delta_part_decoder_update (OstreeDeltaPartDecoder *self,
+                                        const guint8           *buf,
+                                        gsize                   len);
+
+gboolean _ostree_delta_part_decoder_finish (OstreeDeltaPartDecoder *self,
+                                            const char             *expected_checksum,
+                                            gboolean               *out_verified,
+                                            GVariant              **out_part,
+                                            GError                **error);
+
 gboolean _ostree_static_delta_dump (OstreeRepo     *repo,
                                     const char *delta_id,
                                     GCancellable   *cancellable,
@@ -146,9 +163,23 @@ gboolean _ostree_static_delta_part_execute (OstreeRepo      *repo,
                                             GCancellable    *cancellable,
                                             GError         **error);
 
+gboolean _ostree_static_delta_part_open_and_execute (OstreeRepo      *repo,
+                                                     GVariant        *header,
+                                                     GInputStream    *part_in,
+                                                     GBytes          *inline_part_bytes,
+                                                     OstreeStaticDeltaOpenFlags open_flags,
+                                                     const char      *expected_checksum,
+                                                     gboolean         stats_only,
+                                                     GCancellable    *cancellable,
+                                                     GError         **error);
+
 void _ostree_static_delta_part_execute_async (OstreeRepo      *repo,
                                               GVariant        *header,
-                                              GVariant        *part_payload,
+                                              OstreeDeltaPartDecoder *decoder,
+                                              GInputStream    *part_in,
+                                              GBytes          *inline_part_bytes,
+                                              OstreeStaticDeltaOpenFlags open_flags,
+                                              const char      *expected_checksum,
                                               GCancellable    *cancellable,
                                               GAsyncReadyCallback  callback,
                                               gpointer         user_data);
@@ -157,6 +188,17 @@ gboolean _ostree_static_delta_part_execute_finish (OstreeRepo      *repo,
                                                    GAsyncResult    *result,
                                                    GError         **error); 
 
+/* Upper bound on the total uncompressed size of delta parts we execute
+ * concurrently; see _ostree_static_delta_part_execution_fits().
+ */
+#define _OSTREE_STATIC_DELTA_EXECUTE_MEMORY_MAX (256 * 1024 * 1024)
+
+guint _ostree_static_delta_max_concurrent_parts (void);
+
+gboolean _ostree_static_delta_part_execution_fits (guint    n_executing,
+                                                   guint64  executing_usize,
+                                                   guint64  usize);
+
 gboolean
 _ostree_static_delta_parse_checksum_array (GVariant      *array,
                                            guint8       **out_checksums_array,
@@ -184,6 +226,7 @@ _ostree_delta_compute_similar_objects (OstreeRepo                 *repo,
                                        GVariant                   *to_commit,
                                        GHashTable                 *new_reachable_regfile_content,
                                        guint                       similarity_percent_threshold,
+                                       guint                       n_threads,
                                        GHashTable                **out_modified_regfile_content,
                                        GCancellable               *cancellable,
                                        GError                    **error);
@@ -59,7 +59,7 @@ typedef struct {
   GLnxTmpfile      tmpf;
   guint64          content_size;
   GOutputStream   *content_out;
-  GChecksum       *content_checksum;
+  OtChecksum      content_checksum;
   char             checksum[OSTREE_SHA256_STRING_LEN+1];
   char             *read_source_object;
   int               read_source_fd;
@@ -278,14 +278,69 @@ _ostree_static_delta_part_execute (OstreeRepo      *repo,
  out:
   glnx_tmpfile_clear (&state->tmpf);
   g_clear_object (&state->content_out);
-  g_clear_pointer (&state->content_checksum, g_checksum_free);
+  ot_checksum_clear (&state->content_checksum);
   return ret;
 }
 
+/* Uncompressed delta parts are held in memory while executing, so that is
+ * what we budget for; never more parts than CPUs though, since beyond that
+ * running more in parallel doesn't help.
+ */
+guint
+_ostree_static_delta_max_concurrent_parts (void)
+{
+  return MAX (1, g_get_num_processors ());
+}
+
+/* Whether we should start executing a part with uncompressed size @usize,
+ * when @n_executing parts of total uncompressed size @executing_usize are
+ * already running.  We always allow one, however large.
+ */
+gboolean
+_ostree_static_delta_part_execution_fits (guint    n_executing,
+                                          guint64  executing_usize,
+                                          guint64  usize)
+{
+  if (n_executing == 0)
+    return TRUE;
+  if (n_executing >= _ostree_static_delta_max_concurrent_parts ())
+    return FALSE;
+  return executing_usize + usize <= _OSTREE_STATIC_DELTA_EXECUTE_MEMORY_MAX;
+}
+
+/* Decompress (and unless told otherwise, verify) a delta part, then
+ * execute it.  Everything here is independent of other parts, so it may
+ * run in parallel for different parts of the same delta.
+ */
+gboolean
+_ostree_static_delta_part_open_and_execute (OstreeRepo      *repo,
+                                            GVariant        *objects,
+                                            GInputStream    *part_in,
+                                            GBytes          *inline_part_bytes,
+                                            OstreeStaticDeltaOpenFlags open_flags,
+                                            const char      *expected_checksum,
+                                            gboolean         stats_only,
+                                            GCancellable    *cancellable,
+                                            GError         **error)
+{
+  g_autoptr(GVariant) part = NULL;
+  if (!_ostree_static_delta_part_open (part_in, inline_part_bytes, open_flags,
+                                       expected_checksum, &part,
+                                       cancellable, error))
+    return FALSE;
+
+  return _ostree_static_delta_part_execute (repo, objects, part, stats_only,
+                                            NULL, cancellable, error);
+}
+
 typedef struct {
   OstreeRepo *repo;
   GVariant *header;
-  GVariant *part;
+  OstreeDeltaPartDecoder *decoder;
+  GInputStream *part_in;
+  GBytes *inline_part_bytes;
+  OstreeStaticDeltaOpenFlags open_flags;
+  char *expected_checksum;
   GCancellable *cancellable;
   GSimpleAsyncResult *result;
 } StaticDeltaPartExecuteAsyncData;
@@ -297,7 +352,10 @@ static_delta_part_execute_async_data_free (gpointer user_data)
 
   g_clear_object (&data->repo);
   g_variant_unref (data->header);
-  g_variant_unref (data->part);
+  g_clear_pointer (&data->decoder, _ostree_delta_part_decoder_free);
+  g_clear_object (&data->part_in);
+  g_clear_pointer (&data->inline_part_bytes, g_bytes_unref);
+  g_free (data->expected_checksum);
   g_clear_object (&data->cancellable);
   g_free (data);
 }
@@ -309,20 +367,50 @@ static_delta_part_execute_thread (GSimpleAsyncResult  *res,
 {
   GError *error = NULL;
   StaticDeltaPartExecuteAsyncData *data;
+  OstreeStaticDeltaOpenFlags open_flags;
+  g_autoptr(GVariant) part = NULL;
+  gboolean ok = TRUE;
 
   data = g_simple_async_result_get_op_res_gpointer (res);
-  if (!_ostree_static_delta_part_execute (data->repo,
-                                          data->header,
-                                          data->part,
-                                          FALSE, NULL,
-                                          cancellable, &error))
+  open_flags = data->open_flags;
+  if (data->decoder)
+    {
+      gboolean verified;
+      ok = _ostree_delta_part_decoder_finish (data->decoder, data->expected_checksum,
+                                              &verified, &part, &error);
+      if (ok && verified)
+        open_flags |= OSTREE_STATIC_DELTA_OPEN_FLAGS_SKIP_CHECKSUM;
+    }
+  if (ok && part)
+    ok = _ostree_static_delta_part_execute (data->repo, data->header, part,
+                                            FALSE, NULL, cancellable, &error);
+  else if (ok)
+    ok = _ostree_static_delta_part_open_and_execute (data->repo,
+                                                     data->header,
+                                                     data->part_in,
+                                                     data->inline_part_bytes,
+                                                     open_flags,
+                                                     data->expected_checksum,
+                                                     FALSE,
+                                                     cancellable, &error);
+  if (!ok)
     g_simple_async_result_take_error (res, error);
 }
 
+/* Like _ostree_static_delta_part_open_and_execute(), but in a worker
+ * thread; decompression is the expensive part, so it's done there too.
+ * If the part was fed to @decoder as it was fetched, this takes ownership
+ * of it, and waits for it to finish in the worker thread; @part_in is
+ * only read if the decoder didn't get as far as decompressing the part.
+ */
 void
 _ostree_static_delta_part_execute_async (OstreeRepo      *repo,
                                          GVariant        *header,
-                                         GVariant        *part,
+                                         OstreeDeltaPartDecoder *decoder,
+                                         GInputStream    *part_in,
+                                         GBytes          *inline_part_bytes,
+                                         OstreeStaticDeltaOpenFlags open_flags,
+                                         const char      *expected_checksum,
                                          GCancellable    *cancellable,
                                          GAsyncReadyCallback  callback,
                                          gpointer         user_data)
@@ -332,7 +420,11 @@ _ostree_static_delta_part_execute_async (OstreeRepo      *repo,
   asyncdata = g_new0 (StaticDeltaPartExecuteAsyncData, 1);
   asyncdata->repo = g_object_ref (repo);
   asyncdata->header = g_variant_ref (header);
-  asyncdata->part = g_variant_ref (part);
+  asyncdata->decoder = decoder;
+  asyncdata->part_in = part_in ? g_object_ref (part_in) : NULL;
+  asyncdata->inline_part_bytes = inline_part_bytes ? g_bytes_ref (inline_part_bytes) : NULL;
+  asyncdata->open_flags = open_flags;
+  asyncdata->expected_checksum = g_strdup (expected_checksum);
   asyncdata->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
 
   asyncdata->result = g_simple_async_result_new ((GObject*) repo,
@@ -386,8 +478,8 @@ content_out_write (OstreeRepo                 *repo,
 {
   gsize bytes_written;
 
-  if (state->content_checksum)
-    g_checksum_update (state->content_checksum, buf, len);
+  if (state->content_checksum.initialized)
+    ot_checksum_update (&state->content_checksum, buf, len);
 
   /* Ignore bytes_written since we discard partial content */
   if (!g_output_stream_write_all (state->content_out,
@@ -504,10 +596,10 @@ handle_untrusted_content_checksum (OstreeRepo                 *repo,
   g_autoptr(GFileInfo) finfo = _ostree_mode_uidgid_to_gfileinfo (state->mode, state->uid, state->gid);
   g_autoptr(GVariant) header = _ostree_file_header_new (finfo, state->xattrs);
 
-  state->content_checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  ot_checksum_init (&state->content_checksum);
 
   gsize bytes_written;
-  if (!_ostree_write_variant_with_size (NULL, header, 0, &bytes_written, state->content_checksum,
+  if (!_ostree_write_variant_with_size (NULL, header, 0, &bytes_written, &state->content_checksum,
                                         cancellable, error))
     return FALSE;
 
@@ -828,9 +920,10 @@ dispatch_close (OstreeRepo                 *repo,
       if (!g_output_stream_flush (state->content_out, cancellable, error))
         return FALSE;
 
-      if (state->content_checksum)
+      if (state->content_checksum.initialized)
         {
-          const char *actual_checksum = g_checksum_get_string (state->content_checksum);
+          char actual_checksum[OSTREE_SHA256_STRING_LEN+1];
+          ot_checksum_get_hexdigest (&state->content_checksum, actual_checksum, sizeof (actual_checksum));
 
           if (strcmp (actual_checksum, state->checksum) != 0)
             return glnx_throw (error, "Corrupted object %s (actual checksum is %s)",
@@ -849,7 +942,7 @@ dispatch_close (OstreeRepo                 *repo,
     return FALSE;
 
   g_clear_pointer (&state->xattrs, g_variant_unref);
-  g_clear_pointer (&state->content_checksum, g_checksum_free);
+  ot_checksum_clear (&state->content_checksum);
 
   state->checksum_index++;
   state->output_target = NULL;
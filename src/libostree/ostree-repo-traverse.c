@@ -297,10 +297,43 @@ ostree_repo_traverse_new_reachable (void)
                                 NULL, (GDestroyNotify)g_variant_unref);
 }
 
+/* The traversal core works on either the legacy #GHashTable of serialized
+ * object names, or the compact #OstreeObjectSet; exactly one is set.
+ */
+typedef struct {
+  GHashTable      *table;
+  OstreeObjectSet *set;
+} OstreeReachable;
+
+/* Returns %TRUE if the object was newly added */
+static gboolean
+reachable_add (OstreeReachable  *reachable,
+               const char       *checksum,
+               OstreeObjectType  objtype)
+{
+  if (reachable->set)
+    return ostree_object_set_add (reachable->set, checksum, objtype);
+
+  GVariant *key = g_variant_ref_sink (ostree_object_name_serialize (checksum, objtype));
+  return g_hash_table_add (reachable->table, key);
+}
+
+static gboolean
+reachable_contains (OstreeReachable  *reachable,
+                    const char       *checksum,
+                    OstreeObjectType  objtype)
+{
+  if (reachable->set)
+    return ostree_object_set_contains (reachable->set, checksum, objtype);
+
+  g_autoptr(GVariant) key = g_variant_ref_sink (ostree_object_name_serialize (checksum, objtype));
+  return g_hash_table_contains (reachable->table, key);
+}
+
 static gboolean
 traverse_dirtree (OstreeRepo           *repo,
                   const char           *checksum,
-                  GHashTable           *inout_reachable,
+                  OstreeReachable      *inout_reachable,
                   gboolean              ignore_missing_dirs,
                   GCancellable         *cancellable,
                   GError              **error);
@@ -308,7 +341,7 @@ traverse_dirtree (OstreeRepo           *repo,
 static gboolean
 traverse_iter (OstreeRepo                          *repo,
                OstreeRepoCommitTraverseIter        *iter,
-               GHashTable                          *inout_reachable,
+               OstreeReachable                     *inout_reachable,
                gboolean                             ignore_missing_dirs,
                GCancellable                        *cancellable,
                GError                             **error)
@@ -317,7 +350,6 @@ traverse_iter (OstreeRepo                          *repo,
 
   while (TRUE)
     {
-      g_autoptr(GVariant) key = NULL;
       g_autoptr(GError) local_error = NULL;
       OstreeRepoCommitIterResult iterres =
         ostree_repo_commit_traverse_iter_next (iter, cancellable, &local_error);
@@ -348,8 +380,7 @@ traverse_iter (OstreeRepo                          *repo,
           ostree_repo_commit_traverse_iter_get_file (iter, &name, &checksum);
 
           g_debug ("Found file object %s", checksum);
-          key = g_variant_ref_sink (ostree_object_name_serialize (checksum, OSTREE_OBJECT_TYPE_FILE));
-          g_hash_table_add (inout_reachable, g_steal_pointer (&key));
+          (void) reachable_add (inout_reachable, checksum, OSTREE_OBJECT_TYPE_FILE);
         }
       else if (iterres == OSTREE_REPO_COMMIT_ITER_RESULT_DIR)
         {
@@ -362,14 +393,10 @@ traverse_iter (OstreeRepo                          *repo,
 
           g_debug ("Found dirtree object %s", content_checksum);
           g_debug ("Found dirmeta object %s", meta_checksum);
-          key = g_variant_ref_sink (ostree_object_name_serialize (meta_checksum, OSTREE_OBJECT_TYPE_DIR_META));
-          g_hash_table_add (inout_reachable, g_steal_pointer (&key));
+          (void) reachable_add (inout_reachable, meta_checksum, OSTREE_OBJECT_TYPE_DIR_META);
 
-          key = g_variant_ref_sink (ostree_object_name_serialize (content_checksum, OSTREE_OBJECT_TYPE_DIR_TREE));
-          if (!g_hash_table_lookup (inout_reachable, key))
+          if (reachable_add (inout_reachable, content_checksum, OSTREE_OBJECT_TYPE_DIR_TREE))
             {
-              g_hash_table_add (inout_reachable, g_steal_pointer (&key));
-
               if (!traverse_dirtree (repo, content_checksum, inout_reachable,
                                      ignore_missing_dirs, cancellable, error))
                 goto out;
@@ -387,7 +414,7 @@ traverse_iter (OstreeRepo                          *repo,
 static gboolean
 traverse_dirtree (OstreeRepo           *repo,
                   const char           *checksum,
-                  GHashTable           *inout_reachable,
+                  OstreeReachable      *inout_reachable,
                   gboolean              ignore_missing_dirs,
                   GCancellable         *cancellable,
                   GError              **error)
@@ -427,25 +454,13 @@ traverse_dirtree (OstreeRepo           *repo,
   return ret;
 }
 
-/**
- * ostree_repo_traverse_commit_union: (skip)
- * @repo: Repo
- * @commit_checksum: ASCII SHA256 checksum
- * @maxdepth: Traverse this many parent commits, -1 for unlimited
- * @inout_reachable: Set of reachable objects
- * @cancellable: Cancellable
- * @error: Error
- *
- * Update the set @inout_reachable containing all objects reachable
- * from @commit_checksum, traversing @maxdepth parent commits.
- */
-gboolean
-ostree_repo_traverse_commit_union (OstreeRepo      *repo,
-                                   const char      *commit_checksum,
-                                   int              maxdepth,
-                                   GHashTable      *inout_reachable,
-                                   GCancellable    *cancellable,
-                                   GError         **error)
+static gboolean
+traverse_commit_union (OstreeRepo      *repo,
+                       const char      *commit_checksum,
+                       int              maxdepth,
+                       OstreeReachable *inout_reachable,
+                       GCancellable    *cancellable,
+                       GError         **error)
 {
   gboolean ret = FALSE;
   g_autofree char *tmp_checksum = NULL;
@@ -453,16 +468,13 @@ ostree_repo_traverse_commit_union (OstreeRepo      *repo,
   while (TRUE)
     {
       gboolean recurse = FALSE;
-      g_autoptr(GVariant) key = NULL;
       g_autoptr(GVariant) commit = NULL;
       ostree_cleanup_repo_commit_traverse_iter
         OstreeRepoCommitTraverseIter iter = { 0, };
       OstreeRepoCommitState commitstate;
       gboolean ignore_missing_dirs = FALSE;
 
-      key = g_variant_ref_sink (ostree_object_name_serialize (commit_checksum, OSTREE_OBJECT_TYPE_COMMIT));
-
-      if (g_hash_table_contains (inout_reachable, key))
+      if (reachable_contains (inout_reachable, commit_checksum, OSTREE_OBJECT_TYPE_COMMIT))
         break;
 
       if (!ostree_repo_load_variant_if_exists (repo, OSTREE_OBJECT_TYPE_COMMIT,
@@ -484,8 +496,7 @@ ostree_repo_traverse_commit_union (OstreeRepo      *repo,
       if ((commitstate & OSTREE_REPO_COMMIT_STATE_PARTIAL) != 0)
         ignore_missing_dirs = TRUE;
 
-      g_hash_table_add (inout_reachable, key);
-      key = NULL;
+      (void) reachable_add (inout_reachable, commit_checksum, OSTREE_OBJECT_TYPE_COMMIT);
 
       g_debug ("Traversing commit %s", commit_checksum);
       if (!ostree_repo_commit_traverse_iter_init_commit (&iter, repo, commit,
@@ -517,6 +528,61 @@ ostree_repo_traverse_commit_union (OstreeRepo      *repo,
   return ret;
 }
 
+/**
+ * ostree_repo_traverse_commit_union: (skip)
+ * @repo: Repo
+ * @commit_checksum: ASCII SHA256 checksum
+ * @maxdepth: Traverse this many parent commits, -1 for unlimited
+ * @inout_reachable: Set of reachable objects
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Update the set @inout_reachable containing all objects reachable
+ * from @commit_checksum, traversing @maxdepth parent commits.
+ *
+ * For large repositories, prefer ostree_repo_traverse_commit_union_set(),
+ * which uses much less memory.
+ */
+gboolean
+ostree_repo_traverse_commit_union (OstreeRepo      *repo,
+                                   const char      *commit_checksum,
+                                   int              maxdepth,
+                                   GHashTable      *inout_reachable,
+                                   GCancellable    *cancellable,
+                                   GError         **error)
+{
+  OstreeReachable reachable = { inout_reachable, NULL };
+  return traverse_commit_union (repo, commit_checksum, maxdepth, &reachable,
+                                cancellable, error);
+}
+
+/**
+ * ostree_repo_traverse_commit_union_set: (skip)
+ * @repo: Repo
+ * @commit_checksum: ASCII SHA256 checksum
+ * @maxdepth: Traverse this many parent commits, -1 for unlimited
+ * @inout_reachable: Set of reachable objects
+ * @cancellable: Cancellable
+ * @error: Error
+ *
+ * Like ostree_repo_traverse_commit_union(), but uses the compact
+ * #OstreeObjectSet to hold the reachable objects.
+ *
+ * Since: 2017.10
+ */
+gboolean
+ostree_repo_traverse_commit_union_set (OstreeRepo      *repo,
+                                       const char      *commit_checksum,
+                                       int              maxdepth,
+                                       OstreeObjectSet *inout_reachable,
+                                       GCancellable    *cancellable,
+                                       GError         **error)
+{
+  OstreeReachable reachable = { NULL, inout_reachable };
+  return traverse_commit_union (repo, commit_checksum, maxdepth, &reachable,
+                                cancellable, error);
+}
+
 /**
  * ostree_repo_traverse_commit:
  * @repo: Repo
@@ -46,6 +46,7 @@
 #include <glib/gstdio.h>
 #include <sys/file.h>
 #include <sys/statvfs.h>
+#include <sys/xattr.h>
 
 /**
  * SECTION:ostree-repo
@@ -63,6 +64,13 @@
  * A %OSTREE_REPO_MODE_ARCHIVE_Z2 repository in contrast stores
  * content files zlib-compressed.  It is suitable for non-root-owned
  * repositories that can be served via a static HTTP server.
+ * %OSTREE_REPO_MODE_ARCHIVE_ZSTD is the same, except that content is
+ * compressed with zstd, which is substantially cheaper to decompress
+ * on the client.  It is only available if OSTree was built with zstd
+ * support.  An existing archive-z2 repository can be converted by
+ * creating a new archive-zstd repository and using
+ * ostree_repo_pull() (e.g. `ostree pull-local`) to copy the objects
+ * into it; content is recompressed as it is imported.
  *
  * Creating an #OstreeRepo does not invoke any file I/O, and thus needs
  * to be initialized, either from an existing contents or with a new
@@ -486,8 +494,11 @@ ostree_repo_finalize (GObject *object)
   g_clear_error (&self->writable_error);
   g_clear_pointer (&self->object_sizes, (GDestroyNotify) g_hash_table_unref);
   g_clear_pointer (&self->dirmeta_cache, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&self->metadata_cache, _ostree_metadata_cache_free);
   g_mutex_clear (&self->cache_lock);
   g_mutex_clear (&self->txn_stats_lock);
+  g_clear_pointer (&self->object_index, ostree_object_set_free);
+  g_mutex_clear (&self->object_index_lock);
   g_free (self->collection_id);
 
   g_clear_pointer (&self->remotes, g_hash_table_destroy);
@@ -620,6 +631,7 @@ ostree_repo_init (OstreeRepo *self)
   GLnxLockFile empty_lockfile = GLNX_LOCK_FILE_INIT;
   const GDebugKey test_error_keys[] = {
     { "pre-commit", OSTREE_REPO_TEST_ERROR_PRE_COMMIT },
+    { "import-no-hardlink", OSTREE_REPO_TEST_ERROR_IMPORT_NO_HARDLINK },
   };
 
   if (g_once_init_enter (&gpgme_initialized))
@@ -633,7 +645,9 @@ ostree_repo_init (OstreeRepo *self)
                                                  test_error_keys, G_N_ELEMENTS (test_error_keys));
 
   g_mutex_init (&self->cache_lock);
+  self->metadata_cache = _ostree_metadata_cache_new (0);
   g_mutex_init (&self->txn_stats_lock);
+  g_mutex_init (&self->object_index_lock);
 
   self->remotes = g_hash_table_new_full (g_str_hash, g_str_equal,
                                          (GDestroyNotify) NULL,
@@ -1636,6 +1650,9 @@ ostree_repo_mode_to_string (OstreeRepoMode   mode,
     case OSTREE_REPO_MODE_ARCHIVE_Z2:
       ret_mode ="archive-z2";
       break;
+    case OSTREE_REPO_MODE_ARCHIVE_ZSTD:
+      ret_mode = "archive-zstd";
+      break;
     default:
       return glnx_throw (error, "Invalid mode '%d'", mode);
     }
@@ -1660,6 +1677,8 @@ ostree_repo_mode_from_string (const char      *mode,
   else if (strcmp (mode, "archive-z2") == 0 ||
            strcmp (mode, "archive") == 0)
     ret_mode = OSTREE_REPO_MODE_ARCHIVE_Z2;
+  else if (strcmp (mode, "archive-zstd") == 0)
+    ret_mode = OSTREE_REPO_MODE_ARCHIVE_ZSTD;
   else
     return glnx_throw (error, "Invalid mode '%s' in repository configuration", mode);
 
@@ -1700,6 +1719,9 @@ ostree_repo_create (OstreeRepo     *self,
                                "refs", "refs/heads", "refs/mirrors",
                                "refs/remotes" };
 
+  if (!_ostree_repo_mode_check_supported (mode, error))
+    return FALSE;
+
   if (mkdir (repopath, 0755) != 0)
     {
       if (G_UNLIKELY (errno != EEXIST))
@@ -1962,6 +1984,8 @@ reload_core_config (OstreeRepo          *self,
     return FALSE;
   if (!ostree_repo_mode_from_string (mode, &self->mode, error))
     return FALSE;
+  if (!_ostree_repo_mode_check_supported (self->mode, error))
+    return FALSE;
 
   if (self->writable)
     {
@@ -1988,6 +2012,34 @@ reload_core_config (OstreeRepo          *self,
                                             FALSE, &self->disable_xattrs, error))
     return FALSE;
 
+  if (!ot_keyfile_get_boolean_with_default (self->config, "core", "object-index",
+                                            FALSE, &self->enable_object_index, error))
+    return FALSE;
+
+  { g_autofree char *finalize_sync = NULL;
+
+    if (!ot_keyfile_get_value_with_default (self->config, "core", "finalize-sync", "directories",
+                                            &finalize_sync, error))
+      return FALSE;
+
+    if (strcmp (finalize_sync, "directories") == 0)
+      self->finalize_sync = OSTREE_REPO_FINALIZE_SYNC_DIRECTORIES;
+    else if (strcmp (finalize_sync, "syncfs") == 0)
+      self->finalize_sync = OSTREE_REPO_FINALIZE_SYNC_SYNCFS;
+    else
+      return glnx_throw (error, "Invalid finalize-sync '%s'", finalize_sync);
+  }
+
+  { g_autofree char *metadata_cache_size = NULL;
+
+    if (!ot_keyfile_get_value_with_default (self->config, "core", "metadata-cache-size", "0",
+                                            &metadata_cache_size, error))
+      return FALSE;
+
+    _ostree_metadata_cache_set_max_size (self->metadata_cache,
+                                         g_ascii_strtoull (metadata_cache_size, NULL, 10));
+  }
+
   { g_autofree char *tmp_expiry_seconds = NULL;
 
     /* 86400 secs = one day */
@@ -2011,6 +2063,18 @@ reload_core_config (OstreeRepo          *self,
       self->zlib_compression_level = OSTREE_ARCHIVE_DEFAULT_COMPRESSION_LEVEL;
   }
 
+  { g_autofree char *compression_level_str = NULL;
+
+    (void)ot_keyfile_get_value_with_default (self->config, "archive", "zstd-level", NULL,
+                                             &compression_level_str, NULL);
+
+    if (compression_level_str)
+      /* The compressor clamps this to the maximum level zstd supports */
+      self->zstd_compression_level = MAX (1, g_ascii_strtoull (compression_level_str, NULL, 10));
+    else
+      self->zstd_compression_level = OSTREE_ARCHIVE_ZSTD_DEFAULT_COMPRESSION_LEVEL;
+  }
+
   { g_autofree char *min_free_space_percent_str = NULL;
     /* If changing this, be sure to change the man page too */
     const char *default_min_free_space = "3";
@@ -2252,7 +2316,7 @@ ostree_repo_open (OstreeRepo    *self,
     return FALSE;
 
   /* TODO - delete this */
-  if (self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2 && self->enable_uncompressed_cache)
+  if (_ostree_repo_mode_is_archive (self->mode) && self->enable_uncompressed_cache)
     {
       if (!glnx_shutil_mkdir_p_at (self->repo_dir_fd, "uncompressed-objects-cache", 0755,
                                    cancellable, error))
@@ -2385,6 +2449,33 @@ ostree_repo_get_mode (OstreeRepo  *self)
   return self->mode;
 }
 
+/**
+ * ostree_repo_get_metadata_cache_stats:
+ * @self: Repo
+ * @out_hits: (out) (optional): Number of lookups answered from the cache
+ * @out_misses: (out) (optional): Number of lookups which had to load the object
+ * @out_evictions: (out) (optional): Number of objects dropped to stay within the size limit
+ * @out_size: (out) (optional): Current total size in bytes of cached objects
+ *
+ * If `core.metadata-cache-size` is set in the repository configuration,
+ * dirtree, dirmeta and commit objects loaded from @self are kept in a
+ * least-recently-used cache bounded to that many bytes, shared by all
+ * users of @self.  Retrieve counters describing how effective it is;
+ * they are cumulative for the lifetime of @self.
+ *
+ * Since: 2017.10
+ */
+void
+ostree_repo_get_metadata_cache_stats (OstreeRepo  *self,
+                                      guint64     *out_hits,
+                                      guint64     *out_misses,
+                                      guint64     *out_evictions,
+                                      guint64     *out_size)
+{
+  _ostree_metadata_cache_get_stats (self->metadata_cache, out_hits, out_misses,
+                                    out_evictions, out_size);
+}
+
 /**
  * ostree_repo_get_parent:
  * @self: Repo
@@ -2400,6 +2491,34 @@ ostree_repo_get_parent (OstreeRepo  *self)
   return self->parent_repo;
 }
 
+/* Parse the name of a loose object file (without the two character
+ * prefix directory); returns %FALSE if it isn't an object we list.
+ */
+static gboolean
+loose_object_type_from_name (OstreeRepo        *self,
+                             const char        *name,
+                             OstreeObjectType  *out_objtype)
+{
+  const char *dot = strrchr (name, '.');
+  if (!dot)
+    return FALSE;
+
+  if (g_str_has_prefix (dot, ".file") &&
+      strcmp (dot + strlen (".file"),
+              _ostree_loose_object_suffix (OSTREE_OBJECT_TYPE_FILE, self->mode)) == 0)
+    *out_objtype = OSTREE_OBJECT_TYPE_FILE;
+  else if (strcmp (dot, ".dirtree") == 0)
+    *out_objtype = OSTREE_OBJECT_TYPE_DIR_TREE;
+  else if (strcmp (dot, ".dirmeta") == 0)
+    *out_objtype = OSTREE_OBJECT_TYPE_DIR_META;
+  else if (strcmp (dot, ".commit") == 0)
+    *out_objtype = OSTREE_OBJECT_TYPE_COMMIT;
+  else
+    return FALSE;
+
+  return (dot - name) == 62;
+}
+
 static gboolean
 list_loose_objects_at (OstreeRepo             *self,
                        GHashTable             *inout_objects,
@@ -2433,26 +2552,8 @@ list_loose_objects_at (OstreeRepo             *self,
           strcmp (name, "..") == 0)
         continue;
 
-      const char *dot = strrchr (name, '.');
-      if (!dot)
-        continue;
-
       OstreeObjectType objtype;
-      if ((self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2
-           && strcmp (dot, ".filez") == 0) ||
-          ((_ostree_repo_mode_is_bare (self->mode))
-           && strcmp (dot, ".file") == 0))
-        objtype = OSTREE_OBJECT_TYPE_FILE;
-      else if (strcmp (dot, ".dirtree") == 0)
-        objtype = OSTREE_OBJECT_TYPE_DIR_TREE;
-      else if (strcmp (dot, ".dirmeta") == 0)
-        objtype = OSTREE_OBJECT_TYPE_DIR_META;
-      else if (strcmp (dot, ".commit") == 0)
-        objtype = OSTREE_OBJECT_TYPE_COMMIT;
-      else
-        continue;
-
-      if ((dot - name) != 62)
+      if (!loose_object_type_from_name (self, name, &objtype))
         continue;
 
       char buf[OSTREE_SHA256_STRING_LEN+1];
@@ -2510,6 +2611,20 @@ list_loose_objects (OstreeRepo                     *self,
   return TRUE;
 }
 
+static gboolean
+metadata_cache_covers_type (OstreeObjectType objtype)
+{
+  switch (objtype)
+    {
+    case OSTREE_OBJECT_TYPE_DIR_TREE:
+    case OSTREE_OBJECT_TYPE_DIR_META:
+    case OSTREE_OBJECT_TYPE_COMMIT:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
 static gboolean
 load_metadata_internal (OstreeRepo       *self,
                         OstreeObjectType  objtype,
@@ -2549,17 +2664,35 @@ load_metadata_internal (OstreeRepo       *self,
         return TRUE;
     }
 
+  /* And the general LRU cache, if enabled */
+  const gboolean is_lru_cachable =
+    (metadata_cache_covers_type (objtype) && out_variant && !out_stream && !out_size);
+  if (is_lru_cachable)
+    {
+      GVariant *cache_hit = _ostree_metadata_cache_lookup (self->metadata_cache, objtype, sha256);
+      if (cache_hit)
+        {
+          *out_variant = cache_hit;
+          return TRUE;
+        }
+    }
+
   _ostree_loose_path (loose_path_buf, sha256, objtype, self->mode);
 
  if (!ot_openat_ignore_enoent (self->objects_dir_fd, loose_path_buf, &fd,
                                error))
     return FALSE;
 
+  /* Objects only in the staging dir may go away if the transaction is
+   * aborted, so don't put those in the LRU cache.
+   */
+  gboolean is_staged = FALSE;
   if (fd < 0 && self->commit_stagedir_fd != -1)
     {
       if (!ot_openat_ignore_enoent (self->commit_stagedir_fd, loose_path_buf, &fd,
                                     error))
         return FALSE;
+      is_staged = (fd != -1);
     }
 
   if (fd != -1)
@@ -2604,6 +2737,8 @@ load_metadata_internal (OstreeRepo       *self,
                 g_hash_table_replace (self->dirmeta_cache, g_strdup (sha256), g_variant_ref (ret_variant));
               g_mutex_unlock (lock);
             }
+          if (is_lru_cachable && !is_staged)
+            _ostree_metadata_cache_insert (self->metadata_cache, objtype, sha256, ret_variant);
         }
       else if (out_stream)
         {
@@ -2682,9 +2817,9 @@ repo_load_file_archive (OstreeRepo *self,
 
       g_autoptr(GInputStream) tmp_stream = g_unix_input_stream_new (glnx_steal_fd (&fd), TRUE);
       /* Note return here */
-      return ostree_content_stream_parse (TRUE, tmp_stream, stbuf.st_size, TRUE,
-                                          out_input, out_file_info, out_xattrs,
-                                          cancellable, error);
+      return _ostree_content_stream_parse (self->mode, tmp_stream, stbuf.st_size, TRUE,
+                                           out_input, out_file_info, out_xattrs,
+                                           cancellable, error);
     }
   else if (self->parent_repo)
     {
@@ -2864,7 +2999,7 @@ ostree_repo_load_file (OstreeRepo         *self,
                        GCancellable       *cancellable,
                        GError            **error)
 {
-  if (self->mode == OSTREE_REPO_MODE_ARCHIVE_Z2)
+  if (_ostree_repo_mode_is_archive (self->mode))
     return repo_load_file_archive (self, checksum, out_input, out_file_info, out_xattrs,
                                    cancellable, error);
   else
@@ -2956,12 +3091,151 @@ ostree_repo_load_object_stream (OstreeRepo         *self,
   return TRUE;
 }
 
+/* The object index only tracks the types that list_loose_objects()
+ * knows about; detached metadata and tombstones are always looked up
+ * on disk.
+ */
+static gboolean
+object_index_covers_type (OstreeObjectType objtype)
+{
+  switch (objtype)
+    {
+    case OSTREE_OBJECT_TYPE_FILE:
+    case OSTREE_OBJECT_TYPE_DIR_TREE:
+    case OSTREE_OBJECT_TYPE_DIR_META:
+    case OSTREE_OBJECT_TYPE_COMMIT:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+static gboolean
+object_index_scan (OstreeRepo       *self,
+                   OstreeObjectSet  *set,
+                   int               dfd,
+                   GCancellable     *cancellable,
+                   GError          **error)
+{
+  static const gchar hexchars[] = "0123456789abcdef";
+
+  for (guint c = 0; c < 256; c++)
+    {
+      char prefix[3];
+      prefix[0] = hexchars[c >> 4];
+      prefix[1] = hexchars[c & 0xF];
+      prefix[2] = '\0';
+
+      g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+      gboolean exists;
+      if (!ot_dfd_iter_init_allow_noent (dfd, prefix, &dfd_iter, &exists, error))
+        return FALSE;
+      if (!exists)
+        continue;
+
+      while (TRUE)
+        {
+          struct dirent *dent;
+          if (!glnx_dirfd_iterator_next_dent (&dfd_iter, &dent, cancellable, error))
+            return FALSE;
+          if (dent == NULL)
+            break;
+
+          OstreeObjectType objtype;
+          if (!loose_object_type_from_name (self, dent->d_name, &objtype))
+            continue;
+
+          char buf[OSTREE_SHA256_STRING_LEN+1];
+          memcpy (buf, prefix, 2);
+          memcpy (buf + 2, dent->d_name, 62);
+          buf[sizeof(buf)-1] = '\0';
+          if (!ostree_validate_checksum_string (buf, NULL))
+            continue;
+
+          ostree_object_set_add (set, buf, objtype);
+        }
+    }
+
+  return TRUE;
+}
+
+/* Populate the object index with one pass over the objects/ and staging
+ * directories; called with object_index_lock held.
+ */
+static gboolean
+ensure_object_index (OstreeRepo    *self,
+                     GCancellable  *cancellable,
+                     GError       **error)
+{
+  if (self->object_index)
+    return TRUE;
+
+  g_autoptr(OstreeObjectSet) set = ostree_object_set_new ();
+  const int dfd_searches[] = { self->commit_stagedir_fd, self->objects_dir_fd };
+  for (guint i = 0; i < G_N_ELEMENTS (dfd_searches); i++)
+    {
+      int dfd = dfd_searches[i];
+      if (dfd == -1)
+        continue;
+      if (!object_index_scan (self, set, dfd, cancellable, error))
+        return glnx_prefix_error (error, "Building object index");
+    }
+
+  self->object_index = g_steal_pointer (&set);
+  return TRUE;
+}
+
+/* Record that an object was written; a no-op unless the index has
+ * been built.
+ */
+void
+_ostree_repo_object_index_add (OstreeRepo        *self,
+                               const char        *checksum,
+                               OstreeObjectType   objtype)
+{
+  if (!object_index_covers_type (objtype))
+    return;
+
+  g_mutex_lock (&self->object_index_lock);
+  if (self->object_index)
+    ostree_object_set_add (self->object_index, checksum, objtype);
+  g_mutex_unlock (&self->object_index_lock);
+}
+
+void
+_ostree_repo_object_index_remove (OstreeRepo        *self,
+                                  const char        *checksum,
+                                  OstreeObjectType   objtype)
+{
+  if (!object_index_covers_type (objtype))
+    return;
+
+  g_mutex_lock (&self->object_index_lock);
+  if (self->object_index)
+    ostree_object_set_remove (self->object_index, checksum, objtype);
+  g_mutex_unlock (&self->object_index_lock);
+}
+
+/* The index is only valid for the duration of a transaction, since other
+ * processes may modify the repository outside of one.
+ */
+void
+_ostree_repo_object_index_clear (OstreeRepo *self)
+{
+  g_mutex_lock (&self->object_index_lock);
+  g_clear_pointer (&self->object_index, ostree_object_set_free);
+  g_mutex_unlock (&self->object_index_lock);
+}
+
 /*
  * _ostree_repo_has_loose_object:
  * @loose_path_buf: Buffer of size _OSTREE_LOOSE_PATH_MAX
  *
  * Locate object in repository; if it exists, @out_is_stored will be
  * set to TRUE.  @loose_path_buf is always set to the loose path.
+ *
+ * If core.object-index is enabled, lookups made during a transaction
+ * are answered from an in-memory index rather than with fstatat().
  */
 gboolean
 _ostree_repo_has_loose_object (OstreeRepo           *self,
@@ -2971,6 +3245,18 @@ _ostree_repo_has_loose_object (OstreeRepo           *self,
                                GCancellable         *cancellable,
                                GError             **error)
 {
+  if (self->enable_object_index && self->in_transaction &&
+      object_index_covers_type (objtype))
+    {
+      g_mutex_lock (&self->object_index_lock);
+      gboolean ret = ensure_object_index (self, cancellable, error);
+      if (ret)
+        *out_is_stored = ostree_object_set_contains (self->object_index,
+                                                     checksum, objtype);
+      g_mutex_unlock (&self->object_index_lock);
+      return ret;
+    }
+
   char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
   _ostree_loose_path (loose_path_buf, checksum, objtype, self->mode);
 
@@ -3080,6 +3366,9 @@ ostree_repo_delete_object (OstreeRepo           *self,
 
   if (TEMP_FAILURE_RETRY (unlinkat (self->objects_dir_fd, loose_path, 0)) < 0)
     return glnx_throw_errno_prefix (error, "Deleting object %s.%s", sha256, ostree_object_type_to_string (objtype));
+  _ostree_repo_object_index_remove (self, sha256, objtype);
+  if (metadata_cache_covers_type (objtype))
+    _ostree_metadata_cache_remove (self->metadata_cache, objtype, sha256);
 
   /* If the repository is configured to use tombstone commits, create one when deleting a commit.  */
   if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
@@ -3187,6 +3476,13 @@ import_one_object_link (OstreeRepo    *self,
         g_assert_not_reached ();
     }
 
+  /* Used by the test suite to exercise the copy fallback */
+  if ((self->test_error_flags & OSTREE_REPO_TEST_ERROR_IMPORT_NO_HARDLINK) > 0)
+    {
+      *out_was_supported = FALSE;
+      return TRUE;
+    }
+
   if (!_ostree_repo_ensure_loose_objdir_at (self->objects_dir_fd, loose_path_buf, cancellable, error))
     return FALSE;
 
@@ -3207,12 +3503,140 @@ import_one_object_link (OstreeRepo    *self,
         return glnx_throw_errno (error);
     }
 
+  _ostree_repo_object_index_add (self, checksum, objtype);
+
+  if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
+    {
+      if (!copy_detached_metadata (self, source, checksum, cancellable, error))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Between repos of the same mode, a loose object file is valid as is,
+ * so when we can't hardlink it, copy the file along with its physical
+ * metadata rather than parsing and rewriting the object.  The data is
+ * copied by glnx_regfile_copy_bytes(); asked for the whole file, it tries
+ * a FICLONE reflink first (a metadata-only operation on btrfs and XFS),
+ * then copy_file_range(), so it generally never passes through userspace.
+ * Symlinks, objects which live in a parent repo, and ownership we can't
+ * reproduce are left to the generic path.
+ */
+static gboolean
+import_one_object_copy (OstreeRepo    *self,
+                        OstreeRepo    *source,
+                        const char   *checksum,
+                        OstreeObjectType objtype,
+                        gboolean       *out_was_supported,
+                        GCancellable  *cancellable,
+                        GError        **error)
+{
+  char loose_path_buf[_OSTREE_LOOSE_PATH_MAX];
+  _ostree_loose_path (loose_path_buf, checksum, objtype, source->mode);
+
+  g_assert (source->mode == self->mode);
+
+  *out_was_supported = FALSE;
+
+  glnx_fd_close int src_fd = -1;
+  if (!ot_openat_ignore_enoent (source->objects_dir_fd, loose_path_buf, &src_fd, error))
+    return FALSE;
+  if (src_fd == -1)
+    return TRUE;
+
+  struct stat stbuf;
+  if (!glnx_fstat (src_fd, &stbuf, error))
+    return FALSE;
+  if (!S_ISREG (stbuf.st_mode))
+    return TRUE;
+
+  g_auto(GLnxTmpfile) tmpf = { 0, };
+  if (!glnx_open_tmpfile_linkable_at (self->tmp_dir_fd, ".", O_WRONLY|O_CLOEXEC,
+                                      &tmpf, error))
+    return FALSE;
+
+  if (glnx_regfile_copy_bytes (src_fd, tmpf.fd, (off_t) -1, TRUE) < 0)
+    return glnx_throw_errno_prefix (error, "regfile copy");
+
+  /* The physical metadata: ownership and xattrs for bare (where xattrs are
+   * part of the object), the user.ostreemeta xattr for bare-user, and the
+   * repo owner for archive.
+   */
+  if (self->mode == OSTREE_REPO_MODE_BARE)
+    {
+      if (TEMP_FAILURE_RETRY (fchown (tmpf.fd, stbuf.st_uid, stbuf.st_gid)) < 0)
+        {
+          if (errno == EPERM)
+            return TRUE;
+          return glnx_throw_errno_prefix (error, "fchown");
+        }
+    }
+  else if (_ostree_repo_mode_is_archive (self->mode) && self->target_owner_uid != -1)
+    {
+      if (fchown (tmpf.fd, self->target_owner_uid, self->target_owner_gid) < 0)
+        return glnx_throw_errno_prefix (error, "fchown");
+    }
+
+  /* If we can't set the xattrs here (e.g. SELinux labels as non-root, or
+   * no xattr support on this filesystem), let the generic path decide.
+   */
+  if (self->mode == OSTREE_REPO_MODE_BARE && !self->disable_xattrs)
+    {
+      g_autoptr(GVariant) xattrs = NULL;
+      if (!glnx_fd_get_all_xattrs (src_fd, &xattrs, cancellable, error))
+        return FALSE;
+
+      g_autoptr(GError) local_error = NULL;
+      if (!glnx_fd_set_all_xattrs (tmpf.fd, xattrs, cancellable, &local_error))
+        {
+          if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED) ||
+              g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+            return TRUE;
+          g_propagate_error (error, g_steal_pointer (&local_error));
+          return FALSE;
+        }
+    }
+  else if (self->mode == OSTREE_REPO_MODE_BARE_USER)
+    {
+      g_autoptr(GBytes) meta = glnx_fgetxattr_bytes (src_fd, "user.ostreemeta", error);
+      if (!meta)
+        return FALSE;
+
+      gsize len;
+      const guint8 *data = g_bytes_get_data (meta, &len);
+      if (TEMP_FAILURE_RETRY (fsetxattr (tmpf.fd, "user.ostreemeta", data, len, 0)) != 0)
+        {
+          if (errno == EPERM || errno == ENOTSUP)
+            return TRUE;
+          return glnx_throw_errno_prefix (error, "fsetxattr(user.ostreemeta)");
+        }
+    }
+
+  if (!glnx_fchmod (tmpf.fd, stbuf.st_mode & 07777, error))
+    return FALSE;
+
+  const struct timespec times[2] = { { 0, UTIME_OMIT }, stbuf.st_mtim };
+  if (TEMP_FAILURE_RETRY (futimens (tmpf.fd, times)) < 0)
+    return glnx_throw_errno_prefix (error, "futimens");
+
+  if (!self->in_transaction && !self->disable_fsync)
+    {
+      if (fsync (tmpf.fd) == -1)
+        return glnx_throw_errno_prefix (error, "fsync");
+    }
+
   if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
     {
       if (!copy_detached_metadata (self, source, checksum, cancellable, error))
         return FALSE;
     }
 
+  if (!_ostree_repo_commit_tmpf_final (self, checksum, objtype, &tmpf,
+                                       cancellable, error))
+    return FALSE;
+
+  *out_was_supported = TRUE;
   return TRUE;
 }
 
@@ -3323,6 +3747,22 @@ ostree_repo_import_object_from_with_trust (OstreeRepo           *self,
   if (has_object)
     return TRUE;
 
+  /* Unlike a hardlink, copying the loose file only needs the modes to
+   * match, not the owner; see import_one_object_copy().
+   */
+  if (trusted && source->mode == self->mode)
+    {
+      gboolean copy_was_supported = FALSE;
+
+      if (!import_one_object_copy (self, source, checksum, objtype,
+                                   &copy_was_supported,
+                                   cancellable, error))
+        return FALSE;
+
+      if (copy_was_supported)
+        return TRUE;
+    }
+
   if (OSTREE_OBJECT_TYPE_IS_META (objtype))
     {
       /* Metadata object */
@@ -110,6 +110,13 @@ int           ostree_repo_get_dfd (OstreeRepo  *self);
 _OSTREE_PUBLIC
 OstreeRepoMode ostree_repo_get_mode (OstreeRepo  *self);
 
+_OSTREE_PUBLIC
+void ostree_repo_get_metadata_cache_stats (OstreeRepo  *self,
+                                           guint64     *out_hits,
+                                           guint64     *out_misses,
+                                           guint64     *out_evictions,
+                                           guint64     *out_size);
+
 _OSTREE_PUBLIC
 GKeyFile *    ostree_repo_get_config (OstreeRepo *self);
 
@@ -251,9 +258,12 @@ gboolean      ostree_repo_write_config (OstreeRepo *self,
  * were written to the repository in this transaction.
  * @content_bytes_written: The amount of data added to the repository,
  * in bytes, counting only content objects.
- * @padding1: reserved
- * @padding2: reserved
- * @padding3: reserved
+ * @data_sync_usec: Microseconds spent flushing written objects to disk
+ * when committing the transaction (Since: 2017.10)
+ * @rename_usec: Microseconds spent moving objects out of the staging
+ * directory (Since: 2017.10)
+ * @dir_sync_usec: Microseconds spent making the renamed objects
+ * durable; see the core.finalize-sync option (Since: 2017.10)
  * @padding4: reserved
  *
  * A list of statistics for each transaction that may be
@@ -268,9 +278,9 @@ struct _OstreeRepoTransactionStats {
   guint content_objects_written;
   guint64 content_bytes_written;
 
-  guint64 padding1;
-  guint64 padding2;
-  guint64 padding3;
+  guint64 data_sync_usec;
+  guint64 rename_usec;
+  guint64 dir_sync_usec;
   guint64 padding4;
 };
 
@@ -640,6 +650,10 @@ _OSTREE_PUBLIC
 void ostree_repo_commit_modifier_set_devino_cache (OstreeRepoCommitModifier              *modifier,
                                                    OstreeRepoDevInoCache                 *cache);
 
+_OSTREE_PUBLIC
+void ostree_repo_commit_modifier_set_threads (OstreeRepoCommitModifier              *modifier,
+                                              guint                                  n_threads);
+
 _OSTREE_PUBLIC
 OstreeRepoCommitModifier *ostree_repo_commit_modifier_ref (OstreeRepoCommitModifier *modifier);
 _OSTREE_PUBLIC
@@ -812,6 +826,19 @@ ostree_repo_checkout_tree (OstreeRepo               *self,
  * options.  This is used by ostree_repo_checkout_at() which
  * supercedes previous separate enumeration usage in
  * ostree_repo_checkout_tree() and ostree_repo_checkout_tree_at().
+ *
+ * If `n_threads` is greater than 1, files and directories are checked
+ * out concurrently by up to that many worker threads; directory
+ * permissions, ownership and timestamps are still applied only after
+ * all of their children have been written.  Checkouts using `sepolicy`
+ * or `process_whiteouts` are always done on the calling thread.
+ *
+ * If `update_from` is set to a commit checksum, the destination must be an
+ * existing checkout of that commit, made with the same options.  Rather
+ * than populating it from scratch, only the paths which differ between
+ * `update_from` and the commit being checked out are removed, added or
+ * replaced, in place.  This is done on the calling thread, and can't be
+ * combined with `sepolicy` or `process_whiteouts`.
  */
 typedef struct {
   OstreeRepoCheckoutMode mode;
@@ -829,8 +856,10 @@ typedef struct {
 
   OstreeRepoDevInoCache *devino_to_csum_cache;
 
-  int unused_ints[6];
-  gpointer unused_ptrs[5];
+  int n_threads; /* Since: 2017.10 */
+  int unused_ints[5];
+  const char *update_from; /* Since: 2017.10 */
+  gpointer unused_ptrs[4];
   OstreeSePolicy *sepolicy; /* Since: 2017.6 */
   const char *sepolicy_prefix;
 } OstreeRepoCheckoutAtOptions;
@@ -956,6 +985,14 @@ gboolean ostree_repo_traverse_commit_union (OstreeRepo         *repo,
                                             GCancellable       *cancellable,
                                             GError            **error);
 
+_OSTREE_PUBLIC
+gboolean ostree_repo_traverse_commit_union_set (OstreeRepo         *repo,
+                                                const char         *commit_checksum,
+                                                int                 maxdepth,
+                                                OstreeObjectSet    *inout_reachable,
+                                                GCancellable       *cancellable,
+                                                GError            **error);
+
 struct _OstreeRepoCommitTraverseIter {
   gboolean initialized;
   gpointer dummy[10];
@@ -1050,7 +1087,8 @@ struct _OstreeRepoPruneOptions {
 
   gboolean unused_bools[6];
   int unused_ints[6];
-  gpointer unused_ptrs[7];
+  OstreeObjectSet *reachable_set; /* Since: 2017.10 */
+  gpointer unused_ptrs[6];
 };
 
 typedef struct _OstreeRepoPruneOptions OstreeRepoPruneOptions;
@@ -1064,6 +1102,44 @@ gboolean ostree_repo_prune_from_reachable (OstreeRepo             *self,
                                            GCancellable           *cancellable,
                                            GError              **error);
 
+_OSTREE_PUBLIC
+gboolean ostree_repo_fsck_object (OstreeRepo           *self,
+                                  OstreeObjectType      objtype,
+                                  const char           *sha256,
+                                  GCancellable         *cancellable,
+                                  GError              **error);
+
+/**
+ * OstreeRepoFsckObjectFunc:
+ * @repo: Repo
+ * @checksum: Checksum of the object
+ * @objtype: Type of the object
+ * @object_error: (nullable): Error from verifying the object, or %NULL if it is valid
+ * @user_data: User data
+ * @error: Error
+ *
+ * Called by ostree_repo_fsck_objects() with the result for each object.
+ *
+ * Returns: %TRUE to continue verification, %FALSE (with @error set) to stop
+ *
+ * Since: 2017.10
+ */
+typedef gboolean (*OstreeRepoFsckObjectFunc) (OstreeRepo        *repo,
+                                              const char        *checksum,
+                                              OstreeObjectType   objtype,
+                                              const GError      *object_error,
+                                              gpointer           user_data,
+                                              GError           **error);
+
+_OSTREE_PUBLIC
+gboolean ostree_repo_fsck_objects (OstreeRepo               *self,
+                                   OstreeObjectSet          *objects,
+                                   guint                     n_threads,
+                                   OstreeRepoFsckObjectFunc  func,
+                                   gpointer                  user_data,
+                                   GCancellable             *cancellable,
+                                   GError                  **error);
+
 /**
  * OstreeRepoPullFlags:
  * @OSTREE_REPO_PULL_FLAGS_NONE: No special options for pull
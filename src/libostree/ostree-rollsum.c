@@ -21,36 +21,231 @@
 #include "config.h"
 
 #include <string.h>
-#include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define HAVE_CRC32C_SSE42 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HAVE_CRC32C_ARMV8 1
+#endif
 
 #include "ostree-rollsum.h"
 #include "libglnx.h"
 #include "bupsplit.h"
 
 #define ROLLSUM_BLOB_MAX (8192*4)
+/* Must match bupsplit.c */
+#define ROLLSUM_CHAR_OFFSET 31
 
-static GHashTable *
-rollsum_chunks_crc32 (GBytes           *bytes)
+/* The rolling checksum here is bupsplit's: a split point is a position
+ * where (s2 & (BUP_BLOBSIZE-1)) is all ones.  bupsplit_find_ofs() restarts
+ * the sum from a zeroed window for each chunk, but once the window has
+ * filled, s1 and s2 depend only on the last BUP_WINDOWSIZE bytes:
+ *
+ *   s2 = s2_init + sum (i = 1..BUP_WINDOWSIZE) i * buf[pos - i + 1]
+ *
+ * So we find the split points once over the whole buffer, and only rescan
+ * the first BUP_WINDOWSIZE - 1 bytes of each chunk.  This gives the same
+ * chunks as calling bupsplit_find_ofs() from each chunk start, without
+ * rescanning the rest of the file for every chunk.
+ *
+ * Only the low bits of s2 are checked, so the sums may be truncated to 16
+ * bits, which lets us compute them 8 at a time.
+ */
+
+#define ROLLSUM_S1_INIT (BUP_WINDOWSIZE * ROLLSUM_CHAR_OFFSET)
+#define ROLLSUM_S2_INIT (BUP_WINDOWSIZE * (BUP_WINDOWSIZE-1) * ROLLSUM_CHAR_OFFSET)
+#define ROLLSUM_IS_SPLIT(s2) (((s2) & (BUP_BLOBSIZE-1)) == (BUP_BLOBSIZE-1))
+
+/* Append the positions in [@pos, @end) where @buf splits, starting with
+ * sums @s1, @s2 of the window ending just before @pos; requires
+ * @pos >= BUP_WINDOWSIZE.
+ */
+static void
+find_splits_scalar (const guint8 *buf,
+                    gsize         pos,
+                    gsize         end,
+                    guint32       s1,
+                    guint32       s2,
+                    GArray       *splits)
 {
-  gsize start = 0;
-  gboolean rollsum_end = FALSE;
-  GHashTable *ret_rollsums = NULL;
-  const guint8 *buf;
-  gsize buflen;
-  gsize remaining;
+  for (; pos < end; pos++)
+    {
+      const guint8 drop = buf[pos - BUP_WINDOWSIZE];
+      s1 += buf[pos] - drop;
+      s2 += s1 - (BUP_WINDOWSIZE * (drop + ROLLSUM_CHAR_OFFSET));
+      if (G_UNLIKELY (ROLLSUM_IS_SPLIT (s2)))
+        g_array_append_val (splits, pos);
+    }
+}
 
-  ret_rollsums = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)g_ptr_array_unref);
+#ifdef __SSE2__
+/* We multiply by BUP_WINDOWSIZE with a shift */
+G_STATIC_ASSERT (BUP_WINDOWSIZE == 1 << 6);
 
-  buf = g_bytes_get_data (bytes, &buflen);
+/* Inclusive prefix sum of the 16 bit lanes */
+static inline __m128i
+prefix_sum_epi16 (__m128i v)
+{
+  v = _mm_add_epi16 (v, _mm_slli_si128 (v, 2));
+  v = _mm_add_epi16 (v, _mm_slli_si128 (v, 4));
+  v = _mm_add_epi16 (v, _mm_slli_si128 (v, 8));
+  return v;
+}
+
+/* Broadcast the last 16 bit lane */
+static inline __m128i
+broadcast_last_epi16 (__m128i v)
+{
+  v = _mm_shufflehi_epi16 (v, _MM_SHUFFLE (3, 3, 3, 3));
+  return _mm_unpackhi_epi64 (v, v);
+}
+
+static void
+find_splits_sse2 (const guint8 *buf,
+                  gsize         pos,
+                  gsize         end,
+                  guint32       s1,
+                  guint32       s2,
+                  GArray       *splits)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i char_offset = _mm_set1_epi16 (ROLLSUM_CHAR_OFFSET);
+  const __m128i mask = _mm_set1_epi16 (BUP_BLOBSIZE-1);
+  __m128i vs1 = _mm_set1_epi16 ((gint16)s1);
+  __m128i vs2 = _mm_set1_epi16 ((gint16)s2);
+
+  for (; pos + 8 <= end; pos += 8)
+    {
+      const __m128i add = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i*)(buf + pos)), zero);
+      const __m128i drop = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i*)(buf + pos - BUP_WINDOWSIZE)), zero);
+
+      /* s1 += add - drop */
+      const __m128i s1s = _mm_add_epi16 (vs1, prefix_sum_epi16 (_mm_sub_epi16 (add, drop)));
+      /* s2 += s1 - BUP_WINDOWSIZE * (drop + ROLLSUM_CHAR_OFFSET) */
+      const __m128i s2_delta = _mm_sub_epi16 (s1s, _mm_slli_epi16 (_mm_add_epi16 (drop, char_offset), 6));
+      const __m128i s2s = _mm_add_epi16 (vs2, prefix_sum_epi16 (s2_delta));
+
+      const int hits = _mm_movemask_epi8 (_mm_cmpeq_epi16 (_mm_and_si128 (s2s, mask), mask));
+      if (G_UNLIKELY (hits != 0))
+        {
+          for (guint i = 0; i < 8; i++)
+            {
+              if (hits & (1 << (2 * i)))
+                {
+                  gsize split = pos + i;
+                  g_array_append_val (splits, split);
+                }
+            }
+        }
+
+      vs1 = broadcast_last_epi16 (s1s);
+      vs2 = broadcast_last_epi16 (s2s);
+    }
+
+  find_splits_scalar (buf, pos, end,
+                      (guint16)_mm_cvtsi128_si32 (vs1),
+                      (guint16)_mm_cvtsi128_si32 (vs2), splits);
+}
+#endif
+
+/* Scan up to @len bytes of @buf from a zeroed window, as
+ * bupsplit_find_ofs() does, returning the offset just past the first split
+ * point, or 0 if there is none.
+ */
+static gsize
+find_first_split (const guint8 *buf,
+                  gsize         len)
+{
+  guint32 s1 = ROLLSUM_S1_INIT;
+  guint32 s2 = ROLLSUM_S2_INIT;
+  gsize pos;
+
+  g_assert_cmpint (len, <=, BUP_WINDOWSIZE);
+
+  for (pos = 0; pos < len; pos++)
+    {
+      /* The window is still filling, so we always drop a zero */
+      s1 += buf[pos];
+      s2 += s1 - (BUP_WINDOWSIZE * ROLLSUM_CHAR_OFFSET);
+      if (ROLLSUM_IS_SPLIT (s2))
+        return pos + 1;
+    }
+
+  return 0;
+}
+
+/* Positions in @buf at which the checksum over a full window splits */
+static GArray *
+find_splits (const guint8      *buf,
+             gsize              len,
+             OstreeRollsumImpl  impl)
+{
+  GArray *splits = g_array_new (FALSE, FALSE, sizeof (gsize));
+  guint32 s1 = ROLLSUM_S1_INIT;
+  guint32 s2 = ROLLSUM_S2_INIT;
+
+  if (len < BUP_WINDOWSIZE)
+    return splits;
+
+  /* Fill the first window; nothing real is dropped yet */
+  for (gsize pos = 0; pos < BUP_WINDOWSIZE; pos++)
+    {
+      s1 += buf[pos];
+      s2 += s1 - (BUP_WINDOWSIZE * ROLLSUM_CHAR_OFFSET);
+    }
+  if (ROLLSUM_IS_SPLIT (s2))
+    {
+      gsize split = BUP_WINDOWSIZE - 1;
+      g_array_append_val (splits, split);
+    }
+
+#ifdef __SSE2__
+  if (impl == OSTREE_ROLLSUM_IMPL_ACCEL)
+    find_splits_sse2 (buf, BUP_WINDOWSIZE, len, s1, s2, splits);
+  else
+#endif
+    find_splits_scalar (buf, BUP_WINDOWSIZE, len, s1, s2, splits);
+
+  return splits;
+}
+
+GArray *
+_ostree_rollsum_chunk_lengths (const guint8      *buf,
+                               gsize              buflen,
+                               OstreeRollsumImpl  impl)
+{
+  g_autoptr(GArray) splits = find_splits (buf, buflen, impl);
+  GArray *ret_lengths = g_array_new (FALSE, FALSE, sizeof (gsize));
+  gsize start = 0;
+  gboolean rollsum_end = FALSE;
+  gsize remaining = buflen;
+  guint next_split = 0;
 
-  remaining = buflen;
   while (remaining > 0)
     {
-      int offset, bits;
+      gsize offset;
 
       if (!rollsum_end)
         {
-          offset = bupsplit_find_ofs (buf + start, MIN(G_MAXINT32, remaining), &bits); 
+          /* bupsplit_find_ofs() takes an int length */
+          const gsize limit = MIN (G_MAXINT32, remaining);
+
+          /* A split before the window fills depends on where we started */
+          offset = find_first_split (buf + start, MIN (limit, BUP_WINDOWSIZE - 1));
+          if (offset == 0)
+            {
+              while (next_split < splits->len &&
+                     g_array_index (splits, gsize, next_split) < start + BUP_WINDOWSIZE - 1)
+                next_split++;
+              if (next_split < splits->len &&
+                  g_array_index (splits, gsize, next_split) < start + limit)
+                offset = g_array_index (splits, gsize, next_split) - start + 1;
+            }
+
           if (offset == 0)
             {
               rollsum_end = TRUE;
@@ -62,25 +257,168 @@ rollsum_chunks_crc32 (GBytes           *bytes)
       else
         offset = MIN(ROLLSUM_BLOB_MAX, remaining);
 
-      /* Use zlib's crc32 */
-      { guint32 crc = crc32 (0L, NULL, 0);
-        GVariant *val;
-        GPtrArray *matches;
+      g_array_append_val (ret_lengths, offset);
+      start += offset;
+      remaining -= offset;
+    }
 
-        crc = crc32 (crc, buf, offset);
+  return g_steal_pointer (&ret_lengths);
+}
 
-        val = g_variant_ref_sink (g_variant_new ("(utt)", crc, (guint64) start, (guint64)offset));
-        matches = g_hash_table_lookup (ret_rollsums, GUINT_TO_POINTER (crc));
-        if (!matches)
-          {
-            matches = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
-            g_hash_table_insert (ret_rollsums, GUINT_TO_POINTER (crc), matches);
-          }
-        g_ptr_array_add (matches, val);
-      }
+/* CRC32C (Castagnoli).  Chunks are only compared against each other in
+ * memory, so the choice of polynomial is ours; unlike zlib's CRC32, this
+ * one has an instruction on x86-64 and ARMv8.
+ */
+#define CRC32C_POLY 0x82f63b78
+
+static guint32 crc32c_table[8][256];
+
+static void
+crc32c_init_table (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      for (guint i = 0; i < 256; i++)
+        {
+          guint32 crc = i;
+          for (guint j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+          crc32c_table[0][i] = crc;
+        }
+      for (guint i = 0; i < 256; i++)
+        for (guint j = 1; j < 8; j++)
+          crc32c_table[j][i] = (crc32c_table[j-1][i] >> 8) ^ crc32c_table[0][crc32c_table[j-1][i] & 0xff];
+      g_once_init_leave (&initialized, 1);
+    }
+}
+
+/* Slicing-by-8 */
+static guint32
+crc32c_scalar (guint32       crc,
+               const guint8 *buf,
+               gsize         len)
+{
+  crc32c_init_table ();
+
+  for (; len >= 8; buf += 8, len -= 8)
+    {
+      guint32 lo, hi;
+      memcpy (&lo, buf, 4);
+      memcpy (&hi, buf + 4, 4);
+      lo = GUINT32_TO_LE (lo) ^ crc;
+      hi = GUINT32_TO_LE (hi);
+      crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+            crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^
+            crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+            crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+    }
+  for (; len > 0; buf++, len--)
+    crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *buf) & 0xff];
+
+  return crc;
+}
+
+#if defined(HAVE_CRC32C_SSE42)
+__attribute__((target("sse4.2")))
+static guint32
+crc32c_hw (guint32       crc,
+           const guint8 *buf,
+           gsize         len)
+{
+  guint64 crc64 = crc;
+
+  for (; len >= 8; buf += 8, len -= 8)
+    {
+      guint64 v;
+      memcpy (&v, buf, 8);
+      crc64 = _mm_crc32_u64 (crc64, v);
+    }
+  crc = crc64;
+  for (; len > 0; buf++, len--)
+    crc = _mm_crc32_u8 (crc, *buf);
+
+  return crc;
+}
+
+static gboolean
+have_crc32c_hw (void)
+{
+  return __builtin_cpu_supports ("sse4.2");
+}
+#elif defined(HAVE_CRC32C_ARMV8)
+static guint32
+crc32c_hw (guint32       crc,
+           const guint8 *buf,
+           gsize         len)
+{
+  for (; len >= 8; buf += 8, len -= 8)
+    {
+      guint64 v;
+      memcpy (&v, buf, 8);
+      crc = __crc32cd (crc, v);
+    }
+  for (; len > 0; buf++, len--)
+    crc = __crc32cb (crc, *buf);
+
+  return crc;
+}
+
+static gboolean
+have_crc32c_hw (void)
+{
+  return TRUE;
+}
+#endif
+
+guint32
+_ostree_rollsum_crc32c (const guint8      *buf,
+                        gsize              len,
+                        OstreeRollsumImpl  impl)
+{
+  guint32 crc = 0xffffffff;
+
+#if defined(HAVE_CRC32C_SSE42) || defined(HAVE_CRC32C_ARMV8)
+  if (impl == OSTREE_ROLLSUM_IMPL_ACCEL && have_crc32c_hw ())
+    crc = crc32c_hw (crc, buf, len);
+  else
+#endif
+    crc = crc32c_scalar (crc, buf, len);
+
+  return crc ^ 0xffffffff;
+}
+
+static GHashTable *
+rollsum_chunks_crc32 (GBytes           *bytes)
+{
+  GHashTable *ret_rollsums = NULL;
+  const guint8 *buf;
+  gsize buflen;
+  gsize start = 0;
+
+  ret_rollsums = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)g_ptr_array_unref);
+
+  buf = g_bytes_get_data (bytes, &buflen);
+
+  g_autoptr(GArray) lengths = _ostree_rollsum_chunk_lengths (buf, buflen, OSTREE_ROLLSUM_IMPL_ACCEL);
+  for (guint i = 0; i < lengths->len; i++)
+    {
+      const gsize offset = g_array_index (lengths, gsize, i);
+      guint32 crc = _ostree_rollsum_crc32c (buf + start, offset, OSTREE_ROLLSUM_IMPL_ACCEL);
+      GVariant *val;
+      GPtrArray *matches;
+
+      val = g_variant_ref_sink (g_variant_new ("(utt)", crc, (guint64) start, (guint64)offset));
+      matches = g_hash_table_lookup (ret_rollsums, GUINT_TO_POINTER (crc));
+      if (!matches)
+        {
+          matches = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+          g_hash_table_insert (ret_rollsums, GUINT_TO_POINTER (crc), matches);
+        }
+      g_ptr_array_add (matches, val);
 
       start += offset;
-      remaining -= offset;
     }
 
   return ret_rollsums;
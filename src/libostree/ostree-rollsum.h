@@ -39,6 +39,24 @@ OstreeRollsumMatches *
 _ostree_compute_rollsum_matches (GBytes                           *from,
                                  GBytes                           *to);
 
+/* Which implementation of the rolling and chunk checksums to use; the
+ * results are the same either way.
+ */
+typedef enum {
+  OSTREE_ROLLSUM_IMPL_SCALAR,
+  OSTREE_ROLLSUM_IMPL_ACCEL, /* SIMD and hardware CRC where available */
+} OstreeRollsumImpl;
+
+GArray *
+_ostree_rollsum_chunk_lengths (const guint8      *buf,
+                               gsize              buflen,
+                               OstreeRollsumImpl  impl);
+
+guint32
+_ostree_rollsum_crc32c (const guint8      *buf,
+                        gsize              len,
+                        OstreeRollsumImpl  impl);
+
 void _ostree_rollsum_matches_free (OstreeRollsumMatches *rollsum);
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(OstreeRollsumMatches, _ostree_rollsum_matches_free)
 
@@ -366,6 +366,280 @@ copy_modified_config_file (int                 orig_etc_fd,
   return TRUE;
 }
 
+/* The /etc changes to merge, as paths relative to /etc */
+typedef struct {
+  GPtrArray *modified;
+  GPtrArray *removed;
+  GPtrArray *added;
+} EtcDiff;
+
+static char *
+etc_child_path (const char *parent,
+                const char *name)
+{
+  if (*parent == '\0')
+    return g_strdup (name);
+  return g_build_filename (parent, name, NULL);
+}
+
+/* Like read(), but only returns short at end of file */
+static ssize_t
+read_full (int     fd,
+           guint8 *buf,
+           gsize   len)
+{
+  gsize n = 0;
+
+  while (n < len)
+    {
+      ssize_t r = TEMP_FAILURE_RETRY (read (fd, buf + n, len - n));
+      if (r < 0)
+        return -1;
+      if (r == 0)
+        break;
+      n += r;
+    }
+
+  return n;
+}
+
+/* Whether two regular files of the same size have the same contents */
+static gboolean
+regfile_contents_equal (int           a_dfd,
+                        int           b_dfd,
+                        const char   *name,
+                        gboolean     *out_equal,
+                        GCancellable *cancellable,
+                        GError      **error)
+{
+  glnx_fd_close int a_fd = -1;
+  glnx_fd_close int b_fd = -1;
+  const gsize bufsize = 64 * 1024;
+  g_autofree guint8 *a_buf = g_malloc (bufsize);
+  g_autofree guint8 *b_buf = g_malloc (bufsize);
+
+  if (!glnx_openat_rdonly (a_dfd, name, FALSE, &a_fd, error))
+    return FALSE;
+  if (!glnx_openat_rdonly (b_dfd, name, FALSE, &b_fd, error))
+    return FALSE;
+
+  while (TRUE)
+    {
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+
+      const ssize_t a_len = read_full (a_fd, a_buf, bufsize);
+      if (a_len < 0)
+        return glnx_throw_errno_prefix (error, "read");
+      const ssize_t b_len = a_len > 0 ? read_full (b_fd, b_buf, a_len) : 0;
+      if (b_len < 0)
+        return glnx_throw_errno_prefix (error, "read");
+
+      if (a_len != b_len || memcmp (a_buf, b_buf, a_len) != 0)
+        {
+          *out_equal = FALSE;
+          return TRUE;
+        }
+      if (a_len == 0)
+        break;
+    }
+
+  *out_equal = TRUE;
+  return TRUE;
+}
+
+/* Whether @name differs between @a_dfd and @b_dfd, where it has the same
+ * type.  This gives the same answer as comparing ostree checksums without
+ * xattrs, as ostree_diff_dirs() does, but avoids reading files where it
+ * can: a file which is still a hardlink to the original is unmodified,
+ * and differing ownership, mode or size means it is modified.  Otherwise,
+ * we compare contents; unlike checksumming, that stops at the first
+ * difference.
+ */
+static gboolean
+etc_entry_differs (int                a_dfd,
+                   const struct stat *a_stbuf,
+                   int                b_dfd,
+                   const struct stat *b_stbuf,
+                   const char        *name,
+                   gboolean          *out_differs,
+                   GCancellable      *cancellable,
+                   GError           **error)
+{
+  if (a_stbuf->st_dev == b_stbuf->st_dev && a_stbuf->st_ino == b_stbuf->st_ino)
+    {
+      *out_differs = FALSE;
+      return TRUE;
+    }
+
+  if (a_stbuf->st_uid != b_stbuf->st_uid ||
+      a_stbuf->st_gid != b_stbuf->st_gid ||
+      a_stbuf->st_mode != b_stbuf->st_mode)
+    {
+      *out_differs = TRUE;
+      return TRUE;
+    }
+
+  if (S_ISREG (a_stbuf->st_mode))
+    {
+      gboolean equal;
+
+      if (a_stbuf->st_size != b_stbuf->st_size)
+        {
+          *out_differs = TRUE;
+          return TRUE;
+        }
+      if (!regfile_contents_equal (a_dfd, b_dfd, name, &equal, cancellable, error))
+        return FALSE;
+      *out_differs = !equal;
+    }
+  else if (S_ISLNK (a_stbuf->st_mode))
+    {
+      g_autofree char *a_target = glnx_readlinkat_malloc (a_dfd, name, cancellable, error);
+      if (!a_target)
+        return FALSE;
+      g_autofree char *b_target = glnx_readlinkat_malloc (b_dfd, name, cancellable, error);
+      if (!b_target)
+        return FALSE;
+      *out_differs = strcmp (a_target, b_target) != 0;
+    }
+  else
+    *out_differs = FALSE;
+
+  return TRUE;
+}
+
+/* Everything below @path in @dfd is added */
+static gboolean
+etc_diff_add_dir_recurse (int            dfd,
+                          const char    *path,
+                          EtcDiff       *diff,
+                          GCancellable  *cancellable,
+                          GError       **error)
+{
+  g_auto(GLnxDirFdIterator) dfd_iter = { 0, };
+
+  if (!glnx_dirfd_iterator_init_at (dfd, path, FALSE, &dfd_iter, error))
+    return FALSE;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+
+      if (!glnx_dirfd_iterator_next_dent_ensure_dtype (&dfd_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+
+      g_autofree char *child_path = etc_child_path (path, dent->d_name);
+      if (dent->d_type == DT_DIR)
+        {
+          g_ptr_array_add (diff->added, g_strdup (child_path));
+          if (!etc_diff_add_dir_recurse (dfd, child_path, diff, cancellable, error))
+            return FALSE;
+        }
+      else
+        g_ptr_array_add (diff->added, g_steal_pointer (&child_path));
+    }
+
+  return TRUE;
+}
+
+/* Compare the directory @path (or the root, if empty) under @orig_dfd and
+ * @modified_dfd.  This finds the same changes, in the same order, as
+ * ostree_diff_dirs() with %OSTREE_DIFF_FLAGS_IGNORE_XATTRS, but works on
+ * file descriptors and only reads files when it has to.
+ */
+static gboolean
+etc_diff_dirs (int            orig_dfd,
+               int            modified_dfd,
+               const char    *path,
+               EtcDiff       *diff,
+               GCancellable  *cancellable,
+               GError       **error)
+{
+  g_auto(GLnxDirFdIterator) a_iter = { 0, };
+  glnx_fd_close int b_dfd = -1;
+
+  if (!glnx_dirfd_iterator_init_at (orig_dfd, *path ? path : ".", FALSE, &a_iter, error))
+    return FALSE;
+  if (!glnx_opendirat (modified_dfd, *path ? path : ".", FALSE, &b_dfd, error))
+    return FALSE;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+      struct stat a_stbuf;
+      struct stat b_stbuf;
+
+      if (!glnx_dirfd_iterator_next_dent (&a_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+
+      g_autofree char *child_path = etc_child_path (path, dent->d_name);
+
+      if (!glnx_fstatat (a_iter.fd, dent->d_name, &a_stbuf, AT_SYMLINK_NOFOLLOW, error))
+        return FALSE;
+      if (fstatat (b_dfd, dent->d_name, &b_stbuf, AT_SYMLINK_NOFOLLOW) < 0)
+        {
+          if (errno != ENOENT)
+            return glnx_throw_errno_prefix (error, "fstatat(%s)", child_path);
+          g_ptr_array_add (diff->removed, g_steal_pointer (&child_path));
+          continue;
+        }
+
+      if ((a_stbuf.st_mode & S_IFMT) != (b_stbuf.st_mode & S_IFMT))
+        {
+          g_ptr_array_add (diff->modified, g_steal_pointer (&child_path));
+          continue;
+        }
+
+      gboolean differs;
+      if (!etc_entry_differs (a_iter.fd, &a_stbuf, b_dfd, &b_stbuf, dent->d_name,
+                              &differs, cancellable, error))
+        return glnx_prefix_error (error, "Comparing %s", child_path);
+      if (differs)
+        g_ptr_array_add (diff->modified, g_strdup (child_path));
+
+      if (S_ISDIR (a_stbuf.st_mode))
+        {
+          if (!etc_diff_dirs (orig_dfd, modified_dfd, child_path, diff, cancellable, error))
+            return FALSE;
+        }
+    }
+
+  g_auto(GLnxDirFdIterator) b_iter = { 0, };
+  if (!glnx_dirfd_iterator_init_at (b_dfd, ".", FALSE, &b_iter, error))
+    return FALSE;
+
+  while (TRUE)
+    {
+      struct dirent *dent;
+      struct stat a_stbuf;
+
+      if (!glnx_dirfd_iterator_next_dent_ensure_dtype (&b_iter, &dent, cancellable, error))
+        return FALSE;
+      if (dent == NULL)
+        break;
+
+      if (fstatat (a_iter.fd, dent->d_name, &a_stbuf, AT_SYMLINK_NOFOLLOW) == 0)
+        continue;
+      else if (errno != ENOENT)
+        return glnx_throw_errno_prefix (error, "fstatat(%s)", dent->d_name);
+
+      g_autofree char *child_path = etc_child_path (path, dent->d_name);
+      g_ptr_array_add (diff->added, g_strdup (child_path));
+      if (dent->d_type == DT_DIR)
+        {
+          if (!etc_diff_add_dir_recurse (modified_dfd, child_path, diff, cancellable, error))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
 /*
  * merge_configuration_from:
  * @sysroot: Sysroot
@@ -409,13 +683,21 @@ merge_configuration_from (OstreeSysroot    *sysroot,
       merge_deployment_dfd = owned_merge_deployment_dfd;
     }
 
-  /* TODO: get rid of GFile usage here */
-  g_autoptr(GFile) orig_etc = ot_fdrel_to_gfile (merge_deployment_dfd, "usr/etc");
-  g_autoptr(GFile) modified_etc = ot_fdrel_to_gfile (merge_deployment_dfd, "etc");
+  glnx_fd_close int orig_etc_fd = -1;
+  if (!glnx_opendirat (merge_deployment_dfd, "usr/etc", TRUE, &orig_etc_fd, error))
+    return FALSE;
+  glnx_fd_close int modified_etc_fd = -1;
+  if (!glnx_opendirat (merge_deployment_dfd, "etc", TRUE, &modified_etc_fd, error))
+    return FALSE;
+  glnx_fd_close int new_etc_fd = -1;
+  if (!glnx_opendirat (new_deployment_dfd, "etc", TRUE, &new_etc_fd, error))
+    return FALSE;
+
   /* Return values for below */
-  g_autoptr(GPtrArray) modified = g_ptr_array_new_with_free_func ((GDestroyNotify) ostree_diff_item_unref);
-  g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
-  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+  g_autoptr(GPtrArray) modified = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (g_free);
+  EtcDiff diff = { modified, removed, added };
   /* For now, ignore changes to xattrs; the problem is that
    * security.selinux will be different between the /usr/etc labels
    * and the ones in the real /etc, so they all show up as different.
@@ -424,9 +706,7 @@ merge_configuration_from (OstreeSysroot    *sysroot,
    * file, to have that change persist across upgrades, you must also
    * modify the content of the file.
    */
-  if (!ostree_diff_dirs (OSTREE_DIFF_FLAGS_IGNORE_XATTRS,
-                         orig_etc, modified_etc, modified, removed, added,
-                         cancellable, error))
+  if (!etc_diff_dirs (orig_etc_fd, modified_etc_fd, "", &diff, cancellable, error))
     return glnx_prefix_error (error, "While computing configuration diff");
 
   ot_log_structured_print_id_v (OSTREE_CONFIGMERGE_ID,
@@ -435,23 +715,9 @@ merge_configuration_from (OstreeSysroot    *sysroot,
                                 removed->len,
                                 added->len);
 
-  glnx_fd_close int orig_etc_fd = -1;
-  if (!glnx_opendirat (merge_deployment_dfd, "usr/etc", TRUE, &orig_etc_fd, error))
-    return FALSE;
-  glnx_fd_close int modified_etc_fd = -1;
-  if (!glnx_opendirat (merge_deployment_dfd, "etc", TRUE, &modified_etc_fd, error))
-    return FALSE;
-  glnx_fd_close int new_etc_fd = -1;
-  if (!glnx_opendirat (new_deployment_dfd, "etc", TRUE, &new_etc_fd, error))
-    return FALSE;
-
   for (guint i = 0; i < removed->len; i++)
     {
-      GFile *file = removed->pdata[i];
-      g_autofree char *path = NULL;
-
-      path = g_file_get_relative_path (orig_etc, file);
-      g_assert (path);
+      const char *path = removed->pdata[i];
 
       if (!glnx_shutil_rm_rf_at (new_etc_fd, path, cancellable, error))
         return FALSE;
@@ -459,10 +725,7 @@ merge_configuration_from (OstreeSysroot    *sysroot,
 
   for (guint i = 0; i < modified->len; i++)
     {
-      OstreeDiffItem *diff = modified->pdata[i];
-      g_autofree char *path = g_file_get_relative_path (modified_etc, diff->target);
-
-      g_assert (path);
+      const char *path = modified->pdata[i];
 
       if (!copy_modified_config_file (orig_etc_fd, modified_etc_fd, new_etc_fd, path,
                                       flags, cancellable, error))
@@ -470,10 +733,7 @@ merge_configuration_from (OstreeSysroot    *sysroot,
     }
   for (guint i = 0; i < added->len; i++)
     {
-      GFile *file = added->pdata[i];
-      g_autofree char *path = g_file_get_relative_path (modified_etc, file);
-
-      g_assert (path);
+      const char *path = added->pdata[i];
 
       if (!copy_modified_config_file (orig_etc_fd, modified_etc_fd, new_etc_fd, path,
                                       flags, cancellable, error))
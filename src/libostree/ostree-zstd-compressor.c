@@ -0,0 +1,167 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "ostree-zstd-compressor.h"
+
+#include <zstd.h>
+
+/*
+ * OstreeZstdCompressor:
+ *
+ * An implementation of #GConverter that compresses data into a single
+ * zstd frame.
+ */
+struct _OstreeZstdCompressor
+{
+  GObject parent_instance;
+
+  int level;
+  ZSTD_CStream *cstream;
+  gboolean initialized;
+};
+
+static void _ostree_zstd_compressor_iface_init          (GConverterIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (OstreeZstdCompressor, _ostree_zstd_compressor,
+                         G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
+                                                _ostree_zstd_compressor_iface_init))
+
+static void
+_ostree_zstd_compressor_finalize (GObject *object)
+{
+  OstreeZstdCompressor *self = OSTREE_ZSTD_COMPRESSOR (object);
+
+  if (self->cstream)
+    ZSTD_freeCStream (self->cstream);
+
+  G_OBJECT_CLASS (_ostree_zstd_compressor_parent_class)->finalize (object);
+}
+
+static void
+_ostree_zstd_compressor_init (OstreeZstdCompressor *self)
+{
+}
+
+static void
+_ostree_zstd_compressor_class_init (OstreeZstdCompressorClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = _ostree_zstd_compressor_finalize;
+}
+
+OstreeZstdCompressor *
+_ostree_zstd_compressor_new (int level)
+{
+  OstreeZstdCompressor *self = g_object_new (OSTREE_TYPE_ZSTD_COMPRESSOR, NULL);
+  self->level = CLAMP (level, 1, ZSTD_maxCLevel ());
+  return self;
+}
+
+static void
+_ostree_zstd_compressor_reset (GConverter *converter)
+{
+  OstreeZstdCompressor *self = OSTREE_ZSTD_COMPRESSOR (converter);
+
+  self->initialized = FALSE;
+}
+
+static GConverterResult
+_ostree_zstd_compressor_convert (GConverter *converter,
+                                 const void *inbuf,
+                                 gsize       inbuf_size,
+                                 void       *outbuf,
+                                 gsize       outbuf_size,
+                                 GConverterFlags flags,
+                                 gsize      *bytes_read,
+                                 gsize      *bytes_written,
+                                 GError    **error)
+{
+  OstreeZstdCompressor *self = OSTREE_ZSTD_COMPRESSOR (converter);
+  ZSTD_inBuffer input = { inbuf, inbuf_size, 0 };
+  ZSTD_outBuffer output = { outbuf, outbuf_size, 0 };
+  GConverterResult ret = G_CONVERTER_CONVERTED;
+  size_t res;
+
+  if (outbuf_size == 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                           "Output buffer too small");
+      return G_CONVERTER_ERROR;
+    }
+
+  if (!self->initialized)
+    {
+      if (!self->cstream)
+        self->cstream = ZSTD_createCStream ();
+      if (!self->cstream)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "Out of memory");
+          return G_CONVERTER_ERROR;
+        }
+      res = ZSTD_initCStream (self->cstream, self->level);
+      if (ZSTD_isError (res))
+        goto err;
+      self->initialized = TRUE;
+    }
+
+  res = ZSTD_compressStream (self->cstream, &output, &input);
+  if (ZSTD_isError (res))
+    goto err;
+
+  if (input.pos == input.size)
+    {
+      if (flags & G_CONVERTER_INPUT_AT_END)
+        {
+          /* Returns the number of bytes left to flush */
+          res = ZSTD_endStream (self->cstream, &output);
+          if (ZSTD_isError (res))
+            goto err;
+          if (res == 0)
+            ret = G_CONVERTER_FINISHED;
+        }
+      else if (flags & G_CONVERTER_FLUSH)
+        {
+          res = ZSTD_flushStream (self->cstream, &output);
+          if (ZSTD_isError (res))
+            goto err;
+          if (res == 0)
+            ret = G_CONVERTER_FLUSHED;
+        }
+    }
+
+  *bytes_read = input.pos;
+  *bytes_written = output.pos;
+  return ret;
+
+ err:
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+               "zstd compression failed: %s", ZSTD_getErrorName (res));
+  return G_CONVERTER_ERROR;
+}
+
+static void
+_ostree_zstd_compressor_iface_init (GConverterIface *iface)
+{
+  iface->convert = _ostree_zstd_compressor_convert;
+  iface->reset = _ostree_zstd_compressor_reset;
+}
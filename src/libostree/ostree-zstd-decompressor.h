@@ -0,0 +1,44 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define OSTREE_TYPE_ZSTD_DECOMPRESSOR         (_ostree_zstd_decompressor_get_type ())
+#define OSTREE_ZSTD_DECOMPRESSOR(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), OSTREE_TYPE_ZSTD_DECOMPRESSOR, OstreeZstdDecompressor))
+#define OSTREE_ZSTD_DECOMPRESSOR_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), OSTREE_TYPE_ZSTD_DECOMPRESSOR, OstreeZstdDecompressorClass))
+#define OSTREE_IS_ZSTD_DECOMPRESSOR(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), OSTREE_TYPE_ZSTD_DECOMPRESSOR))
+#define OSTREE_IS_ZSTD_DECOMPRESSOR_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), OSTREE_TYPE_ZSTD_DECOMPRESSOR))
+#define OSTREE_ZSTD_DECOMPRESSOR_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), OSTREE_TYPE_ZSTD_DECOMPRESSOR, OstreeZstdDecompressorClass))
+
+typedef struct _OstreeZstdDecompressorClass   OstreeZstdDecompressorClass;
+typedef struct _OstreeZstdDecompressor        OstreeZstdDecompressor;
+
+struct _OstreeZstdDecompressorClass
+{
+  GObjectClass parent_class;
+};
+
+GType            _ostree_zstd_decompressor_get_type (void) G_GNUC_CONST;
+
+OstreeZstdDecompressor *_ostree_zstd_decompressor_new (void);
+
+G_END_DECLS
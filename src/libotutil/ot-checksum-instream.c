@@ -23,19 +23,10 @@
 #include "ot-checksum-instream.h"
 #include "ot-checksum-utils.h"
 
-#ifdef HAVE_OPENSSL
-#include <openssl/evp.h>
-#endif
-
 G_DEFINE_TYPE (OtChecksumInstream, ot_checksum_instream, G_TYPE_FILTER_INPUT_STREAM)
 
 struct _OtChecksumInstreamPrivate {
-#ifdef HAVE_OPENSSL
-  EVP_MD_CTX *checksum;
-#else
-  GChecksumType checksum_type;
-  GChecksum *checksum;
-#endif
+  OtChecksum checksum;
 };
 
 static gssize   ot_checksum_instream_read         (GInputStream         *stream,
@@ -49,11 +40,7 @@ ot_checksum_instream_finalize (GObject *object)
 {
   OtChecksumInstream *self = (OtChecksumInstream*)object;
 
-#ifdef HAVE_OPENSSL
-  EVP_MD_CTX_destroy (self->priv->checksum);
-#else
-  g_checksum_free (self->priv->checksum);
-#endif
+  ot_checksum_clear (&self->priv->checksum);
 
   G_OBJECT_CLASS (ot_checksum_instream_parent_class)->finalize (object);
 }
@@ -76,21 +63,6 @@ ot_checksum_instream_init (OtChecksumInstream *self)
   self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, OT_TYPE_CHECKSUM_INSTREAM, OtChecksumInstreamPrivate);
 }
 
-#ifdef HAVE_OPENSSL
-static const EVP_MD *
-gchecksum_type_to_openssl (GChecksumType checksum_type)
-{
-  switch (checksum_type)
-    {
-    case G_CHECKSUM_SHA256:
-      return EVP_sha256 ();
-    default:
-      /* If there's something else, fill in here */
-      g_assert_not_reached ();
-    }
-}
-#endif
-
 OtChecksumInstream *
 ot_checksum_instream_new (GInputStream    *base,
                           GChecksumType    checksum_type)
@@ -106,14 +78,7 @@ ot_checksum_instream_new (GInputStream    *base,
   /* For now */
   g_assert (checksum_type == G_CHECKSUM_SHA256);
 
-#ifdef HAVE_OPENSSL
-  stream->priv->checksum = EVP_MD_CTX_create ();
-  g_assert (stream->priv->checksum);
-  g_assert (EVP_DigestInit_ex (stream->priv->checksum, gchecksum_type_to_openssl (checksum_type), NULL));
-#else
-  stream->priv->checksum = g_checksum_new (checksum_type);
-  stream->priv->checksum_type = checksum_type;
-#endif
+  ot_checksum_init (&stream->priv->checksum);
 
   return (OtChecksumInstream*) (stream);
 }
@@ -135,13 +100,7 @@ ot_checksum_instream_read (GInputStream  *stream,
                              cancellable,
                              error);
   if (res > 0)
-    {
-#ifdef HAVE_OPENSSL
-      g_assert (EVP_DigestUpdate (self->priv->checksum, buffer, res));
-#else
-      g_checksum_update (self->priv->checksum, buffer, res);
-#endif
-    }
+    ot_checksum_update (&self->priv->checksum, buffer, res);
 
   return res;
 }
@@ -151,45 +110,24 @@ ot_checksum_instream_get_digest (OtChecksumInstream *stream,
                                  guint8          *buffer,
                                  gsize           *digest_len)
 {
-#ifdef HAVE_OPENSSL
-  unsigned len;
-  EVP_DigestFinal_ex (stream->priv->checksum, buffer, &len);
+  ot_checksum_get_digest (&stream->priv->checksum, buffer, OT_SHA256_DIGEST_LEN);
   if (digest_len)
-    *digest_len = len;
-#else
-  g_checksum_get_digest (stream->priv->checksum, buffer, digest_len);
-#endif
+    *digest_len = OT_SHA256_DIGEST_LEN;
 }
 
 guint8*
 ot_checksum_instream_dup_digest (OtChecksumInstream *stream,
                                  gsize              *ret_len)
 {
-#ifdef HAVE_OPENSSL
-  guint len;
-  guchar *ret = g_malloc0 (EVP_MAX_MD_SIZE);
-  g_assert (EVP_DigestFinal_ex (stream->priv->checksum, ret, &len));
-#else
-  gsize len = g_checksum_type_get_length (stream->priv->checksum_type);
-  guchar *ret = g_malloc (len);
-  g_checksum_get_digest (stream->priv->checksum, ret, &len);
-#endif
-  if (ret_len)
-    *ret_len = len;
+  guint8 *ret = g_malloc (OT_SHA256_DIGEST_LEN);
+  ot_checksum_instream_get_digest (stream, ret, ret_len);
   return ret;
 }
 
 char *
 ot_checksum_instream_get_string (OtChecksumInstream *stream)
 {
-#ifdef HAVE_OPENSSL
-  unsigned len;
-  guint8 csum[EVP_MAX_MD_SIZE];
-  g_assert (EVP_DigestFinal_ex (stream->priv->checksum, csum, &len));
-  char *buf = g_malloc (len * 2 + 1);
-  ot_bin2hex (buf, (guint8*)csum, len);
+  char *buf = g_malloc (OT_SHA256_STRING_LEN + 1);
+  ot_checksum_get_hexdigest (&stream->priv->checksum, buf, OT_SHA256_STRING_LEN + 1);
   return buf;
-#else
-  return g_strdup (g_checksum_get_string (stream->priv->checksum));
-#endif
 }
@@ -23,6 +23,9 @@
 #include "config.h"
 
 #include "otutil.h"
+#if defined(HAVE_OPENSSL)
+#include <openssl/evp.h>
+#endif
 
 #include <string.h>
 
@@ -42,15 +45,182 @@ ot_bin2hex (char *out_buf, const guint8 *inbuf, gsize len)
   out_buf[j] = '\0';
 }
 
-guchar *
-ot_csum_from_gchecksum (GChecksum  *checksum)
+static OtChecksumBackend
+default_backend (void)
 {
-  guchar *ret = g_malloc (32);
-  gsize len = 32;
+#ifdef HAVE_OPENSSL
+  return OT_CHECKSUM_BACKEND_OPENSSL;
+#else
+  return OT_CHECKSUM_BACKEND_GLIB;
+#endif
+}
+
+gboolean
+ot_checksum_backend_is_available (OtChecksumBackend backend)
+{
+  switch (backend)
+    {
+    case OT_CHECKSUM_BACKEND_DEFAULT:
+    case OT_CHECKSUM_BACKEND_GLIB:
+      return TRUE;
+    case OT_CHECKSUM_BACKEND_OPENSSL:
+#ifdef HAVE_OPENSSL
+      return TRUE;
+#else
+      return FALSE;
+#endif
+    }
+  return FALSE;
+}
+
+const char *
+ot_checksum_backend_to_string (OtChecksumBackend backend)
+{
+  if (backend == OT_CHECKSUM_BACKEND_DEFAULT)
+    backend = default_backend ();
+
+  switch (backend)
+    {
+    case OT_CHECKSUM_BACKEND_GLIB:
+      return "glib";
+    case OT_CHECKSUM_BACKEND_OPENSSL:
+      return "openssl";
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+void
+ot_checksum_init (OtChecksum *checksum)
+{
+  ot_checksum_init_with_backend (checksum, OT_CHECKSUM_BACKEND_DEFAULT);
+}
+
+void
+ot_checksum_init_with_backend (OtChecksum        *checksum,
+                               OtChecksumBackend  backend)
+{
+  g_return_if_fail (ot_checksum_backend_is_available (backend));
+
+  if (backend == OT_CHECKSUM_BACKEND_DEFAULT)
+    backend = default_backend ();
+
+  checksum->backend = backend;
+  switch (backend)
+    {
+    case OT_CHECKSUM_BACKEND_GLIB:
+      checksum->ctx = g_checksum_new (G_CHECKSUM_SHA256);
+      break;
+#ifdef HAVE_OPENSSL
+    case OT_CHECKSUM_BACKEND_OPENSSL:
+      {
+        EVP_MD_CTX *ctx = EVP_MD_CTX_create ();
+        g_assert (ctx);
+        g_assert (EVP_DigestInit_ex (ctx, EVP_sha256 (), NULL));
+        checksum->ctx = ctx;
+      }
+      break;
+#endif
+    default:
+      g_assert_not_reached ();
+    }
+
+  checksum->closed = FALSE;
+  checksum->initialized = TRUE;
+}
+
+void
+ot_checksum_update (OtChecksum    *checksum,
+                    const guint8  *buf,
+                    size_t         len)
+{
+  g_return_if_fail (checksum->initialized);
+  g_return_if_fail (!checksum->closed);
+
+  switch (checksum->backend)
+    {
+    case OT_CHECKSUM_BACKEND_GLIB:
+      g_checksum_update (checksum->ctx, buf, len);
+      break;
+#ifdef HAVE_OPENSSL
+    case OT_CHECKSUM_BACKEND_OPENSSL:
+      g_assert (EVP_DigestUpdate (checksum->ctx, buf, len));
+      break;
+#endif
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+void
+ot_checksum_get_digest (OtChecksum *checksum,
+                        guint8     *buf,
+                        size_t      buflen)
+{
+  g_return_if_fail (checksum->initialized);
+  g_return_if_fail (!checksum->closed);
+  g_return_if_fail (buflen == OT_SHA256_DIGEST_LEN);
 
-  g_checksum_get_digest (checksum, ret, &len);
-  g_assert (len == 32);
-  return ret;
+  switch (checksum->backend)
+    {
+    case OT_CHECKSUM_BACKEND_GLIB:
+      {
+        gsize len = buflen;
+        g_checksum_get_digest (checksum->ctx, buf, &len);
+        g_assert_cmpint (len, ==, buflen);
+      }
+      break;
+#ifdef HAVE_OPENSSL
+    case OT_CHECKSUM_BACKEND_OPENSSL:
+      {
+        guint len;
+        g_assert (EVP_DigestFinal_ex (checksum->ctx, buf, &len));
+        g_assert_cmpint (len, ==, buflen);
+      }
+      break;
+#endif
+    default:
+      g_assert_not_reached ();
+    }
+
+  checksum->closed = TRUE;
+}
+
+void
+ot_checksum_get_hexdigest (OtChecksum *checksum,
+                           char       *buf,
+                           size_t      buflen)
+{
+  guint8 digest[OT_SHA256_DIGEST_LEN];
+
+  g_return_if_fail (buflen == OT_SHA256_STRING_LEN + 1);
+
+  ot_checksum_get_digest (checksum, digest, sizeof (digest));
+  ot_bin2hex (buf, digest, sizeof (digest));
+}
+
+void
+ot_checksum_clear (OtChecksum *checksum)
+{
+  if (!checksum->initialized)
+    return;
+
+  switch (checksum->backend)
+    {
+    case OT_CHECKSUM_BACKEND_GLIB:
+      g_checksum_free (checksum->ctx);
+      break;
+#ifdef HAVE_OPENSSL
+    case OT_CHECKSUM_BACKEND_OPENSSL:
+      EVP_MD_CTX_destroy (checksum->ctx);
+      break;
+#endif
+    default:
+      g_assert_not_reached ();
+    }
+
+  checksum->ctx = NULL;
+  checksum->initialized = FALSE;
 }
 
 gboolean
@@ -58,7 +228,7 @@ ot_gio_write_update_checksum (GOutputStream  *out,
                               gconstpointer   data,
                               gsize           len,
                               gsize          *out_bytes_written,
-                              GChecksum      *checksum,
+                              OtChecksum     *checksum,
                               GCancellable   *cancellable,
                               GError        **error)
 {
@@ -74,14 +244,14 @@ ot_gio_write_update_checksum (GOutputStream  *out,
     }
 
   if (checksum)
-    g_checksum_update (checksum, data, len);
+    ot_checksum_update (checksum, data, len);
   return TRUE;
 }
 
 gboolean
 ot_gio_splice_update_checksum (GOutputStream  *out,
                                GInputStream   *in,
-                               GChecksum      *checksum,
+                               OtChecksum     *checksum,
                                GCancellable   *cancellable,
                                GError        **error)
 {
@@ -120,13 +290,16 @@ ot_gio_splice_get_checksum (GOutputStream  *out,
                             GCancellable   *cancellable,
                             GError        **error)
 {
-  g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_auto(OtChecksum) checksum = { 0, };
+  ot_checksum_init (&checksum);
 
-  if (!ot_gio_splice_update_checksum (out, in, checksum, cancellable, error))
+  if (!ot_gio_splice_update_checksum (out, in, &checksum, cancellable, error))
     return FALSE;
 
-  g_autofree guchar *ret_csum = ot_csum_from_gchecksum (checksum);
-  ot_transfer_out_value (out_csum, &ret_csum);
+  guint8 digest[OT_SHA256_DIGEST_LEN];
+  ot_checksum_get_digest (&checksum, digest, sizeof (digest));
+  if (out_csum)
+    *out_csum = g_memdup (digest, sizeof (digest));
   return TRUE;
 }
 
@@ -152,9 +325,15 @@ ot_checksum_file_at (int             dfd,
   if (!ot_openat_read_stream (dfd, path, TRUE, &in, cancellable, error))
     return FALSE;
 
-  g_autoptr(GChecksum) checksum = g_checksum_new (checksum_type);
-  if (!ot_gio_splice_update_checksum (NULL, in, checksum, cancellable, error))
+  /* For now */
+  g_assert (checksum_type == G_CHECKSUM_SHA256);
+
+  g_auto(OtChecksum) checksum = { 0, };
+  ot_checksum_init (&checksum);
+  if (!ot_gio_splice_update_checksum (NULL, in, &checksum, cancellable, error))
     return FALSE;
 
-  return g_strdup (g_checksum_get_string (checksum));
+  char hexdigest[OT_SHA256_STRING_LEN+1];
+  ot_checksum_get_hexdigest (&checksum, hexdigest, sizeof (hexdigest));
+  return g_strdup (hexdigest);
 }
@@ -28,13 +28,52 @@ G_BEGIN_DECLS
 
 void ot_bin2hex (char *out_buf, const guint8 *inbuf, gsize len);
 
-guchar *ot_csum_from_gchecksum (GChecksum *checksum);
+#define OT_SHA256_DIGEST_LEN 32
+#define OT_SHA256_STRING_LEN 64
+
+/* Implementations of SHA-256 that OtChecksum can use.  The default is
+ * OpenSSL libcrypto when built with it, since it has code paths for
+ * the SHA extensions on x86 and ARMv8 CPUs, and GLib otherwise.
+ */
+typedef enum {
+  OT_CHECKSUM_BACKEND_DEFAULT,
+  OT_CHECKSUM_BACKEND_GLIB,
+  OT_CHECKSUM_BACKEND_OPENSSL,
+} OtChecksumBackend;
+
+/* A SHA-256 checksum, to be allocated on the stack; the members are
+ * private.  The digest can only be retrieved once.
+ */
+typedef struct {
+  gboolean initialized;
+  gboolean closed;
+  guint backend;
+  gpointer ctx;
+} OtChecksum;
+
+gboolean ot_checksum_backend_is_available (OtChecksumBackend backend);
+const char *ot_checksum_backend_to_string (OtChecksumBackend backend);
+
+void ot_checksum_init (OtChecksum *checksum);
+void ot_checksum_init_with_backend (OtChecksum        *checksum,
+                                    OtChecksumBackend  backend);
+void ot_checksum_update (OtChecksum    *checksum,
+                         const guint8  *buf,
+                         size_t         len);
+void ot_checksum_get_digest (OtChecksum *checksum,
+                             guint8     *buf,
+                             size_t      buflen);
+void ot_checksum_get_hexdigest (OtChecksum *checksum,
+                                char       *buf,
+                                size_t      buflen);
+void ot_checksum_clear (OtChecksum *checksum);
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC(OtChecksum, ot_checksum_clear)
 
 gboolean ot_gio_write_update_checksum (GOutputStream  *out,
                                        gconstpointer   data,
                                        gsize           len,
                                        gsize          *out_bytes_written,
-                                       GChecksum      *checksum,
+                                       OtChecksum     *checksum,
                                        GCancellable   *cancellable,
                                        GError        **error);
 
@@ -46,7 +85,7 @@ gboolean ot_gio_splice_get_checksum (GOutputStream  *out,
 
 gboolean ot_gio_splice_update_checksum (GOutputStream  *out,
                                         GInputStream   *in,
-                                        GChecksum      *checksum,
+                                        OtChecksum     *checksum,
                                         GCancellable   *cancellable,
                                         GError        **error);
 
@@ -44,6 +44,8 @@ static gboolean opt_disable_fsync;
 static gboolean opt_require_hardlinks;
 static gboolean opt_force_copy;
 static gboolean opt_bareuseronly_dirs;
+static int opt_threads = 1;
+static char *opt_update_from;
 
 static gboolean
 parse_fsync_cb (const char  *option_name,
@@ -75,6 +77,8 @@ static GOptionEntry options[] = {
   { "require-hardlinks", 'H', 0, G_OPTION_ARG_NONE, &opt_require_hardlinks, "Do not fall back to full copies if hardlinking fails", NULL },
   { "force-copy", 'C', 0, G_OPTION_ARG_NONE, &opt_force_copy, "Never hardlink (but may reflink if available)", NULL },
   { "bareuseronly-dirs", 'M', 0, G_OPTION_ARG_NONE, &opt_bareuseronly_dirs, "Suppress mode bits outside of 0775 for directories (suid, world writable, etc.)", NULL },
+  { "threads", 0, 0, G_OPTION_ARG_INT, &opt_threads, "Check out files using N threads (0 for one per CPU, default 1)", "N" },
+  { "update-from", 0, 0, G_OPTION_ARG_STRING, &opt_update_from, "Update an existing checkout of COMMIT in place", "COMMIT" },
   { NULL }
 };
 
@@ -94,9 +98,11 @@ process_one_checkout (OstreeRepo           *repo,
    * convenient infrastructure for testing C APIs with data.
    */
   if (opt_disable_cache || opt_whiteouts || opt_require_hardlinks ||
-      opt_union_add || opt_force_copy || opt_bareuseronly_dirs)
+      opt_union_add || opt_force_copy || opt_bareuseronly_dirs ||
+      opt_threads != 1 || opt_update_from)
     {
       OstreeRepoCheckoutAtOptions options = { 0, };
+      g_autofree char *resolved_update_from = NULL;
 
       if (opt_user_mode)
         options.mode = OSTREE_REPO_CHECKOUT_MODE_USER;
@@ -123,6 +129,13 @@ process_one_checkout (OstreeRepo           *repo,
       options.no_copy_fallback = opt_require_hardlinks;
       options.force_copy = opt_force_copy;
       options.bareuseronly_dirs = opt_bareuseronly_dirs;
+      options.n_threads = opt_threads > 0 ? opt_threads : (int) g_get_num_processors ();
+      if (opt_update_from)
+        {
+          if (!ostree_repo_resolve_rev (repo, opt_update_from, FALSE, &resolved_update_from, error))
+            goto out;
+          options.update_from = resolved_update_from;
+        }
 
       if (!ostree_repo_checkout_at (repo, &options,
                                     AT_FDCWD, destination,
@@ -268,6 +281,13 @@ ostree_builtin_checkout (int argc, char **argv, GCancellable *cancellable, GErro
   if (opt_disable_fsync)
     ostree_repo_set_disable_fsync (repo, TRUE);
 
+  if (opt_threads < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid --threads value %d", opt_threads);
+      goto out;
+    }
+
   if (argc < 2)
     {
       gchar *help = g_option_context_get_help (context, TRUE, NULL);
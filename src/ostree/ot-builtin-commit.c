@@ -57,6 +57,7 @@ static char *opt_gpg_homedir;
 static gboolean opt_generate_sizes;
 static gboolean opt_disable_fsync;
 static char *opt_timestamp;
+static int opt_threads = 1;
 
 static gboolean
 parse_fsync_cb (const char  *option_name,
@@ -100,6 +101,7 @@ static GOptionEntry options[] = {
   { "disable-fsync", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &opt_disable_fsync, "Do not invoke fsync()", NULL },
   { "fsync", 0, 0, G_OPTION_ARG_CALLBACK, parse_fsync_cb, "Specify how to invoke fsync()", "POLICY" },
   { "timestamp", 0, 0, G_OPTION_ARG_STRING, &opt_timestamp, "Override the timestamp of the commit", "TIMESTAMP" },
+  { "threads", 0, 0, G_OPTION_ARG_INT, &opt_threads, "Write content objects using N threads (0 for one per CPU, default 1)", "N" },
   { NULL }
 };
 
@@ -448,18 +450,27 @@ ostree_builtin_commit (int argc, char **argv, GCancellable *cancellable, GError
     flags |= OSTREE_REPO_COMMIT_MODIFIER_FLAGS_GENERATE_SIZES;
   if (opt_disable_fsync)
     ostree_repo_set_disable_fsync (repo, TRUE);
+  if (opt_threads < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid --threads value %d", opt_threads);
+      goto out;
+    }
 
   if (flags != 0
       || opt_owner_uid >= 0
       || opt_owner_gid >= 0
       || opt_statoverride_file != NULL
       || opt_skiplist_file != NULL
-      || opt_no_xattrs)
+      || opt_no_xattrs
+      || opt_threads != 1)
     {
       filter_data.mode_adds = mode_adds;
       filter_data.skip_list = skip_list;
       modifier = ostree_repo_commit_modifier_new (flags, commit_filter,
                                                   &filter_data, NULL);
+      if (opt_threads != 1)
+        ostree_repo_commit_modifier_set_threads (modifier, opt_threads);
     }
 
   if (opt_parent)
@@ -723,6 +734,9 @@ ostree_builtin_commit (int argc, char **argv, GCancellable *cancellable, GError
       g_print ("Content Total: %u\n", stats.content_objects_total);
       g_print ("Content Written: %u\n", stats.content_objects_written);
       g_print ("Content Bytes Written: %" G_GUINT64_FORMAT "\n", stats.content_bytes_written);
+      g_print ("Data Sync Time: %" G_GUINT64_FORMAT " us\n", stats.data_sync_usec);
+      g_print ("Rename Time: %" G_GUINT64_FORMAT " us\n", stats.rename_usec);
+      g_print ("Directory Sync Time: %" G_GUINT64_FORMAT " us\n", stats.dir_sync_usec);
     }
   else
     {
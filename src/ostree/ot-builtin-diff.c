@@ -42,6 +42,12 @@ static GOptionEntry options[] = {
   { NULL }
 };
 
+static gboolean
+arg_is_path (const char *arg)
+{
+  return g_str_has_prefix (arg, "/") || g_str_has_prefix (arg, "./");
+}
+
 static gboolean
 parse_file_or_commit (OstreeRepo  *repo,
                       const char  *arg,
@@ -52,9 +58,7 @@ parse_file_or_commit (OstreeRepo  *repo,
   gboolean ret = FALSE;
   g_autoptr(GFile) ret_file = NULL;
 
-  if (g_str_has_prefix (arg, "/")
-      || g_str_has_prefix (arg, "./")
-      )
+  if (arg_is_path (arg))
     {
       ret_file = g_file_new_for_path (arg);
     }
@@ -70,6 +74,76 @@ parse_file_or_commit (OstreeRepo  *repo,
   return ret;
 }
 
+typedef struct {
+  GPtrArray *modified;
+  GPtrArray *removed;
+  GPtrArray *added;
+} CommitDiff;
+
+static gboolean
+collect_commit_change (OstreeDiffChangeType  change,
+                       const char           *path,
+                       OstreeObjectType      src_objtype,
+                       const char           *src_checksum,
+                       OstreeObjectType      target_objtype,
+                       const char           *target_checksum,
+                       gpointer              user_data,
+                       GError              **error)
+{
+  CommitDiff *diff = user_data;
+
+  switch (change)
+    {
+    case OSTREE_DIFF_CHANGE_MODIFIED:
+      g_ptr_array_add (diff->modified, g_strdup (path));
+      break;
+    case OSTREE_DIFF_CHANGE_REMOVED:
+      g_ptr_array_add (diff->removed, g_strdup (path));
+      break;
+    case OSTREE_DIFF_CHANGE_ADDED:
+      g_ptr_array_add (diff->added, g_strdup (path));
+      break;
+    }
+
+  return TRUE;
+}
+
+/* Diff two commits without going through GFile; prints the same as
+ * ostree_diff_print().
+ */
+static gboolean
+diff_commits (OstreeRepo    *repo,
+              const char    *src,
+              const char    *target,
+              GCancellable  *cancellable,
+              GError       **error)
+{
+  g_autofree char *src_rev = NULL;
+  g_autofree char *target_rev = NULL;
+  g_autoptr(GPtrArray) modified = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GPtrArray) removed = g_ptr_array_new_with_free_func (g_free);
+  g_autoptr(GPtrArray) added = g_ptr_array_new_with_free_func (g_free);
+  CommitDiff diff = { modified, removed, added };
+
+  if (!ostree_repo_resolve_rev (repo, src, FALSE, &src_rev, error))
+    return FALSE;
+  if (!ostree_repo_resolve_rev (repo, target, FALSE, &target_rev, error))
+    return FALSE;
+
+  if (!ostree_diff_commits (repo, src_rev, target_rev, collect_commit_change, &diff,
+                            cancellable, error))
+    return FALSE;
+
+  for (guint i = 0; i < modified->len; i++)
+    g_print ("M    %s\n", (char*)modified->pdata[i]);
+  for (guint i = 0; i < removed->len; i++)
+    g_print ("D    %s\n", (char*)removed->pdata[i]);
+  for (guint i = 0; i < added->len; i++)
+    g_print ("A    %s\n", (char*)added->pdata[i]);
+
+  return TRUE;
+}
+
 static GHashTable *
 reachable_set_intersect (GHashTable *a, GHashTable *b)
 {
@@ -166,7 +240,12 @@ ostree_builtin_diff (int argc, char **argv, GCancellable *cancellable, GError **
   if (!opt_stats && !opt_fs_diff)
     opt_fs_diff = TRUE;
 
-  if (opt_fs_diff)
+  if (opt_fs_diff && !arg_is_path (src) && !arg_is_path (target))
+    {
+      if (!diff_commits (repo, src, target, cancellable, error))
+        goto out;
+    }
+  else if (opt_fs_diff)
     {
       OstreeDiffFlags diff_flags = OSTREE_DIFF_FLAGS_NONE; 
 
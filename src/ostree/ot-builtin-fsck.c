@@ -31,130 +31,58 @@
 static gboolean opt_quiet;
 static gboolean opt_delete;
 static gboolean opt_add_tombstones;
+static int opt_threads = 1;
 
 static GOptionEntry options[] = {
   { "add-tombstones", 0, 0, G_OPTION_ARG_NONE, &opt_add_tombstones, "Add tombstones for missing commits", NULL },
   { "quiet", 'q', 0, G_OPTION_ARG_NONE, &opt_quiet, "Only print error messages", NULL },
   { "delete", 0, 0, G_OPTION_ARG_NONE, &opt_delete, "Remove corrupted objects", NULL },
+  { "threads", 0, 0, G_OPTION_ARG_INT, &opt_threads, "Verify objects using N threads (0 for one per CPU, default 1)", "N" },
   { NULL }
 };
 
+typedef struct {
+  gboolean found_corruption;
+  guint count;
+  guint mod;
+  guint i;
+} FsckData;
+
 static gboolean
-load_and_fsck_one_object (OstreeRepo            *repo,
-                          const char            *checksum,
-                          OstreeObjectType       objtype,
-                          gboolean              *out_found_corruption,
-                          GCancellable          *cancellable,
-                          GError               **error)
+fsck_one_object_result (OstreeRepo        *repo,
+                        const char        *checksum,
+                        OstreeObjectType   objtype,
+                        const GError      *object_error,
+                        gpointer           user_data,
+                        GError           **error)
 {
-  gboolean missing = FALSE;
-  g_autoptr(GVariant) metadata = NULL;
-  g_autoptr(GInputStream) input = NULL;
-  g_autoptr(GFileInfo) file_info = NULL;
-  g_autoptr(GVariant) xattrs = NULL;
-  g_autoptr(GError) temp_error = NULL;
-
-  if (OSTREE_OBJECT_TYPE_IS_META (objtype))
-    {
-      if (!ostree_repo_load_variant (repo, objtype,
-                                     checksum, &metadata, &temp_error))
-        {
-          if (g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-            {
-              g_clear_error (&temp_error);
-              g_printerr ("Object missing: %s.%s\n", checksum,
-                          ostree_object_type_to_string (objtype));
-              missing = TRUE;
-            }
-          else
-            {
-              g_propagate_error (error, g_steal_pointer (&temp_error));
-              return glnx_prefix_error (error, "Loading metadata object %s", checksum);
-            }
-        }
-      else
-        {
-          if (objtype == OSTREE_OBJECT_TYPE_COMMIT)
-            {
-              if (!ostree_validate_structureof_commit (metadata, error))
-                return glnx_prefix_error (error, "While validating commit metadata '%s'", checksum);
-            }
-          else if (objtype == OSTREE_OBJECT_TYPE_DIR_TREE)
-            {
-              if (!ostree_validate_structureof_dirtree (metadata, error))
-                return glnx_prefix_error (error, "While validating directory tree '%s'", checksum);
-            }
-          else if (objtype == OSTREE_OBJECT_TYPE_DIR_META)
-            {
-              if (!ostree_validate_structureof_dirmeta (metadata, error))
-                return glnx_prefix_error (error, "While validating directory metadata '%s'", checksum);
-            }
-
-          input = g_memory_input_stream_new_from_data (g_variant_get_data (metadata),
-                                                       g_variant_get_size (metadata),
-                                                       NULL);
+  FsckData *data = user_data;
 
-        }
-    }
-  else
+  if (object_error == NULL)
+    ;
+  else if (g_error_matches (object_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
     {
-      guint32 mode;
-      g_assert (objtype == OSTREE_OBJECT_TYPE_FILE);
-      if (!ostree_repo_load_file (repo, checksum, &input, &file_info,
-                                  &xattrs, cancellable, &temp_error))
-        {
-          if (g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
-            {
-              g_clear_error (&temp_error);
-              g_printerr ("Object missing: %s.%s\n", checksum,
-                          ostree_object_type_to_string (objtype));
-              missing = TRUE;
-            }
-          else
-            {
-              g_propagate_error (error, g_steal_pointer (&temp_error));
-              return glnx_prefix_error (error, "Loading file object %s", checksum);
-            }
-        }
-      else
-        {
-          mode = g_file_info_get_attribute_uint32 (file_info, "unix::mode");
-          if (!ostree_validate_structureof_file_mode (mode, error))
-            return glnx_prefix_error (error, "While validating file '%s'", checksum);
-        }
+      g_printerr ("Object missing: %s.%s\n", checksum,
+                  ostree_object_type_to_string (objtype));
+      data->found_corruption = TRUE;
     }
-
-  if (missing)
+  else if (opt_delete &&
+           g_error_matches (object_error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA))
     {
-      *out_found_corruption = TRUE;
+      g_printerr ("%s\n", object_error->message);
+      (void) ostree_repo_delete_object (repo, objtype, checksum, NULL, NULL);
+      data->found_corruption = TRUE;
     }
   else
     {
-      g_autofree guchar *computed_csum = NULL;
-      g_autofree char *tmp_checksum = NULL;
-
-      if (!ostree_checksum_file_from_input (file_info, xattrs, input,
-                                            objtype, &computed_csum,
-                                            cancellable, error))
-        return FALSE;
-
-      tmp_checksum = ostree_checksum_from_bytes (computed_csum);
-      if (strcmp (checksum, tmp_checksum) != 0)
-        {
-          g_autofree char *msg = g_strdup_printf ("corrupted object %s.%s; actual checksum: %s",
-                                               checksum, ostree_object_type_to_string (objtype),
-                                               tmp_checksum);
-          if (opt_delete)
-            {
-              g_printerr ("%s\n", msg);
-              (void) ostree_repo_delete_object (repo, objtype, checksum, cancellable, NULL);
-              *out_found_corruption = TRUE;
-            }
-          else
-            return glnx_throw (error, "%s", msg);
-        }
+      g_propagate_error (error, g_error_copy (object_error));
+      return FALSE;
     }
 
+  if (data->mod == 0 || (data->i % data->mod == 0))
+    g_print ("%u/%u objects\n", data->i + 1, data->count);
+  data->i++;
+
   return TRUE;
 }
 
@@ -165,7 +93,7 @@ fsck_reachable_objects_from_commits (OstreeRepo            *repo,
                                      GCancellable          *cancellable,
                                      GError               **error)
 {
-  g_autoptr(GHashTable) reachable_objects = ostree_repo_traverse_new_reachable ();
+  g_autoptr(OstreeObjectSet) reachable_objects = ostree_object_set_new ();
 
   GHashTableIter hash_iter;
   gpointer key, value;
@@ -180,31 +108,21 @@ fsck_reachable_objects_from_commits (OstreeRepo            *repo,
 
       g_assert (objtype == OSTREE_OBJECT_TYPE_COMMIT);
 
-      if (!ostree_repo_traverse_commit_union (repo, checksum, 0, reachable_objects,
-                                              cancellable, error))
+      if (!ostree_repo_traverse_commit_union_set (repo, checksum, 0, reachable_objects,
+                                                  cancellable, error))
         return FALSE;
     }
 
-  const guint count = g_hash_table_size (reachable_objects);
-  const guint mod = count / 10;
-  guint i = 0;
-  g_hash_table_iter_init (&hash_iter, reachable_objects);
-  while (g_hash_table_iter_next (&hash_iter, &key, &value))
-    {
-      GVariant *serialized_key = key;
-      const char *checksum;
-      OstreeObjectType objtype;
-
-      ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
-
-      if (!load_and_fsck_one_object (repo, checksum, objtype, out_found_corruption,
-                                     cancellable, error))
-        return FALSE;
+  FsckData data = { 0, };
+  data.count = ostree_object_set_size (reachable_objects);
+  data.mod = data.count / 10;
+  if (!ostree_repo_fsck_objects (repo, reachable_objects, opt_threads,
+                                 fsck_one_object_result, &data,
+                                 cancellable, error))
+    return FALSE;
 
-      if (mod == 0 || (i % mod == 0))
-        g_print ("%u/%u objects\n", i + 1, count);
-      i++;
-    }
+  if (data.found_corruption)
+    *out_found_corruption = TRUE;
 
   return TRUE;
 }
@@ -219,6 +137,9 @@ ostree_builtin_fsck (int argc, char **argv, GCancellable *cancellable, GError **
   if (!ostree_option_context_parse (context, options, &argc, &argv, OSTREE_BUILTIN_FLAG_NONE, &repo, cancellable, error))
     return FALSE;
 
+  if (opt_threads < 0)
+    return glnx_throw (error, "Invalid --threads value %d", opt_threads);
+
   if (!opt_quiet)
     g_print ("Validating refs...\n");
 
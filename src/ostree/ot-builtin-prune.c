@@ -110,7 +110,7 @@ delete_commit (OstreeRepo *repo, const char *commit_to_delete, GCancellable *can
 static gboolean
 traverse_keep_younger_than (OstreeRepo *repo, const char *checksum,
                             struct timespec *ts,
-                            GHashTable *reachable,
+                            OstreeObjectSet *reachable,
                             GCancellable *cancellable, GError **error)
 {
   g_autofree char *next_checksum = g_strdup (checksum);
@@ -119,8 +119,8 @@ traverse_keep_younger_than (OstreeRepo *repo, const char *checksum,
   /* This is the first commit in our loop, which has a ref pointing to it. We
    * don't want to auto-prune it.
    */
-  if (!ostree_repo_traverse_commit_union (repo, checksum, 0, reachable,
-                                          cancellable, error))
+  if (!ostree_repo_traverse_commit_union_set (repo, checksum, 0, reachable,
+                                              cancellable, error))
     return FALSE;
 
   while (TRUE)
@@ -139,8 +139,8 @@ traverse_keep_younger_than (OstreeRepo *repo, const char *checksum,
       if (commit_timestamp >= ts->tv_sec)
         {
           /* It's newer, traverse it */
-          if (!ostree_repo_traverse_commit_union (repo, next_checksum, 0, reachable,
-                                                  cancellable, error))
+          if (!ostree_repo_traverse_commit_union_set (repo, next_checksum, 0, reachable,
+                                                      cancellable, error))
             return FALSE;
 
           g_free (next_checksum);
@@ -215,7 +215,7 @@ ostree_builtin_prune (int argc, char **argv, GCancellable *cancellable, GError *
   else
     {
       g_autoptr(GHashTable) all_refs = NULL;
-      g_autoptr(GHashTable) reachable = ostree_repo_traverse_new_reachable ();
+      g_autoptr(OstreeObjectSet) reachable = ostree_object_set_new ();
       g_autoptr(GHashTable) retain_branch_depth = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
       struct timespec keep_younger_than_ts;
       GHashTableIter hash_iter;
@@ -309,12 +309,13 @@ ostree_builtin_prune (int argc, char **argv, GCancellable *cancellable, GError *
                                   the global default */
 
           g_debug ("Finding objects to keep for commit %s", checksum);
-          if (!ostree_repo_traverse_commit_union (repo, checksum, depth, reachable,
-                                                  cancellable, error))
+          if (!ostree_repo_traverse_commit_union_set (repo, checksum, depth, reachable,
+                                                      cancellable, error))
             return FALSE;
         }
 
-      { OstreeRepoPruneOptions opts = { pruneflags, reachable };
+      { OstreeRepoPruneOptions opts = { pruneflags, };
+        opts.reachable_set = reachable;
         if (!ostree_repo_prune_from_reachable (repo, &opts,
                                                &n_objects_total,
                                                &n_objects_pruned,
@@ -39,6 +39,57 @@ static gboolean opt_swap_endianness;
 static gboolean opt_inline;
 static gboolean opt_disable_bsdiff;
 static gboolean opt_if_not_exists;
+static int opt_threads = -1;
+static int opt_compression_level = -1;
+static guint opt_max_rss;
+
+static gboolean
+parse_compression_level_cb (const char  *option_name,
+                            const char  *value,
+                            gpointer     data,
+                            GError     **error)
+{
+  char *endptr = NULL;
+  gint64 level = g_ascii_strtoll (value, &endptr, 10);
+
+  if (*value == '\0' || *endptr != '\0' || level < 0 || level > 9)
+    return glnx_throw (error, "Invalid --compression-level value '%s'; must be 0-9", value);
+
+  opt_compression_level = level;
+  return TRUE;
+}
+
+static gboolean
+parse_threads_cb (const char  *option_name,
+                  const char  *value,
+                  gpointer     data,
+                  GError     **error)
+{
+  char *endptr = NULL;
+  guint64 n = g_ascii_strtoull (value, &endptr, 10);
+
+  if (!g_ascii_isdigit (*value) || *endptr != '\0' || n > G_MAXINT)
+    return glnx_throw (error, "Invalid --threads value '%s'", value);
+
+  opt_threads = n;
+  return TRUE;
+}
+
+static gboolean
+parse_max_rss_cb (const char  *option_name,
+                  const char  *value,
+                  gpointer     data,
+                  GError     **error)
+{
+  char *endptr = NULL;
+  guint64 size = g_ascii_strtoull (value, &endptr, 10);
+
+  if (!g_ascii_isdigit (*value) || *endptr != '\0' || size == 0 || size > G_MAXUINT32)
+    return glnx_throw (error, "Invalid --max-rss value '%s'; must be a positive number of megabytes", value);
+
+  opt_max_rss = size;
+  return TRUE;
+}
 
 #define BUILTINPROTO(name) static gboolean ot_static_delta_builtin_ ## name (int argc, char **argv, GCancellable *cancellable, GError **error)
 
@@ -73,6 +124,9 @@ static GOptionEntry generate_options[] = {
   { "max-bsdiff-size", 0, 0, G_OPTION_ARG_STRING, &opt_max_bsdiff_size, "Maximum size in megabytes to consider bsdiff compression for input files", NULL},
   { "max-chunk-size", 0, 0, G_OPTION_ARG_STRING, &opt_max_chunk_size, "Maximum size of delta chunks in megabytes", NULL},
   { "filename", 0, 0, G_OPTION_ARG_FILENAME, &opt_filename, "Write the delta content to PATH (a directory).  If not specified, the OSTree repository is used", "PATH"},
+  { "threads", 0, 0, G_OPTION_ARG_CALLBACK, parse_threads_cb, "Generate and compress delta parts using N threads (0 for one per CPU, default 1)", "N" },
+  { "compression-level", 0, 0, G_OPTION_ARG_CALLBACK, parse_compression_level_cb, "xz compression level for delta parts, 0-9 (default 8)", "LEVEL" },
+  { "max-rss", 0, 0, G_OPTION_ARG_CALLBACK, parse_max_rss_cb, "Bound memory used for generation to about SIZE megabytes, writing parts as they're completed", "SIZE" },
   { NULL }
 };
 
@@ -235,6 +289,12 @@ ot_static_delta_builtin_generate (int argc, char **argv, GCancellable *cancellab
 
       g_assert (opt_to_rev);
 
+      if (opt_threads < 0)
+        {
+          glnx_throw (error, "Invalid --threads value %d", opt_threads);
+          goto out;
+        }
+
       if (opt_empty)
         {
           if (opt_from_rev)
@@ -327,6 +387,15 @@ ot_static_delta_builtin_generate (int argc, char **argv, GCancellable *cancellab
       if (opt_filename)
         g_variant_builder_add (parambuilder, "{sv}",
                                "filename", g_variant_new_bytestring (opt_filename));
+      if (opt_threads >= 0)
+        g_variant_builder_add (parambuilder, "{sv}",
+                               "threads", g_variant_new_uint32 (opt_threads));
+      if (opt_compression_level >= 0)
+        g_variant_builder_add (parambuilder, "{sv}",
+                               "compression-level", g_variant_new_uint32 (opt_compression_level));
+      if (opt_max_rss > 0)
+        g_variant_builder_add (parambuilder, "{sv}",
+                               "max-rss", g_variant_new_uint32 (opt_max_rss));
 
       g_variant_builder_add (parambuilder, "{sv}", "verbose", g_variant_new_boolean (TRUE));
       if (opt_endianness || opt_swap_endianness)
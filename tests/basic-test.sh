@@ -19,7 +19,7 @@
 
 set -euo pipefail
 
-echo "1..$((70 + ${extra_basic_tests:-0}))"
+echo "1..$((76 + ${extra_basic_tests:-0}))"
 
 $CMD_PREFIX ostree --version > version.yaml
 python -c 'import yaml; yaml.safe_load(open("version.yaml"))'
@@ -186,6 +186,122 @@ omitted_rev=$($OSTREE commit ${COMMIT_ARGS} -b test2-no-subject-2 --bind-ref=tes
 assert_streq $empty_rev $omitted_rev
 echo "ok commit no subject"
 
+cd ${test_tmpdir}
+rm -rf threads-tree threads-checkout
+mkdir -p threads-tree/sub/dir
+for i in $(seq 50); do
+    echo "threaded $i" > threads-tree/file$i
+    echo "nested $i" > threads-tree/sub/dir/file$i
+done
+ln -s file1 threads-tree/sub/link
+threaded_rev=$($OSTREE commit ${COMMIT_ARGS} --orphan --threads=4 -s threads --timestamp="2005-10-29 12:43:29 +0000" threads-tree)
+serial_rev=$($OSTREE commit ${COMMIT_ARGS} --orphan -s threads --timestamp="2005-10-29 12:43:29 +0000" threads-tree)
+assert_streq $threaded_rev $serial_rev
+$OSTREE checkout ${CHECKOUT_U_ARG} $threaded_rev threads-checkout
+diff -r threads-tree threads-checkout
+rm -rf threads-tree threads-checkout
+echo "ok commit with threads"
+
+cd ${test_tmpdir}
+rm -rf threads-tree threads-checkout threads-checkout-serial
+for d in a a/b a/b/c d e/f; do
+    mkdir -p threads-tree/$d
+    for i in $(seq 20); do
+        echo "$d $i" > threads-tree/$d/file$i
+    done
+done
+chmod 0700 threads-tree/a/b
+chmod 0755 threads-tree/e/f
+ln -s ../d/file1 threads-tree/a/link
+threads_rev=$($OSTREE commit ${COMMIT_ARGS} --orphan -s threads threads-tree)
+$OSTREE checkout ${CHECKOUT_U_ARG} --threads=4 $threads_rev threads-checkout
+$OSTREE checkout ${CHECKOUT_U_ARG} $threads_rev threads-checkout-serial
+diff -r threads-checkout-serial threads-checkout
+for d in . a a/b a/b/c d e e/f; do
+    assert_streq "$(stat -c '%a %Y' threads-checkout/$d)" "$(stat -c '%a %Y' threads-checkout-serial/$d)"
+done
+rm -rf threads-tree threads-checkout threads-checkout-serial
+echo "ok checkout with threads"
+
+cd ${test_tmpdir}
+rm -rf update-tree update-checkout update-checkout-fresh
+mkdir -p update-tree/a/b update-tree/c/gone-dir update-tree/tofile update-tree/ro update-tree/ro-both
+echo same > update-tree/a/same
+echo old > update-tree/a/b/modified
+echo removed > update-tree/c/removed
+echo gone > update-tree/c/gone-dir/x
+echo todir > update-tree/todir
+echo inner > update-tree/tofile/inner
+ln -s a/same update-tree/link
+echo old > update-tree/ro/file
+echo old > update-tree/ro-both/file
+chmod 0555 update-tree/ro-both
+update_from_rev=$($OSTREE commit ${COMMIT_ARGS} --orphan -s update-from update-tree)
+echo "new content" > update-tree/a/b/modified
+echo added > update-tree/a/added
+rm -rf update-tree/c/removed update-tree/c/gone-dir update-tree/todir update-tree/tofile
+mkdir -p update-tree/todir update-tree/d/e/f
+echo inner > update-tree/todir/inner
+echo tofile > update-tree/tofile
+echo deep > update-tree/d/e/f/deep
+ln -sf a/added update-tree/link
+chmod 0700 update-tree/a/b
+# Read-only directories whose children change, both newly and already read-only
+echo new > update-tree/ro/file
+echo added > update-tree/ro/added
+chmod 0555 update-tree/ro
+chmod 0755 update-tree/ro-both
+rm update-tree/ro-both/file
+echo added > update-tree/ro-both/added
+chmod 0555 update-tree/ro-both
+update_rev=$($OSTREE commit ${COMMIT_ARGS} --orphan -s update update-tree)
+$OSTREE checkout ${CHECKOUT_U_ARG} $update_from_rev update-checkout
+same_ino=$(stat -c '%i' update-checkout/a/same)
+$OSTREE checkout ${CHECKOUT_U_ARG} --update-from=$update_from_rev $update_rev update-checkout
+$OSTREE checkout ${CHECKOUT_U_ARG} $update_rev update-checkout-fresh
+diff -r update-checkout-fresh update-checkout
+for d in . a a/b c d d/e d/e/f todir ro ro-both; do
+    assert_streq "$(stat -c '%a %Y' update-checkout/$d)" "$(stat -c '%a %Y' update-checkout-fresh/$d)"
+done
+assert_symlink_has_content update-checkout/link a/added
+assert_not_has_file update-checkout/c/removed
+assert_not_has_dir update-checkout/c/gone-dir
+# Unchanged files are left alone
+assert_streq "$(stat -c '%i' update-checkout/a/same)" "${same_ino}"
+chmod -R u+w update-tree update-checkout update-checkout-fresh
+rm -rf update-tree update-checkout update-checkout-fresh
+echo "ok checkout update-from"
+
+cd ${test_tmpdir}
+rm -rf index-tree
+mkdir index-tree
+echo "indexed" > index-tree/file
+unindexed_rev=$($OSTREE commit ${COMMIT_ARGS} --orphan -s index --timestamp="2005-10-29 12:43:29 +0000" index-tree)
+$OSTREE config set core.object-index true
+indexed_rev=$($OSTREE commit ${COMMIT_ARGS} --orphan -s index --timestamp="2005-10-29 12:43:29 +0000" index-tree)
+assert_streq $unindexed_rev $indexed_rev
+echo "new content" > index-tree/newfile
+$OSTREE commit ${COMMIT_ARGS} --orphan --table-output -s index index-tree > index-stats.txt
+assert_file_has_content index-stats.txt "Content Written: 1$"
+$OSTREE config set core.object-index false
+rm -rf index-tree index-stats.txt
+echo "ok commit with object index"
+
+cd ${test_tmpdir}
+rm -rf syncfs-tree
+mkdir syncfs-tree
+for i in $(seq 20); do echo "syncfs $i" > syncfs-tree/file$i; done
+$OSTREE config set core.finalize-sync syncfs
+$OSTREE commit ${COMMIT_ARGS} --table-output -b test-finalize-syncfs -s syncfs syncfs-tree > syncfs-stats.txt
+$OSTREE config set core.finalize-sync directories
+assert_file_has_content syncfs-stats.txt "^Rename Time: [0-9]* us$"
+assert_file_has_content syncfs-stats.txt "^Directory Sync Time: [0-9]* us$"
+$OSTREE checkout ${CHECKOUT_U_ARG} test-finalize-syncfs syncfs-checkout
+diff -r syncfs-tree syncfs-checkout
+$OSTREE refs --delete test-finalize-syncfs
+rm -rf syncfs-tree syncfs-checkout syncfs-stats.txt
+echo "ok commit with syncfs finalization"
+
 cd ${test_tmpdir}
 cat >commitmsg.txt <<EOF
 This is a long
@@ -262,6 +378,20 @@ cd ${test_tmpdir}
 assert_file_has_content diff-test2-2 'M */four$'
 echo "ok diff file changing type"
 
+$OSTREE commit ${COMMIT_ARGS} -b test2-diff -s diff --tree=dir=checkout-test2-4
+$OSTREE diff test2 test2-diff > diff-test2-3
+assert_file_has_content diff-test2-3 'M */four$'
+assert_not_file_has_content diff-test2-3 'four/other'
+$OSTREE diff test2-diff test2 > diff-test2-3
+assert_file_has_content diff-test2-3 'M */four$'
+$OSTREE diff test2 test2 > diff-test2-3
+assert_file_empty diff-test2-3
+$OSTREE diff test2^ test2 > diff-test2-3
+assert_file_has_content diff-test2-3 'D */a/5$'
+assert_file_has_content diff-test2-3 'A */yet/another/tree/green$'
+$OSTREE refs --delete test2-diff
+echo "ok diff commits"
+
 cd ${test_tmpdir}
 mkdir repo2
 # Use a different mode to test hardlinking metadata only
@@ -483,6 +613,11 @@ ${CMD_PREFIX} ostree --repo=shadow-repo config set core.parent $(pwd)/repo
 rm -rf test2-checkout
 parent_rev_test2=$(${CMD_PREFIX} ostree --repo=repo rev-parse test2)
 ${CMD_PREFIX} ostree --repo=shadow-repo checkout ${CHECKOUT_U_ARG} "${parent_rev_test2}" test2-checkout
+validate_checkout_basic test2-checkout
+# Objects only in the parent repo should still be hardlinked
+if grep -q 'mode=bare$' repo/config; then
+    assert_not_streq $(stat -c '%h' test2-checkout/firstfile) 1
+fi
 echo "ok checkout from shadow repo"
 
 cd ${test_tmpdir}
@@ -35,7 +35,7 @@ function verify_initial_contents() {
     assert_file_has_content baz/cow '^moo$'
 }
 
-echo "1..28"
+echo "1..29"
 
 # Try both syntaxes
 repo_init --no-gpg-verify
@@ -428,3 +428,37 @@ if ${CMD_PREFIX} ostree --repo=repo pull origin main 2>err.txt; then
 fi
 assert_file_has_content_literal err.txt 'error: Fetching refs/heads/main: Invalid rev lots of html here  lots of html here  lots of html here  lots of'
 echo "ok pull got HTML for a ref"
+
+cd ${test_tmpdir}
+rm checkout-origin-main -rf
+$OSTREE --repo=ostree-srv/gnomerepo checkout main checkout-origin-main
+echo "this object will be corrupted" > checkout-origin-main/corrupted-file
+echo "this object will replace it" > checkout-origin-main/other-file
+${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo commit -b corrupted-content --tree=dir=checkout-origin-main
+${CMD_PREFIX} ostree --repo=ostree-srv/gnomerepo summary -u
+corrupted_path=$(ostree_file_path_to_relative_object_path ostree-srv/gnomerepo corrupted-content /corrupted-file)z
+other_path=$(ostree_file_path_to_relative_object_path ostree-srv/gnomerepo corrupted-content /other-file)z
+# A well-formed object, but with the wrong checksum
+cp ostree-srv/gnomerepo/${corrupted_path}{,.orig}
+cp ostree-srv/gnomerepo/${other_path} ostree-srv/gnomerepo/${corrupted_path}
+# Verify we reject it when unpacking, and when storing it as is
+for flag in "" "--mirror"; do
+    rm mirrorrepo -rf
+    ostree_repo_init mirrorrepo --mode=archive
+    ${CMD_PREFIX} ostree --repo=mirrorrepo remote add --set=gpg-verify=false origin $(cat httpd-address)/ostree/gnomerepo
+    if ${CMD_PREFIX} ostree --repo=mirrorrepo pull ${flag} origin corrupted-content 2>err.txt; then
+        assert_not_reached "pulled corrupted content object"
+    fi
+    assert_file_has_content err.txt 'Corrupted content object'
+done
+for flag in "" "--mirror"; do
+    repo_init --no-gpg-verify
+    if ${CMD_PREFIX} ostree --repo=repo pull ${flag} origin corrupted-content 2>err.txt; then
+        assert_not_reached "pulled corrupted content object"
+    fi
+    assert_file_has_content err.txt 'Corrupted'
+done
+mv ostree-srv/gnomerepo/${corrupted_path}{.orig,}
+${CMD_PREFIX} ostree --repo=mirrorrepo pull origin corrupted-content
+${CMD_PREFIX} ostree --repo=mirrorrepo fsck
+echo "ok pull corrupted content object"
@@ -0,0 +1,140 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "libglnx.h"
+
+#include "ostree-adaptive-limit.h"
+
+/* A model of a link whose throughput, in completions per second, is a
+ * function of the number of operations in flight.
+ */
+typedef double (*RateFunc) (guint in_flight);
+
+/* Run enough completions through @limit to close one sampling window, at
+ * the rate given by @func for the current limit.
+ */
+static void
+run_window (OstreeAdaptiveLimit *limit,
+            guint64             *now,
+            RateFunc             func)
+{
+  const guint in_flight = limit->limit;
+  const double rate = func (in_flight);
+  const guint n = MAX (in_flight, (guint) (rate / 2) + 1);
+  const guint64 interval = (guint64) (G_USEC_PER_SEC / rate);
+
+  for (guint i = 0; i < n; i++)
+    {
+      *now += interval;
+      (void) _ostree_adaptive_limit_record (limit, *now, 1000, in_flight);
+    }
+}
+
+static OstreeAdaptiveLimit *
+run_model (OstreeAdaptiveLimit *limit,
+           RateFunc             func,
+           guint                n_windows)
+{
+  guint64 now = 1;
+
+  /* The first completion just starts the window */
+  (void) _ostree_adaptive_limit_record (limit, now, 0, 1);
+  for (guint i = 0; i < n_windows; i++)
+    run_window (limit, &now, func);
+  return limit;
+}
+
+static double
+rate_linear (guint in_flight)
+{
+  return in_flight * 2.0;
+}
+
+static double
+rate_saturated (guint in_flight)
+{
+  return 40;
+}
+
+static double
+rate_peaked (guint in_flight)
+{
+  return in_flight <= 16 ? in_flight : MAX (1, 32 - (int) in_flight);
+}
+
+static void
+test_adaptive_limit_fixed (void)
+{
+  OstreeAdaptiveLimit limit;
+
+  _ostree_adaptive_limit_init (&limit, 8, 8, 16);
+  g_assert_cmpuint (limit.limit, ==, 8);
+  run_model (&limit, rate_linear, 20);
+  g_assert_cmpuint (limit.limit, ==, 8);
+}
+
+static void
+test_adaptive_limit_grow (void)
+{
+  OstreeAdaptiveLimit limit;
+
+  /* More concurrency keeps helping, so we should go all the way up */
+  _ostree_adaptive_limit_init (&limit, 2, 64, 8);
+  run_model (&limit, rate_linear, 30);
+  g_assert_cmpuint (limit.limit, ==, 64);
+}
+
+static void
+test_adaptive_limit_saturated (void)
+{
+  OstreeAdaptiveLimit limit;
+
+  /* Once more concurrency stops helping, we should stop growing */
+  _ostree_adaptive_limit_init (&limit, 2, 64, 8);
+  run_model (&limit, rate_saturated, 30);
+  g_assert_cmpuint (limit.limit, <=, 10);
+}
+
+static void
+test_adaptive_limit_peaked (void)
+{
+  OstreeAdaptiveLimit limit;
+
+  /* Past the peak throughput gets worse, so we should back off towards it */
+  _ostree_adaptive_limit_init (&limit, 2, 64, 8);
+  run_model (&limit, rate_peaked, 30);
+  g_assert_cmpuint (limit.limit, >=, 10);
+  g_assert_cmpuint (limit.limit, <=, 18);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/ostree/adaptive-limit/fixed", test_adaptive_limit_fixed);
+  g_test_add_func ("/ostree/adaptive-limit/grow", test_adaptive_limit_grow);
+  g_test_add_func ("/ostree/adaptive-limit/saturated", test_adaptive_limit_saturated);
+  g_test_add_func ("/ostree/adaptive-limit/peaked", test_adaptive_limit_peaked);
+
+  return g_test_run ();
+}
@@ -38,6 +38,8 @@ etc=sysroot/ostree/deploy/testos/deploy/${rev}.0/etc
 
 # modified config file
 echo "a modified config file" > ${etc}/NetworkManager/nm.conf
+# modified config file with the same size as the original
+echo "a CONFIG file" > ${etc}/aconfigfile
 
 # Ok, let's create a long directory chain with custom permissions
 mkdir -p ${etc}/a/long/dir/chain
@@ -65,6 +67,7 @@ newetc=${newroot}/etc
 
 assert_file_has_content ${newroot}/usr/etc/NetworkManager/nm.conf "a default daemon file"
 assert_file_has_content ${newetc}/NetworkManager/nm.conf "a modified config file"
+assert_file_has_content ${newetc}/aconfigfile "a CONFIG file"
 
 assert_file_has_mode() {
   stat -c '%a' $1 > mode.txt
@@ -0,0 +1,58 @@
+#!/bin/bash
+#
+# Copyright (C) 2026 agent <agent@local>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -euo pipefail
+
+if ! ostree --version | grep -q -e '- zstd'; then
+    echo "1..0 #SKIP no zstd support compiled in"
+    exit 0
+fi
+
+. $(dirname $0)/libtest.sh
+
+echo '1..12'
+
+setup_test_repository "archive-zstd"
+
+. ${test_srcdir}/archive-test.sh
+
+cd ${test_tmpdir}
+mkdir repo2
+ostree_repo_init repo2
+${CMD_PREFIX} ostree --repo=repo2 remote add --set=gpg-verify=false aremote file://$(pwd)/repo test2
+${CMD_PREFIX} ostree --repo=repo2 pull aremote
+${CMD_PREFIX} ostree --repo=repo2 rev-parse aremote/test2
+${CMD_PREFIX} ostree --repo=repo2 fsck
+echo "ok pull with from file:/// uri"
+
+cd ${test_tmpdir}
+rm repo-z2 repo-zstd -rf
+ostree_repo_init repo-z2 --mode=archive-z2
+${CMD_PREFIX} ostree --repo=repo-z2 pull-local repo test2
+find repo-z2/objects -name '*.filez' > z2-objects.txt
+assert_file_has_content z2-objects.txt '\.filez$'
+ostree_repo_init repo-zstd --mode=archive-zstd
+${CMD_PREFIX} ostree --repo=repo-zstd pull-local repo-z2 test2
+find repo-zstd/objects -name '*.filez*' > zstd-objects.txt
+assert_file_has_content zstd-objects.txt '\.filezst$'
+assert_not_file_has_content zstd-objects.txt '\.filez$'
+${CMD_PREFIX} ostree --repo=repo-zstd fsck
+${CMD_PREFIX} ostree --repo=repo-zstd checkout -U test2 checkout-from-zstd
+assert_file_has_content checkout-from-zstd/baz/cow moo
+echo "ok convert archive-z2 to archive-zstd"
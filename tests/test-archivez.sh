@@ -21,7 +21,7 @@ set -euo pipefail
 
 . $(dirname $0)/libtest.sh
 
-echo '1..11'
+echo '1..12'
 
 setup_test_repository "archive-z2"
 
@@ -35,3 +35,9 @@ ${CMD_PREFIX} ostree --repo=repo2 pull aremote
 ${CMD_PREFIX} ostree --repo=repo2 rev-parse aremote/test2
 ${CMD_PREFIX} ostree --repo=repo2 fsck
 echo "ok pull with from file:/// uri"
+
+cd ${test_tmpdir}
+$OSTREE commit -b test2-recommit -s 'Recommit' --table-output --tree=dir=files > recommit-stats.txt
+assert_file_has_content recommit-stats.txt "^Content Written: 0$"
+assert_not_file_has_content recommit-stats.txt "^Content Total: 0$"
+echo "ok recommit of unchanged tree writes no content"
@@ -23,6 +23,7 @@
 #include "libglnx.h"
 #include "bsdiff/bsdiff.h"
 #include "bsdiff/bspatch.h"
+#include "ostree-bsdiff.h"
 #include <glib.h>
 #include <stdlib.h>
 #include <gio/gio.h>
@@ -100,9 +101,166 @@ test_bsdiff (void)
   g_assert_cmpint (memcmp (new, new_generated, NEW_SIZE), ==, 0);
 }
 
+static const guint8 *suffix_cmp_buf;
+static gsize suffix_cmp_len;
+
+static int
+suffix_cmp (gconstpointer a,
+            gconstpointer b)
+{
+  const gint32 sa = *(const gint32*)a;
+  const gint32 sb = *(const gint32*)b;
+  const gsize la = suffix_cmp_len - sa;
+  const gsize lb = suffix_cmp_len - sb;
+  int r = memcmp (suffix_cmp_buf + sa, suffix_cmp_buf + sb, MIN (la, lb));
+  if (r != 0)
+    return r;
+  return la < lb ? -1 : (la > lb ? 1 : 0);
+}
+
+static void
+test_suffix_sort (void)
+{
+  /* Small alphabets give long repeats, which exercise the recursion */
+  const guint alphabets[] = { 1, 2, 4, 256 };
+
+  for (guint iter = 0; iter < 2000; iter++)
+    {
+      const guint alphabet = alphabets[iter % G_N_ELEMENTS (alphabets)];
+      const gsize len = g_test_rand_int_range (0, iter < 1000 ? 64 : 4096);
+      g_autofree guint8 *buf = g_new (guint8, len + 1);
+      g_autofree gint32 *sa = g_new (gint32, len + 1);
+      g_autofree gint32 *expected = g_new (gint32, len + 1);
+
+      for (gsize i = 0; i < len; i++)
+        buf[i] = g_test_rand_int_range (0, alphabet);
+
+      g_assert (_ostree_bsdiff_suffix_sort (buf, len, sa));
+
+      for (gsize i = 0; i <= len; i++)
+        expected[i] = i;
+      suffix_cmp_buf = buf;
+      suffix_cmp_len = len;
+      qsort (expected, len + 1, sizeof (gint32), suffix_cmp);
+
+      g_assert_cmpint (memcmp (sa, expected, (len + 1) * sizeof (gint32)), ==, 0);
+    }
+}
+
+/* Make a new version of @old, with some bytes changed and some
+ * insertions and deletions.
+ */
+static guint8 *
+mutate (const guint8 *old,
+        gsize         old_size,
+        gsize        *out_size)
+{
+  GByteArray *new = g_byte_array_sized_new (old_size + 64);
+
+  for (gsize i = 0; i < old_size; i++)
+    {
+      const guint32 r = g_test_rand_int_range (0, 1000);
+      guint8 c = old[i];
+      if (r < 5)
+        continue;
+      if (r < 10)
+        g_byte_array_append (new, &c, 1);
+      if (r < 40)
+        c = g_test_rand_int_range (0, 256);
+      g_byte_array_append (new, &c, 1);
+    }
+
+  *out_size = new->len;
+  return g_byte_array_free (new, FALSE);
+}
+
+static GBytes *
+generate_patch (gboolean      use_sais,
+                const guint8 *old,
+                gsize         old_size,
+                const guint8 *new,
+                gsize         new_size)
+{
+  struct bsdiff_stream bsdiff_stream;
+  g_autoptr(GOutputStream) out = g_memory_output_stream_new_resizable ();
+
+  bsdiff_stream.malloc = malloc;
+  bsdiff_stream.free = free;
+  bsdiff_stream.write = bzdiff_write;
+  bsdiff_stream.opaque = out;
+  if (use_sais)
+    g_assert_cmpint (_ostree_bsdiff (old, old_size, new, new_size, &bsdiff_stream), ==, 0);
+  else
+    g_assert_cmpint (bsdiff (old, old_size, new, new_size, &bsdiff_stream), ==, 0);
+
+  g_assert (g_output_stream_close (out, NULL, NULL));
+  return g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (out));
+}
+
+static void
+test_bsdiff_sais (void)
+{
+  const gsize sizes[] = { 0, 1, 17, 4096, 65536 };
+
+  for (guint i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      const gsize old_size = sizes[i];
+      g_autofree guint8 *old = g_new (guint8, old_size + 1);
+      /* Mostly text-like, so there are plenty of partial matches */
+      for (gsize j = 0; j < old_size; j++)
+        old[j] = 'a' + g_test_rand_int_range (0, 8);
+      gsize new_size;
+      g_autofree guint8 *new = mutate (old, old_size, &new_size);
+
+      g_autoptr(GBytes) expected = generate_patch (FALSE, old, old_size, new, new_size);
+      g_autoptr(GBytes) patch = generate_patch (TRUE, old, old_size, new, new_size);
+      g_assert (g_bytes_equal (patch, expected));
+
+      struct bspatch_stream bspatch_stream;
+      g_autoptr(GInputStream) in = g_memory_input_stream_new_from_bytes (patch);
+      g_autofree guint8 *new_generated = g_new0 (guint8, new_size + 1);
+      bspatch_stream.read = bzpatch_read;
+      bspatch_stream.opaque = in;
+      g_assert_cmpint (bspatch (old, old_size, new_generated, new_size, &bspatch_stream), ==, 0);
+      g_assert_cmpint (memcmp (new, new_generated, new_size), ==, 0);
+    }
+}
+
+/* Run with -m perf; the size in MB may be set with OSTREE_BSDIFF_BENCH_MB */
+static void
+test_bsdiff_benchmark (void)
+{
+  const char *size_env = g_getenv ("OSTREE_BSDIFF_BENCH_MB");
+  const gsize old_size = (size_env ? g_ascii_strtoull (size_env, NULL, 10) : 16) * 1024 * 1024;
+  g_autofree guint8 *old = g_new (guint8, old_size + 1);
+
+  /* Half random, half repeats, a bit like a binary with its tables */
+  for (gsize i = 0; i < old_size; i++)
+    old[i] = (i % 1024 < 512 || i < 512) ? g_test_rand_int_range (0, 256) : old[i - 512];
+  gsize new_size;
+  g_autofree guint8 *new = mutate (old, old_size, &new_size);
+
+  g_test_timer_start ();
+  g_autoptr(GBytes) expected = generate_patch (FALSE, old, old_size, new, new_size);
+  const double qsufsort_secs = g_test_timer_elapsed ();
+
+  g_test_timer_start ();
+  g_autoptr(GBytes) patch = generate_patch (TRUE, old, old_size, new, new_size);
+  const double sais_secs = g_test_timer_elapsed ();
+
+  g_assert (g_bytes_equal (patch, expected));
+  g_test_message ("bsdiff of %" G_GSIZE_FORMAT " MB: qsufsort %.2fs, SA-IS %.2fs",
+                  old_size / (1024 * 1024), qsufsort_secs, sais_secs);
+  g_test_maximized_result (qsufsort_secs / MAX (sais_secs, 1e-6), "speedup");
+}
+
 int main (int argc, char **argv)
 {
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/bsdiff", test_bsdiff);
+  g_test_add_func ("/bsdiff/suffix-sort", test_suffix_sort);
+  g_test_add_func ("/bsdiff/sais", test_bsdiff_sais);
+  if (g_test_perf ())
+    g_test_add_func ("/bsdiff/benchmark", test_bsdiff_benchmark);
   return g_test_run();
 }
@@ -79,9 +79,53 @@ test_ostree_parse_delta_name (void)
   }
 }
 
+static void
+test_checksum_backends (void)
+{
+  const OtChecksumBackend backends[] = { OT_CHECKSUM_BACKEND_DEFAULT,
+                                         OT_CHECKSUM_BACKEND_GLIB,
+                                         OT_CHECKSUM_BACKEND_OPENSSL };
+  const gsize bufsize = 1024 * 1024 + 7;
+  g_autofree guint8 *buf = g_malloc (bufsize);
+
+  for (gsize i = 0; i < bufsize; i++)
+    buf[i] = (guint8) (i * 31 + (i >> 8));
+  g_autofree char *expected = g_compute_checksum_for_data (G_CHECKSUM_SHA256, buf, bufsize);
+
+  for (guint i = 0; i < G_N_ELEMENTS (backends); i++)
+    {
+      if (!ot_checksum_backend_is_available (backends[i]))
+        continue;
+
+      { g_auto(OtChecksum) checksum = { 0, };
+        char hexdigest[OT_SHA256_STRING_LEN+1];
+        ot_checksum_init_with_backend (&checksum, backends[i]);
+        ot_checksum_update (&checksum, (guint8*)"abc", 3);
+        ot_checksum_get_hexdigest (&checksum, hexdigest, sizeof (hexdigest));
+        g_assert_cmpstr (hexdigest, ==, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+      }
+
+      /* Feed the data in uneven chunks */
+      { g_auto(OtChecksum) checksum = { 0, };
+        char hexdigest[OT_SHA256_STRING_LEN+1];
+        gsize off = 0;
+        ot_checksum_init_with_backend (&checksum, backends[i]);
+        while (off < bufsize)
+          {
+            gsize len = MIN (bufsize - off, 4093);
+            ot_checksum_update (&checksum, buf + off, len);
+            off += len;
+          }
+        ot_checksum_get_hexdigest (&checksum, hexdigest, sizeof (hexdigest));
+        g_assert_cmpstr (hexdigest, ==, expected);
+      }
+    }
+}
+
 int main (int argc, char **argv)
 {
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/ostree_parse_delta_name", test_ostree_parse_delta_name);
+  g_test_add_func ("/ostree/checksum/backends", test_checksum_backends);
   return g_test_run();
 }
@@ -19,7 +19,7 @@
 
 set -euo pipefail
 
-echo "1..3"
+echo "1..4"
 
 . $(dirname $0)/libtest.sh
 
@@ -56,3 +56,26 @@ fi
 assert_file_has_content_literal err.txt "Loading commit for ref test2: No such metadata object"
 
 echo "ok missing commit"
+
+cd ${test_tmpdir}
+rm repo files -rf
+setup_test_repository "bare"
+rm checkout-test2 -rf
+$OSTREE fsck -q --threads=4
+$OSTREE checkout test2 checkout-test2
+cd checkout-test2
+chmod o+x firstfile
+if $OSTREE fsck -q --threads=4 2>err.txt; then
+    assert_not_reached "fsck unexpectedly succeeded"
+fi
+assert_file_has_content err.txt "corrupted object"
+if $OSTREE fsck -q --threads=0 --delete 2>err.txt; then
+    assert_not_reached "fsck unexpectedly succeeded"
+fi
+assert_file_has_content err.txt "corrupted object"
+if $OSTREE fsck -q --threads=4 2>err.txt; then
+    assert_not_reached "fsck unexpectedly succeeded"
+fi
+assert_file_has_content err.txt "Object missing"
+
+echo "ok fsck with threads"
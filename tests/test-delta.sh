@@ -26,7 +26,7 @@ skip_without_user_xattrs
 bindatafiles="bash true ostree"
 morebindatafiles="false ls"
 
-echo '1..12'
+echo '1..16'
 
 mkdir repo
 ostree_repo_init repo --mode=archive-z2
@@ -204,6 +204,102 @@ ${CMD_PREFIX} ostree --repo=repo2 ls ${newrev} >/dev/null
 
 echo 'ok apply offline inline'
 
+rm -rf repo/deltas/${deltaprefix}/${deltadir}/*
+${CMD_PREFIX} ostree --repo=repo static-delta generate --from=${origrev} --to=${newrev} --threads=4 --compression-level=1
+assert_has_file repo/deltas/${deltaprefix}/${deltadir}/0
+
+rm repo2 -rf
+ostree_repo_init repo2 --mode=bare-user
+
+${CMD_PREFIX} ostree --repo=repo2 pull-local repo ${origrev}
+${CMD_PREFIX} ostree --repo=repo2 static-delta apply-offline repo/deltas/${deltaprefix}/${deltadir}
+${CMD_PREFIX} ostree --repo=repo2 fsck
+${CMD_PREFIX} ostree --repo=repo2 ls ${newrev} >/dev/null
+
+for level in -2 -1 10 x; do
+    if ${CMD_PREFIX} ostree --repo=repo static-delta generate --from=${origrev} --to=${newrev} --compression-level=${level} 2>err.txt; then
+        assert_not_reached "--compression-level=${level} unexpectedly succeeded"
+    fi
+    assert_file_has_content err.txt "Invalid --compression-level"
+done
+
+echo 'ok generate threaded + apply offline'
+
+mkdir delta-t0 delta-t1 delta-t2 delta-t4
+${CMD_PREFIX} ostree --repo=repo static-delta generate --from=${origrev} --to=${newrev} --threads=0 --compression-level=1 --filename=delta-t0/superblock
+${CMD_PREFIX} ostree --repo=repo static-delta generate --from=${origrev} --to=${newrev} --threads=1 --compression-level=1 --filename=delta-t1/superblock
+${CMD_PREFIX} ostree --repo=repo static-delta generate --from=${origrev} --to=${newrev} --threads=2 --compression-level=1 --filename=delta-t2/superblock
+${CMD_PREFIX} ostree --repo=repo static-delta generate --from=${origrev} --to=${newrev} --threads=4 --compression-level=1 --filename=delta-t4/superblock
+# The superblock has a timestamp, so just compare the parts
+(cd delta-t1 && ls) > delta-t1.parts
+(cd delta-t4 && ls) > delta-t4.parts
+cmp delta-t1.parts delta-t4.parts
+for part in delta-t0/[0-9]* delta-t1/[0-9]* delta-t2/[0-9]*; do
+    cmp ${part} delta-t4/$(basename ${part})
+done
+rm -rf delta-t0 delta-t1 delta-t2 delta-t4 delta-t1.parts delta-t4.parts
+
+echo 'ok generate threaded is reproducible'
+
+mkdir delta-rss delta-norss
+${CMD_PREFIX} ostree --repo=repo static-delta generate --from=${origrev} --to=${newrev} --threads=2 --max-chunk-size=1 --max-rss=10 --filename=delta-rss/superblock
+${CMD_PREFIX} ostree --repo=repo static-delta generate --from=${origrev} --to=${newrev} --threads=2 --max-chunk-size=1 --filename=delta-norss/superblock
+for part in delta-norss/[0-9]*; do
+    cmp ${part} delta-rss/$(basename ${part})
+done
+
+rm repo2 -rf
+ostree_repo_init repo2 --mode=bare-user
+
+${CMD_PREFIX} ostree --repo=repo2 pull-local repo ${origrev}
+${CMD_PREFIX} ostree --repo=repo2 static-delta apply-offline delta-rss/superblock
+${CMD_PREFIX} ostree --repo=repo2 fsck
+${CMD_PREFIX} ostree --repo=repo2 ls ${newrev} >/dev/null
+rm -rf delta-rss delta-norss
+
+if ${CMD_PREFIX} ostree --repo=repo static-delta generate --from=${origrev} --to=${newrev} --max-chunk-size=32 --max-rss=64 2>err.txt; then
+    fatal "generated with max-rss too small"
+fi
+assert_file_has_content err.txt "max-rss"
+
+for size in 8G abc 0 -1 ""; do
+    if ${CMD_PREFIX} ostree --repo=repo static-delta generate --from=${origrev} --to=${newrev} --max-rss=${size} 2>err.txt; then
+        assert_not_reached "--max-rss=${size} unexpectedly succeeded"
+    fi
+    assert_file_has_content err.txt "Invalid --max-rss"
+done
+
+echo 'ok generate with bounded memory'
+
+# Objects which can only be shipped via bsdiff, with enough of them to span
+# several parts
+mkdir repo-bsdiff bsdiff-files delta-bsdiff
+ostree_repo_init repo-bsdiff --mode=archive-z2
+for i in $(seq 6); do
+    dd if=/dev/urandom of=bsdiff-files/file${i} bs=1k count=512 2>/dev/null
+done
+${CMD_PREFIX} ostree --repo=repo-bsdiff commit -b test -s test --tree=dir=bsdiff-files
+bsdiff_origrev=$(${CMD_PREFIX} ostree --repo=repo-bsdiff rev-parse test)
+# Replace most of each file, so there's too little for rollsums to match
+for i in $(seq 6); do
+    dd if=/dev/urandom of=bsdiff-files/file${i} bs=1k count=384 seek=128 conv=notrunc 2>/dev/null
+done
+${CMD_PREFIX} ostree --repo=repo-bsdiff commit -b test -s test --tree=dir=bsdiff-files
+bsdiff_newrev=$(${CMD_PREFIX} ostree --repo=repo-bsdiff rev-parse test)
+${CMD_PREFIX} ostree --repo=repo-bsdiff static-delta generate --from=${bsdiff_origrev} --to=${bsdiff_newrev} --threads=2 --max-chunk-size=1 --max-rss=10 --filename=delta-bsdiff/superblock > out.txt 2>&1
+assert_file_has_content out.txt "bsdiff=6 objects"
+assert_has_file delta-bsdiff/1
+
+rm repo2 -rf
+ostree_repo_init repo2 --mode=bare-user
+${CMD_PREFIX} ostree --repo=repo2 pull-local repo-bsdiff ${bsdiff_origrev}
+${CMD_PREFIX} ostree --repo=repo2 static-delta apply-offline delta-bsdiff/superblock
+${CMD_PREFIX} ostree --repo=repo2 fsck
+${CMD_PREFIX} ostree --repo=repo2 ls ${bsdiff_newrev} >/dev/null
+rm -rf repo-bsdiff bsdiff-files delta-bsdiff
+
+echo 'ok generate bsdiff parts with bounded memory'
+
 ${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${origrev}-${newrev}$ || exit 1
 ${CMD_PREFIX} ostree --repo=repo static-delta list | grep ^${origrev}$ || exit 1
 
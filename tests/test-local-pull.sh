@@ -26,7 +26,7 @@ unset OSTREE_GPG_HOME
 
 skip_without_user_xattrs
 
-echo "1..8"
+echo "1..9"
 
 setup_test_repository "archive-z2"
 echo "ok setup"
@@ -105,3 +105,31 @@ for src_object in `find repo/objects -name '*.filez'`; do
     assert_files_hardlinked "$src_object" "$dst_object"
 done
 echo "ok pull-local z2 to z2 default hardlink"
+
+# Force the copy fallback used when hardlinking isn't possible (e.g. across
+# filesystems), and verify the imported objects are intact and not linked.
+mkdir repo8
+ostree_repo_init repo8 --mode="archive-z2"
+env OSTREE_REPO_TEST_ERROR=import-no-hardlink ${CMD_PREFIX} ostree --repo=repo8 pull-local repo
+${CMD_PREFIX} ostree --repo=repo8 fsck
+for src_object in `find repo/objects -name '*.filez'`; do
+    dst_object=${src_object/repo/repo8}
+    if files_are_hardlinked "$src_object" "$dst_object"; then
+        assert_not_reached "Files '$src_object' and '$dst_object' are hardlinked"
+    fi
+done
+
+mkdir repo9
+ostree_repo_init repo9 --mode="bare-user"
+env OSTREE_REPO_TEST_ERROR=import-no-hardlink ${CMD_PREFIX} ostree --repo=repo9 pull-local repo2
+${CMD_PREFIX} ostree --repo=repo9 fsck
+for src_object in `find repo2/objects -name '*.file'`; do
+    dst_object=${src_object/repo2/repo9}
+    if files_are_hardlinked "$src_object" "$dst_object"; then
+        assert_not_reached "Files '$src_object' and '$dst_object' are hardlinked"
+    fi
+done
+${CMD_PREFIX} ostree checkout --repo repo9 test2 checkout9
+find checkout9 -printf '%P %s %#m %u/%g %y %l\n' | sort > checkout9.files
+cmp checkout1.files checkout9.files
+echo "ok pull-local copy fallback to z2 and bare-user"
@@ -0,0 +1,137 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "libglnx.h"
+
+#include "ostree-metadata-cache.h"
+
+static char *
+make_checksum (guint i)
+{
+  g_autofree char *s = g_strdup_printf ("%u", i);
+  return g_compute_checksum_for_string (G_CHECKSUM_SHA256, s, -1);
+}
+
+/* A variant with a serialized size of exactly @size bytes */
+static GVariant *
+make_variant (gsize size)
+{
+  g_autofree guint8 *data = g_malloc0 (size);
+  return g_variant_ref_sink (g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, data, size, 1));
+}
+
+static void
+test_metadata_cache_basic (void)
+{
+  g_autoptr(OstreeMetadataCache) cache = _ostree_metadata_cache_new (1024);
+  g_autofree char *checksum = make_checksum (0);
+  g_autoptr(GVariant) v = make_variant (100);
+  guint64 hits, misses, evictions, size;
+
+  g_assert (_ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_TREE, checksum) == NULL);
+  _ostree_metadata_cache_insert (cache, OSTREE_OBJECT_TYPE_DIR_TREE, checksum, v);
+
+  { g_autoptr(GVariant) hit = _ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_TREE, checksum);
+    g_assert (hit == v);
+  }
+  /* Same checksum, different type is a distinct object */
+  g_assert (_ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_META, checksum) == NULL);
+
+  _ostree_metadata_cache_get_stats (cache, &hits, &misses, &evictions, &size);
+  g_assert_cmpuint (hits, ==, 1);
+  g_assert_cmpuint (misses, ==, 2);
+  g_assert_cmpuint (evictions, ==, 0);
+  g_assert_cmpuint (size, ==, 100);
+
+  _ostree_metadata_cache_remove (cache, OSTREE_OBJECT_TYPE_DIR_TREE, checksum);
+  g_assert (_ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_TREE, checksum) == NULL);
+  _ostree_metadata_cache_get_stats (cache, NULL, NULL, NULL, &size);
+  g_assert_cmpuint (size, ==, 0);
+
+  /* Larger than the whole cache */
+  { g_autoptr(GVariant) big = make_variant (2048);
+    _ostree_metadata_cache_insert (cache, OSTREE_OBJECT_TYPE_COMMIT, checksum, big);
+    g_assert (_ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_COMMIT, checksum) == NULL);
+  }
+}
+
+static void
+test_metadata_cache_lru (void)
+{
+  g_autoptr(OstreeMetadataCache) cache = _ostree_metadata_cache_new (1000);
+  g_autoptr(GVariant) v = make_variant (100);
+  guint64 evictions, size;
+
+  for (guint i = 0; i < 10; i++)
+    {
+      g_autofree char *checksum = make_checksum (i);
+      _ostree_metadata_cache_insert (cache, OSTREE_OBJECT_TYPE_DIR_TREE, checksum, v);
+    }
+
+  /* Touch the oldest entry, so the second oldest is evicted next */
+  { g_autofree char *checksum = make_checksum (0);
+    g_autoptr(GVariant) hit = _ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_TREE, checksum);
+    g_assert (hit != NULL);
+  }
+  { g_autofree char *checksum = make_checksum (10);
+    _ostree_metadata_cache_insert (cache, OSTREE_OBJECT_TYPE_DIR_TREE, checksum, v);
+  }
+
+  for (guint i = 0; i <= 10; i++)
+    {
+      g_autofree char *checksum = make_checksum (i);
+      g_autoptr(GVariant) hit = _ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_TREE, checksum);
+      g_assert_cmpint (hit != NULL, ==, i != 1);
+    }
+
+  _ostree_metadata_cache_get_stats (cache, NULL, NULL, &evictions, &size);
+  g_assert_cmpuint (evictions, ==, 1);
+  g_assert_cmpuint (size, ==, 1000);
+
+  /* Shrinking evicts down to the new budget */
+  _ostree_metadata_cache_set_max_size (cache, 250);
+  _ostree_metadata_cache_get_stats (cache, NULL, NULL, &evictions, &size);
+  g_assert_cmpuint (evictions, ==, 9);
+  g_assert_cmpuint (size, ==, 200);
+
+  /* And a size of zero disables it */
+  _ostree_metadata_cache_set_max_size (cache, 0);
+  { g_autofree char *checksum = make_checksum (10);
+    g_assert (_ostree_metadata_cache_lookup (cache, OSTREE_OBJECT_TYPE_DIR_TREE, checksum) == NULL);
+  }
+}
+
+int
+main (int argc, char **argv)
+{
+
+  g_setenv ("GIO_USE_VFS", "local", TRUE);
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/ostree/metadata-cache/basic", test_metadata_cache_basic);
+  g_test_add_func ("/ostree/metadata-cache/lru", test_metadata_cache_lru);
+
+  return g_test_run ();
+}
@@ -0,0 +1,125 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "libglnx.h"
+
+#include "ostree-autocleanups.h"
+#include "ostree-object-set.h"
+
+/* Deterministic pseudo-random checksums */
+static void
+make_csum (guint          i,
+           guint8        *csum)
+{
+  g_autofree char *s = g_strdup_printf ("%u", i);
+  g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  gsize len = OSTREE_SHA256_DIGEST_LEN;
+
+  g_checksum_update (checksum, (guint8*)s, strlen (s));
+  g_checksum_get_digest (checksum, csum, &len);
+}
+
+static void
+test_object_set_basic (void)
+{
+  g_autoptr(OstreeObjectSet) set = ostree_object_set_new ();
+  const char *checksum = "a2c3fd2c22ab73f4ee8da8a2ee7c0b58d0e25e73ba8b8d27b2c9d2b2c0c6d1f2";
+
+  g_assert_cmpuint (ostree_object_set_size (set), ==, 0);
+  g_assert (!ostree_object_set_contains (set, checksum, OSTREE_OBJECT_TYPE_FILE));
+
+  g_assert (ostree_object_set_add (set, checksum, OSTREE_OBJECT_TYPE_FILE));
+  g_assert (!ostree_object_set_add (set, checksum, OSTREE_OBJECT_TYPE_FILE));
+  g_assert_cmpuint (ostree_object_set_size (set), ==, 1);
+
+  /* Same checksum, different type is a distinct object */
+  g_assert (!ostree_object_set_contains (set, checksum, OSTREE_OBJECT_TYPE_DIR_META));
+  g_assert (ostree_object_set_add (set, checksum, OSTREE_OBJECT_TYPE_DIR_META));
+  g_assert_cmpuint (ostree_object_set_size (set), ==, 2);
+
+  g_assert (ostree_object_set_remove (set, checksum, OSTREE_OBJECT_TYPE_FILE));
+  g_assert (!ostree_object_set_remove (set, checksum, OSTREE_OBJECT_TYPE_FILE));
+  g_assert (!ostree_object_set_contains (set, checksum, OSTREE_OBJECT_TYPE_FILE));
+  g_assert (ostree_object_set_contains (set, checksum, OSTREE_OBJECT_TYPE_DIR_META));
+  g_assert_cmpuint (ostree_object_set_size (set), ==, 1);
+}
+
+static void
+test_object_set_many (void)
+{
+  g_autoptr(OstreeObjectSet) set = ostree_object_set_new ();
+  const guint n = 10000;
+  guint8 csum[OSTREE_SHA256_DIGEST_LEN];
+  OstreeObjectSetIter iter;
+  const guint8 *iter_csum;
+  OstreeObjectType iter_objtype;
+  guint n_iterated = 0;
+
+  for (guint i = 0; i < n; i++)
+    {
+      make_csum (i, csum);
+      g_assert (_ostree_object_set_add (set, csum, OSTREE_OBJECT_TYPE_FILE));
+    }
+  g_assert_cmpuint (ostree_object_set_size (set), ==, n);
+
+  /* Remove every other entry; this exercises moving entries back
+   * into the holes left behind.
+   */
+  for (guint i = 0; i < n; i += 2)
+    {
+      make_csum (i, csum);
+      g_assert (_ostree_object_set_remove (set, csum, OSTREE_OBJECT_TYPE_FILE));
+    }
+  g_assert_cmpuint (ostree_object_set_size (set), ==, n / 2);
+
+  for (guint i = 0; i < n; i++)
+    {
+      make_csum (i, csum);
+      g_assert_cmpint (_ostree_object_set_contains (set, csum, OSTREE_OBJECT_TYPE_FILE), ==, (i % 2) == 1);
+      g_assert (!_ostree_object_set_contains (set, csum, OSTREE_OBJECT_TYPE_COMMIT));
+    }
+
+  ostree_object_set_iter_init (&iter, set);
+  while (ostree_object_set_iter_next (&iter, &iter_csum, &iter_objtype))
+    {
+      g_assert_cmpint (iter_objtype, ==, OSTREE_OBJECT_TYPE_FILE);
+      g_assert (_ostree_object_set_contains (set, iter_csum, iter_objtype));
+      n_iterated++;
+    }
+  g_assert_cmpuint (n_iterated, ==, n / 2);
+}
+
+int
+main (int argc, char **argv)
+{
+
+  g_setenv ("GIO_USE_VFS", "local", TRUE);
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/ostree/object-set/basic", test_object_set_basic);
+  g_test_add_func ("/ostree/object-set/many", test_object_set_many);
+
+  return g_test_run ();
+}
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <gio/gio.h>
 #include <string.h>
+#include <zlib.h>
 #include "ostree-rollsum.h"
 #include "bupsplit.h"
 
@@ -78,12 +79,14 @@ test_rollsum (void)
   g_autofree unsigned char *b = malloc (MAX_BUFFER_SIZE);
   g_autoptr(GRand) rand = g_rand_new ();
 
-  /* These two buffers produce the same crc32.  */
+  /* These two buffers are each a single chunk and produce the same CRC32C.  */
   const unsigned char conflicting_a[] = {0x35, 0x9b, 0x94, 0x5a, 0xa0, 0x5a, 0x34, 0xdc, 0x5c, 0x3, 0x46, 0xe, 0x34, 0x53, 0x85, 0x73, 0x64, 0xcc, 0x47, 0x10, 0x23, 0x8e, 0x7e, 0x6a, 0xca, 0xda, 0x7c, 0x12, 0x8a, 0x59, 0x7f, 0x7f, 0x4d, 0x1, 0xd8, 0xcc, 0x81, 0xcf, 0x2c, 0x7f, 0x10, 0xc2, 0xb4, 0x40, 0x1f, 0x2a, 0x0, 0x37, 0x85, 0xde, 0xfe, 0xa5, 0xc, 0x7c, 0xa1, 0x8, 0xd6, 0x75, 0xfd, 0x2, 0xcf, 0x2d, 0x53, 0x1b, 0x8a, 0x6b, 0x35, 0xad, 0xa, 0x8f, 0xad, 0x2d, 0x91, 0x87, 0x2b, 0x97, 0xcf, 0x1d, 0x7c, 0x61, 0xc4, 0xb2, 0x5e, 0xc3, 0xba, 0x5d, 0x2f, 0x3a, 0xeb, 0x41, 0x61, 0x4c, 0xa2, 0x34, 0xd, 0x43, 0xce, 0x10, 0xa3, 0x47, 0x4, 0xa0, 0x39, 0x77, 0xc2, 0xe8, 0x36, 0x1d, 0x87, 0xd1, 0x8f, 0x4d, 0x13, 0xa1, 0x34, 0xc3, 0x2c, 0xee, 0x1a, 0x10, 0x79, 0xb7, 0x97, 0x29, 0xe8, 0xf0, 0x5, 0xfc, 0xe6, 0x14, 0x87, 0x9c, 0x8f, 0x97, 0x23, 0xac, 0x1, 0xf2, 0xee, 0x69, 0xb2, 0xe5};
 
-  const unsigned char conflicting_b[] = {0xb2, 0x54, 0x81, 0x7d, 0x31, 0x83, 0xc7, 0xc, 0xcf, 0x7d, 0x90, 0x1c, 0x6b, 0xf6, 0x4e, 0xff, 0x49, 0xd1, 0xb6, 0xc, 0x9e, 0x85, 0xe3, 0x2d, 0xdb, 0x94, 0x8e, 0x1a, 0x17, 0x3f, 0x63, 0x59, 0xf9, 0x4b, 0x5f, 0x47, 0x97, 0x9c, 0x1c, 0xd7, 0x24, 0xd9, 0x42, 0x6, 0x1e, 0xf, 0x98, 0x10, 0xb4, 0xc, 0x50, 0xcb, 0xc5, 0x62, 0x53, 0x1, 0xd1, 0x5f, 0x16, 0x97, 0xaa, 0xd7, 0x57, 0x5e, 0xf2, 0xde, 0xae, 0x53, 0x58, 0x6, 0xb7, 0x9b, 0x8d, 0x2b, 0xd6, 0xb4, 0x55, 0x29, 0x3b, 0x27, 0x70, 0xd5, 0xf3, 0x8d, 0xdc, 0xad, 0x68, 0x63, 0xa5, 0x72, 0xce, 0x6b, 0x9, 0x2b, 0x60, 0x1b, 0x99, 0xd7, 0x86};
+  const unsigned char conflicting_b[] = {0xe7, 0x1, 0xd4, 0x28, 0x64, 0xd6, 0x92, 0x59, 0x9a, 0x28, 0xc5, 0x49, 0x3e, 0xa3, 0x1b, 0xaa, 0x1c, 0x84, 0xe3, 0x59, 0xcb, 0xd0, 0xb6, 0x78, 0x8e, 0xc1, 0xdb, 0x4f, 0x42, 0x6a, 0x36, 0xc, 0xac, 0x1e, 0xa, 0x12, 0xc2, 0xc9, 0x49, 0x82, 0x71, 0x8c, 0x17, 0x53, 0x4b, 0x5a, 0xcd, 0x45, 0xe1, 0x59, 0x5, 0x9e, 0x90, 0x37, 0x6, 0x54, 0x84, 0xa, 0x43, 0xc2, 0xff, 0x82, 0x2, 0xb, 0xa7, 0x8b, 0xfb, 0x6, 0xd, 0x53, 0xe2, 0xce, 0xd8, 0x7e, 0x83, 0xe1, 0x0, 0x7c, 0x6e, 0x72, 0x25, 0x80, 0xa6, 0xd8, 0x89, 0xf8, 0x3d, 0x36, 0xf0, 0x27, 0x9b, 0x3e, 0x5c, 0x7e, 0x35, 0x3b, 0x4f, 0xfb, 0x8d};
 
-    test_rollsum_helper (conflicting_a, sizeof conflicting_a, conflicting_b, sizeof conflicting_b, FALSE);
+  g_assert_cmphex (_ostree_rollsum_crc32c (conflicting_a, sizeof conflicting_a, OSTREE_ROLLSUM_IMPL_SCALAR), ==,
+                   _ostree_rollsum_crc32c (conflicting_b, sizeof conflicting_b, OSTREE_ROLLSUM_IMPL_SCALAR));
+  test_rollsum_helper (conflicting_a, sizeof conflicting_a, conflicting_b, sizeof conflicting_b, FALSE);
 
     for (i = 0; i < MAX_BUFFER_SIZE; i++)
     {
@@ -137,6 +140,143 @@ test_rollsum (void)
   test_rollsum_helper (a, MAX_BUFFER_SIZE, b, MAX_BUFFER_SIZE, FALSE);
 }
 
+/* How rollsum chunks were computed before, calling bupsplit_find_ofs()
+ * from each chunk start; the chunks must stay the same.
+ */
+static GArray *
+reference_chunk_lengths (const guint8 *buf, gsize buflen)
+{
+  GArray *lengths = g_array_new (FALSE, FALSE, sizeof (gsize));
+  gboolean rollsum_end = FALSE;
+  gsize start = 0;
+  gsize remaining = buflen;
+
+  while (remaining > 0)
+    {
+      gsize offset;
+
+      if (!rollsum_end)
+        {
+          offset = bupsplit_find_ofs (buf + start, MIN (G_MAXINT32, remaining), NULL);
+          if (offset == 0)
+            {
+              rollsum_end = TRUE;
+              offset = MIN (8192*4, remaining);
+            }
+          else if (offset > 8192*4)
+            offset = 8192*4;
+        }
+      else
+        offset = MIN (8192*4, remaining);
+
+      g_array_append_val (lengths, offset);
+      start += offset;
+      remaining -= offset;
+    }
+
+  return lengths;
+}
+
+static void
+assert_chunks_equal (GArray *a, GArray *b)
+{
+  g_assert_cmpint (a->len, ==, b->len);
+  for (guint i = 0; i < a->len; i++)
+    g_assert_cmpint (g_array_index (a, gsize, i), ==, g_array_index (b, gsize, i));
+}
+
+static void
+test_rollsum_chunks (void)
+{
+  for (guint iter = 0; iter < 500; iter++)
+    {
+      const gsize len = g_test_rand_int_range (0, iter < 200 ? 300 : 200000);
+      g_autofree guint8 *buf = g_malloc (len + 1);
+      const guint kind = iter % 4;
+
+      /* Random data, and data with few distinct bytes, long zero runs or
+       * a two-valued alphabet, which split unusually often or rarely.
+       */
+      for (gsize i = 0; i < len; i++)
+        {
+          switch (kind)
+            {
+            case 0:
+              buf[i] = g_test_rand_int_range (0, 256);
+              break;
+            case 1:
+              buf[i] = g_test_rand_int_range (0, 3);
+              break;
+            case 2:
+              buf[i] = i % 97 < 50 ? g_test_rand_int_range (0, 256) : 0;
+              break;
+            default:
+              buf[i] = g_test_rand_bit () ? 0xff : 0;
+              break;
+            }
+        }
+
+      g_autoptr(GArray) expected = reference_chunk_lengths (buf, len);
+      g_autoptr(GArray) scalar = _ostree_rollsum_chunk_lengths (buf, len, OSTREE_ROLLSUM_IMPL_SCALAR);
+      g_autoptr(GArray) accel = _ostree_rollsum_chunk_lengths (buf, len, OSTREE_ROLLSUM_IMPL_ACCEL);
+      assert_chunks_equal (scalar, expected);
+      assert_chunks_equal (accel, expected);
+
+      g_assert_cmpuint (_ostree_rollsum_crc32c (buf, len, OSTREE_ROLLSUM_IMPL_SCALAR), ==,
+                        _ostree_rollsum_crc32c (buf, len, OSTREE_ROLLSUM_IMPL_ACCEL));
+    }
+
+  /* The standard check value */
+  g_assert_cmphex (_ostree_rollsum_crc32c ((const guint8*)"123456789", 9, OSTREE_ROLLSUM_IMPL_SCALAR), ==, 0xe3069283);
+  g_assert_cmphex (_ostree_rollsum_crc32c ((const guint8*)"123456789", 9, OSTREE_ROLLSUM_IMPL_ACCEL), ==, 0xe3069283);
+}
+
+/* Run with -m perf; the size in MB may be set with OSTREE_ROLLSUM_BENCH_MB */
+static void
+test_rollsum_benchmark (void)
+{
+  const char *size_env = g_getenv ("OSTREE_ROLLSUM_BENCH_MB");
+  const gsize len = (size_env ? g_ascii_strtoull (size_env, NULL, 10) : 64) * 1024 * 1024;
+  g_autofree guint8 *buf = g_malloc (len);
+
+  for (gsize i = 0; i < len; i++)
+    buf[i] = g_test_rand_int_range (0, 256);
+
+  g_test_timer_start ();
+  g_autoptr(GArray) expected = reference_chunk_lengths (buf, len);
+  const double reference_secs = g_test_timer_elapsed ();
+
+  g_test_timer_start ();
+  g_autoptr(GArray) scalar = _ostree_rollsum_chunk_lengths (buf, len, OSTREE_ROLLSUM_IMPL_SCALAR);
+  const double scalar_secs = g_test_timer_elapsed ();
+
+  g_test_timer_start ();
+  g_autoptr(GArray) accel = _ostree_rollsum_chunk_lengths (buf, len, OSTREE_ROLLSUM_IMPL_ACCEL);
+  const double accel_secs = g_test_timer_elapsed ();
+
+  assert_chunks_equal (scalar, expected);
+  assert_chunks_equal (accel, expected);
+  g_test_message ("splitting %" G_GSIZE_FORMAT " MB: bupsplit %.3fs, scalar %.3fs, accelerated %.3fs",
+                  len / (1024 * 1024), reference_secs, scalar_secs, accel_secs);
+  g_test_maximized_result (reference_secs / MAX (accel_secs, 1e-6), "speedup");
+
+  g_test_timer_start ();
+  (void) crc32 (crc32 (0L, NULL, 0), buf, len);
+  const double zlib_secs = g_test_timer_elapsed ();
+
+  g_test_timer_start ();
+  const guint32 scalar_crc = _ostree_rollsum_crc32c (buf, len, OSTREE_ROLLSUM_IMPL_SCALAR);
+  const double crc_scalar_secs = g_test_timer_elapsed ();
+
+  g_test_timer_start ();
+  const guint32 accel_crc = _ostree_rollsum_crc32c (buf, len, OSTREE_ROLLSUM_IMPL_ACCEL);
+  const double crc_accel_secs = g_test_timer_elapsed ();
+
+  g_assert_cmphex (scalar_crc, ==, accel_crc);
+  g_test_message ("checksumming %" G_GSIZE_FORMAT " MB: zlib crc32 %.3fs, crc32c scalar %.3fs, accelerated %.3fs",
+                  len / (1024 * 1024), zlib_secs, crc_scalar_secs, crc_accel_secs);
+}
+
 #define BUP_SELFTEST_SIZE 100000
 
 static void
@@ -166,6 +306,9 @@ int main (int argc, char **argv)
 {
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/rollsum", test_rollsum);
+  g_test_add_func ("/rollsum/chunks", test_rollsum_chunks);
   g_test_add_func ("/bupsum", test_bupsplit_sum);
+  if (g_test_perf ())
+    g_test_add_func ("/rollsum/benchmark", test_rollsum_benchmark);
   return g_test_run();
 }